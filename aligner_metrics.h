@@ -21,6 +21,8 @@
 #define ALIGNER_METRICS_H_
 
 #include <math.h>
+#include <string.h>
+#include <stdint.h>
 #include <iostream>
 #include "alphabet.h"
 #include "timer.h"
@@ -83,6 +85,94 @@ private:
 	double m_oldM, m_newM, m_oldS, m_newS;
 };
 
+/**
+ * Log-linear latency histogram in the spirit of HdrHistogram.  Values are
+ * nanoseconds; each power of two is split into 2^SUB_BITS equal-width
+ * sub-buckets, so any recorded value is known to within 1/2^SUB_BITS of its
+ * magnitude.  Recording is a couple of shifts and an increment, and the
+ * object is meant to be owned by a single thread and merged into a shared
+ * copy periodically, like the other metrics objects.
+ */
+struct LatencyHistogram {
+
+	static const int      SUB_BITS    = 3;
+	static const int      SUB_COUNT   = 1 << SUB_BITS;
+	static const int      MAX_BITS    = 40; // ~18 minutes; larger values are clamped
+	static const size_t   NUM_BUCKETS = (MAX_BITS - SUB_BITS + 1) * SUB_COUNT;
+
+	LatencyHistogram() { reset(); }
+
+	void reset() {
+		memset(counts, 0, sizeof(counts));
+		count = sum = max = 0;
+	}
+
+	/**
+	 * Return the bucket that value v falls into.
+	 */
+	static size_t bucket(uint64_t v) {
+		if(v < (uint64_t)SUB_COUNT) return (size_t)v;
+		if(v >> MAX_BITS) return NUM_BUCKETS - 1;
+		int msb = SUB_BITS;
+		while(v >> (msb + 1)) msb++;
+		int shift = msb - SUB_BITS;
+		return (size_t)((msb - SUB_BITS + 1) * SUB_COUNT + ((v >> shift) & (SUB_COUNT - 1)));
+	}
+
+	/**
+	 * Return the smallest value that falls into bucket b.
+	 */
+	static uint64_t lowest(size_t b) {
+		if(b < (size_t)SUB_COUNT) return (uint64_t)b;
+		int msb = (int)(b / SUB_COUNT) + SUB_BITS - 1;
+		uint64_t sub = (uint64_t)(b % SUB_COUNT);
+		return (SUB_COUNT + sub) << (msb - SUB_BITS);
+	}
+
+	void record(uint64_t v) {
+		counts[bucket(v)]++;
+		count++;
+		sum += v;
+		if(v > max) max = v;
+	}
+
+	void merge(const LatencyHistogram& o) {
+		if(o.count == 0) return;
+		for(size_t i = 0; i < NUM_BUCKETS; i++) {
+			counts[i] += o.counts[i];
+		}
+		count += o.count;
+		sum += o.sum;
+		if(o.max > max) max = o.max;
+	}
+
+	/**
+	 * Return an estimate of the given quantile (0.0-1.0): the lower bound of
+	 * the bucket containing it, or the maximum for the top quantile.
+	 */
+	uint64_t quantile(double q) const {
+		if(count == 0) return 0;
+		uint64_t target = (uint64_t)ceil(q * (double)count);
+		if(target == 0) target = 1;
+		if(target >= count) return max;
+		uint64_t seen = 0;
+		for(size_t i = 0; i < NUM_BUCKETS; i++) {
+			seen += counts[i];
+			if(seen >= target) return lowest(i);
+		}
+		return max;
+	}
+
+	double mean() const {
+		return count > 0 ? (double)sum / (double)count : 0.0;
+	}
+
+	uint64_t counts[NUM_BUCKETS];
+	uint64_t count; // # values recorded
+	uint64_t sum;   // sum of values recorded
+	uint64_t max;   // largest value recorded
+};
+
 /**
  * Encapsulates a set of metrics that we would like an aligner to keep
  * track of, so that we can possibly use it to diagnose performance
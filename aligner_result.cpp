@@ -669,6 +669,7 @@ void StackedAln::init(
 	trimLH_ = trimLH;
 	trimRS_ = trimRS;
 	trimRH_ = trimRH;
+	fused_ = false;
 	ASSERT_ONLY(size_t ln_postsoft = s.length() - trimLS - trimRS);
 	stackRef_.clear();
 	stackRel_.clear();
@@ -728,6 +729,185 @@ void StackedAln::init(
 	inited_ = true;
 }
 
+/**
+ * Append one CIGAR operation, first writing out the pending one unless the
+ * new one extends it.  Skipped regions are never merged.
+ */
+#define FUSED_CIG(o, n) { \
+	if((o) == cigop && cigop != 'N') { \
+		cigrun += (n); \
+	} else { \
+		if(cigrun > 0) { \
+			cig = utoa10<size_t>(cigrun, cig); \
+			*cig++ = cigop; \
+		} \
+		cigop = (o); \
+		cigrun = (n); \
+	} \
+}
+
+/**
+ * Write out the pending run of matches in the MD:Z string.
+ */
+#define FUSED_MDZ_MATCHES() { \
+	if(mdzrun > 0) { \
+		mdz = utoa10<size_t>(mdzrun, mdz); \
+		mdzrun = 0; \
+		first_print = mm_last = rdgap_last = false; \
+	} \
+}
+
+/**
+ * Like init() followed by leftAlign(false), buildCigar(false) and
+ * buildMdz(), but done in one pass over the edits without stacking the
+ * alignment.  Falls back on init() and leftAlign() when a gap would move.
+ */
+void StackedAln::initFused(
+	const BTDnaString& s,
+	const EList<Edit>& ed,
+	size_t trimLS,
+	size_t trimLH,
+	size_t trimRS,
+	size_t trimRH,
+	bool fw,
+	size_t nalts)
+{
+	trimLS_ = trimLS;
+	trimLH_ = trimLH;
+	trimRS_ = trimRS;
+	trimRH_ = trimRH;
+	numMm_ = numGapOpen_ = numGapExt_ = numEd_ = 0;
+	stackRef_.clear();
+	stackRel_.clear();
+	stackSNP_.clear();
+	stackRead_.clear();
+	stackSkip_.clear();
+	size_t ln_postsoft = s.length() - trimLS - trimRS;
+	// Every edit adds at most two CIGAR operations and two MD:Z entries,
+	// none longer than a 20-digit run plus three characters
+	size_t bound = (ed.size() * 2 + 4) * 24;
+	if(fusedCig_.size() < bound) {
+		fusedCig_.resizeNoCopy(bound);
+		fusedMdz_.resizeNoCopy(bound);
+	}
+	char *cig = fusedCig_.ptr();
+	char *mdz = fusedMdz_.ptr();
+	char cigop = 'S';
+	size_t cigrun = trimLS;
+	size_t mdzrun = 0;
+	bool mm_last = false, rdgap_last = false, first_print = true;
+	char lastcol = 0;   // relation in the last column so far
+	size_t ncols = 0;   // columns so far
+	bool moves = false; // would leftAlign() move a gap?
+	size_t rdoff = 0;
+	for(size_t i = 0; i < ed.size(); i++) {
+		const Edit& e = ed[i];
+		assert_leq(rdoff, e.pos);
+		if(rdoff < e.pos) {
+			size_t n = e.pos - rdoff;
+			FUSED_CIG('M', n);
+			mdzrun += n;
+			ncols += n;
+			rdoff = e.pos;
+			lastcol = '=';
+		}
+		if(e.type != EDIT_TYPE_SPL && e.snpID >= nalts) {
+			numEd_++;
+		}
+		if(e.isMismatch()) {
+			if(e.snpID >= nalts) numMm_++;
+			FUSED_CIG('M', 1);
+			FUSED_MDZ_MATCHES();
+			if(rdgap_last || mm_last || first_print) *mdz++ = '0';
+			*mdz++ = e.chr;
+			first_print = rdgap_last = false;
+			mm_last = true;
+			rdoff++;
+			ncols++;
+			lastcol = 'X';
+		} else if(e.isReadGap() || e.isRefGap()) {
+			// Take the whole gap at once, as in SamConfig's XO:i/XG:i
+			// count, so it's known which end opened it and whether
+			// leftAlign() can slide it past the column to its left
+			bool rdgap = e.isReadGap();
+			size_t j = i + 1;
+			while(j < ed.size() &&
+			      (rdgap ? (ed[j].isReadGap() && ed[j].pos == ed[j-1].pos)
+			             : (ed[j].isRefGap() && ed[j].pos == ed[j-1].pos + 1)))
+			{
+				j++;
+			}
+			if((fw ? e : ed[j-1]).snpID >= nalts) numGapOpen_++;
+			for(size_t k = i; k < j; k++) {
+				if(ed[k].snpID >= nalts) numGapExt_++;
+				if(k > i && ed[k].type != EDIT_TYPE_SPL && ed[k].snpID >= nalts) {
+					numEd_++;
+				}
+			}
+			if(e.snpID == (uint32_t)INDEX_MAX && !moves) {
+				// leftAlign() swaps the gap with the column to its left
+				// when that column is a match and holds the same base as
+				// the gap's last column
+				if(ncols == 0) {
+					moves = true;
+				} else if(ncols > 1 && lastcol == '=') {
+					int left = "ACGTN"[(int)s[trimLS + rdoff - 1]];
+					int right = rdgap ? (int)ed[j-1].chr
+					                  : "ACGTN"[(int)s[trimLS + ed[j-1].pos]];
+					moves = (left == right);
+				}
+			}
+			size_t n = j - i;
+			if(rdgap) {
+				FUSED_CIG('D', n);
+				FUSED_MDZ_MATCHES();
+				if(mm_last || first_print) *mdz++ = '0';
+				// Insertions don't show up in MD:Z, so a deletion right
+				// after an insertion right after a deletion continues it
+				if(!rdgap_last) *mdz++ = '^';
+				for(size_t k = i; k < j; k++) {
+					*mdz++ = ed[k].chr;
+				}
+				first_print = mm_last = false;
+				rdgap_last = true;
+				lastcol = 'D';
+			} else {
+				FUSED_CIG('I', n);
+				rdoff += n;
+				lastcol = 'I';
+			}
+			ncols += n;
+			i = j - 1;
+		} else if(e.isSpliced()) {
+			assert_gt(e.splLen, 0);
+			FUSED_CIG('N', e.splLen);
+			ncols++;
+			lastcol = 'N';
+		}
+	}
+	assert_leq(rdoff, ln_postsoft);
+	if(rdoff < ln_postsoft) {
+		size_t n = ln_postsoft - rdoff;
+		FUSED_CIG('M', n);
+		mdzrun += n;
+	}
+	FUSED_CIG('S', trimRS);
+	FUSED_CIG(0, 0); // write out the last operation
+	FUSED_MDZ_MATCHES();
+	if(mm_last || rdgap_last) *mdz++ = '0';
+	fusedCigLen_ = cig - fusedCig_.ptr();
+	fusedMdzLen_ = mdz - fusedMdz_.ptr();
+	assert_leq(fusedCigLen_, bound);
+	assert_leq(fusedMdzLen_, bound);
+	if(moves) {
+		init(s, ed, trimLS, trimLH, trimRS, trimRH);
+		leftAlign(false /* not past MMs */);
+	} else {
+		fused_ = true;
+		inited_ = true;
+	}
+}
+
 /**
  * Left-align all the gaps.  If this changes the alignment and the CIGAR or
  * MD:Z strings have already been calculated, this renders them invalid.
@@ -795,6 +975,10 @@ void StackedAln::leftAlign(bool pastMms) {
  */
 bool StackedAln::buildCigar(bool xeq) {
 	assert(inited_);
+	if(fused_) {
+		assert(!xeq);
+		return false; // built by initFused()
+	}
 	if(cigCalc_) {
 		return false; // already done
 	}
@@ -846,6 +1030,9 @@ bool StackedAln::buildCigar(bool xeq) {
  */
 bool StackedAln::buildMdz() {
 	assert(inited_);
+	if(fused_) {
+		return false; // built by initFused()
+	}
 	if(mdzCalc_) {
 		return false; // already done
 	}
@@ -899,6 +1086,14 @@ void StackedAln::writeCigar(
 	BTString* o,      // if non-NULL, string to append to
 	char* occ) const  // if non-NULL, character string to append to
 {
+	if(fused_) {
+		if(o != NULL) o->append(fusedCig_.ptr(), fusedCigLen_);
+		if(occ != NULL) {
+			memcpy(occ, fusedCig_.ptr(), fusedCigLen_);
+			occ[fusedCigLen_] = '\0';
+		}
+		return;
+	}
 	const EList<char>& op = cigOp_;
 	const EList<size_t>& run = cigRun_;
 	assert_eq(op.size(), run.size());
@@ -933,6 +1128,14 @@ void StackedAln::writeCigar(
  * char buffer.
  */
 void StackedAln::writeMdz(BTString* o, char* occ) const {
+	if(fused_) {
+		if(o != NULL) o->append(fusedMdz_.ptr(), fusedMdzLen_);
+		if(occ != NULL) {
+			memcpy(occ, fusedMdz_.ptr(), fusedMdzLen_);
+			occ[fusedMdzLen_] = '\0';
+		}
+		return;
+	}
 	char buf[128];
 	bool mm_last = false;
 	bool rdgap_last = false;
@@ -2127,3 +2330,223 @@ int main() {
 }
 
 #endif /*def ALIGNER_RESULT_MAIN*/
+
+#ifdef FUSED_SAM_MAIN
+
+/*
+ * Benchmark StackedAln::initFused() against the path AlnSinkSam::appendMate
+ * used to take for the CIGAR, XM:i, XO:i, XG:i, NM:i and MD:Z fields: stack
+ * the alignment, left-align it, build and write the CIGAR, count edits with
+ * the loops from SamConfig::printAlignedOptFlags, then build and write the
+ * MD:Z string.  Records are random spliced alignments with mismatches, known
+ * SNPs and short indels, some of which left-alignment moves; both paths must
+ * print the same fields for every record.
+ *
+ * Build with something like:
+ *
+ *   g++ -O3 -DNDEBUG -DFUSED_SAM_MAIN -DHISAT2_VERSION='"bench"' \
+ *       -o fused_sam_bench aligner_result.cpp edit.cpp ds.cpp ref_coord.cpp \
+ *       alphabet.cpp splice_site.cpp reference.cpp ref_read.cpp ccnt_lut.cpp \
+ *       shmem.cpp limit.cpp tinythread.cpp gfm.cpp -lpthread
+ *
+ * and run as "fused_sam_bench [records] [read length]".
+ */
+
+#include <stdio.h>
+#include "random_source.h"
+#include "timer.h"
+
+MemoryTally gMemTally;
+
+/**
+ * itoa10 as it was before it emitted two digits per division.
+ */
+template<typename T>
+static char* itoa10Old(const T& value, char* result) {
+	char* out = result;
+	T quotient = value;
+	do {
+		*out = "0123456789"[quotient % 10];
+		++out;
+		quotient /= 10;
+	} while (quotient > 0);
+	reverse(result, out);
+	*out = 0;
+	return out;
+}
+
+struct FusedRec {
+	BTDnaString seq;
+	EList<Edit> ed;   // edits in stacked (left-to-right) order
+	EList<Edit> oed;  // same edits as AlnRes holds them
+	size_t      trimLS;
+	size_t      trimRS;
+	bool        fw;
+};
+
+static const size_t NALTS = 1000;
+
+/**
+ * Make up a read and a plausible set of edits for it.
+ */
+static void makeRec(FusedRec& r, size_t len, RandomSource& rnd) {
+	r.seq.resize(len);
+	for(size_t i = 0; i < len; i++) {
+		r.seq.set(rnd.nextU32() % 4, i);
+	}
+	r.trimLS = (rnd.nextU32() % 4 == 0) ? rnd.nextU32() % 10 : 0;
+	r.trimRS = (rnd.nextU32() % 4 == 0) ? rnd.nextU32() % 10 : 0;
+	r.fw = (rnd.nextU32() & 1) == 0;
+	r.ed.clear();
+	size_t ln = len - r.trimLS - r.trimRS;
+	for(size_t p = 0; p < ln; p++) {
+		int c = r.seq[r.trimLS + p];
+		uint32_t snp = (rnd.nextU32() % 5 == 0) ?
+			rnd.nextU32() % NALTS : std::numeric_limits<uint32_t>::max();
+		uint32_t roll = rnd.nextU32() % 1000;
+		if(p > 1 && roll < 3) {
+			r.ed.push_back(Edit((uint32_t)p, '-', '-', EDIT_TYPE_SPL,
+			                    100 + rnd.nextU32() % 100000, SPL_FW, false));
+		} else if(p > 1 && roll < 5) {
+			// Deletion; often of the base just before it, so that
+			// left-alignment has something to do
+			size_t n = 1 + rnd.nextU32() % 3;
+			for(size_t k = 0; k < n; k++) {
+				int rc = (rnd.nextU32() & 1) ? r.seq[r.trimLS + p - 1] : rnd.nextU32() % 4;
+				r.ed.push_back(Edit((uint32_t)p, "ACGT"[rc], '-', EDIT_TYPE_READ_GAP, true, snp));
+			}
+		}
+		roll = rnd.nextU32() % 1000;
+		if(roll < 6) {
+			r.ed.push_back(Edit((uint32_t)p, "ACGT"[(c + 1 + rnd.nextU32() % 3) % 4],
+			                    "ACGT"[c], EDIT_TYPE_MM, true, snp));
+		} else if(p > 1 && roll < 8) {
+			size_t n = 1 + rnd.nextU32() % 3;
+			for(size_t k = 0; k < n && p < ln - 1; k++, p++) {
+				r.ed.push_back(Edit((uint32_t)p, '-', "ACGT"[(int)r.seq[r.trimLS + p]],
+				                    EDIT_TYPE_REF_GAP, true, snp));
+			}
+			p--;
+		}
+	}
+	r.oed = r.ed;
+	if(!r.fw) {
+		Edit::invertPoss(r.oed, ln, false);
+	}
+}
+
+/**
+ * Write the fields the old way.
+ */
+static void formatStacked(const FusedRec& r, StackedAln& staln, BTString& o) {
+	char buf[1024];
+	staln.reset();
+	staln.init(r.seq, r.ed, r.trimLS, 0, r.trimRS, 0);
+	staln.leftAlign(false);
+	staln.buildCigar(false);
+	staln.writeCigar(&o, NULL);
+	o.append('\t');
+	const EList<Edit>& ned = r.oed;
+	size_t num_mm = 0, num_go = 0, num_gx = 0, NM = 0;
+	for(size_t i = 0; i < ned.size(); i++) {
+		if(ned[i].isMismatch()) {
+			if(ned[i].snpID >= NALTS) num_mm++;
+		} else if(ned[i].isReadGap()) {
+			if(ned[i].snpID >= NALTS) { num_go++; num_gx++; }
+			while(i < ned.size()-1 && ned[i+1].pos == ned[i].pos && ned[i+1].isReadGap()) {
+				i++;
+				if(ned[i].snpID >= NALTS) num_gx++;
+			}
+		} else if(ned[i].isRefGap()) {
+			if(ned[i].snpID >= NALTS) { num_go++; num_gx++; }
+			while(i < ned.size()-1 && ned[i+1].pos == ned[i].pos+1 && ned[i+1].isRefGap()) {
+				i++;
+				if(ned[i].snpID >= NALTS) num_gx++;
+			}
+		}
+	}
+	for(size_t i = 0; i < ned.size(); i++) {
+		if(ned[i].type != EDIT_TYPE_SPL && ned[i].snpID >= NALTS) NM++;
+	}
+	itoa10Old<size_t>(num_mm, buf); o.append("XM:i:"); o.append(buf); o.append('\t');
+	itoa10Old<size_t>(num_go, buf); o.append("XO:i:"); o.append(buf); o.append('\t');
+	itoa10Old<size_t>(num_gx, buf); o.append("XG:i:"); o.append(buf); o.append('\t');
+	itoa10Old<size_t>(NM, buf);     o.append("NM:i:"); o.append(buf); o.append('\t');
+	o.append("MD:Z:");
+	staln.buildMdz();
+	staln.writeMdz(&o, NULL);
+	o.append('\n');
+}
+
+/**
+ * Write the fields with initFused().
+ */
+static void formatFused(const FusedRec& r, StackedAln& staln, BTString& o) {
+	char buf[1024];
+	staln.reset();
+	staln.initFused(r.seq, r.ed, r.trimLS, 0, r.trimRS, 0, r.fw, NALTS);
+	staln.buildCigar(false);
+	staln.writeCigar(&o, NULL);
+	o.append('\t');
+	itoa10<size_t>(staln.numMismatches(), buf); o.append("XM:i:"); o.append(buf); o.append('\t');
+	itoa10<size_t>(staln.numGapOpens(), buf);   o.append("XO:i:"); o.append(buf); o.append('\t');
+	itoa10<size_t>(staln.numGapExts(), buf);    o.append("XG:i:"); o.append(buf); o.append('\t');
+	itoa10<size_t>(staln.editDistance(), buf);  o.append("NM:i:"); o.append(buf); o.append('\t');
+	o.append("MD:Z:");
+	staln.buildMdz();
+	staln.writeMdz(&o, NULL);
+	o.append('\n');
+}
+
+int main(int argc, char **argv) {
+	size_t nrecs = argc > 1 ? (size_t)atol(argv[1]) : 200000;
+	size_t len = argc > 2 ? (size_t)atol(argv[2]) : 150;
+	RandomSource rnd(17);
+	EList<FusedRec> recs;
+	recs.resize(nrecs);
+	for(size_t i = 0; i < nrecs; i++) {
+		makeRec(recs[i], len, rnd);
+	}
+	StackedAln staln;
+	BTString o1, o2;
+	size_t nbad = 0, nstacked = 0;
+	for(size_t i = 0; i < nrecs; i++) {
+		o1.clear(); o2.clear();
+		formatStacked(recs[i], staln, o1);
+		formatFused(recs[i], staln, o2);
+		if(!staln.fused()) nstacked++;
+		if(o1 != o2) {
+			if(nbad++ < 5) {
+				cerr << "Mismatch at record " << i << ":" << endl
+				     << "  stacked: " << o1.toZBuf()
+				     << "  fused:   " << o2.toZBuf();
+			}
+		}
+	}
+	if(nbad > 0) {
+		cerr << nbad << " of " << nrecs << " records differ" << endl;
+		return 1;
+	}
+	const int reps = 5;
+	double best[2] = { 1e30, 1e30 };
+	for(int rep = 0; rep < reps; rep++) {
+		for(int way = 0; way < 2; way++) {
+			o1.clear();
+			uint64_t t0 = nanoTime();
+			for(size_t i = 0; i < nrecs; i++) {
+				if(way == 0) formatStacked(recs[i], staln, o1);
+				else         formatFused(recs[i], staln, o1);
+				if(o1.length() > (1 << 20)) o1.clear();
+			}
+			double t = (nanoTime() - t0) / 1e9;
+			if(t < best[way]) best[way] = t;
+		}
+	}
+	printf("%zu records of length %zu, %.1f%% with a gap to left-align\n",
+	       nrecs, len, 100.0 * nstacked / nrecs);
+	printf("stacked: %10.0f records/s\n", nrecs / best[0]);
+	printf("fused:   %10.0f records/s (%.2fx)\n", nrecs / best[1], best[0] / best[1]);
+	return 0;
+}
+
+#endif /*def FUSED_SAM_MAIN*/
@@ -734,7 +734,9 @@ public:
     cigRun_(RES_CAT),
     mdzOp_(RES_CAT),
     mdzChr_(RES_CAT),
-    mdzRun_(RES_CAT)
+    mdzRun_(RES_CAT),
+    fusedCig_(RES_CAT),
+    fusedMdz_(RES_CAT)
 	{
 		reset();
 	}
@@ -757,6 +759,9 @@ public:
 		mdzOp_.clear();
 		mdzChr_.clear();
 		mdzRun_.clear();
+		fused_ = false;
+		fusedCigLen_ = fusedMdzLen_ = 0;
+		numMm_ = numGapOpen_ = numGapExt_ = numEd_ = 0;
 	}
 	
 	/**
@@ -783,6 +788,47 @@ public:
 		size_t trimLH,
 		size_t trimRS,
 		size_t trimRH);
+
+	/**
+	 * Like init() followed by leftAlign(false), buildCigar(false) and
+	 * buildMdz(), but done in one pass over the edits without stacking the
+	 * alignment: the CIGAR and MD:Z strings are written straight into
+	 * buffers kept across calls, and the mismatch, gap open, gap extension
+	 * and edit-distance counts reported in XM:i, XO:i, XG:i and NM:i are
+	 * tallied along the way.  Edits whose snpID is below nalts are known
+	 * SNPs and are not counted.
+	 *
+	 * The stacked form is only needed when leftAlign() would actually move
+	 * a gap; that is detected during the pass, in which case this falls
+	 * back to init() and leftAlign().  Either way writeCigar() and
+	 * writeMdz() then print the same strings the stacked path would.
+	 *
+	 * fw is false iff the edits were inverted to the reverse-complement
+	 * strand, which only matters for deciding which end of a gap opens it.
+	 */
+	void initFused(
+		const BTDnaString& s,
+		const EList<Edit>& ed,
+		size_t trimLS,
+		size_t trimLH,
+		size_t trimRS,
+		size_t trimRH,
+		bool fw,
+		size_t nalts);
+
+	/**
+	 * Return true iff initFused() wrote the CIGAR and MD:Z strings itself,
+	 * rather than falling back on the stacked alignment.
+	 */
+	bool fused() const { return fused_; }
+
+	/**
+	 * Counts tallied by initFused().
+	 */
+	size_t numMismatches() const { return numMm_;      }
+	size_t numGapOpens()   const { return numGapOpen_; }
+	size_t numGapExts()    const { return numGapExt_;  }
+	size_t editDistance()  const { return numEd_;      }
 	
 	/**
 	 * Left-align all the gaps.  If this changes the alignment and the CIGAR or
@@ -862,6 +908,16 @@ protected:
 	EList<char>     mdzOp_;     // MD:Z operations
 	EList<char>     mdzChr_;    // MD:Z operations
 	EList<size_t>   mdzRun_;    // MD:Z run lengths
+
+	bool            fused_;      // CIGAR/MD:Z written by initFused()?
+	EList<char>     fusedCig_;   // CIGAR from initFused()
+	size_t          fusedCigLen_;
+	EList<char>     fusedMdz_;   // MD:Z from initFused()
+	size_t          fusedMdzLen_;
+	size_t          numMm_;      // XM:i
+	size_t          numGapOpen_; // XO:i
+	size_t          numGapExt_;  // XG:i
+	size_t          numEd_;      // NM:i
 };
 
 /**
@@ -918,36 +974,7 @@ public:
     aed_node_(NULL),
     raw_edits_(NULL)
     {
-        shapeSet_ = other.shapeSet_;
-        rdlen_ = other.rdlen_;
-        rdid_ = other.rdid_;
-        rdrows_ = other.rdrows_;
-        score_ = other.score_;
-        oscore_ = other.oscore_;
-        refcoord_ = other.refcoord_;
-        reflen_ = other.reflen_;
-        refival_ = other.refival_;
-        rdextent_ = other.rdextent_;
-        rdexrows_ = other.rdexrows_;
-        rfextent_ = other.rfextent_;
-        seedmms_ = other.seedmms_;
-        seedlen_ = other.seedlen_;
-        minsc_ = other.minsc_;
-        nuc5p_ = other.nuc5p_;
-        nuc3p_ = other.nuc3p_;
-        refns_ = other.refns_;
-        type_ = other.type_;
-        fraglenSet_ = other.fraglenSet_;
-        fraglen_ = other.fraglen_;
-        pretrimSoft_ = other.pretrimSoft_;
-        pretrim5p_ = other.pretrim5p_;
-        pretrim3p_ = other.pretrim3p_;
-        trimSoft_ = other.trimSoft_;
-        trim5p_ = other.trim5p_;
-        trim3p_ = other.trim3p_;
-        repeat_ = other.repeat_;
-        
-        num_spliced_ = other.num_spliced_;
+        copyFields(other);
         raw_edits_ = other.raw_edits_;
         if(raw_edits_ != NULL) {
             assert(ned_ == NULL && aed_ == NULL);
@@ -965,36 +992,7 @@ public:
     
     AlnRes& operator=(const AlnRes& other) {
         if(this == &other) return *this;
-        shapeSet_ = other.shapeSet_;
-        rdlen_ = other.rdlen_;
-        rdid_ = other.rdid_;
-        rdrows_ = other.rdrows_;
-        score_ = other.score_;
-        oscore_ = other.oscore_;
-        refcoord_ = other.refcoord_;
-        reflen_ = other.reflen_;
-        refival_ = other.refival_;
-        rdextent_ = other.rdextent_;
-        rdexrows_ = other.rdexrows_;
-        rfextent_ = other.rfextent_;
-        seedmms_ = other.seedmms_;
-        seedlen_ = other.seedlen_;
-        minsc_ = other.minsc_;
-        nuc5p_ = other.nuc5p_;
-        nuc3p_ = other.nuc3p_;
-        refns_ = other.refns_;
-        type_ = other.type_;
-        fraglenSet_ = other.fraglenSet_;
-        fraglen_ = other.fraglen_;
-        pretrimSoft_ = other.pretrimSoft_;
-        pretrim5p_ = other.pretrim5p_;
-        pretrim3p_ = other.pretrim3p_;
-        trimSoft_ = other.trimSoft_;
-        trim5p_ = other.trim5p_;
-        trim3p_ = other.trim3p_;
-        repeat_ = other.repeat_;
-        
-        num_spliced_ = other.num_spliced_;
+        copyFields(other);
         assert(raw_edits_ == NULL || raw_edits_ == other.raw_edits_);
         raw_edits_ = other.raw_edits_;
         if(ned_ != NULL) {
@@ -1020,6 +1018,45 @@ public:
         return *this;
     }
     
+    /**
+     * Move other into a new AlnRes, taking its edit lists.
+     */
+    AlnRes(AlnRes&& other) :
+    ned_(NULL),
+    aed_(NULL),
+    ned_node_(NULL),
+    aed_node_(NULL),
+    raw_edits_(NULL)
+    {
+        *this = std::move(other);
+    }
+    
+    /**
+     * Move other into this AlnRes by swapping edit lists with it rather
+     * than copying them; other keeps this one's lists, if any, for reuse.
+     * Results whose lists come from different pools are copied instead.
+     */
+    AlnRes& operator=(AlnRes&& other) {
+        if(this == &other) return *this;
+        if(other.ned_ == NULL ||
+           (raw_edits_ != NULL && raw_edits_ != other.raw_edits_)) {
+            return *this = (const AlnRes&)other;
+        }
+        copyFields(other);
+        std::swap(ned_, other.ned_);
+        std::swap(aed_, other.aed_);
+        std::swap(ned_node_, other.ned_node_);
+        std::swap(aed_node_, other.aed_node_);
+        raw_edits_ = other.raw_edits_;
+        if(other.ned_ == NULL) {
+            other.raw_edits_ = NULL;
+        } else {
+            other.ned_->clear();
+            other.aed_->clear();
+        }
+        return *this;
+    }
+    
     ~AlnRes()
     {
 #ifndef NDEBUG
@@ -1872,8 +1909,66 @@ public:
 		}
 	}
 
+	/**
+	 * Like initStacked(), but using StackedAln::initFused() so that the
+	 * CIGAR, MD:Z and edit counts come out of a single pass over the edits.
+	 */
+	void initFused(const Read& rd, StackedAln& st, size_t nalts) const {
+		size_t trimLS = trimmed5p(true);
+		size_t trimLH = trimmed5p(false);
+		size_t trimRS = trimmed3p(true);
+		size_t trimRH = trimmed3p(false);
+		size_t len_trimmed = rd.length() - trimLS - trimRS;
+		if(!fw()) {
+			Edit::invertPoss(const_cast<EList<Edit>&>(*ned_), len_trimmed, false);
+			swap(trimLS, trimRS);
+			swap(trimLH, trimRH);
+		}
+		st.initFused(
+			fw() ? rd.patFw : rd.patRc,
+			*ned_, trimLS, trimLH, trimRS, trimRH, fw(), nalts);
+		if(!fw()) {
+			Edit::invertPoss(const_cast<EList<Edit>&>(*ned_), len_trimmed, false);
+		}
+	}
+
 protected:
 
+	/**
+	 * Copy everything but the edit lists from other.
+	 */
+	void copyFields(const AlnRes& other) {
+		shapeSet_ = other.shapeSet_;
+		rdlen_ = other.rdlen_;
+		rdid_ = other.rdid_;
+		rdrows_ = other.rdrows_;
+		score_ = other.score_;
+		oscore_ = other.oscore_;
+		refcoord_ = other.refcoord_;
+		reflen_ = other.reflen_;
+		refival_ = other.refival_;
+		rdextent_ = other.rdextent_;
+		rdexrows_ = other.rdexrows_;
+		rfextent_ = other.rfextent_;
+		seedmms_ = other.seedmms_;
+		seedlen_ = other.seedlen_;
+		minsc_ = other.minsc_;
+		nuc5p_ = other.nuc5p_;
+		nuc3p_ = other.nuc3p_;
+		refns_ = other.refns_;
+		type_ = other.type_;
+		fraglenSet_ = other.fraglenSet_;
+		fraglen_ = other.fraglen_;
+		pretrimSoft_ = other.pretrimSoft_;
+		pretrim5p_ = other.pretrim5p_;
+		pretrim3p_ = other.pretrim3p_;
+		trimSoft_ = other.trimSoft_;
+		trim5p_ = other.trim5p_;
+		trim3p_ = other.trim3p_;
+		repeat_ = other.repeat_;
+		num_spliced_ = other.num_spliced_;
+	}
+
 	/**
 	 * Given that rdextent_ and ned_ are already set, calculate rfextent_.
 	 */
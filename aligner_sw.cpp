@@ -57,6 +57,8 @@ void SwAligner::initRead(
 	sseU8rcBuilt_  = false;  // built rc query profile, 8-bit score
 	sseI16fwBuilt_ = false;  // built fw query profile, 16-bit score
 	sseI16rcBuilt_ = false;  // built rc query profile, 16-bit score
+	wideU8fwBuilt_ = false;  // built fw wide query profile, 8-bit score
+	wideU8rcBuilt_ = false;  // built rc wide query profile, 8-bit score
 #endif
 }
 
@@ -500,7 +502,7 @@ bool SwAligner::align(
 				if(flag == 0) {
 					gathered = true;
 				}
-			} else {
+			} else if(!alignWideU8(flag, best)) {
 				best = alignNucleotidesEnd2EndSseU8(flag, false);
 #ifndef NDEBUG
 				int flagtmp = 0;
@@ -82,6 +82,7 @@
 #include "mask.h"
 #include "dp_framer.h"
 #include "aligner_swsse.h"
+#include "aligner_swsse_wide.h"
 #include "aligner_bt.h"
 
 #define QUAL2(d, f) sc_->mm((int)(*rd_)[rdi_ + d], \
@@ -209,6 +210,13 @@ public:
 		sseU8rc_(DP_CAT),
 		sseI16fw_(DP_CAT),
 		sseI16rc_(DP_CAT),
+		wideU8fw_(DP_CAT),
+		wideU8rc_(DP_CAT),
+		wideLevel_(sseWideLevel()),
+		wideTried_(0),
+		wideSettled_(0),
+		wideSkipped_(0),
+		wideSkipLen_(64),
 		state_(STATE_UNINIT),
 		initedRead_(false),
 		readSse16_(false),
@@ -320,6 +328,16 @@ public:
 	 * last time init() was called.  Uses dynamic programming.
 	 */
 	bool align(RandomSource& rnd, TAlScore& best);
+
+	/**
+	 * Override the AVX2 kernel level detected at construction;
+	 * SSE_WIDE_NONE restricts the aligner to the SSE2 kernels.
+	 */
+	void setWideLevel(int level) {
+		wideLevel_ = level;
+		wideTried_ = wideSettled_ = wideSkipped_ = 0;
+		wideSkipLen_ = 64;
+	}
 	
 	/**
 	 * Populate the given SwResult with information about the "next best"
@@ -498,6 +516,14 @@ protected:
 	 */
 	void buildQueryProfileEnd2EndSseI16(bool fw);
 	void buildQueryProfileLocalSseI16(bool fw);
+
+	/**
+	 * Score-only 8-bit end-to-end fill with the AVX2 kernel.  Returns
+	 * true, with flag and best set, if it settled the problem (no valid
+	 * alignment or saturated); false if the SSE2 fill must run.
+	 */
+	bool alignWideU8(int& flag, TAlScore& best);
+	void buildQueryProfileWideU8(bool fw);
 	
 	bool gatherCellsNucleotidesLocalSseU8(TAlScore best);
 	bool gatherCellsNucleotidesEnd2EndSseU8(TAlScore best);
@@ -603,6 +629,15 @@ protected:
 	bool                sseU8rcBuilt_;   // built rc query profile, 8-bit score
 	bool                sseI16fwBuilt_;  // built fw query profile, 16-bit score
 	bool                sseI16rcBuilt_;  // built rc query profile, 16-bit score
+	SSEWideData         wideU8fw_;  // buf for fw query, 8-bit score, AVX2
+	SSEWideData         wideU8rc_;  // buf for rc query, 8-bit score, AVX2
+	bool                wideU8fwBuilt_;  // built fw wide query profile
+	bool                wideU8rcBuilt_;  // built rc wide query profile
+	int                 wideLevel_;   // SSE_WIDE_* kernels to use; NONE = SSE2 only
+	size_t              wideTried_;   // # problems given to the wide pre-pass
+	size_t              wideSettled_; // # of those it settled without SSE2
+	size_t              wideSkipped_; // # problems skipped since pre-pass paused
+	size_t              wideSkipLen_; // # problems to skip before measuring again
 
 	SSEMetrics			sseU8ExtendMet_;
 	SSEMetrics			sseU8MateMet_;
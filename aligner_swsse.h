@@ -494,6 +494,64 @@ inline void SSEMatrix::fMaskSet(
 	masks_[row][col] |=  (1 << 10 | mask << 11);
 }
 
+/**
+ * Seeds the lazy-F loop of the striped 8-bit fills.  After the first pass over
+ * a column, that loop used to start from the F values leaving the last row of
+ * each lane and wrap around the column until they stopped improving, which
+ * takes about one iteration per row a vertical gap travels.  carry() instead
+ * returns the F value entering the first row of every lane from all the lanes
+ * above it, using a 4-step max-plus scan, so the loop walks each lane at most
+ * once.  The cells come out the same, since subtracting a then b with unsigned
+ * saturation is the same as subtracting min(a+b, 255).
+ */
+struct SSECarryU8 {
+
+	/**
+	 * Compose the cost of carrying a reference gap through whole lanes for
+	 * each step of the scan.  Going through a lane costs iter gap extensions,
+	 * or stops the gap if the lane holds a gap barrier row.
+	 */
+	void init(
+		const __m128i *pvGbar, // gap barrier of the first segment
+		size_t iter,           // segments per column
+		size_t stride,         // __m128is between segments' gap barriers
+		int rfgape)            // reference gap extension penalty
+	{
+		__m128i vbar = _mm_setzero_si128();
+		for(size_t j = 0; j < iter; j++) {
+			vbar = _mm_or_si128(vbar, pvGbar[j * stride]);
+		}
+		size_t through = iter * (size_t)rfgape;
+		__m128i vd = _mm_or_si128(_mm_set1_epi8((char)(through > 0xff ? 0xff : through)), vbar);
+		__m128i vhi = _mm_set1_epi8((char)0xff);
+		// Nothing enters the first row from above
+		vd = _mm_or_si128(_mm_slli_si128(vd, 1), _mm_subs_epu8(vhi, _mm_slli_si128(vhi, 1)));
+		dsteps_[0] = vd;
+		vd = _mm_adds_epu8(vd, _mm_or_si128(_mm_slli_si128(vd, 1), _mm_subs_epu8(vhi, _mm_slli_si128(vhi, 1))));
+		dsteps_[1] = vd;
+		vd = _mm_adds_epu8(vd, _mm_or_si128(_mm_slli_si128(vd, 2), _mm_subs_epu8(vhi, _mm_slli_si128(vhi, 2))));
+		dsteps_[2] = vd;
+		vd = _mm_adds_epu8(vd, _mm_or_si128(_mm_slli_si128(vd, 4), _mm_subs_epu8(vhi, _mm_slli_si128(vhi, 4))));
+		dsteps_[3] = vd;
+	}
+
+	/**
+	 * Given the F values leaving the last row of each lane (with rfgape
+	 * already subtracted), return the F values entering the first row of each
+	 * lane, before the gap barrier veto.
+	 */
+	__m128i carry(__m128i vf) const {
+		vf = _mm_slli_si128(vf, 1);
+		vf = _mm_max_epu8(vf, _mm_subs_epu8(_mm_slli_si128(vf, 1), dsteps_[0]));
+		vf = _mm_max_epu8(vf, _mm_subs_epu8(_mm_slli_si128(vf, 2), dsteps_[1]));
+		vf = _mm_max_epu8(vf, _mm_subs_epu8(_mm_slli_si128(vf, 4), dsteps_[2]));
+		vf = _mm_max_epu8(vf, _mm_subs_epu8(_mm_slli_si128(vf, 8), dsteps_[3]));
+		return vf;
+	}
+
+	__m128i dsteps_[4]; // lane-through costs composed 1, 2, 4 and 8 lanes back
+};
+
 #define ROWSTRIDE_2COL 4
 #define ROWSTRIDE 4
 
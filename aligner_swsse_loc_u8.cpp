@@ -1097,6 +1097,8 @@ TAlScore SwAligner::alignNucleotidesLocalSseU8(int& flag, bool debug) {
 	
 	assert_gt(sc_->gapbar, 0);
 	size_t nfixup = 0;
+	SSECarryU8 fcarry;
+	fcarry.init(d.profbuf_.ptr() + 1, iter, 2, sc_->refGapExtend());
 	TAlScore matchsc = sc_->match(30);
 	
 	// Fill in the table as usual but instead of using the same gap-penalty
@@ -1249,9 +1251,10 @@ TAlScore SwAligner::alignNucleotidesLocalSseU8(int& flag, bool debug) {
 		pvHLoad = pvHStore;    // new pvHLoad = pvHStore
 		pvScore = d.profbuf_.ptr() + off + 1; // reset veto vector
 		
-		// vf from last row gets shifted down by one to overlay the first row
-		// rfgape has already been subtracted from it.
-		vf = _mm_slli_si128(vf, NBYTES_PER_WORD);
+		// vf from the last row of each lane, carried through the lanes below
+		// it to overlay the first row.  rfgape has already been subtracted
+		// from it.
+		vf = fcarry.carry(vf);
 		
 		vf = _mm_subs_epu8(vf, *pvScore); // veto some ref gap extensions
 		vf = _mm_max_epu8(vtmp, vf);
@@ -0,0 +1,369 @@
+/*
+ * Copyright 2015, Daehwan Kim <infphilo@gmail.com>
+ *
+ * This file is part of HISAT 2.
+ *
+ * HISAT 2 is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * HISAT 2 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with HISAT 2.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <limits>
+#include "aligner_sw.h"
+#include "aligner_swsse_wide.h"
+#include "processor_support.h"
+
+#ifdef SSE_WIDE_CAPABILITY
+#include <immintrin.h>
+
+// After this many problems, stop running the wide pre-pass for a while if
+// fewer than half of them were settled by it
+static const size_t SSE_WIDE_PROBE  = 64;
+static const size_t SSE_WIDE_WINDOW = 1024;
+// Longest run of problems skipped before measuring again
+static const size_t SSE_WIDE_MAX_SKIP = 4096;
+
+/**
+ * AVX2: 32 unsigned 8-bit lanes.  VSHIFT1 moves every byte up one lane
+ * across the 128-bit halves and shifts a zero into lane 0.
+ */
+namespace sse_wide_avx2 {
+
+#define SSE_WIDE_TARGET __attribute__((target("avx2")))
+#define VEC          __m256i
+#define VLOAD(p)     _mm256_load_si256(p)
+#define VSTORE(p, v) _mm256_store_si256(p, v)
+#define VSET1(x)     _mm256_set1_epi8((char)(x))
+#define VZERO()      _mm256_setzero_si256()
+#define VSUBS(a, b)  _mm256_subs_epu8(a, b)
+#define VADDS(a, b)  _mm256_adds_epu8(a, b)
+#define VMAX(a, b)   _mm256_max_epu8(a, b)
+#define VOR(a, b)    _mm256_or_si256(a, b)
+#define VSHIFT1(a)   _mm256_alignr_epi8(a, _mm256_permute2x128_si256(a, a, 0x08), 15)
+// Shift toward the high lanes by n <= 16 lanes, shifting in zeros
+#define VSHIFTN(a, n) _mm256_alignr_epi8(a, _mm256_permute2x128_si256(a, a, 0x08), 16 - (n))
+
+/**
+ * Shift by 2^s lanes; s is a step of the F scan in the kernels.
+ */
+static const int VNSTEP = 5;
+SSE_WIDE_TARGET static inline __m256i vshiftStep(__m256i a, int s) {
+	switch(s) {
+		case 0:  return VSHIFTN(a, 1);
+		case 1:  return VSHIFTN(a, 2);
+		case 2:  return VSHIFTN(a, 4);
+		case 3:  return VSHIFTN(a, 8);
+		default: return VSHIFTN(a, 16);
+	}
+}
+
+#include "aligner_swsse_wide_kernel.h"
+
+#undef SSE_WIDE_TARGET
+#undef VEC
+#undef VLOAD
+#undef VSTORE
+#undef VSET1
+#undef VZERO
+#undef VSUBS
+#undef VADDS
+#undef VMAX
+#undef VOR
+#undef VSHIFT1
+#undef VSHIFTN
+}
+
+static int sseWideDetect() {
+	ProcessorSupport ps;
+	if(ps.AVX2enabled()) {
+		return SSE_WIDE_AVX2;
+	}
+	return SSE_WIDE_NONE;
+}
+
+int sseWideLevel() {
+	static const int level = sseWideDetect();
+	return level;
+}
+
+#else
+
+int sseWideLevel() {
+	return SSE_WIDE_NONE;
+}
+
+#endif /*def SSE_WIDE_CAPABILITY*/
+
+/**
+ * Build the wide query profile for the read.  Same scores and gap barrier as
+ * buildQueryProfileEnd2EndSseU8, striped over sseWideLanes(wideLevel_) lanes
+ * instead of 16.
+ */
+void SwAligner::buildQueryProfileWideU8(bool fw) {
+	bool& done = fw ? wideU8fwBuilt_ : wideU8rcBuilt_;
+	SSEWideData& d = fw ? wideU8fw_ : wideU8rc_;
+	if(done && d.level_ == wideLevel_) {
+		return;
+	}
+	done = true;
+	const BTDnaString* rd = fw ? rdfw_ : rdrc_;
+	const BTString* qu = fw ? qufw_ : qurc_;
+	const size_t len = dpRows();
+	const size_t lanes = sseWideLanes(wideLevel_);
+	const size_t seglen = (len + (lanes-1)) / lanes;
+	d.level_  = wideLevel_;
+	d.seglen_ = seglen;
+	d.prof_   = SSEWideData::alignedBuf(d.profbuf_, ALPHA_SIZE * 2 * seglen * lanes);
+	d.lastIter_ = d.lastWord_ = 0;
+	for(size_t refc = 0; refc < ALPHA_SIZE; refc++) {
+		for(size_t i = 0; i < seglen; i++) {
+			uint8_t *qprofWords = d.prof_ + ((refc * seglen + i) * 2) * lanes;
+			uint8_t *gbarWords  = qprofWords + lanes;
+			size_t j = i;
+			for(size_t k = 0; k < lanes; k++) {
+				int sc = 0;
+				gbarWords[k] = 0;
+				if(j < len) {
+					sc = -sc_->score((*rd)[j], (int)(1 << refc), (*qu)[j] - 33);
+					size_t j_from_end = len - j - 1;
+					if(j < (size_t)sc_->gapbar ||
+					   j_from_end < (size_t)sc_->gapbar)
+					{
+						gbarWords[k] = 0xff;
+					}
+				}
+				if(refc == 0 && j == len-1) {
+					d.lastIter_ = i;
+					d.lastWord_ = k;
+				}
+				qprofWords[k] = (uint8_t)sc;
+				j += seglen;
+			}
+		}
+	}
+}
+
+/**
+ * Run the score-only wide kernel for the current 8-bit end-to-end problem.
+ * If it shows
+ * that there is no valid alignment, or that 8-bit scores saturate, account
+ * for the problem exactly as the SSE2 fill would have, set flag and best, and
+ * return true.  Otherwise return false; the caller then runs the SSE2 fill,
+ * whose matrix the gather and backtrace steps need.
+ */
+bool SwAligner::alignWideU8(int& flag, TAlScore& best) {
+#ifdef SSE_WIDE_CAPABILITY
+	assert(sc_->monotone);
+	if(wideLevel_ == SSE_WIDE_NONE) {
+		return false;
+	}
+	if(wideTried_ >= SSE_WIDE_PROBE && wideSettled_ * 2 < wideTried_) {
+		// The pre-pass has mostly been wasted work lately; skip it for a
+		// while and then measure again, skipping twice as long next time if
+		// it still doesn't pay
+		if(++wideSkipped_ < wideSkipLen_) {
+			return false;
+		}
+		wideTried_ = wideSettled_ = wideSkipped_ = 0;
+		if(wideSkipLen_ < SSE_WIDE_MAX_SKIP) {
+			wideSkipLen_ <<= 1;
+		}
+	} else if(wideTried_ >= SSE_WIDE_PROBE) {
+		wideSkipLen_ = SSE_WIDE_PROBE;
+	}
+	if(wideTried_ >= SSE_WIDE_WINDOW) {
+		wideTried_ >>= 1;
+		wideSettled_ >>= 1;
+	}
+	buildQueryProfileWideU8(fw_);
+	SSEWideData& d = fw_ ? wideU8fw_ : wideU8rc_;
+	SSEWideArgs a;
+	a.prof     = d.prof_;
+	a.buf      = SSEWideData::alignedBuf(d.vecbuf_, 3 * d.seglen_ * sseWideLanes(wideLevel_));
+	a.rf       = rf_;
+	a.rfi      = (size_t)rfi_;
+	a.rff      = (size_t)rff_;
+	a.seglen   = d.seglen_;
+	a.lastIter = d.lastIter_;
+	a.lastWord = d.lastWord_;
+	a.rfgapo   = (uint8_t)sc_->refGapOpen();
+	a.rfgape   = (uint8_t)sc_->refGapExtend();
+	a.rdgapo   = (uint8_t)sc_->readGapOpen();
+	a.rdgape   = (uint8_t)sc_->readGapExtend();
+	a.minsc    = minsc_;
+	TAlScore sc = sse_wide_avx2::alignEnd2EndU8(a, flag);
+	wideTried_++;
+	if(flag == 0) {
+		return false;
+	}
+	wideSettled_++;
+	SSEMetrics& met = extend_ ? sseU8ExtendMet_ : sseU8MateMet_;
+	size_t ninner = (rff_ - rfi_) * ((dpRows() + 15) / 16);
+	met.dp++;
+	met.col   += (rff_ - rfi_);   // DP columns
+	met.cell  += (ninner * 16);   // DP cells, as counted by the SSE2 fill
+	met.inner += ninner;          // DP inner loop iters
+	if(flag == -1) {
+		met.dpfail++;
+	} else {
+		met.dpsat++;
+	}
+	colstop_ = a.colstop;
+	lastsolcol_ = 0;
+	best = sc;
+	return true;
+#else
+	return false;
+#endif
+}
+
+#ifdef ALIGNER_SWSSE_WIDE_MAIN
+
+/*
+ * Benchmark the wide pre-pass against the SSE2 kernels on DP rectangles
+ * shaped like the seed extensions hisat2 hands SwAligner with --bowtie2-dp:
+ * a little wider than the read.  Each read is tried against one or two
+ * windows; the first window of every hitEvery-th read holds a copy of it
+ * with ~2% mismatches and a one-base deletion, and the others have no valid
+ * alignment.  The "all-hits" case shows what the pre-pass costs when every
+ * problem has to be filled again by SSE2.  The SSE2-only and the wide
+ * aligner take turns on every read, and every problem must get the same
+ * answer from both.
+ *
+ * Build with something like:
+ *
+ *   g++ -O3 -msse2 -DNDEBUG -DALIGNER_SWSSE_WIDE_MAIN -DBOWTIE2 \
+ *       -DPOPCNT_CAPABILITY -DHISAT2_VERSION='"bench"' -DBUILD_HOST='""' \
+ *       -DBUILD_TIME='""' -DCOMPILER_VERSION='""' -DCOMPILER_OPTIONS='""' \
+ *       -o swsse_wide_bench aligner_swsse*.cpp aligner_sw.cpp aligner_bt.cpp \
+ *       aligner_result.cpp sse_util.cpp scoring.cpp simple_func.cpp mask.cpp \
+ *       qual.cpp dp_framer.cpp ref_coord.cpp ds.cpp alphabet.cpp ccnt_lut.cpp \
+ *       tinythread.cpp random_source.cpp reference.cpp bit_packed_array.cpp \
+ *       edit.cpp limit.cpp ref_read.cpp gfm.cpp -lpthread
+ *
+ * and run as "swsse_wide_bench [reads per case] [level]", where level 0
+ * compares SSE2 against itself and 1 forces AVX2.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include "timer.h"
+
+MemoryTally gMemTally;
+
+struct WideBenchCase {
+	const char *name;
+	size_t      rdlen;
+	size_t      width;
+	size_t      nwin;      // windows tried per read
+	size_t      hitEvery;  // plant the read in every hitEvery-th read's first window
+};
+
+int main(int argc, char **argv) {
+	const WideBenchCase cases[] = {
+		{ "extend-100",  100,  130, 2, 2 },
+		{ "extend-150",  150,  190, 2, 2 },
+		{ "extend-250",  250,  300, 2, 2 },
+		{ "all-hits",    150,  190, 1, 1 },
+	};
+	size_t nread = argc > 1 ? (size_t)atoi(argv[1]) : 1000;
+	int level = argc > 2 ? atoi(argv[2]) : sseWideLevel();
+	RandomSource rnd(77);
+	const double DMAX = std::numeric_limits<double>::max();
+	SimpleFunc scoreMin(SIMPLE_FUNC_LINEAR, 0.0f, DMAX, 0.0f, -0.2f);
+	SimpleFunc nCeil(SIMPLE_FUNC_LINEAR, 0.0f, DMAX, 0.0f, 0.15f);
+	Scoring scEE(0, COST_MODEL_QUAL, 6, 2, 2, 1, scoreMin, nCeil,
+	             COST_MODEL_CONSTANT, 1, false, 5, 5, 3, 3, 4);
+	fprintf(stderr, "Detected level %d, running level %d (%u lanes)\n",
+	        sseWideLevel(), level, (unsigned)sseWideLanes(level));
+	int nbad = 0;
+	for(size_t ci = 0; ci < sizeof(cases) / sizeof(cases[0]); ci++) {
+		const WideBenchCase& c = cases[ci];
+		const Scoring& sc = scEE;
+		TAlScore minsc = (TAlScore)(-0.2 * c.rdlen);
+		DPRect rect;
+		rect.refl = rect.refl_pretrim = 0;
+		rect.refr = rect.refr_pretrim = c.width - 1;
+		rect.corel = 0;
+		rect.corer = c.width - 1;
+		rect.maxgap = 15;
+		SwAligner sw[2];
+		sw[0].setWideLevel(SSE_WIDE_NONE);
+		sw[1].setWideLevel(level);
+		double secs[2] = { 0.0, 0.0 };
+		size_t nsucc[2] = { 0, 0 };
+		size_t ndiff = 0;
+		BTDnaString rdfw, rdrc;
+		BTString qu;
+		EList<char> ref;
+		for(size_t r = 0; r < nread; r++) {
+			rdfw.resize(c.rdlen);
+			qu.resize(c.rdlen);
+			for(size_t i = 0; i < c.rdlen; i++) {
+				rdfw.set((int)(rnd.nextU32() & 3), i);
+				qu.set('I', i);
+			}
+			rdrc = rdfw;
+			rdrc.reverseComp();
+			for(size_t w = 0; w < c.nwin; w++) {
+				ref.resize(c.width);
+				for(size_t i = 0; i < c.width; i++) {
+					ref[i] = (char)(1 << (rnd.nextU32() & 3));
+				}
+				if(w == 0 && r % c.hitEvery == 0) {
+					// Plant the read with a one-base deletion and ~2% mismatches
+					size_t off = rnd.nextU32() % (c.width - c.rdlen - 8);
+					size_t indel = 20 + rnd.nextU32() % (c.rdlen - 40);
+					for(size_t i = 0; i < c.rdlen; i++) {
+						int ch = rdfw[i];
+						if(rnd.nextU32() % 50 == 0) {
+							ch = (ch + 1) & 3;
+						}
+						ref[off + i + (i >= indel ? 1 : 0)] = (char)(1 << ch);
+					}
+				}
+				TAlScore best[2] = { 0, 0 };
+				bool ok[2] = { false, false };
+				for(size_t k = 0; k < 2; k++) {
+					// Alternate which aligner goes first
+					size_t a = (r + w + k) & 1;
+					uint64_t t0 = nanoTime();
+					if(w == 0) {
+						sw[a].initRead(rdfw, rdrc, qu, qu, 0, c.rdlen, sc);
+					}
+					sw[a].initRef(true, 0, rect, ref.ptr(), 0, c.width, c.width,
+					              sc, minsc, true, 2000, 4, false, true);
+					ok[a] = sw[a].align(rnd, best[a]);
+					secs[a] += (nanoTime() - t0) / 1e9;
+					if(ok[a]) {
+						nsucc[a]++;
+					}
+				}
+				if(ok[0] != ok[1] || best[0] != best[1]) {
+					ndiff++;
+				}
+			}
+		}
+		if(ndiff > 0 || nsucc[0] != nsucc[1]) {
+			nbad++;
+		}
+		size_t nprob = nread * c.nwin;
+		fprintf(stderr, "%-12s rdlen=%4u width=%5u  sse2 %8.2f us  wide %8.2f us  speedup %.2fx  succ %u/%u  mismatches %u\n",
+		        c.name, (unsigned)c.rdlen, (unsigned)c.width,
+		        secs[0] * 1e6 / nprob, secs[1] * 1e6 / nprob,
+		        secs[1] > 0 ? secs[0] / secs[1] : 0.0,
+		        (unsigned)nsucc[1], (unsigned)nprob, (unsigned)ndiff);
+	}
+	return nbad == 0 ? 0 : 1;
+}
+
+#endif /*def ALIGNER_SWSSE_WIDE_MAIN*/
@@ -0,0 +1,121 @@
+/*
+ * Copyright 2015, Daehwan Kim <infphilo@gmail.com>
+ *
+ * This file is part of HISAT 2.
+ *
+ * HISAT 2 is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * HISAT 2 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with HISAT 2.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * aligner_swsse_wide.h
+ *
+ * 256-bit (AVX2) striped Smith-Waterman kernel for end-to-end, unsigned 8-bit
+ * scores.  The SSE2 kernels fill an SSEMatrix whose 128-bit striped layout
+ * the backtrace code depends on, so the wide kernel is score-only: it keeps
+ * two columns of H plus one of E and reports the same best score and flag
+ * the SSE2 fill would.  SwAligner uses it as a filter ahead of the SSE2 fill
+ * for the seed extensions of --bowtie2-dp: problems with no valid alignment
+ * (or that saturate) are settled by it alone, while problems with one are
+ * filled again by SSE2, so those pay for both fills.
+ *
+ * Local mode and the 16-bit kernels stay SSE2, and there is no 512-bit
+ * build: hisat2 does not align in local mode, and an AVX-512BW build of
+ * this kernel measured no faster than AVX2.
+ *
+ * Whether AVX2 is available is checked once at runtime with CPUID; builds
+ * for other compilers or architectures always use SSE2.
+ */
+
+#ifndef ALIGNER_SWSSE_WIDE_H_
+#define ALIGNER_SWSSE_WIDE_H_
+
+#include <stdint.h>
+#include "ds.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && !defined(NO_SSE)
+#define SSE_WIDE_CAPABILITY
+#endif
+
+enum {
+	SSE_WIDE_NONE = 0,  // SSE2 only
+	SSE_WIDE_AVX2       // 32 x 8-bit lanes
+};
+
+/**
+ * Return the kernel level this processor and OS support.  The CPUID probe
+ * runs once; later calls return the cached answer.
+ */
+extern int sseWideLevel();
+
+/**
+ * Number of 8-bit lanes in a vector at the given level.
+ */
+static inline size_t sseWideLanes(int level) {
+	return level == SSE_WIDE_AVX2 ? 32 : 16;
+}
+
+/**
+ * Query profile and column buffers for one read orientation.  Layout of the
+ * profile is [refc][segment][profile, gap barrier], each entry one vector of
+ * sseWideLanes(level_) bytes.
+ */
+struct SSEWideData {
+	SSEWideData(int cat = 0) : profbuf_(cat), vecbuf_(cat) { }
+
+	/**
+	 * Return a pointer into buf aligned for the widest vector type, having
+	 * grown buf to hold at least n bytes past that point.
+	 */
+	static uint8_t *alignedBuf(EList<uint8_t>& buf, size_t n) {
+		buf.resizeNoCopy(n + 64);
+		uintptr_t p = (uintptr_t)buf.ptr();
+		return (uint8_t*)((p + 63) & ~(uintptr_t)63);
+	}
+
+	EList<uint8_t> profbuf_;   // query profile & gap barrier
+	EList<uint8_t> vecbuf_;    // E, F and two H columns
+	uint8_t       *prof_;      // aligned start of profile
+	int            level_;     // level the profile was built for
+	size_t         seglen_;    // vectors per column
+	size_t         lastIter_;  // which vector has the final row?
+	size_t         lastWord_;  // which byte within that vector?
+};
+
+/**
+ * Inputs and outputs of one score-only fill.
+ */
+struct SSEWideArgs {
+	const uint8_t *prof;     // query profile, see SSEWideData
+	uint8_t       *buf;      // 3 * seglen vectors of scratch
+	const char    *rf;       // reference characters (masks)
+	size_t         rfi;      // first reference column
+	size_t         rff;      // last reference column (excl)
+	size_t         seglen;   // vectors per column
+	size_t         lastIter; // vector holding the final row
+	size_t         lastWord; // byte within lastIter holding the final row
+	uint8_t        rfgapo;   // reference gap open
+	uint8_t        rfgape;   // reference gap extend
+	uint8_t        rdgapo;   // read gap open
+	uint8_t        rdgape;   // read gap extend
+	int64_t        minsc;    // minimum valid score
+	size_t         colstop;  // out: columns filled before giving up
+};
+
+#ifdef SSE_WIDE_CAPABILITY
+namespace sse_wide_avx2 {
+	int64_t alignEnd2EndU8(SSEWideArgs& a, int& flag);
+}
+#endif
+
+#endif /*ALIGNER_SWSSE_WIDE_H_*/
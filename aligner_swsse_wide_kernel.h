@@ -0,0 +1,168 @@
+/*
+ * Copyright 2015, Daehwan Kim <infphilo@gmail.com>
+ *
+ * This file is part of HISAT 2.
+ *
+ * HISAT 2 is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * HISAT 2 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with HISAT 2.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * aligner_swsse_wide_kernel.h
+ *
+ * Body of the score-only striped end-to-end kernel.  No include guard: this
+ * file is included by aligner_swsse_wide.cpp inside the namespace of an
+ * instruction set, after it has defined SSE_WIDE_TARGET and the VEC / V*
+ * primitives for that width.  The kernel reports the same score and flag as
+ * alignNucleotidesEnd2EndSseU8.
+ *
+ * Rather than Farrar's lazy-F loop, which needs about one iteration per row
+ * a vertical gap travels no matter how wide the vector is, each column is
+ * filled in two passes over the segments with a prefix scan between them:
+ *
+ *  1. H' = max(diagonal + profile, E), plus the F value each lane passes on
+ *     to the first row of the next lane from gaps that open inside it.
+ *  2. A log2(lanes)-step max-plus scan turns those into the F value that
+ *     enters the first row of every lane from all lanes above it.  Going
+ *     through a whole lane costs seglen gap extensions, or kills the gap if
+ *     the lane holds a gap-barrier row; that cost doesn't depend on the
+ *     column and is composed once per problem.
+ *  3. F, H = max(H', F) and the next column's E, starting from the scanned
+ *     F in each lane.
+ *
+ * Every score is an unsigned saturating byte, and subtracting a then b
+ * saturates to the same value as subtracting a+b saturated at 255, so the
+ * scan yields exactly the cells the SSE2 fixpoint does.
+ */
+
+/**
+ * Compose the cost of carrying a reference gap through whole lanes, for
+ * each step of the scan.  Lane k of dsteps[0] holds the cost of carrying a
+ * gap from the first row of lane k-1 into the first row of lane k; lane 0
+ * holds 0xff since nothing enters the first row from above.
+ */
+SSE_WIDE_TARGET static inline void scanCosts(
+	const SSEWideArgs& a,
+	VEC *dsteps)
+{
+	const size_t iter = a.seglen;
+	const VEC *prof = reinterpret_cast<const VEC*>(a.prof);
+	const VEC vhi = VSET1(0xff);
+	// Lanes holding a gap-barrier row stop a gap outright
+	VEC vbar = VZERO();
+	for(size_t j = 0; j < iter; j++) {
+		vbar = VOR(vbar, VLOAD(prof + j * 2 + 1));
+	}
+	size_t through = iter * a.rfgape;
+	VEC vd = VOR(VSET1(through > 0xff ? 0xff : through), vbar);
+	vd = VOR(VSHIFT1(vd), VSUBS(vhi, VSHIFT1(vhi)));
+	for(int s = 0; s < VNSTEP; s++) {
+		dsteps[s] = vd;
+		vd = VADDS(vd, VOR(vshiftStep(vd, s), VSUBS(vhi, vshiftStep(vhi, s))));
+	}
+}
+
+/**
+ * Given the F value each lane passes on to the first row of the next lane,
+ * return the F value entering the first row of every lane.
+ */
+SSE_WIDE_TARGET static inline VEC scanF(VEC vout, const VEC *dsteps) {
+	VEC vc = VSHIFT1(vout);
+	for(int s = 0; s < VNSTEP; s++) {
+		vc = VMAX(vc, VSUBS(vshiftStep(vc, s), dsteps[s]));
+	}
+	return vc;
+}
+
+/**
+ * End-to-end, unsigned 8-bit.  Scores start at 0xff and penalties are
+ * subtracted with saturation; returns the best score in the last row or sets
+ * flag to -1 (no valid alignment) or -2 (saturated).
+ */
+SSE_WIDE_TARGET int64_t alignEnd2EndU8(SSEWideArgs& a, int& flag) {
+	const size_t iter = a.seglen;
+	const VEC rfgapo = VSET1(a.rfgapo);
+	const VEC rfgape = VSET1(a.rfgape);
+	const VEC rdgapo = VSET1(a.rdgapo);
+	const VEC rdgape = VSET1(a.rdgape);
+	const VEC vlo    = VZERO();
+	const VEC vhi    = VSET1(0xff);
+	// Only the least significant byte set to 0xff
+	const VEC vhilsw = VSUBS(vhi, VSHIFT1(vhi));
+	VEC dsteps[VNSTEP];
+	scanCosts(a, dsteps);
+
+	VEC *pvE      = reinterpret_cast<VEC*>(a.buf);
+	VEC *pvHLoad  = pvE + iter;
+	VEC *pvHStore = pvHLoad + iter;
+	for(size_t j = 0; j < iter; j++) {
+		VSTORE(pvE + j, vlo);
+		VSTORE(pvHLoad + j, vlo);
+	}
+	const VEC *prof = reinterpret_cast<const VEC*>(a.prof);
+
+	uint8_t lrmax = 0;
+	for(size_t i = a.rfi; i < a.rff; i++) {
+		const VEC *pvScoreBase = prof + (size_t)firsts5[(int)a.rf[i]] * iter * 2;
+		const VEC *pvScore = pvScoreBase;
+
+		// Pass 1: H without vertical gaps; F carried within each lane
+		VEC vf = vlo;
+		VEC vh = VOR(VSHIFT1(VLOAD(pvHLoad + iter - 1)), vhilsw);
+		for(size_t j = 0; j < iter; j++) {
+			vf = VSUBS(vf, VLOAD(pvScore + 1)); // veto some ref gap extensions
+			vh = VSUBS(vh, VLOAD(pvScore));
+			vh = VMAX(vh, VLOAD(pvE + j));
+			VSTORE(pvHStore + j, vh);
+			vf = VMAX(VSUBS(vf, rfgape), VSUBS(vh, rfgapo));
+			vh = VLOAD(pvHLoad + j);
+			pvScore += 2;
+		}
+
+		// Pass 2: F entering each lane from the lanes above
+		vf = scanF(vf, dsteps);
+
+		// Pass 3: fold in F, then compute E for the next column
+		pvScore = pvScoreBase;
+		for(size_t j = 0; j < iter; j++) {
+			const VEC vgbar = VLOAD(pvScore + 1);
+			vf = VSUBS(vf, vgbar); // veto some ref gap extensions
+			vh = VMAX(VLOAD(pvHStore + j), vf);
+			VSTORE(pvHStore + j, vh);
+			VEC ve = VSUBS(VLOAD(pvE + j), rdgape);
+			ve = VMAX(ve, VSUBS(VSUBS(vh, rdgapo), vgbar)); // veto some read gap opens
+			VSTORE(pvE + j, ve);
+			vf = VMAX(VSUBS(vf, rfgape), VSUBS(vh, rfgapo));
+			pvScore += 2;
+		}
+
+		uint8_t lr = reinterpret_cast<const uint8_t*>(pvHStore + a.lastIter)[a.lastWord];
+		if(lr > lrmax) {
+			lrmax = lr;
+		}
+		VEC *tmp = pvHLoad; pvHLoad = pvHStore; pvHStore = tmp;
+	}
+	a.colstop = a.rff - 1;
+
+	flag = 0;
+	int64_t score = (int64_t)lrmax - 0xff;
+	if(score < a.minsc) {
+		flag = -1;
+		return score;
+	}
+	if(lrmax == 0) {
+		flag = -2;
+		return std::numeric_limits<int64_t>::min();
+	}
+	return score;
+}
@@ -232,7 +232,8 @@ struct ReportingParams {
                              bool localAlign_,
                              int bowtie2_dp_,
                              bool sensitive_,
-                             bool repeat_)
+                             bool repeat_,
+                             bool repeatCompact_ = false)
                              
 	{
 		init(
@@ -247,7 +248,8 @@ struct ReportingParams {
              localAlign_,
              bowtie2_dp_,
              sensitive_,
-             repeat_);
+             repeat_,
+             repeatCompact_);
 	}
 
 	void init(
@@ -262,7 +264,8 @@ struct ReportingParams {
               bool localAlign_,
               int bowtie2_dp_,
               bool sensitive_,
-              bool repeat_)
+              bool repeat_,
+              bool repeatCompact_ = false)
 	{
 		khits   = khits_;     // -k (or high if -a)
         kseeds  = kseeds_;
@@ -276,6 +279,7 @@ struct ReportingParams {
         bowtie2_dp = bowtie2_dp_;
         sensitive = sensitive_;
         repeat = repeat_;
+        repeatCompact = repeatCompact_;
 	}
 	
 #ifndef NDEBUG
@@ -367,6 +371,11 @@ struct ReportingParams {
                              
     // true iff we output alignments to repeat sequences
     bool repeat;
+    
+    // true iff a pair whose mates both fall in the same repeat copies is
+    // reported once against the repeat sequences rather than aligned again
+    // at each of the genomic copies
+    bool repeatCompact;
 };
 
 /**
@@ -1093,7 +1102,9 @@ public:
 		rs2u_(),       // mate 2 unpaired alignments
 		select1_(),    // for selecting random subsets for mate 1
 		select2_(),    // for selecting random subsets for mate 2
-		st_(rp)        // reporting state - what's left to do?
+		st_(rp),       // reporting state - what's left to do?
+		timeOutput_(false),
+		outputNs_(0)
 	{
 		assert(rp_.repOk());
 	}
@@ -1218,6 +1229,24 @@ public:
 	const ReportingState& state() const { return st_; }
     
     const ReportingParams& reportingParams() { return rp_;}
+    
+    /**
+     * Set whether finishRead() should measure the time it spends handing
+     * records to the output queue; see outputNs().
+     */
+    void timeOutput(bool t) { timeOutput_ = t; }
+    
+    /**
+     * Set how many reads after the read that found it a splice site
+     * becomes usable for mate-pair checks.
+     */
+    void threadRidsMindist(uint64_t mindist) { threads_rids_mindist_ = mindist; }
+    
+    /**
+     * Return nanoseconds the last finishRead() spent in the output queue, or
+     * 0 if timing is off.
+     */
+    uint64_t outputNs() const { return outputNs_; }
 	
 	/**
 	 * Return true iff we're in -M mode.
@@ -1503,6 +1532,9 @@ protected:
 	StackedAln staln_;
     
     EList<SpliceSite> spliceSites_;
+    
+    bool     timeOutput_; // measure time spent in the output queue?
+    uint64_t outputNs_;   // ns spent in the output queue by last finishRead
 };
 
 /**
@@ -1959,7 +1991,8 @@ void AlnSinkWrap<index_t>::finishRead(
                                       bool templateLenAdjustment)      // = true
 {
 	obuf_.clear();
-	OutputQueueMark qqm(g_.outq(), obuf_, rdid_, threadid_);
+	outputNs_ = 0;
+	OutputQueueMark qqm(g_.outq(), obuf_, rdid_, threadid_, timeOutput_ ? &outputNs_ : NULL);
 	assert(init_);
 	if(!suppressSeedSummary) {
 		if(sr1 != NULL) {
@@ -3044,8 +3077,7 @@ void AlnSinkSam<index_t>::appendMate(
 	char mapqInps[1024];
 	if(rs != NULL) {
 		staln.reset();
-		rs->initStacked(rd, staln);
-		staln.leftAlign(false /* not past MMs */);
+		rs->initFused(rd, staln, this->altdb_->alts().size());
 	}
 	int offAdj = 0;
 	// QNAME
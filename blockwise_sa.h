@@ -202,7 +202,7 @@ public:
                           string base_fname = "",
 	      	              ostream& __logger = cout) :
 	InorderBlockwiseSA<TStr>(__text, __bucketSz, __sanityCheck, __passMemExc, __verbose, __logger),
-	_sampleSuffs(EBWTB_CAT), _nthreads(__nthreads), _itrBucketIdx(0), _cur(0), _dcV(__dcV), _dc(EBWTB_CAT), _built(false), _base_fname(base_fname), _bigEndian(currentlyBigEndian())
+	_sampleSuffs(EBWTB_CAT), _nthreads(__nthreads), _itrBucketIdx(0), _cur(0), _dcV(__dcV), _dc(EBWTB_CAT), _built(false), _base_fname(base_fname), _bigEndian(currentlyBigEndian()), _bucketEst(EBWTB_CAT), _order(EBWTB_CAT), _orderPos(0), _wanted(0), _idle(0)
 	{ _randomSrc.init(__seed); reset(); }
 
     ~KarkkainenBlockwiseSA()
@@ -231,17 +231,34 @@ public:
 		return bsz;
 	}
     
+    /**
+     * Worker for building blocks with more than one thread.  Each worker
+     * claims whole blocks, preferring the one the consumer in nextSuffix()
+     * is waiting on and otherwise the largest one no one has started.
+     * Once every block is claimed, idle workers help scan the text for
+     * blocks others are still building.
+     */
     static void nextBlock_Worker(void *vp) {
         pair<KarkkainenBlockwiseSA*, int> param = *(pair<KarkkainenBlockwiseSA*, int>*)vp;
         KarkkainenBlockwiseSA* sa = param.first;
         int tid = param.second;
         while(true) {
             size_t cur = 0;
+            int help = -1;
             {
                 ThreadSafe ts(&sa->_mutex, sa->_nthreads > 1);
-                cur = sa->_cur;
-                if(cur > sa->_sampleSuffs.size()) break;
-                sa->_cur++;
+                if(!sa->claimBlock(cur)) {
+                    help = sa->stealScan();
+                    if(help < 0) {
+                        // Nothing left to do; let sorts use this thread
+                        sa->_idle++;
+                        break;
+                    }
+                }
+            }
+            if(help >= 0) {
+                sa->helpScan(sa->_scans[help]);
+                continue;
             }
             sa->nextBlock((int)cur, tid);
             // Write suffixes into a file
@@ -272,6 +289,7 @@ public:
             if(_threads.size() == 0) {
                 _done.resize(_sampleSuffs.size() + 1);
                 _done.fill(false);
+                initSchedule();
                 _itrBuckets.resize(this->_nthreads);
                 for(int tid = 0; tid < this->_nthreads; tid++) {
                     _tparams.expand();
@@ -297,6 +315,10 @@ public:
                 nextBlock((int)_cur);
                 _cur++;
             } else {
+                {
+                    ThreadSafe ts(&_mutex);
+                    _wanted = this->_itrBucketIdx;
+                }
                 while(!_done[this->_itrBucketIdx]) {
 #if defined(_TTHREAD_WIN32_)
                     Sleep(1);
@@ -331,7 +353,7 @@ public:
     virtual void nextBlock(int cur_block, int tid = 0);
 
 	/// Defined in blockwise_sa.cpp
-	virtual void qsort(EList<TIndexOffU>& bucket);
+	virtual void qsort(EList<TIndexOffU>& bucket, int nthreads = 1);
 
 	/// Return true iff more blocks are available
 	virtual bool hasMoreBlocks() const {
@@ -410,6 +432,46 @@ private:
 
 	void buildSamples();
 
+	/**
+	 * Add the suffixes in [begin, end) of the text that fall between the
+	 * samples lo and hi to bucket.  With progress set, report progress
+	 * every tenth of the range.
+	 */
+	void scanBlock(TIndexOffU begin,
+	               TIndexOffU end,
+	               TIndexOffU lo,
+	               TIndexOffU hi,
+	               const EList<TIndexOffU>& zLo,
+	               const EList<TIndexOffU>& zHi,
+	               EList<TIndexOffU>& bucket,
+	               int progress = -1);
+
+	/**
+	 * Part of a block's text scan that other workers can take over.  The
+	 * text is handed out in chunks; a block is scanned once next reaches
+	 * end and no chunk is inflight.
+	 */
+	struct BlockScan {
+		BlockScan() : active(false), inflight(0), helpers(0) { }
+
+		bool                     active;   /// open to helpers?
+		TIndexOffU               lo, hi;   /// bounding samples
+		const EList<TIndexOffU>* zLo;
+		const EList<TIndexOffU>* zHi;
+		EList<TIndexOffU>*       bucket;   /// suffixes found so far
+		TIndexOffU               next;     /// first unclaimed text offset
+		TIndexOffU               end;      /// end of text
+		TIndexOffU               chunk;    /// text offsets per claim
+		int                      inflight; /// chunks being scanned
+		int                      helpers;  /// # threads that helped
+	};
+
+	/// Defined below; all but helpScan must be called with _mutex held
+	void initSchedule();
+	bool claimBlock(size_t& cur);
+	int  stealScan();
+	void helpScan(BlockScan& sc);
+
 	EList<TIndexOffU>  _sampleSuffs; /// sample suffixes
     int                _nthreads;    /// # of threads
     TIndexOffU         _itrBucketIdx;
@@ -426,13 +488,20 @@ private:
     EList<pair<KarkkainenBlockwiseSA*, int> > _tparams;
     ELList<TIndexOffU>      _itrBuckets;  /// buckets
     EList<bool>             _done;        /// is a block processed?
+    EList<TIndexOffU>       _bucketEst;   /// estimated size of each block
+    EList<TIndexOffU>       _order;       /// blocks, largest estimate first
+    size_t                  _orderPos;    /// next block in _order to try
+    EList<bool>             _started;     /// has a worker claimed a block?
+    TIndexOffU              _wanted;      /// block nextSuffix() waits on
+    EList<BlockScan>        _scans;       /// block scan of each worker
+    int                     _idle;        /// workers that have finished
 };
 
 /**
  * Qsort the set of suffixes whose offsets are in 'bucket'.
  */
 template<typename TStr>
-inline void KarkkainenBlockwiseSA<TStr>::qsort(EList<TIndexOffU>& bucket) {
+inline void KarkkainenBlockwiseSA<TStr>::qsort(EList<TIndexOffU>& bucket, int nthreads) {
 	const TStr& t = this->text();
 	TIndexOffU *s = bucket.ptr();
 	size_t slen = bucket.size();
@@ -444,8 +513,8 @@ inline void KarkkainenBlockwiseSA<TStr>::qsort(EList<TIndexOffU>& bucket) {
 		// with than the EList<> container
 		const uint8_t *host = (const uint8_t *)t.buf();
 		assert(_dc.get() != NULL);
-		mkeyQSortSufDcU8(t, host, len, s, slen, *_dc.get(), 4,
-		                 this->verbose(), this->sanityCheck());
+		mkeyQSortSufDcU8Par(t, host, len, s, slen, *_dc.get(), 4, nthreads,
+		                    this->verbose(), this->sanityCheck());
 	} else {
 		VMSG_NL("  (Not using difference cover)");
 		// We don't have a difference cover - just do a normal
@@ -463,7 +532,8 @@ inline void KarkkainenBlockwiseSA<TStr>::qsort(EList<TIndexOffU>& bucket) {
  */
 template<>
 inline void KarkkainenBlockwiseSA<S2bDnaString>::qsort(
-	EList<TIndexOffU>& bucket)
+	EList<TIndexOffU>& bucket,
+	int nthreads)
 {
 	const S2bDnaString& t = this->text();
 	TIndexOffU *s = bucket.ptr();
@@ -474,8 +544,8 @@ inline void KarkkainenBlockwiseSA<S2bDnaString>::qsort(
 		VMSG_NL("  (Using difference cover)");
 		// Can't use the text's 'host' array because the backing
 		// store for the packed string is not one-char-per-elt.
-		mkeyQSortSufDcU8(t, t, len, s, slen, *_dc.get(), 4,
-		                 this->verbose(), this->sanityCheck());
+		mkeyQSortSufDcU8Par(t, t, len, s, slen, *_dc.get(), 4, nthreads,
+		                    this->verbose(), this->sanityCheck());
 	} else {
 		VMSG_NL("  (Not using difference cover)");
 		// We don't have a difference cover - just do a normal
@@ -597,7 +667,7 @@ void KarkkainenBlockwiseSA<TStr>::buildSamples() {
     {
         Timer timer(cout, "  Multikey QSorting samples time: ", this->verbose());
         VMSG_NL("Multikey QSorting " << _sampleSuffs.size() << " samples");
-        this->qsort(_sampleSuffs);
+        this->qsort(_sampleSuffs, this->_nthreads);
     }
     // Calculate bucket sizes
     VMSG_NL("Calculating bucket sizes");
@@ -661,6 +731,9 @@ void KarkkainenBlockwiseSA<TStr>::buildSamples() {
         TIndexOff merged = 0;
         assert_eq(bucketSzs.size(), numBuckets);
         assert_eq(bucketReps.size(), numBuckets);
+        // Sizes of the buckets as they stand after splitting and merging,
+        // guessing that a split bucket splits down the middle
+        _bucketEst.clear();
         {
             Timer timer(cout, "  Splitting and merging time: ", this->verbose());
             VMSG_NL("Splitting and merging");
@@ -691,9 +764,14 @@ void KarkkainenBlockwiseSA<TStr>::buildSamples() {
                     // set accumulated in the binarySASearch loop; this
                     // effectively splits the bucket
                     _sampleSuffs.insert(bucketReps[(size_t)i], (TIndexOffU)(i + (added++)));
+                    _bucketEst.push_back(bucketSzs[(size_t)i] / 2);
+                    _bucketEst.push_back(bucketSzs[(size_t)i] - bucketSzs[(size_t)i] / 2);
+                } else {
+                    _bucketEst.push_back(bucketSzs[(size_t)i]);
                 }
             }
         }
+        assert_eq(_bucketEst.size(), _sampleSuffs.size()+1);
         if(added == 0) {
             //if(this->verbose()) {
             //	cout << "Final bucket sizes:" << endl;
@@ -716,6 +794,113 @@ void KarkkainenBlockwiseSA<TStr>::buildSamples() {
     VMSG_NL("Avg bucket size: " << ((double)(len-_sampleSuffs.size()) / (_sampleSuffs.size()+1)) << " (target: " << bsz << ")");
 }
 
+/**
+ * Set up the schedule for building blocks with more than one thread: order
+ * the blocks by estimated size, largest first, so that the biggest ones
+ * aren't left until the end.
+ */
+template<typename TStr>
+void KarkkainenBlockwiseSA<TStr>::initSchedule() {
+    size_t nblocks = _sampleSuffs.size() + 1;
+    EList<pair<TIndexOffU, TIndexOffU> > bysz(EBWTB_CAT);
+    bysz.resizeExact(nblocks);
+    for(size_t i = 0; i < nblocks; i++) {
+        TIndexOffU est = (_bucketEst.size() == nblocks ? _bucketEst[i] : 0);
+        bysz[i].first = OFF_MASK - est;
+        bysz[i].second = (TIndexOffU)i;
+    }
+    bysz.sort();
+    _order.resizeExact(nblocks);
+    for(size_t i = 0; i < nblocks; i++) {
+        _order[i] = bysz[i].second;
+    }
+    _orderPos = 0;
+    _started.resizeExact(nblocks);
+    _started.fill(false);
+    _wanted = 0;
+    _idle = 0;
+    _scans.resizeExact(this->_nthreads);
+    for(size_t i = 0; i < _scans.size(); i++) {
+        _scans[i] = BlockScan();
+    }
+}
+
+/**
+ * Claim the block the consumer is waiting on if no one has started it,
+ * otherwise the largest unclaimed block.  Return false if every block has
+ * been claimed.
+ */
+template<typename TStr>
+bool KarkkainenBlockwiseSA<TStr>::claimBlock(size_t& cur) {
+    if(_wanted < _started.size() && !_started[_wanted]) {
+        cur = _wanted;
+    } else {
+        while(_orderPos < _order.size() && _started[_order[_orderPos]]) {
+            _orderPos++;
+        }
+        if(_orderPos == _order.size()) {
+            return false;
+        }
+        cur = _order[_orderPos];
+    }
+    _started[cur] = true;
+    return true;
+}
+
+/**
+ * Return the worker whose block has the most text left to scan, or -1 if
+ * no scan has anything left to hand out.
+ */
+template<typename TStr>
+int KarkkainenBlockwiseSA<TStr>::stealScan() {
+    int best = -1;
+    TIndexOffU bestLeft = 0;
+    for(size_t i = 0; i < _scans.size(); i++) {
+        const BlockScan& sc = _scans[i];
+        if(sc.active && sc.next < sc.end && sc.end - sc.next > bestLeft) {
+            best = (int)i;
+            bestLeft = sc.end - sc.next;
+        }
+    }
+    if(best >= 0) {
+        _scans[best].helpers++;
+    }
+    return best;
+}
+
+/**
+ * Scan chunks of the text for the block in sc until there are none left to
+ * claim.  Both the worker that owns the block and helpers call this.
+ */
+template<typename TStr>
+void KarkkainenBlockwiseSA<TStr>::helpScan(BlockScan& sc) {
+    EList<TIndexOffU> found(EBWTB_CAT);
+    while(true) {
+        TIndexOffU begin, end, lo, hi;
+        const EList<TIndexOffU>* zLo;
+        const EList<TIndexOffU>* zHi;
+        EList<TIndexOffU>* bucket;
+        {
+            ThreadSafe ts(&_mutex);
+            if(!sc.active || sc.next >= sc.end) break;
+            begin = sc.next;
+            end = min<TIndexOffU>(sc.end, begin + sc.chunk);
+            sc.next = end;
+            sc.inflight++;
+            lo = sc.lo; hi = sc.hi;
+            zLo = sc.zLo; zHi = sc.zHi;
+            bucket = sc.bucket;
+        }
+        found.clear();
+        scanBlock(begin, end, lo, hi, *zLo, *zHi, found);
+        {
+            ThreadSafe ts(&_mutex);
+            bucket->push_back_array(found.ptr(), found.size());
+            sc.inflight--;
+        }
+    }
+}
+
 /**
  * Do a simple LCP calculation on two strings.
  */
@@ -912,6 +1097,64 @@ bool KarkkainenBlockwiseSA<TStr>::suffixCmp(
 	}
 }
 
+/**
+ * Add the suffixes in [begin, end) of the text that fall between the
+ * samples lo and hi to bucket.
+ *
+ * This loop is based on the SMALLERSUFFIXES function outlined on p7 of the
+ * "Fast BWT" paper.  Its Z-box state starts out empty, so any range of
+ * the text can be scanned on its own.
+ */
+template<typename TStr>
+void KarkkainenBlockwiseSA<TStr>::scanBlock(
+    TIndexOffU begin,
+    TIndexOffU end,
+    TIndexOffU lo,
+    TIndexOffU hi,
+    const EList<TIndexOffU>& zLo,
+    const EList<TIndexOffU>& zHi,
+    EList<TIndexOffU>& bucket,
+    int progress)
+{
+    int64_t kHi = -1, kLo = -1;
+    int64_t jHi = -1, jLo = -1;
+    bool kHiSoft = false, kLoSoft = false;
+    TIndexOffU lenDiv10 = (end - begin + 9) / 10;
+    if(lenDiv10 == 0) return;
+    for(TIndexOffU iten = begin, ten = 0; iten < end; iten += lenDiv10, ten++) {
+        TIndexOffU itenNext = iten + lenDiv10;
+        if(progress >= 0 && ten > 0) VMSG_NL("  bucket " << (progress+1) << ": " << (ten * 10) << "%");
+        for(TIndexOffU i = iten; i < itenNext && i < end; i++) {
+            assert_lt(jLo, (int64_t)i); assert_lt(jHi, (int64_t)i);
+            // Advance the upper-bound comparison by one character
+            if(i == hi || i == lo) continue; // equal to one of the bookends
+            if(hi != OFF_MASK && !suffixCmp(hi, i, jHi, kHi, kHiSoft, zHi)) {
+                continue; // not in the bucket
+            }
+            if(lo != OFF_MASK && suffixCmp(lo, i, jLo, kLo, kLoSoft, zLo)) {
+                continue; // not in the bucket
+            }
+            // In the bucket! - add it
+            try {
+                bucket.push_back(i);
+            } catch(bad_alloc &e) {
+                cerr << "Could not append element to block of " << ((bucket.size()) * OFF_SIZE) << " bytes" << endl;
+                if(this->_passMemExc) {
+                    throw e; // rethrow immediately
+                } else {
+                    cerr << "Please try using a larger number of blocks by specifying a smaller --bmax or" << endl
+                    << "a larger --bmaxdivn" << endl;
+                    throw 1;
+                }
+            }
+            // Not necessarily true; we allow overflowing buckets
+            // since we can't guarantee that a good set of sample
+            // suffixes can be found in a reasonable amount of time
+            //assert_lt(bucket.size(), this->bucketSz());
+        }
+    }
+}
+
 /**
  * Retrieve the next block.  This is the most performance-critical part
  * of the blockwise suffix sorting process.
@@ -936,6 +1179,8 @@ void KarkkainenBlockwiseSA<TStr>::nextBlock(int cur_block, int tid) {
     // Set up the bucket
     bucket.clear();
     TIndexOffU lo = OFF_MASK, hi = OFF_MASK;
+    uint64_t scanNs = 0;
+    int scanHelpers = 0;
     if(_sampleSuffs.size() == 0) {
         // Special case: if _sampleSuffs is 0, then multikey-quicksort
         // everything
@@ -1035,67 +1280,76 @@ void KarkkainenBlockwiseSA<TStr>::nextBlock(int cur_block, int tid) {
         // This loop is based on the SMALLERSUFFIXES function outlined on
         // p7 of the "Fast BWT" paper
         //
-        int64_t kHi = -1, kLo = -1;
-        int64_t jHi = -1, jLo = -1;
-        bool kHiSoft = false, kLoSoft = false;
         assert_eq(0, bucket.size());
-        {
-            // Timer timer(cout, "  Block accumulator loop time: ", this->verbose());
+        if(this->_nthreads > 1) {
+            // Scan the text a chunk at a time so that idle workers can
+            // take some of it on
+            BlockScan& sc = _scans[tid];
+            uint64_t scanStart = nanoTime();
             {
-                ThreadSafe ts(&_mutex, this->_nthreads > 1);
-                VMSG_NL("  Entering block accumulator loop for bucket " << (cur_block+1) << ":");
+                ThreadSafe ts(&_mutex);
+                sc.lo = lo; sc.hi = hi;
+                sc.zLo = &zLo; sc.zHi = &zHi;
+                sc.bucket = &bucket;
+                sc.next = 0;
+                sc.end = len;
+                sc.chunk = max<TIndexOffU>(len / (this->_nthreads * 16), 1 << 16);
+                sc.inflight = 0;
+                sc.helpers = 0;
+                sc.active = true;
             }
-            TIndexOffU lenDiv10 = (len + 9) / 10;
-            for(TIndexOffU iten = 0, ten = 0; iten < len; iten += lenDiv10, ten++) {
-                TIndexOffU itenNext = iten + lenDiv10;
+            helpScan(sc);
+            int helpers = 0;
+            while(true) {
                 {
-                    ThreadSafe ts(&_mutex, this->_nthreads > 1);
-                    if(ten > 0) VMSG_NL("  bucket " << (cur_block+1) << ": " << (ten * 10) << "%");
-                }
-                for(TIndexOffU i = iten; i < itenNext && i < len; i++) {
-                    assert_lt(jLo, (int64_t)i); assert_lt(jHi, (int64_t)i);
-                    // Advance the upper-bound comparison by one character
-                    if(i == hi || i == lo) continue; // equal to one of the bookends
-                    if(hi != OFF_MASK && !suffixCmp(hi, i, jHi, kHi, kHiSoft, zHi)) {
-                        continue; // not in the bucket
-                    }
-                    if(lo != OFF_MASK && suffixCmp(lo, i, jLo, kLo, kLoSoft, zLo)) {
-                        continue; // not in the bucket
-                    }
-                    // In the bucket! - add it
-                    assert_lt(i, len);
-                    try {
-                        bucket.push_back(i);
-                    } catch(bad_alloc &e) {
-                        cerr << "Could not append element to block of " << ((bucket.size()) * OFF_SIZE) << " bytes" << endl;
-                        if(this->_passMemExc) {
-                            throw e; // rethrow immediately
-                        } else {
-                            cerr << "Please try using a larger number of blocks by specifying a smaller --bmax or" << endl
-                            << "a larger --bmaxdivn" << endl;
-                            throw 1;
-                        }
+                    ThreadSafe ts(&_mutex);
+                    if(sc.inflight == 0) {
+                        sc.active = false;
+                        helpers = sc.helpers;
+                        break;
                     }
-                    // Not necessarily true; we allow overflowing buckets
-                    // since we can't guarantee that a good set of sample
-                    // suffixes can be found in a reasonable amount of time
-                    //assert_lt(bucket.size(), this->bucketSz());
                 }
-            } // end loop over all suffixes of t
-            {
-                ThreadSafe ts(&_mutex, this->_nthreads > 1);
-                VMSG_NL("  bucket " << (cur_block+1) << ": 100%");
+#if defined(_TTHREAD_WIN32_)
+                Sleep(1);
+#elif defined(_TTHREAD_POSIX_)
+                const static timespec ts = {0, 1000000};  // 1 millisecond
+                nanosleep(&ts, NULL);
+#endif
             }
+            scanNs = nanoTime() - scanStart;
+            scanHelpers = helpers;
+        } else {
+            // Timer timer(cout, "  Block accumulator loop time: ", this->verbose());
+            VMSG_NL("  Entering block accumulator loop for bucket " << (cur_block+1) << ":");
+            scanBlock(0, len, lo, hi, zLo, zHi, bucket, cur_block);
+            VMSG_NL("  bucket " << (cur_block+1) << ": 100%");
         }
     } // end else clause of if(_sampleSuffs.size() == 0)
-    // Sort the bucket
+    // Sort the bucket, borrowing the threads of workers that have run
+    // out of blocks
+    uint64_t sortStart = nanoTime();
+    int sortThreads = 1;
     if(bucket.size() > 0) {
         Timer timer(cout, "  Sorting block time: ", this->verbose());
         {
             ThreadSafe ts(&_mutex, this->_nthreads > 1);
+            if(this->_nthreads > 1) {
+                sortThreads += _idle;
+                _idle = 0;
+            }
             VMSG_NL("  Sorting block of length " << bucket.size() << " for bucket " << (cur_block+1));
         }
-        this->qsort(bucket);
+        this->qsort(bucket, sortThreads);
+        if(sortThreads > 1) {
+            ThreadSafe ts(&_mutex);
+            _idle += sortThreads - 1;
+        }
+    }
+    if(this->_nthreads > 1) {
+        ThreadSafe ts(&_mutex);
+        VMSG_NL("  bucket " << (cur_block+1) << ": " << bucket.size() << " suffixes, scanned in "
+                << (scanNs / 1000000) << " ms with " << scanHelpers << " helper(s), sorted in "
+                << ((nanoTime() - sortStart) / 1000000) << " ms on " << sortThreads << " thread(s)");
     }
     if(hi != OFF_MASK) {
         // Not the final bucket; throw in the sample on the RHS
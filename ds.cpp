@@ -22,30 +22,104 @@
 extern MemoryTally gMemTally;
 
 /**
- * Tally a memory allocation of size amt bytes.
+ * Add amt (possibly negative) to a category's total and to the overall
+ * total, raising the peaks if needed.
  */
-void MemoryTally::add(int cat, uint64_t amt) {
-	ThreadSafe ts(&mutex_m);
-	tots_[cat] += amt;
-	tot_ += amt;
-	if(tots_[cat] > peaks_[cat]) {
-		peaks_[cat] = tots_[cat];
+void MemoryTally::commit(int cat, int64_t amt) {
+	Counter* cs[2] = { &tots_[cat], &tot_ };
+	for(int i = 0; i < 2; i++) {
+		int64_t cur = cs[i]->cur.fetch_add(amt, std::memory_order_relaxed) + amt;
+		int64_t peak = cs[i]->peak.load(std::memory_order_relaxed);
+		while(cur > peak &&
+		      !cs[i]->peak.compare_exchange_weak(peak, cur, std::memory_order_relaxed))
+		{ }
+	}
+}
+
+#ifndef NO_MEM_TALLY
+
+#define MEM_TALLY_FLUSH (64 * 1024)
+
+/**
+ * One thread's changes to one MemoryTally that haven't been folded into
+ * its totals yet.  Folded in when the thread exits.
+ */
+class MemoryTallyBuf {
+
+public:
+
+	MemoryTallyBuf() : tally_(NULL) {
+		memset(pend_, 0, 256 * sizeof(int64_t));
+	}
+
+	~MemoryTallyBuf() { flush(); }
+
+	/**
+	 * Buffer a change to a category of tally, folding it in right away
+	 * if the buffered change for the category has grown large.
+	 */
+	void change(MemoryTally* tally, int cat, int64_t amt) {
+		if(tally != tally_) {
+			flush();
+			tally_ = tally;
+		}
+		int64_t p = (pend_[cat] += amt);
+		if(p >= MEM_TALLY_FLUSH || p <= -MEM_TALLY_FLUSH) {
+			tally_->commit(cat, p);
+			pend_[cat] = 0;
+		}
+	}
+
+	/**
+	 * Fold all buffered changes into the tally.
+	 */
+	void flush() {
+		if(tally_ == NULL) return;
+		for(int i = 0; i < 256; i++) {
+			if(pend_[i] != 0) {
+				tally_->commit(i, pend_[i]);
+				pend_[i] = 0;
+			}
+		}
 	}
-	if(tot_ > peak_) {
-		peak_ = tot_;
+
+	/**
+	 * Fold all buffered changes into the tally if they belong to it.
+	 */
+	void flush(MemoryTally* tally) {
+		if(tally == tally_) flush();
 	}
+
+private:
+
+	MemoryTally* tally_;
+	int64_t pend_[256];
+};
+
+static thread_local MemoryTallyBuf memTallyBuf;
+
+/**
+ * Tally a memory allocation of size amt bytes.
+ */
+void MemoryTally::add(int cat, uint64_t amt) {
+	memTallyBuf.change(this, cat, (int64_t)amt);
 }
 
 /**
  * Tally a memory free of size amt bytes.
  */
 void MemoryTally::del(int cat, uint64_t amt) {
-	ThreadSafe ts(&mutex_m);
-	assert_geq(tots_[cat], amt);
-	assert_geq(tot_, amt);
-	tots_[cat] -= amt;
-	tot_ -= amt;
+	memTallyBuf.change(this, cat, -(int64_t)amt);
 }
+
+/**
+ * Fold the calling thread's buffered changes into the totals.
+ */
+void MemoryTally::flush() {
+	memTallyBuf.flush(this);
+}
+
+#endif /*ndef NO_MEM_TALLY*/
 	
 #ifdef MAIN_DS
 
@@ -153,3 +227,111 @@ int main(void) {
 }
 
 #endif /*def MAIN_SSTRING*/
+
+#ifdef ELIST_MOVE_MAIN
+
+/*
+ * Count the heap allocations and time spent per read in the list
+ * operations an aligned read goes through: results that carry their own
+ * edit lists and grow from a small capacity, hits dropped from the front,
+ * reference windows kept in an EList<SStringExpandable>, and an ELList of
+ * edit lists.  Every allocation beyond the lists' own buffers is a deep
+ * copy of a nested buffer made while growing or shifting a list.
+ *
+ * Build with something like:
+ *
+ *   g++ -O3 -DNDEBUG -DELIST_MOVE_MAIN -o elist_move_bench ds.cpp -lpthread
+ *
+ * and run as "elist_move_bench [reads] [hits per read]".
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <new>
+#include <malloc.h>
+#include "sstring.h"
+#include "random_source.h"
+#include "timer.h"
+
+MemoryTally gMemTally;
+
+static uint64_t nallocs = 0;
+
+void* operator new[](size_t sz) {
+	nallocs++;
+	void* p = malloc(sz == 0 ? 1 : sz);
+	if(p == NULL) throw std::bad_alloc();
+	return p;
+}
+
+void operator delete[](void* p) noexcept { free(p); }
+
+/**
+ * An alignment result in miniature: a score and the edits behind it.
+ */
+struct BenchRes {
+	int64_t          score;
+	EList<uint32_t>  ned;
+};
+
+int main(int argc, char **argv) {
+	size_t nreads = argc > 1 ? atoi(argv[1]) : 200000;
+	size_t nhits  = argc > 2 ? atoi(argv[2]) : 16;
+	RandomSource rnd(73);
+	SStringExpandable<char> window;
+	for(size_t i = 0; i < 150; i++) window.append("ACGT"[rnd.nextU32() & 3]);
+	// Keep freed lists on the heap rather than handing them back to the
+	// kernel after every read, which would otherwise dominate the timing
+	mallopt(M_TRIM_THRESHOLD, 256 << 20);
+	mallopt(M_MMAP_THRESHOLD, 256 << 20);
+
+	uint64_t nallocs0 = nallocs;
+	uint64_t t0 = nanoTime();
+	size_t sink = 0;
+	for(size_t r = 0; r < nreads; r++) {
+		// Alignments for the read, grown one at a time
+		EList<BenchRes> rs(1);
+		for(size_t i = 0; i < nhits; i++) {
+			BenchRes res;
+			res.score = -(int64_t)(rnd.nextU32() % 40);
+			for(size_t j = 0; j < 1 + (i & 3); j++) {
+				res.ned.push_back(rnd.nextU32() % 100);
+			}
+			rs.push_back(std::move(res));
+		}
+		rs.erase(0, nhits / 4);
+		// Edits of each candidate hit
+		EList<EList<uint32_t> > hits(1);
+		for(size_t i = 0; i < 2 * nhits; i++) {
+			EList<uint32_t> ed;
+			for(size_t j = 0; j < 4; j++) {
+				ed.push_back((uint32_t)j);
+			}
+			hits.push_back(std::move(ed));
+		}
+		hits.erase(0);
+		// Reference windows for aligning with alternatives
+		EList<SStringExpandable<char> > bufs(1);
+		for(size_t i = 0; i < nhits / 2; i++) {
+			bufs.expand();
+			bufs.back() = window;
+		}
+		// Edit lists at each search depth
+		ELList<uint32_t, 1, 4> llist;
+		for(size_t i = 0; i < nhits; i++) {
+			llist.expand();
+			llist.back().clear();
+			llist.back().push_back((uint32_t)i);
+		}
+		sink += rs.size() + hits.size() + bufs.size() + llist.size();
+		sink += rs[0].ned.size() + hits[0].size() + bufs[0].length();
+	}
+	double t = (nanoTime() - t0) / 1e9;
+	uint64_t n = nallocs - nallocs0;
+	fprintf(stderr, "%llu reads, %llu hits per read: %.1f allocations per read, %.0f ns per read (%llu)\n",
+	        (unsigned long long)nreads, (unsigned long long)nhits,
+	        (double)n / nreads, t * 1e9 / nreads, (unsigned long long)sink);
+	return 0;
+}
+
+#endif /*def ELIST_MOVE_MAIN*/
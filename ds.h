@@ -26,6 +26,8 @@
 #include <stdint.h>
 #include <string.h>
 #include <limits>
+#include <atomic>
+#include <type_traits>
 #include "assert_helpers.h"
 #include "threading.h"
 #include "random_source.h"
@@ -34,17 +36,33 @@
 #include <cstring>
 
 /**
- * Tally how much memory is allocated to certain 
+ * Tally how much memory is allocated to certain categories.
+ *
+ * Allocating threads don't share counters: each buffers its changes per
+ * category and only folds them into the shared totals, which are atomic
+ * and kept on separate cache lines, once they amount to MEM_TALLY_FLUSH
+ * bytes or the thread exits.  Totals and peaks can therefore lag the truth
+ * by up to MEM_TALLY_FLUSH bytes per category for each other running
+ * thread.  Compiling with NO_MEM_TALLY removes the accounting altogether.
  */
 class MemoryTally {
 
 public:
 
-	MemoryTally() : tot_(0), peak_(0) {
-		memset(tots_,  0, 256 * sizeof(uint64_t));
-		memset(peaks_, 0, 256 * sizeof(uint64_t));
+	MemoryTally() {
+		for(int i = 0; i < 256; i++) {
+			tots_[i].cur = 0;
+			tots_[i].peak = 0;
+		}
+		tot_.cur = 0;
+		tot_.peak = 0;
 	}
 
+#ifdef NO_MEM_TALLY
+	void add(int cat, uint64_t amt) { }
+	void del(int cat, uint64_t amt) { }
+	void flush() { }
+#else
 	/**
 	 * Tally a memory allocation of size amt bytes.
 	 */
@@ -54,51 +72,76 @@ public:
 	 * Tally a memory free of size amt bytes.
 	 */
 	void del(int cat, uint64_t amt);
-	
+
+	/**
+	 * Fold the calling thread's buffered changes into the totals.
+	 */
+	void flush();
+#endif
+
 	/**
 	 * Return the total amount of memory allocated.
 	 */
-	uint64_t total() { return tot_; }
+	uint64_t total() { flush(); return clamp(tot_.cur); }
 
 	/**
 	 * Return the total amount of memory allocated in a particular
 	 * category.
 	 */
-	uint64_t total(int cat) { return tots_[cat]; }
+	uint64_t total(int cat) { flush(); return clamp(tots_[cat].cur); }
 
 	/**
 	 * Return the peak amount of memory allocated.
 	 */
-	uint64_t peak() { return peak_; }
+	uint64_t peak() { flush(); return clamp(tot_.peak); }
 
 	/**
 	 * Return the peak amount of memory allocated in a particular
 	 * category.
 	 */
-	uint64_t peak(int cat) { return peaks_[cat]; }
+	uint64_t peak(int cat) { flush(); return clamp(tots_[cat].peak); }
 
 #ifndef NDEBUG
 	/**
-	 * Check that memory tallies are internally consistent;
+	 * Check that memory tallies are internally consistent.  Only holds
+	 * when no other thread has changes buffered.
 	 */
 	bool repOk() const {
-		uint64_t tot = 0;
+		int64_t tot = 0;
 		for(int i = 0; i < 256; i++) {
-			assert_leq(tots_[i], peaks_[i]);
-			tot += tots_[i];
+			assert_leq(tots_[i].cur.load(), tots_[i].peak.load());
+			tot += tots_[i].cur.load();
 		}
-		assert_eq(tot, tot_);
+		assert_eq(tot, tot_.cur.load());
 		return true;
 	}
 #endif
 
 protected:
 
-	MUTEX_T mutex_m;
-	uint64_t tots_[256];
-	uint64_t tot_;
-	uint64_t peaks_[256];
-	uint64_t peak_;
+	friend class MemoryTallyBuf;
+
+	/**
+	 * A running total and its high-water mark, alone on a cache line.
+	 * The total is signed because a thread that frees memory another
+	 * thread allocated may fold its change in first.
+	 */
+	struct alignas(64) Counter {
+		std::atomic<int64_t> cur;
+		std::atomic<int64_t> peak;
+		char pad[64 - 2 * sizeof(std::atomic<int64_t>)];
+	};
+
+	static uint64_t clamp(int64_t v) { return v < 0 ? 0 : (uint64_t)v; }
+
+	/**
+	 * Add amt (possibly negative) to a category's total and to the
+	 * overall total, raising the peaks if needed.
+	 */
+	void commit(int cat, int64_t amt);
+
+	Counter tots_[256];
+	Counter tot_;
 };
 
 extern MemoryTally gMemTally;
@@ -360,6 +403,18 @@ public:
 		assert_geq(cat, 0);
 	}
 
+	/**
+	 * Take over the buffer of another EList, leaving it empty.
+	 */
+	EList(EList<T, S>&& o) :
+		cat_(o.cat_), allocCat_(o.allocCat_), list_(o.list_), sz_(o.sz_), cur_(o.cur_)
+	{
+		o.allocCat_ = -1;
+		o.list_ = NULL;
+		o.sz_ = S;
+		o.cur_ = 0;
+	}
+
 	/**
 	 * Destructor.
 	 */
@@ -382,9 +437,22 @@ public:
 		if(sz_ < o.cur_) expandNoCopy(o.cur_ + 1);
 		assert_geq(sz_, o.cur_);
 		cur_ = o.cur_;
-		for(size_t i = 0; i < cur_; i++) {
-			list_[i] = o.list_[i];
-		}
+		copyElts(list_, o.list_, cur_, std::is_trivially_copyable<T>());
+		return *this;
+	}
+
+	/**
+	 * Swap buffers with o, so that this list holds o's elements and o
+	 * keeps this list's buffer for reuse.  Lists of different categories
+	 * are copied instead.
+	 */
+	EList<T, S>& operator=(EList<T, S>&& o) {
+		if(this == &o) return *this;
+		if(cat_ != o.cat_) return *this = (const EList<T, S>&)o;
+		std::swap(allocCat_, o.allocCat_);
+		std::swap(list_, o.list_);
+		std::swap(sz_, o.sz_);
+		std::swap(cur_, o.cur_);
 		return *this;
 	}
 	
@@ -487,6 +555,16 @@ public:
 		list_[cur_++] = el;
 	}
 
+	/**
+	 * Add an element to the back and immediately initialize it via
+	 * move assignment.
+	 */
+	void push_back(T&& el) {
+		if(list_ == NULL) lazyInit();
+		if(cur_ == sz_) expandCopy(sz_+1);
+		list_[cur_++] = std::move(el);
+	}
+
 	void nullify() {
 		free();
 	}
@@ -600,7 +678,7 @@ public:
 	void erase(size_t idx) {
 		assert_lt(idx, cur_);
 		for(size_t i = idx; i < cur_-1; i++) {
-			list_[i] = list_[i+1];
+			list_[i] = std::move(list_[i+1]);
 		}
 		cur_--;
 	}
@@ -615,7 +693,7 @@ public:
 		}
 		assert_lt(idx, cur_);
 		for(size_t i = idx; i < cur_-len; i++) {
-			list_[i] = list_[i+len];
+			list_[i] = std::move(list_[i+len]);
 		}
 		cur_ -= len;
 	}
@@ -628,7 +706,7 @@ public:
 		assert_leq(idx, cur_);
 		if(cur_ == sz_) expandCopy(sz_+1);
 		for(size_t i = cur_; i > idx; i--) {
-			list_[i] = list_[i-1];
+			list_[i] = std::move(list_[i-1]);
 		}
 		list_[idx] = el;
 		cur_++;
@@ -643,7 +721,7 @@ public:
 		if(l.cur_ == 0) return;
 		if(cur_ + l.cur_ > sz_) expandCopy(cur_ + l.cur_);
 		for(size_t i = cur_ + l.cur_ - 1; i > idx + (l.cur_ - 1); i--) {
-			list_[i] = list_[i - l.cur_];
+			list_[i] = std::move(list_[i - l.cur_]);
 		}
 		for(size_t i = 0; i < l.cur_; i++) {
 			list_[i+idx] = l.list_[i];
@@ -695,9 +773,7 @@ public:
 		if(cur_ > 1) {
 			size_t n = cur_ >> 1;
 			for(size_t i = 0; i < n; i++) {
-				T tmp = list_[i];
-				list_[i] = list_[cur_ - i - 1];
-				list_[cur_ - i - 1] = tmp;
+				std::swap(list_[i], list_[cur_ - i - 1]);
 			}
 		}
 	}
@@ -873,7 +949,7 @@ public:
 		assert_lt(idx, cur_);
 		assert_gt(cur_, 0);
 		for(size_t i = idx; i < cur_-1; i++) {
-			list_[i] = list_[i+1];
+			list_[i] = std::move(list_[i+1]);
 		}
 		cur_--;
 	}
@@ -987,8 +1063,9 @@ private:
 	}
 
 	/**
-	 * Expand the list_ buffer until it has exactly 'newsz' elements.  Copy
-	 * old contents into new buffer using operator=.
+	 * Expand the list_ buffer until it has exactly 'newsz' elements.  Move
+	 * old contents into new buffer: memcpy for trivially copyable types,
+	 * move assignment otherwise.
 	 */
 	void expandCopyExact(size_t newsz) {
 		if(newsz <= sz_) return;
@@ -996,10 +1073,7 @@ private:
 		assert(tmp != NULL);
 		size_t cur = cur_;
 		if(list_ != NULL) {
- 			for(size_t i = 0; i < cur_; i++) {
-				// Note: operator= is used
-				tmp[i] = list_[i];
-			}
+			moveElts(tmp, list_, cur_, std::is_trivially_copyable<T>());
 			free();
 		}
 		list_ = tmp;
@@ -1007,6 +1081,38 @@ private:
 		cur_ = cur;
 	}
 
+	/**
+	 * Copy n elements of src to dst with memcpy.
+	 */
+	static void copyElts(T* dst, const T* src, size_t n, std::true_type) {
+		memcpy(dst, src, n * sizeof(T));
+	}
+
+	/**
+	 * Copy n elements of src to dst with operator=.
+	 */
+	static void copyElts(T* dst, const T* src, size_t n, std::false_type) {
+		for(size_t i = 0; i < n; i++) {
+			dst[i] = src[i];
+		}
+	}
+
+	/**
+	 * Move n elements of src to dst with memcpy.
+	 */
+	static void moveElts(T* dst, T* src, size_t n, std::true_type) {
+		memcpy(dst, src, n * sizeof(T));
+	}
+
+	/**
+	 * Move n elements of src to dst with move assignment.
+	 */
+	static void moveElts(T* dst, T* src, size_t n, std::false_type) {
+		for(size_t i = 0; i < n; i++) {
+			dst[i] = std::move(src[i]);
+		}
+	}
+
 	/**
 	 * Expand the list_ buffer until it has at least 'thresh' elements.
 	 * Size increases quadratically with number of expansions.  Don't copy old
@@ -1104,6 +1210,17 @@ public:
 		assert_geq(cat, 0);
 	}
 
+	/**
+	 * Take over the lists of another ELList, leaving it empty.
+	 */
+	ELList(ELList<T, S1, S2>&& o) :
+		cat_(o.cat_), list_(o.list_), sz_(o.sz_), cur_(o.cur_)
+	{
+		o.list_ = NULL;
+		o.sz_ = S2;
+		o.cur_ = 0;
+	}
+
 	/**
 	 * Destructor.
 	 */
@@ -1134,6 +1251,19 @@ public:
 		}
 		return *this;
 	}
+
+	/**
+	 * Swap lists with o, so that this holds o's lists and o keeps this
+	 * one's for reuse.  Lists of different categories are copied instead.
+	 */
+	ELList<T, S1, S2>& operator=(ELList<T, S1, S2>&& o) {
+		if(this == &o) return *this;
+		if(cat_ != o.cat_) return *this = (const ELList<T, S1, S2>&)o;
+		std::swap(list_, o.list_);
+		std::swap(sz_, o.sz_);
+		std::swap(cur_, o.cur_);
+		return *this;
+	}
 	
 	/**
 	 * Transfer the guts of another EList into this one without using
@@ -1337,8 +1467,9 @@ protected:
 
 	/**
 	 * Expand the list_ buffer until it has at least 'thresh' elements.
-	 * Expansions are quadratic.  Copy old contents into new buffer
-	 * using operator=.
+	 * Expansions are quadratic.  Transfer old lists into the new buffer
+	 * with xfer, including unused ones past cur_ so that their buffers
+	 * are kept for reuse.
 	 */
 	void expandCopy(size_t thresh) {
 		assert(list_ != NULL);
@@ -1347,7 +1478,7 @@ protected:
 		while(newsz < thresh) newsz *= 2;
 		EList<T, S1>* tmp = alloc(newsz);
 		if(list_ != NULL) {
-			for(size_t i = 0; i < cur_; i++) {
+			for(size_t i = 0; i < sz_; i++) {
 				assert_eq(cat_, tmp[i].cat());
 				tmp[i].xfer(list_[i]);
 				assert_eq(cat_, tmp[i].cat());
@@ -0,0 +1,171 @@
+#!/usr/bin/env python3
+
+#
+# Copyright 2015, Daehwan Kim <infphilo@gmail.com>
+#
+# This file is part of HISAT 2.
+#
+# HISAT 2 is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# HISAT 2 is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with HISAT 2.  If not, see <http://www.gnu.org/licenses/>.
+#
+
+import sys, os, subprocess, random, tempfile, shutil
+from argparse import ArgumentParser
+
+
+"""
+"""
+def generate_random_seq(seq_len):
+    return "".join(random.choice("ACGT") for i in range(seq_len))
+
+
+"""
+Write two chromosomes holding five exact copies of one repeat, plus reads
+drawn from the repeat and from unique sequence.
+"""
+def write_test_data(work_dir, read_len, num_reads):
+    repeat_seq = generate_random_seq(400)
+    chr_seqs = []
+    for num_copies in [3, 2]:
+        seq = ""
+        for c in range(num_copies):
+            seq += generate_random_seq(3000) + repeat_seq
+        seq += generate_random_seq(3000)
+        chr_seqs.append(seq)
+
+    with open(os.path.join(work_dir, "genome.fa"), "w") as f:
+        for i, seq in enumerate(chr_seqs):
+            print(">chr{}".format(i + 1), file=f)
+            for j in range(0, len(seq), 60):
+                print(seq[j:j+60], file=f)
+
+    with open(os.path.join(work_dir, "reads.fa"), "w") as f:
+        for i in range(num_reads):
+            off = random.randint(0, len(repeat_seq) - read_len)
+            print(">repeat_{}\n{}".format(i, repeat_seq[off:off+read_len]), file=f)
+        for i in range(num_reads):
+            # Unique sequence right before the first copy
+            off = random.randint(0, 3000 - read_len)
+            print(">unique_{}_{}\n{}".format(i, off + 1, chr_seqs[0][off:off+read_len]), file=f)
+
+
+"""
+Return {read name: [(reference name, position, AS:i score)]} for the
+aligned records in a SAM file.
+"""
+def read_sam(sam_filename):
+    alns = {}
+    for line in open(sam_filename):
+        if line.startswith("@"):
+            continue
+        fields = line.rstrip("\n").split("\t")
+        if int(fields[1]) & 0x4:
+            continue
+        score = None
+        for field in fields[11:]:
+            if field.startswith("AS:i:"):
+                score = int(field[5:])
+        alns.setdefault(fields[0], []).append((fields[2], int(fields[3]), score))
+    return alns
+
+
+"""
+"""
+def run(cmd, verbose):
+    if verbose:
+        print(" ".join(cmd), file=sys.stderr)
+    subprocess.check_call(cmd, stdout=subprocess.DEVNULL, stderr=None if verbose else subprocess.DEVNULL)
+
+
+"""
+With --repeat-compact, a read whose best genomic alignment is not unique
+must be reported against the repeat sequences only, even though it has no
+more genomic copies than -k, while a read from unique sequence keeps its
+genomic alignment.  Without it, the same repeat reads are reported at their
+genomic copies.
+"""
+def test_repeat_compact(bin_dir, verbose):
+    random.seed(1)
+    read_len, num_reads, khits = 100, 20, 10
+    work_dir = tempfile.mkdtemp(prefix="hisat2_repeat_compact_")
+    try:
+        write_test_data(work_dir, read_len, num_reads)
+        genome = os.path.join(work_dir, "genome.fa")
+        reads = os.path.join(work_dir, "reads.fa")
+        rep = os.path.join(work_dir, "rep")
+        index = os.path.join(work_dir, "genome")
+        run([os.path.join(bin_dir, "hisat2-repeat"), genome, rep,
+             "--min-repeat-length", str(read_len), "--repeat-count", "5"], verbose)
+        run([os.path.join(bin_dir, "hisat2-build-s"),
+             "--repeat-ref", rep + ".rep.fa",
+             "--repeat-info", rep + ".rep.info",
+             "--repeat-snp", rep + ".rep.snp",
+             "--repeat-haplotype", rep + ".rep.haplotype",
+             genome, index], verbose)
+
+        sams = {}
+        for mode in ["--repeat", "--repeat-compact"]:
+            sams[mode] = os.path.join(work_dir, mode[2:] + ".sam")
+            run([os.path.join(bin_dir, "hisat2-align-s"), "-x", index, "-f", "-U", reads,
+                 "-k", str(khits), "--no-spliced-alignment", mode, "-S", sams[mode]], verbose)
+
+        num_bad = 0
+        compact = read_sam(sams["--repeat-compact"])
+        genomic = read_sam(sams["--repeat"])
+        for i in range(num_reads):
+            name = "repeat_{}".format(i)
+            alns, gen_alns = compact.get(name, []), genomic.get(name, [])
+            if len(gen_alns) != 5 or any(a[0].startswith("rep") for a in gen_alns):
+                print("{}: expected 5 genomic records with --repeat, got {}".format(name, gen_alns), file=sys.stderr)
+                num_bad += 1
+            if not alns or any(not a[0].startswith("rep") for a in alns):
+                print("{}: expected only repeat records with --repeat-compact, got {}".format(name, alns), file=sys.stderr)
+                num_bad += 1
+            elif gen_alns and alns[0][2] != gen_alns[0][2]:
+                print("{}: repeat score {} differs from genomic score {}".format(name, alns[0][2], gen_alns[0][2]), file=sys.stderr)
+                num_bad += 1
+        for name, alns in compact.items():
+            if not name.startswith("unique_"):
+                continue
+            pos = int(name.split("_")[2])
+            if alns != [("chr1", pos, 0)]:
+                print("{}: expected chr1:{} with --repeat-compact, got {}".format(name, pos, alns), file=sys.stderr)
+                num_bad += 1
+
+        if num_bad > 0:
+            print("FAILED: {} problem(s)".format(num_bad), file=sys.stderr)
+            return False
+        print("PASSED", file=sys.stderr)
+        return True
+    finally:
+        shutil.rmtree(work_dir)
+
+
+"""
+"""
+if __name__ == "__main__":
+    parser = ArgumentParser(
+        description='Check that --repeat-compact reports multi-mapping reads against the repeat sequences')
+    parser.add_argument('--bin-dir',
+                        dest='bin_dir',
+                        type=str,
+                        default=".",
+                        help='directory holding hisat2-repeat, hisat2-build-s and hisat2-align-s (default: .)')
+    parser.add_argument('-v', '--verbose',
+                        dest='verbose',
+                        action='store_true',
+                        help='also print the commands and their messages to stderr')
+
+    args = parser.parse_args()
+    if not test_repeat_compact(args.bin_dir, args.verbose):
+        sys.exit(1)
@@ -0,0 +1,231 @@
+#!/usr/bin/env python3
+
+#
+# Copyright 2015, Daehwan Kim <infphilo@gmail.com>
+#
+# This file is part of HISAT 2.
+#
+# HISAT 2 is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# HISAT 2 is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with HISAT 2.  If not, see <http://www.gnu.org/licenses/>.
+#
+
+import sys, os, subprocess, random, struct, tempfile, shutil
+from argparse import ArgumentParser
+
+# Layout written by SpliceSiteDB::snapshot (splice_site.cpp)
+HEADER = struct.Struct("=8sIIQ")   # magic, version, endianness, number of references
+DIR_ENTRY = struct.Struct("=5Q")   # nameOff, nameLen, fwOff, bwOff, num
+REC = struct.Struct("=IIB3x")      # left, right, splDir
+
+
+"""
+Split the first sequence of a FASTA file into num_chrs chromosomes so the
+snapshot holds several references.
+"""
+def write_genome(in_fname, out_fname, num_chrs):
+    seq = []
+    for line in open(in_fname):
+        if line.startswith(">"):
+            if seq:
+                break
+            continue
+        seq.append(line.strip().upper())
+    seq = "".join(seq)
+    chr_len = len(seq) // num_chrs
+    chr_seqs = [seq[i*chr_len:(i+1)*chr_len] for i in range(num_chrs)]
+    with open(out_fname, "w") as f:
+        for i, chr_seq in enumerate(chr_seqs):
+            print(">chr{}".format(i + 1), file=f)
+            for j in range(0, len(chr_seq), 60):
+                print(chr_seq[j:j+60], file=f)
+    return chr_seqs
+
+
+"""
+Write reads that span GT-AG introns of every chromosome, so that the
+aligner finds novel splice sites to snapshot.
+"""
+def write_spliced_reads(chr_seqs, reads_filename, num_reads, anchor=50):
+    with open(reads_filename, "w") as f:
+        n = 0
+        while n < num_reads:
+            chr_seq = chr_seqs[n % len(chr_seqs)]
+            left = random.randint(1000, len(chr_seq) - 5000)
+            right = left + anchor + random.randint(200, 3000)
+            if chr_seq[left+anchor:left+anchor+2] != "GT" or chr_seq[right-2:right] != "AG":
+                continue
+            seq = chr_seq[left:left+anchor] + chr_seq[right:right+anchor]
+            if "N" in seq:
+                continue
+            print(">read_{}\n{}".format(n, seq), file=f)
+            n += 1
+
+
+"""
+Return the corrupted copies of a snapshot to try: (description, bytes).
+"""
+def corrupt_snapshots(snap):
+    cases = []
+    magic, version, endian, num_refs = HEADER.unpack_from(snap, 0)
+    # Truncated anywhere: in the header, the directory, the names, the arrays
+    cuts = set([8, 12, 16, HEADER.size - 1, HEADER.size, HEADER.size + 1, len(snap) - 1])
+    for r in range(min(num_refs, 3)):
+        off = HEADER.size + r * DIR_ENTRY.size
+        cuts.update([off + 4, off + DIR_ENTRY.size - 1])
+    for i in range(20):
+        cuts.add(random.randint(HEADER.size, len(snap) - 1))
+    for cut in sorted(cuts):
+        if 0 < cut < len(snap):
+            cases.append(("truncated to {} bytes".format(cut), snap[:cut]))
+
+    cases.append(("other version", HEADER.pack(magic, version + 1, endian, num_refs) + snap[HEADER.size:]))
+    cases.append(("other byte order", HEADER.pack(magic, version, 1 << 24, num_refs) + snap[HEADER.size:]))
+    cases.append(("too many references", HEADER.pack(magic, version, endian, num_refs + 1000) + snap[HEADER.size:]))
+
+    # Bad directory entries, including in the last reference, after which
+    # the good ones must not be left loaded
+    refs_with_sites = []
+    for r in range(num_refs):
+        off = HEADER.size + r * DIR_ENTRY.size
+        name_off, name_len, fw_off, bw_off, num = DIR_ENTRY.unpack_from(snap, off)
+        if num > 1:
+            refs_with_sites.append((r, off, fw_off, bw_off, num))
+        for field, value in [(0, len(snap) + 1), (1, len(snap)), (2, fw_off + 2), (2, len(snap) - 4),
+                             (3, bw_off + 1), (3, len(snap)), (4, num + 1), (4, 1 << 40)]:
+            entry = list(DIR_ENTRY.unpack_from(snap, off))
+            entry[field] = value
+            if entry[field] == DIR_ENTRY.unpack_from(snap, off)[field]:
+                continue
+            data = bytearray(snap)
+            DIR_ENTRY.pack_into(data, off, *entry)
+            cases.append(("reference {} field {} set to {}".format(r, field, value), bytes(data)))
+
+    # Bad arrays: records out of order, an unknown direction, an index out
+    # of range, indexes out of order
+    for r, off, fw_off, bw_off, num in refs_with_sites:
+        data = bytearray(snap)
+        a, b = data[fw_off:fw_off+REC.size], data[fw_off+REC.size:fw_off+2*REC.size]
+        data[fw_off:fw_off+REC.size], data[fw_off+REC.size:fw_off+2*REC.size] = b, a
+        cases.append(("reference {} records swapped".format(r), bytes(data)))
+        data = bytearray(snap)
+        data[fw_off + 8] = 7
+        cases.append(("reference {} direction 7".format(r), bytes(data)))
+        data = bytearray(snap)
+        struct.pack_into("=I", data, bw_off + 4 * (num - 1), num)
+        cases.append(("reference {} index {}".format(r, num), bytes(data)))
+        data = bytearray(snap)
+        a, b = data[bw_off:bw_off+4], data[bw_off+4:bw_off+8]
+        data[bw_off:bw_off+4], data[bw_off+4:bw_off+8] = b, a
+        cases.append(("reference {} indexes swapped".format(r), bytes(data)))
+    return cases
+
+
+"""
+Drop the @PG line, which holds the command line.
+"""
+def sam_body(sam):
+    return b"".join(line for line in sam.splitlines(True) if not line.startswith(b"@PG"))
+
+
+"""
+"""
+def run(cmd, verbose):
+    if verbose:
+        print(" ".join(cmd), file=sys.stderr)
+    return subprocess.run(cmd, stdout=subprocess.PIPE, stderr=subprocess.PIPE)
+
+
+"""
+A snapshot written by --novel-splicesite-snapshot must give the same
+alignments as the equivalent text file, and every truncated or corrupted
+copy of it must be rejected with an error message rather than crash the
+aligner or be partly used.
+"""
+def test_snapshot(bin_dir, genome, verbose):
+    random.seed(1)
+    work_dir = tempfile.mkdtemp(prefix="hisat2_snapshot_")
+    try:
+        genome_fname = os.path.join(work_dir, "genome.fa")
+        index = os.path.join(work_dir, "genome")
+        reads = os.path.join(work_dir, "reads.fa")
+        snap_fname = os.path.join(work_dir, "sites.snap")
+        text_fname = os.path.join(work_dir, "sites.txt")
+        chr_seqs = write_genome(genome, genome_fname, 3)
+        p = run([os.path.join(bin_dir, "hisat2-build-s"), genome_fname, index], verbose)
+        if p.returncode != 0:
+            print(p.stderr.decode(), file=sys.stderr)
+            return False
+        write_spliced_reads(chr_seqs, reads, 600)
+
+        align = [os.path.join(bin_dir, "hisat2-align-s"), "-x", index, "-f", "-U", reads, "--no-temp-splicesite"]
+        p = run(align + ["--novel-splicesite-outfile", text_fname, "--novel-splicesite-snapshot", snap_fname], verbose)
+        if p.returncode != 0:
+            print(p.stderr.decode(), file=sys.stderr)
+            return False
+        num_sites = sum(1 for line in open(text_fname))
+        snap = open(snap_fname, "rb").read()
+        if verbose:
+            print("{} splice sites, snapshot of {} bytes".format(num_sites, len(snap)), file=sys.stderr)
+
+        num_bad = 0
+        from_text = run(align + ["--novel-splicesite-infile", text_fname], verbose)
+        from_snap = run(align + ["--novel-splicesite-infile", snap_fname], verbose)
+        if num_sites == 0 or from_text.returncode != 0 or sam_body(from_text.stdout) != sam_body(from_snap.stdout):
+            print("snapshot and text splice sites give different alignments", file=sys.stderr)
+            num_bad += 1
+
+        bad_fname = os.path.join(work_dir, "bad.snap")
+        for desc, data in corrupt_snapshots(snap):
+            with open(bad_fname, "wb") as f:
+                f.write(data)
+            p = run(align + ["--novel-splicesite-infile", bad_fname], verbose)
+            stderr = p.stderr.decode()
+            if p.returncode < 0 or p.returncode == 0 or "Error: splice site snapshot" not in stderr:
+                print("{}: expected an error, got exit status {}: {}".format(desc, p.returncode, stderr.strip()[-200:]), file=sys.stderr)
+                num_bad += 1
+            elif verbose:
+                print("{}: {}".format(desc, stderr.strip().splitlines()[-2]), file=sys.stderr)
+
+        if num_bad > 0:
+            print("FAILED: {} problem(s)".format(num_bad), file=sys.stderr)
+            return False
+        print("PASSED", file=sys.stderr)
+        return True
+    finally:
+        shutil.rmtree(work_dir)
+
+
+"""
+"""
+if __name__ == "__main__":
+    parser = ArgumentParser(
+        description='Check that truncated and corrupted splice site snapshots are rejected')
+    parser.add_argument('--bin-dir',
+                        dest='bin_dir',
+                        type=str,
+                        default=".",
+                        help='directory holding hisat2-build-s and hisat2-align-s (default: .)')
+    parser.add_argument('--genome',
+                        dest='genome',
+                        type=str,
+                        default=os.path.join(os.path.dirname(os.path.abspath(__file__)),
+                                             "../../../example/reference/22_20-21M.fa"),
+                        help='FASTA whose first sequence the test genome is cut from (default: the example reference)')
+    parser.add_argument('-v', '--verbose',
+                        dest='verbose',
+                        action='store_true',
+                        help='also print the commands and each case to stderr')
+
+    args = parser.parse_args()
+    if not test_snapshot(args.bin_dir, args.genome, args.verbose):
+        sys.exit(1)
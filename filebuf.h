@@ -20,6 +20,7 @@
 #ifndef FILEBUF_H_
 #define FILEBUF_H_
 
+#include <algorithm>
 #include <iostream>
 #include <fstream>
 #include <string>
@@ -27,6 +28,10 @@
 #include <string.h>
 #include <stdint.h>
 #include <stdexcept>
+#include <sys/stat.h>
+#ifdef BOWTIE_MM
+#include <sys/mman.h>
+#endif
 #include "assert_helpers.h"
 
 /**
@@ -89,6 +94,7 @@ public:
 	 * Close the input stream (if that's possible)
 	 */
 	void close() {
+		unmap();
 		if(_in != NULL && _in != stdin) {
 			fclose(_in);
 		} else if(_inf != NULL) {
@@ -106,7 +112,7 @@ public:
 		int c = peek();
 		if(c != -1) {
 			_cur++;
-			if(_lastn_cur < LASTN_BUF_SZ) _lastn_buf[_lastn_cur++] = c;
+			if(_lastn_cur < _lastn_cap) _lastn_buf[_lastn_cur++] = c;
 		}
 		return c;
 	}
@@ -122,36 +128,42 @@ public:
 	 * Initialize the buffer with a new C-style file.
 	 */
 	void newFile(FILE *in) {
+		unmap();
 		_in = in;
 		_inf = NULL;
 		_ins = NULL;
 		_cur = BUF_SZ;
 		_buf_sz = BUF_SZ;
 		_done = false;
+		_nread = 0;
 	}
 
 	/**
 	 * Initialize the buffer with a new ifstream.
 	 */
 	void newFile(std::ifstream *__inf) {
+		unmap();
 		_in = NULL;
 		_inf = __inf;
 		_ins = NULL;
 		_cur = BUF_SZ;
 		_buf_sz = BUF_SZ;
 		_done = false;
+		_nread = 0;
 	}
 
 	/**
 	 * Initialize the buffer with a new istream.
 	 */
 	void newFile(std::istream *__ins) {
+		unmap();
 		_in = NULL;
 		_inf = NULL;
 		_ins = __ins;
 		_cur = BUF_SZ;
 		_buf_sz = BUF_SZ;
 		_done = false;
+		_nread = 0;
 	}
 
 	/**
@@ -159,6 +171,11 @@ public:
 	 * stream.
 	 */
 	void reset() {
+		if(_map != NULL) {
+			_cur = 0;
+			resetLastN();
+			return;
+		}
 		if(_inf != NULL) {
 			_inf->clear();
 			_inf->seekg(0, std::ios::beg);
@@ -171,6 +188,7 @@ public:
 		_cur = BUF_SZ;
 		_buf_sz = BUF_SZ;
 		_done = false;
+		_nread = 0;
 	}
 
 	/**
@@ -199,6 +217,7 @@ public:
 					assert(_in != NULL);
 					_buf_sz = fread(_buf, 1, BUF_SZ, _in);
 				}
+				_nread += _buf_sz;
 				_cur = 0;
 				if(_buf_sz == 0) {
 					// Exhausted, and we have nothing to return to the
@@ -211,7 +230,7 @@ public:
 				}
 			}
 		}
-		return (int)_buf[_cur];
+		return (int)_bufp[_cur];
 	}
 
 	/**
@@ -259,6 +278,140 @@ public:
 		return len;
 	}
 
+	/**
+	 * Read up to 'len' characters into 'buf' in bulk, bypassing the
+	 * internal buffer once it's drained.  Returns the number of
+	 * characters read.  Unlike get(), doesn't record the characters in
+	 * the last-N-chars buffer.
+	 */
+	size_t read(char *buf, size_t len) {
+		assert(_in != NULL || _inf != NULL || _ins != NULL);
+		size_t n = _buf_sz - _cur;
+		if(n > len) n = len;
+		memcpy(buf, _bufp + _cur, n);
+		_cur += n;
+		if(n == len || _done) return n;
+		size_t got = 0;
+		if(_inf != NULL) {
+			_inf->read(buf + n, len - n);
+			got = _inf->gcount();
+		} else if(_ins != NULL) {
+			_ins->read(buf + n, len - n);
+			got = _ins->gcount();
+		} else {
+			got = fread(buf + n, 1, len - n, _in);
+		}
+		_nread += got;
+		if(got < len - n) _done = true;
+		return n + got;
+	}
+
+	/**
+	 * Return the offset in the input of the character the next get()
+	 * will return.
+	 */
+	uint64_t tell() const {
+		return _nread - (_buf_sz - _cur);
+	}
+
+	/**
+	 * Return the size of the input, or -1 if it isn't a regular file
+	 * opened as a C-style file.
+	 */
+	int64_t size() const {
+		struct stat st;
+		if(_in == NULL || _in == stdin || fstat(fileno(_in), &st) != 0 || !S_ISREG(st.st_mode)) {
+			return -1;
+		}
+		return (int64_t)st.st_size;
+	}
+
+	/**
+	 * Move to the given offset of a C-style file, discarding what's
+	 * buffered.  Return false if the input can't seek.
+	 */
+	bool seek(uint64_t off) {
+		if(_map != NULL) {
+			if(off > _map_sz) return false;
+			_cur = off;
+			resetLastN();
+			return true;
+		}
+		if(size() < 0 || fseeko(_in, (off_t)off, SEEK_SET) != 0) {
+			return false;
+		}
+		_cur = _buf_sz = BUF_SZ;
+		_done = false;
+		_nread = off;
+		_lastn_cur = 0;
+		return true;
+	}
+
+	/**
+	 * Map a C-style regular file, just opened with newFile(), into
+	 * memory and serve characters straight from the mapping instead of
+	 * copying them through the buffer.  The last-N-chars buffer then
+	 * points into the mapping too; like the copied one, it stops after
+	 * the first LASTN_BUF_SZ characters since the last reset.
+	 * Returns false, leaving the buffered path in place, if the file
+	 * can't be mapped.
+	 */
+	bool map() {
+#ifdef BOWTIE_MM
+		assert_eq(0, _nread);
+		int64_t sz = size();
+		if(sz <= 0 || _map != NULL) {
+			return false;
+		}
+		void *m = mmap(NULL, (size_t)sz, PROT_READ, MAP_SHARED, fileno(_in), 0);
+		if(m == MAP_FAILED) {
+			return false;
+		}
+#ifdef MADV_SEQUENTIAL
+		madvise(m, (size_t)sz, MADV_SEQUENTIAL);
+#endif
+		_map = (uint8_t*)m;
+		_map_sz = (size_t)sz;
+		_bufp = _map;
+		_cur = 0;
+		_buf_sz = _map_sz;
+		_done = true;
+		_nread = _map_sz;
+		_lastn_cap = 0;
+		resetLastN();
+		return true;
+#else
+		return false;
+#endif
+	}
+
+	/**
+	 * Set p to the next character and return how many characters
+	 * starting there are already in memory, reading in a new buffer's
+	 * worth first if none are.  Returns 0 at the end of the input.
+	 * Lets parsers scan a run of characters in place and then skip it
+	 * with advance().
+	 */
+	size_t inBuf(const char*& p) {
+		peek();
+		p = (const char*)_bufp + _cur;
+		return _buf_sz - _cur;
+	}
+
+	/**
+	 * Skip n characters of those inBuf() reported, as though get() had
+	 * been called n times.
+	 */
+	void advance(size_t n) {
+		assert_leq(_cur + n, _buf_sz);
+		if(_lastn_cur < _lastn_cap) {
+			size_t m = std::min(n, _lastn_cap - _lastn_cur);
+			memcpy(_lastn_buf + _lastn_cur, _bufp + _cur, m);
+			_lastn_cur += m;
+		}
+		_cur += n;
+	}
+
 	static const size_t LASTN_BUF_SZ = 8 * 1024;
 
 	/**
@@ -401,29 +554,33 @@ public:
 	 */
 	void resetLastN() {
 		_lastn_cur = 0;
+		_lastn_off = _cur;
 	}
 
 	/**
 	 * Copy the last several characters in the last-N-chars buffer
-	 * (since the last reset) into the provided buffer.
+	 * (since the last reset) into the provided buffer, which must hold
+	 * at least LASTN_BUF_SZ characters.
 	 */
 	size_t copyLastN(char *buf) {
-		memcpy(buf, _lastn_buf, _lastn_cur);
-		return _lastn_cur;
+		size_t len = lastNLen();
+		assert_leq(len, LASTN_BUF_SZ);
+		memcpy(buf, lastN(), len);
+		return len;
 	}
 
 	/**
 	 * Get const pointer to the last-N-chars buffer.
 	 */
 	const char *lastN() const {
-		return _lastn_buf;
+		return _map != NULL ? (const char*)_map + _lastn_off : _lastn_buf;
 	}
 
 	/**
 	 * Get current size of the last-N-chars buffer.
 	 */
 	size_t lastNLen() const {
-		return _lastn_cur;
+		return _map != NULL ? std::min(_cur - _lastn_off, (size_t)LASTN_BUF_SZ) : _lastn_cur;
 	}
 
 private:
@@ -434,10 +591,32 @@ private:
 		_ins = NULL;
 		_cur = _buf_sz = BUF_SZ;
 		_done = false;
+		_nread = 0;
+		_bufp = _buf;
+		_map = NULL;
+		_map_sz = 0;
 		_lastn_cur = 0;
+		_lastn_cap = LASTN_BUF_SZ;
+		_lastn_off = 0;
 		// no need to clear _buf[]
 	}
 
+	/**
+	 * Drop the mapping made by map(), if any, and go back to reading
+	 * through the buffer.
+	 */
+	void unmap() {
+#ifdef BOWTIE_MM
+		if(_map != NULL) {
+			munmap(_map, _map_sz);
+		}
+#endif
+		_map = NULL;
+		_map_sz = 0;
+		_bufp = _buf;
+		_lastn_cap = LASTN_BUF_SZ;
+	}
+
 	static const size_t BUF_SZ = 256 * 1024;
 	FILE     *_in;
 	std::ifstream *_inf;
@@ -445,8 +624,14 @@ private:
 	size_t    _cur;
 	size_t    _buf_sz;
 	bool      _done;
+	uint64_t  _nread;       // characters read from the input so far
 	uint8_t   _buf[BUF_SZ]; // (large) input buffer
+	uint8_t  *_bufp;        // _buf, or the mapping if the input is mapped
+	uint8_t  *_map;         // mapping of the whole input, or NULL
+	size_t    _map_sz;      // length of the mapping
 	size_t    _lastn_cur;
+	size_t    _lastn_cap;   // 0 when the last N chars are read from the mapping
+	size_t    _lastn_off;   // offset of the last-N-chars in the mapping
 	char      _lastn_buf[LASTN_BUF_SZ]; // buffer of the last N chars dispensed
 };
 
@@ -495,6 +680,30 @@ public:
 		}
 	}
 
+	/**
+	 * Write 'nbp' bitpairs packed four to a byte, lowest bits first (as
+	 * written by write(int)).
+	 */
+	void write(const uint8_t *packed, size_t nbp) {
+		const size_t nbytes = nbp >> 2;
+		for(size_t i = 0; i < nbytes; i++) {
+			buf_[cur_] |= (char)(packed[i] << bpPtr_);
+			cur_++;
+			if(cur_ == BUF_SZ) {
+				// Flush the buffer
+				if(!fwrite((const void *)buf_, BUF_SZ, 1, out_)) {
+					std::cerr << "Error writing to the reference index file (.4.ebwt)" << std::endl;
+					throw 1;
+				}
+				cur_ = 0;
+			}
+			buf_[cur_] = (bpPtr_ == 0 ? 0 : (char)(packed[i] >> (8 - bpPtr_)));
+		}
+		for(size_t i = nbytes << 2; i < nbp; i++) {
+			write((packed[i >> 2] >> ((i & 3) << 1)) & 3);
+		}
+	}
+
 	/**
 	 * Write any remaining bitpairs and then close the input
 	 */
@@ -118,6 +118,10 @@ public:
         }
     };
 
+    static index_t EdgeFrom (Edge& a) {
+        return a.from;
+    }
+
     static index_t EdgeTo (Edge& a) {
         return a.to;
     }
@@ -187,14 +191,30 @@ public:
     }
 
 private:
-    static bool isReverseDeterministic(EList<Node>& nodes, EList<Edge>& edges);
-    static void reverseDeterminize(EList<Node>& nodes, EList<Edge>& edges, index_t& lastNode, index_t lastNode_add = 0);
+    static bool isReverseDeterministic(EList<Node>& nodes, EList<Edge>& edges, int nthreads = 1);
+    static void reverseDeterminize(EList<Node>& nodes, EList<Edge>& edges, index_t& lastNode, index_t lastNode_add = 0, int nthreads = 1);
 
-    static void sortEdgesFrom(EList<Edge>& edges) {
-        std::sort(edges.begin(), edges.end(), EdgeFromCmp());
+    // Sorts of edges between num_nodes nodes
+    static void sortEdgesFrom(EList<Edge>& edges, index_t num_nodes, int nthreads = 1) {
+        sortByKey<Edge, EdgeFromCmp>(edges, &EdgeFrom, num_nodes > 0 ? num_nodes - 1 : 0, nthreads);
     }
-    static void sortEdgesTo(EList<Edge>& edges) {
-        std::sort(edges.begin(), edges.end(), EdgeToCmp());
+    static void sortEdgesTo(EList<Edge>& edges, index_t num_nodes, int nthreads = 1) {
+        sortByKey<Edge, EdgeToCmp>(edges, &EdgeTo, num_nodes > 0 ? num_nodes - 1 : 0, nthreads);
+    }
+
+    // Sort v by the key hash() returns, which must not exceed maxv.  With one
+    // thread, or for short lists, this is an in-place std::sort.  Otherwise
+    // it is a parallel stable radix sort, which needs a scratch copy of v and
+    // may leave elements with equal keys in a different order.
+    template <typename T, typename CMP>
+    static void sortByKey(EList<T>& v, index_t (*hash)(T&), index_t maxv, int nthreads) {
+        if(v.size() <= 1) return;
+        if(nthreads <= 1 || v.size() < RADIX_SORT_MIN_PARALLEL) {
+            std::sort(v.begin(), v.end(), CMP());
+            return;
+        }
+        EList<T> scratch; scratch.resizeNoCopyExact(v.size());
+        radix_sort_stable<T, index_t>(v.ptr(), v.size(), v.ptr(), scratch.ptr(), hash, maxv, nthreads);
     }
 
     // Return edge ranges [begin, end)
@@ -343,6 +363,10 @@ private:
         }
     };
 
+    static index_t CompositeEdgeFrom (CompositeEdge& a) {
+        return a.from;
+    }
+
     struct TempNodeLabelCmp {
         TempNodeLabelCmp(const EList<Node>& nodes_) : nodes(nodes_) {}
         bool operator() (index_t a, index_t b) const {
@@ -593,12 +617,12 @@ RefGraph<index_t>::RefGraph(const SString<char>& s,
         }
 
         if(multipleHeadNodes) {
-            if(!isReverseDeterministic(nodes, edges)) {
+            if(!isReverseDeterministic(nodes, edges, nthreads)) {
                 if(verbose) cerr << "\tis not reverse-deterministic, so reverse-determinize..." << endl;
-                reverseDeterminize(nodes, edges, lastNode);
+                reverseDeterminize(nodes, edges, lastNode, 0, nthreads);
             }
         }
-        assert(isReverseDeterministic(nodes, edges));
+        assert(isReverseDeterministic(nodes, edges, nthreads));
     } else { // this is memory-consuming, but simple to implement
         index_t num_predicted_nodes = (index_t)(jlen * 1.2);
         nodes.reserveExact(num_predicted_nodes);
@@ -786,10 +810,10 @@ RefGraph<index_t>::RefGraph(const SString<char>& s,
             throw NongraphException();
         }
 
-        if(!isReverseDeterministic(nodes, edges)) {
+        if(!isReverseDeterministic(nodes, edges, nthreads)) {
             if(verbose) cerr << "\tis not reverse-deterministic, so reverse-determinize..." << endl;
-            reverseDeterminize(nodes, edges, lastNode);
-            assert(isReverseDeterministic(nodes, edges));
+            reverseDeterminize(nodes, edges, lastNode, 0, nthreads);
+            assert(isReverseDeterministic(nodes, edges, nthreads));
         }
     }
     
@@ -1268,12 +1292,12 @@ void RefGraph<index_t>::buildGraph_worker(void* vp) {
 }
 
 template <typename index_t>
-bool RefGraph<index_t>::isReverseDeterministic(EList<Node>& nodes, EList<Edge>& edges)
+bool RefGraph<index_t>::isReverseDeterministic(EList<Node>& nodes, EList<Edge>& edges, int nthreads)
 {
     if(edges.size() <= 0) return true;
 
     // Sort edges by "to" nodes
-    sortEdgesTo(edges);
+    sortEdgesTo(edges, (index_t)nodes.size(), nthreads);
 
     index_t curr_to = (index_t)INDEX_MAX;
     EList<bool> seen; seen.resize(5); seen.fillZero();
@@ -1302,7 +1326,7 @@ bool RefGraph<index_t>::isReverseDeterministic(EList<Node>& nodes, EList<Edge>&
 
 
 template <typename index_t>
-void RefGraph<index_t>::reverseDeterminize(EList<Node>& nodes, EList<Edge>& edges, index_t& lastNode, index_t lastNode_add)
+void RefGraph<index_t>::reverseDeterminize(EList<Node>& nodes, EList<Edge>& edges, index_t& lastNode, index_t lastNode_add, int nthreads)
 {
     EList<CompositeNode> cnodes; cnodes.ensure(nodes.size());
     map<CompositeNodeIDs, index_t> cnode_map;
@@ -1319,7 +1343,7 @@ void RefGraph<index_t>::reverseDeterminize(EList<Node>& nodes, EList<Edge>& edge
     cnodes.back().nodes.push_back(lastNode);
     active_cnodes.push_back(0);
     cnode_map[cnodes.back().nodes] = 0;
-    sortEdgesTo(edges);
+    sortEdgesTo(edges, (index_t)nodes.size(), nthreads);
 
     index_t firstNode = 0; // Y -> ... -> Z
     EList<index_t> predecessors;
@@ -1403,7 +1427,7 @@ void RefGraph<index_t>::reverseDeterminize(EList<Node>& nodes, EList<Edge>& edge
         cedges[i].from = cedges[i].to;
         cedges[i].to = tmp;
     }
-    sort(cedges.begin(), cedges.end());
+    sortByKey<CompositeEdge, less<CompositeEdge> >(cedges, &CompositeEdgeFrom, (index_t)cnodes.size() - 1, nthreads);
     active_cnodes.push_back(0);
     while(!active_cnodes.empty()) {
         index_t cnode_id = active_cnodes.front(); active_cnodes.pop_front();
@@ -1440,7 +1464,7 @@ void RefGraph<index_t>::reverseDeterminize(EList<Node>& nodes, EList<Edge>& edge
     nodes.expand();
     nodes.back() = first_node.getNode();
     active_cnodes.push_back(firstNode);
-    sort(cedges.begin(), cedges.end());
+    sortByKey<CompositeEdge, less<CompositeEdge> >(cedges, &CompositeEdgeFrom, (index_t)cnodes.size() - 1, nthreads);
     while(!active_cnodes.empty()) {
         index_t cnode_id = active_cnodes.front(); active_cnodes.pop_front();
         assert_lt(cnode_id, cnodes.size());
@@ -1475,7 +1499,7 @@ void RefGraph<index_t>::reverseDeterminize(EList<Node>& nodes, EList<Edge>& edge
         edges.expand();
         edges.back() = edge.getEdge(cnodes);
     }
-    sortEdgesFrom(edges);
+    sortEdgesFrom(edges, (index_t)nodes.size(), nthreads);
 
 #if 0
 #ifndef NDEBUG
@@ -1802,7 +1826,7 @@ max_num_nodes(max_num_nodes_)
     // We perform this action here, while we still have past_nodes allocated to avoid
     //   an in-place sort.
     nodes.resizeNoCopyExact(past_nodes.size());
-    radix_sort_copy<PathNode, PathNodeFromCmp, index_t>(past_nodes.begin(), past_nodes.end(), nodes.ptr(),
+    radix_sort_copy<PathNode, PathNodeFromCmp, index_t>(past_nodes.begin(), past_nodes.end(), nodes.ptr(), past_nodes.ptr(),
             &PathNodeFrom, max_from, nthreads);
     past_nodes.nullify();
     from_table.nullify();
@@ -1932,7 +1956,7 @@ void PathGraph<index_t>::firstPruneGeneration() {
     // Z is mapped to 0x101
     // therefore max rank = 101101101101101101101101 = (101) 8 times
     index_t max_rank = 11983725;
-    radix_sort_copy<PathNode, less<PathNode>, index_t>(nodes.begin(), nodes.end(), past_nodes.ptr(),
+    radix_sort_copy<PathNode, less<PathNode>, index_t>(nodes.begin(), nodes.end(), past_nodes.ptr(), nodes.ptr(),
             &PathNodeKey, max_rank, nthreads);
 
     if(verbose) cerr << "SORT NODES: " << time(0) - start << endl;
@@ -1966,7 +1990,9 @@ void PathGraph<index_t>::lateGeneration() {
     if(verbose) cerr << "ALLOCATE FROM_TABLE: " << time(0) - indiv << endl;
     indiv = time(0);
 
-    radix_sort_copy<PathNode, PathNodeFromCmp, index_t>(past_nodes.begin(), past_nodes.end(), from_table.ptr(),
+    // past_nodes is still needed, but nodes is rebuilt by createNewNodes
+    nodes.resizeNoCopyExact(past_nodes.size());
+    radix_sort_copy<PathNode, PathNodeFromCmp, index_t>(past_nodes.begin(), past_nodes.end(), from_table.ptr(), nodes.ptr(),
             &PathNodeFrom, max_from, nthreads);
 
     if(verbose) cerr << "BUILD TABLE: " << time(0) - indiv << endl;
@@ -2485,13 +2511,13 @@ bool PathGraph<index_t>::generateEdges(RefGraph<index_t>& base)
 
     EList<PathEdge> temp_edges; temp_edges.resizeExact(edges.size());
 
-    radix_sort_copy<PathEdge, less<PathEdge>, index_t>(edges.begin()           , edges.begin() + index[0], temp_edges.ptr(),
+    radix_sort_copy<PathEdge, less<PathEdge>, index_t>(edges.begin()           , edges.begin() + index[0], temp_edges.ptr(), edges.begin(),
             &PathEdgeTo, (index_t)nodes.size(), nthreads);
-    radix_sort_copy<PathEdge, less<PathEdge>, index_t>(edges.begin() + index[0], edges.begin() + index[1], temp_edges.ptr() + index[0],
+    radix_sort_copy<PathEdge, less<PathEdge>, index_t>(edges.begin() + index[0], edges.begin() + index[1], temp_edges.ptr() + index[0], edges.begin() + index[0],
             &PathEdgeTo, (index_t)nodes.size(), nthreads);
-    radix_sort_copy<PathEdge, less<PathEdge>, index_t>(edges.begin() + index[1], edges.begin() + index[2], temp_edges.ptr() + index[1],
+    radix_sort_copy<PathEdge, less<PathEdge>, index_t>(edges.begin() + index[1], edges.begin() + index[2], temp_edges.ptr() + index[1], edges.begin() + index[1],
             &PathEdgeTo, (index_t)nodes.size(), nthreads);
-    radix_sort_copy<PathEdge, less<PathEdge>, index_t>(edges.begin() + index[2], edges.begin() + index[3], temp_edges.ptr() + index[2],
+    radix_sort_copy<PathEdge, less<PathEdge>, index_t>(edges.begin() + index[2], edges.begin() + index[3], temp_edges.ptr() + index[2], edges.begin() + index[2],
             &PathEdgeTo, (index_t)nodes.size(), nthreads);
     for(index_t i = index[3]; i < edges.size(); i++) {
         temp_edges[i] = edges[i];
@@ -2504,7 +2530,7 @@ bool PathGraph<index_t>::generateEdges(RefGraph<index_t>& base)
     indiv = time(0);
 
     EList<PathNode> past_nodes; past_nodes.resizeExact(nodes.size());
-    radix_sort_copy<PathNode, less<PathNode>, index_t>(nodes.begin(), nodes.end(), past_nodes.ptr(),  &PathNodeKey, ranks, nthreads);
+    radix_sort_copy<PathNode, less<PathNode>, index_t>(nodes.begin(), nodes.end(), past_nodes.ptr(), nodes.ptr(), &PathNodeKey, ranks, nthreads);
     nodes.xfer(past_nodes);
 
     if(verbose) cerr << "RE-SORTED NODES: " << time(0) - indiv << endl;
@@ -2607,7 +2633,7 @@ bool PathGraph<index_t>::generateEdges(RefGraph<index_t>& base)
     }
 #endif
     temp_edges.resizeExact(edges.size());
-    radix_sort_copy<PathEdge, PathEdgeToCmp, index_t>(edges.begin(), edges.end(), temp_edges.ptr(), &PathEdgeTo, (index_t)nodes.size(), nthreads);
+    radix_sort_copy<PathEdge, PathEdgeToCmp, index_t>(edges.begin(), edges.end(), temp_edges.ptr(), edges.begin(), &PathEdgeTo, (index_t)nodes.size(), nthreads);
     edges.xfer(temp_edges);
     for(index_t i = 0; i < edges.size(); i++) {
         nodes[edges[i].ranking].key.second = i + 1;
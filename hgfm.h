@@ -20,9 +20,102 @@
 #ifndef HGFM_H_
 #define HGFM_H_
 
+#include <atomic>
+#ifdef BOWTIE_MM
+#include <unistd.h>
+#endif
 #include "hier_idx_common.h"
 #include "gfm.h"
 
+/**
+ * Alignment of the arrays carved out of a local index arena.
+ */
+static const size_t LOCAL_ARENA_ALIGN = 64;
+
+/**
+ * Pointer to a local index.  With --lazy-local a slot is filled in by
+ * the first thread to use it while others may be reading it, so it is
+ * read with acquire and written with release ordering.  Copyable so
+ * that slots can live in an EList.
+ */
+template <typename T>
+class LocalGFMSlot {
+public:
+	LocalGFMSlot(T* p = NULL) : p_(p) { }
+	LocalGFMSlot(const LocalGFMSlot& o) : p_(o.load()) { }
+	LocalGFMSlot& operator=(const LocalGFMSlot& o) { store(o.load()); return *this; }
+	LocalGFMSlot& operator=(T* p) { store(p); return *this; }
+	operator T*() const { return load(); }
+	
+	T* load() const { return p_.load(std::memory_order_acquire); }
+	
+	// Const so that a lazily loaded slot can be filled from a const getter
+	void store(T* p) const { p_.store(p, std::memory_order_release); }
+	
+private:
+	mutable std::atomic<T*> p_;
+};
+
+/**
+ * Clock state of a local index under --local-lru: not resident,
+ * resident, or resident and used since the clock hand last passed it.
+ * A hit only sets the used state, with relaxed atomics, so it doesn't
+ * need a lock.  Copyable so that states can live in an EList.
+ */
+class LocalGFMUse {
+public:
+	enum { NOT_RESIDENT = 0, RESIDENT, USED };
+	
+	LocalGFMUse(uint8_t s = NOT_RESIDENT) : s_(s) { }
+	LocalGFMUse(const LocalGFMUse& o) : s_(o.load()) { }
+	LocalGFMUse& operator=(const LocalGFMUse& o) { store(o.load()); return *this; }
+	
+	uint8_t load() const { return s_.load(std::memory_order_relaxed); }
+	void store(uint8_t s) const { s_.store(s, std::memory_order_relaxed); }
+	
+	/**
+	 * Move from state 'from' to state 'to'; return false if it wasn't
+	 * in state 'from'.
+	 */
+	bool change(uint8_t from, uint8_t to) const {
+		return s_.compare_exchange_strong(from, to, std::memory_order_relaxed);
+	}
+	
+private:
+	mutable std::atomic<uint8_t> s_;
+};
+
+/**
+ * Allocate an array of n elements for a local index.  If 'arena' is
+ * non-NULL, the array is carved out of it (cache-line aligned) and
+ * 'arena' is advanced past it; otherwise the array comes from new[].
+ */
+template <typename T>
+static inline T* localAlloc(char*& arena, size_t n) {
+	if(arena == NULL) {
+		return new T[n];
+	}
+	size_t p = ((size_t)arena + LOCAL_ARENA_ALIGN - 1) & ~(LOCAL_ARENA_ALIGN - 1);
+	arena = (char*)(p + n * sizeof(T));
+	return (T*)p;
+}
+
+/**
+ * Where a local index starts in the .5 and .6 files and where its
+ * arrays go in the local index arena.  The table of contents is
+ * reconstructed from the local index headers, so the on-disk format
+ * is unchanged.
+ */
+struct LocalGFMTocEntry {
+	size_t tidx;     // reference sequence the local index belongs to
+	size_t off5;     // offset of the local index in the .5 file
+	size_t sz5;      // its size in the .5 file
+	size_t off6;     // offset of its SA sample in the .6 file
+	size_t sz6;      // size of the SA sample in the .6 file
+	size_t arenaOff; // offset of its arrays in the arena
+	size_t arenaSz;  // arena bytes needed, including alignment slack
+};
+
 /**
  * Extended Burrows-Wheeler transform data.
  * LocalEbwt is a specialized Ebwt index that represents ~64K bps
@@ -66,7 +159,8 @@ public:
              bool startVerbose, // = false,
              bool passMemExc, // = false,
              bool sanityCheck, // = false)
-             bool useHaplotype) : // = false
+             bool useHaplotype, // = false
+             char *arena = NULL) :
 	GFM<index_t>(in,
                  altdb,
                  NULL,
@@ -113,7 +207,8 @@ public:
 					   ftabChars,
 					   mmSweep,
 					   loadNames,
-					   startVerbose);
+					   startVerbose,
+					   arena);
 		
 		_tidx = tidx;
 		_localOffset = localOffset;
@@ -304,7 +399,8 @@ public:
 						int32_t ftabChars,
 						bool mmSweep, 
 						bool loadNames, 
-						bool startVerbose);
+						bool startVerbose,
+						char *arena = NULL);
 	
 	/**
 	 * Sanity-check various pieces of the Ebwt
@@ -1124,7 +1220,8 @@ void LocalGFM<index_t, full_index_t>::readIntoMemory(
                                                      int32_t ftabChars,
                                                      bool mmSweep,
                                                      bool loadNames,
-                                                     bool startVerbose)
+                                                     bool startVerbose,
+                                                     char *arena)
     {
 #ifdef BOWTIE_MM
 	char *mmFile[] = { mmFile5, mmFile6 };
@@ -1187,7 +1284,7 @@ void LocalGFM<index_t, full_index_t>::readIntoMemory(
 				cerr << "Reading plen (" << this->_nPat << "): ";
 				logTime(cerr);
 			}
-			this->_plen.init(new index_t[this->_nPat], this->_nPat, true);
+			this->_plen.init(localAlloc<index_t>(arena, this->_nPat), this->_nPat, arena == NULL);
 			if(switchEndian) {
 				for(index_t i = 0; i < this->_nPat; i++) {
 					this->plen()[i] = readIndex<index_t>(in5, switchEndian);
@@ -1230,7 +1327,7 @@ void LocalGFM<index_t, full_index_t>::readIntoMemory(
 			fseek(in5, this->_nFrag*sizeof(index_t)*3, SEEK_CUR);
 #endif
 		} else {
-			this->_rstarts.init(new index_t[this->_nFrag*3], this->_nFrag*3, true);
+			this->_rstarts.init(localAlloc<index_t>(arena, this->_nFrag*3), this->_nFrag*3, arena == NULL);
 			if(switchEndian) {
 				for(index_t i = 0; i < this->_nFrag*3; i += 3) {
 					// fragment starting position in joined reference
@@ -1280,7 +1377,7 @@ void LocalGFM<index_t, full_index_t>::readIntoMemory(
 			}
 		} else {
 			try {
-				this->_gfm.init(new uint8_t[this->_gh._gbwtTotLen], this->_gh._gbwtTotLen, true);
+				this->_gfm.init(localAlloc<uint8_t>(arena, this->_gh._gbwtTotLen), this->_gh._gbwtTotLen, arena == NULL);
 			} catch(bad_alloc& e) {
 				cerr << "Out of memory allocating the ebwt[] array for the Bowtie index.  Please try" << endl
 				<< "again on a computer with more memory." << endl;
@@ -1345,7 +1442,7 @@ void LocalGFM<index_t, full_index_t>::readIntoMemory(
 			fseek(in5, 5*sizeof(index_t), SEEK_CUR);
 #endif
 		} else {
-			this->_fchr.init(new index_t[5], 5, true);
+			this->_fchr.init(localAlloc<index_t>(arena, 5), 5, arena == NULL);
 			for(index_t i = 0; i < 5; i++) {
 				this->fchr()[i] = readIndex<index_t>(in5, switchEndian);
 				assert_leq(this->fchr()[i], gbwtLen);
@@ -1371,7 +1468,7 @@ void LocalGFM<index_t, full_index_t>::readIntoMemory(
 				fseek(in5, this->_gh._ftabLen*sizeof(index_t), SEEK_CUR);
 #endif
 			} else {
-				this->_ftab.init(new index_t[this->_gh._ftabLen], this->_gh._ftabLen, true);
+				this->_ftab.init(localAlloc<index_t>(arena, this->_gh._ftabLen), this->_gh._ftabLen, arena == NULL);
 				if(switchEndian) {
 					for(uint32_t i = 0; i < this->_gh._ftabLen; i++)
 						this->ftab()[i] = readIndex<index_t>(in5, switchEndian);
@@ -1401,7 +1498,7 @@ void LocalGFM<index_t, full_index_t>::readIntoMemory(
 				fseek(in5, this->_gh._eftabLen*sizeof(index_t), SEEK_CUR);
 #endif
 			} else {
-				this->_eftab.init(new index_t[this->_gh._eftabLen], this->_gh._eftabLen, true);
+				this->_eftab.init(localAlloc<index_t>(arena, this->_gh._eftabLen), this->_gh._eftabLen, arena == NULL);
 				if(switchEndian) {
 					for(uint32_t i = 0; i < this->_gh._eftabLen; i++)
 						this->eftab()[i] = readIndex<index_t>(in5, switchEndian);
@@ -1448,7 +1545,7 @@ void LocalGFM<index_t, full_index_t>::readIntoMemory(
 			if(!this->useShmem_) {
 				// Allocate offs_
 				try {
-					this->_offs.init(new index_t[offsLenSampled], offsLenSampled, true);
+					this->_offs.init(localAlloc<index_t>(arena, offsLenSampled), offsLenSampled, arena == NULL);
 				} catch(bad_alloc& e) {
 					cerr << "Out of memory allocating the offs[] array  for the Bowtie index." << endl
 					<< "Please try again on a computer with more memory." << endl;
@@ -1601,7 +1698,12 @@ public:
                  useHaplotype,
                  skipLoading),
     _in5(NULL),
-    _in6(NULL)
+    _in6(NULL),
+    _localArena(NULL),
+    _lazyLocal(false),
+    _maxResidentLocal(0),
+    _localClockHand(0),
+    _nResidentLocal(0)
     {
         _in5Str = in + ".5." + gfm_ext;
         _in6Str = in + ".6." + gfm_ext;
@@ -1704,18 +1806,21 @@ public:
 		PARENT_CLASS::sanityCheckAll(reverse);
 		for(size_t tidx = 0; tidx < _localGFMs.size(); tidx++) {
 			for(size_t local_idx = 0; local_idx < _localGFMs[tidx].size(); local_idx++) {
-				assert(_localGFMs[tidx][local_idx] != NULL);
-				_localGFMs[tidx][local_idx]->sanityCheckAll(reverse);
+				assert(_lazyLocal || _localGFMs[tidx][local_idx] != NULL);
+				if(_localGFMs[tidx][local_idx] == NULL) continue;
+				_localGFMs[tidx][local_idx].load()->sanityCheckAll(reverse);
 			}
 		}
 	}
     
     const LocalGFM<local_index_t, index_t>* getLocalGFM(index_t tidx, index_t offset) const {
         assert_lt(tidx, _localGFMs.size());
-        const EList<LocalGFM<local_index_t, index_t>*>& localGFMs = _localGFMs[tidx];
+        const EList<LocalGFMSlot<LocalGFM<local_index_t, index_t> > >& localGFMs = _localGFMs[tidx];
         index_t offsetidx = offset / local_index_interval;
         if(offsetidx >= localGFMs.size()) {
             return NULL;
+        } else if(_lazyLocal) {
+            return touchLocalGFM(tidx, offsetidx);
         } else {
             return localGFMs[offsetidx];
         }
@@ -1742,7 +1847,7 @@ public:
 	void clearLocalGFMs() {
 		for(size_t tidx = 0; tidx < _localGFMs.size(); tidx++) {
 			for(size_t local_idx = 0; local_idx < _localGFMs[tidx].size(); local_idx++) {
-				assert(_localGFMs[tidx][local_idx] != NULL);
+				assert(_lazyLocal || _localGFMs[tidx][local_idx] != NULL);
 				delete _localGFMs[tidx][local_idx];
 			}
 			
@@ -1750,6 +1855,35 @@ public:
 		}
 		
 		_localGFMs.clear();
+		_localGFMToc.clear();
+		_localFirst.clear();
+		_localUse.clear();
+		_localClockHand = 0;
+		_nResidentLocal = 0;
+		if(_localArena != NULL) {
+			delete[] _localArena;
+			_localArena = NULL;
+		}
+	}
+	
+	/**
+	 * Load local indexes on first use instead of all up front.  If
+	 * 'maxResident' is non-zero and the index is memory-mapped, at most
+	 * that many local indexes are kept resident; the pages of ones not
+	 * used recently are handed back to the OS.  Must be called before
+	 * the index is loaded.
+	 */
+	void setLazyLocal(bool lazy, size_t maxResident) {
+		_lazyLocal = lazy;
+		_maxResidentLocal = maxResident;
+	}
+	
+	/**
+	 * Set the number of threads used to load the local indexes.
+	 */
+	void setNThreads(int nthreads) {
+		assert_gt(nthreads, 0);
+		this->_nthreads = nthreads;
 	}
 	
 
@@ -1757,7 +1891,7 @@ public:
 	index_t                                  _nrefs;      /// the number of reference sequences
 	EList<index_t>                           _refLens;    /// approx lens of ref seqs (excludes trailing ambig chars)
 	
-	EList<EList<LocalGFM<local_index_t, index_t>*> > _localGFMs;
+	EList<EList<LocalGFMSlot<LocalGFM<local_index_t, index_t> > > > _localGFMs;
 	index_t                                  _nlocalGFMs;
     //index_t                                  _local_index_interval;
 	
@@ -1768,8 +1902,75 @@ public:
 	
 	char                                     *mmFile5_;
 	char                                     *mmFile6_;
+	
+	EList<LocalGFMTocEntry>                  _localGFMToc; // where each local index lives
+	char                                     *_localArena; // backing store for local index arrays
+	
+	// Lazy loading of local indexes
+	bool                                     _lazyLocal;        // load local indexes on first use?
+	size_t                                   _maxResidentLocal; // LRU cap on resident local indexes (0 = none)
+	EList<size_t>                            _localFirst;       // TOC index of each ref's first local index
+	mutable MUTEX_T                          _localMutex;       // guards loading and paging out
+	EList<LocalGFMUse>                       _localUse;         // clock state of each local index
+	mutable size_t                           _localClockHand;   // next local index the clock looks at
+	mutable size_t                           _nResidentLocal;
     
 private:
+    /**
+     * Parameters for loading a contiguous range of local indexes.
+     */
+    struct LocalLoadParam {
+        HGFM<index_t, local_index_t>*            gfm;
+        EList<LocalGFM<local_index_t, index_t>*>* localGFMs;
+        FILE*                                    in5;
+        FILE*                                    in6;
+        size_t                                   begin;
+        size_t                                   end;
+        bool                                     switchEndian;
+        int                                      needEntireRev;
+        int32_t                                  lineRate;
+        int32_t                                  offRate;
+        int32_t                                  ftabChars;
+        bool                                     mmSweep;
+        bool                                     loadNames;
+        bool                                     loadSASamp;
+        bool                                     loadFtab;
+        bool                                     loadRstarts;
+        bool                                     failed;
+    };
+    
+    static void local_load_worker(void* vp) {
+        LocalLoadParam& p = *(LocalLoadParam*)vp;
+        try {
+            p.gfm->loadLocalGFMs(p);
+        } catch(...) {
+            p.failed = true;
+        }
+    }
+    
+    void buildLocalGFMToc(
+                          size_t bytesRead,
+                          bool switchEndian,
+                          int needEntireRev,
+                          int32_t lineRate,
+                          int32_t offRate,
+                          int32_t ftabChars,
+                          bool loadSASamp,
+                          bool loadFtab,
+                          bool loadRstarts);
+    
+    void loadLocalGFMs(LocalLoadParam& p);
+    
+    LocalGFM<local_index_t, index_t>* newLocalGFM(
+                                                  const LocalLoadParam& p,
+                                                  size_t i,
+                                                  size_t& bytesRead,
+                                                  size_t& bytesRead2) const;
+    
+    const LocalGFM<local_index_t, index_t>* touchLocalGFM(index_t tidx, index_t offsetidx) const;
+    
+    LocalLoadParam                           _localLoadParam; // how the local indexes are loaded
+    
     struct ThreadParam {
         // input
         SString<char>                s;
@@ -1986,7 +2187,12 @@ HGFM<index_t, local_index_t>::HGFM(
                  passMemExc,
                  sanityCheck),
     _in5(NULL),
-    _in6(NULL)
+    _in6(NULL),
+    _localArena(NULL),
+    _lazyLocal(false),
+    _maxResidentLocal(0),
+    _localClockHand(0),
+    _nResidentLocal(0)
 {
     _in5Str = outfile + ".5." + gfm_ext;
     _in6Str = outfile + ".6." + gfm_ext;
@@ -2474,7 +2680,12 @@ void HGFM<index_t, local_index_t>::readIntoMemory(
     bool switchEndian; // dummy; caller doesn't care
 #ifdef BOWTIE_MM
 	char *mmFile[] = { NULL, NULL };
+#else
+	_lazyLocal = false;
 #endif
+	if(this->useShmem_) _lazyLocal = false;
+	// Lazily loaded local indexes are paged in from the mapped files
+	const bool mapLocal = this->_useMm || _lazyLocal;
 	if(_in5Str.length() > 0) {
 		if(this->_verbose || startVerbose) {
 			cerr << "  About to open input files: ";
@@ -2499,7 +2710,7 @@ void HGFM<index_t, local_index_t>::readIntoMemory(
 		}
 		
 #ifdef BOWTIE_MM
-		if(this->_useMm /*&& !justHeader*/) {
+		if(mapLocal /*&& !justHeader*/) {
 			const char *names[] = {_in5Str.c_str(), _in6Str.c_str()};
             int fds[] = { fileno(_in5), fileno(_in6) };
 			for(int i = 0; i < (loadSASamp ? 2 : 1); i++) {
@@ -2537,11 +2748,11 @@ void HGFM<index_t, local_index_t>::readIntoMemory(
 #endif
 	}
 #ifdef BOWTIE_MM
-	else if(this->_useMm && !justHeader) {
+	else if(mapLocal && !justHeader) {
 		mmFile[0] = mmFile5_;
 		mmFile[1] = mmFile6_;
 	}
-	if(this->_useMm && !justHeader) {
+	if(mapLocal && !justHeader) {
 		assert(mmFile[0] == mmFile5_);
 		assert(mmFile[1] == mmFile6_);
 	}
@@ -2553,7 +2764,7 @@ void HGFM<index_t, local_index_t>::readIntoMemory(
 	}
 	
 	// Read endianness hints from both streams
-    size_t bytesRead = 0, bytesRead2 = 4;
+    size_t bytesRead = 0;
 	switchEndian = false;
 	uint32_t one = readU32(_in5, switchEndian); // 1st word of primary stream
 	bytesRead += 4;
@@ -2574,7 +2785,7 @@ void HGFM<index_t, local_index_t>::readIntoMemory(
 	// support this, someone has to modify the file to switch
 	// endiannesses appropriately, and we can't do this inside Bowtie
 	// or we might be setting up a race condition with other processes.
-	if(switchEndian && this->_useMm) {
+	if(switchEndian && mapLocal) {
 		cerr << "Error: Can't use memory-mapped files when the index is the opposite endianness" << endl;
 		throw 1;
 	}	
@@ -2599,48 +2810,141 @@ void HGFM<index_t, local_index_t>::readIntoMemory(
 	
 	clearLocalGFMs();
 	
-    index_t tidx = 0, localOffset = 0, joinedOffset = 0;
-    string base = "";
-	for(size_t i = 0; i < _nlocalGFMs; i++) {
-		LocalGFM<local_index_t, index_t> *localGFM = new LocalGFM<local_index_t, index_t>(base,
-                                                                                          NULL,
-                                                                                          _in5,
-                                                                                          _in6,
-                                                                                          mmFile5_,
-                                                                                          mmFile6_,
-                                                                                          tidx,
-                                                                                          localOffset,
-                                                                                          joinedOffset,
-                                                                                          switchEndian,
-                                                                                          bytesRead,
-                                                                                          bytesRead2,
-                                                                                          needEntireRev,
-                                                                                          this->fw_,
-                                                                                          -1, // overrideOffRate
-                                                                                          -1, // offRatePlus
-                                                                                          (uint32_t)lineRate,
-                                                                                          (uint32_t)offRate,
-                                                                                          (uint32_t)ftabChars,
-                                                                                          this->_useMm,
-                                                                                          this->useShmem_,
-                                                                                          mmSweep,
-                                                                                          loadNames,
-                                                                                          loadSASamp,
-                                                                                          loadFtab,
-                                                                                          loadRstarts,
-                                                                                          false,  // _verbose
-                                                                                          false,
-                                                                                          this->_passMemExc,
-                                                                                          this->_sanity,
-                                                                                          false); // use haplotypes?
-        
-		if(tidx >= _localGFMs.size()) {
-			assert_eq(tidx, _localGFMs.size());
-			_localGFMs.expand();
+	// Find where each local index starts so that they can be loaded
+	// independently, and how much memory their arrays take
+	buildLocalGFMToc(bytesRead,
+	                 switchEndian,
+	                 needEntireRev,
+	                 lineRate,
+	                 offRate,
+	                 ftabChars,
+	                 loadSASamp,
+	                 loadFtab,
+	                 loadRstarts);
+	
+	LocalLoadParam& lp = _localLoadParam;
+	lp.gfm = this;
+	lp.localGFMs = NULL;
+	lp.in5 = _in5;
+	lp.in6 = loadSASamp ? _in6 : NULL;
+	lp.begin = lp.end = 0;
+	lp.switchEndian = switchEndian;
+	lp.needEntireRev = needEntireRev;
+	lp.lineRate = lineRate;
+	lp.offRate = offRate;
+	lp.ftabChars = ftabChars;
+	lp.mmSweep = mmSweep;
+	lp.loadNames = loadNames;
+	lp.loadSASamp = loadSASamp;
+	lp.loadFtab = loadFtab;
+	lp.loadRstarts = loadRstarts;
+	lp.failed = false;
+	
+	if(_lazyLocal) {
+		// Local indexes are loaded by getLocalGFM() on first use; just
+		// lay out empty slots for them
+		for(size_t i = 0; i < _nlocalGFMs; i++) {
+			size_t tidx = _localGFMToc[i].tidx;
+			if(tidx >= _localGFMs.size()) {
+				assert_eq(tidx, _localGFMs.size());
+				_localGFMs.expand();
+				_localFirst.push_back(i);
+			}
+			assert_eq(tidx + 1, _localGFMs.size());
+			_localGFMs.back().push_back(NULL);
 		}
-		assert_eq(tidx + 1, _localGFMs.size());
-		_localGFMs.back().push_back(localGFM);
-	}	
+		_localUse.resizeExact(_nlocalGFMs);
+		_localUse.fill(LocalGFMUse());
+		if(this->_verbose || startVerbose) {
+			cerr << "  Deferring loading of " << _nlocalGFMs << " local indexes";
+			if(_maxResidentLocal > 0) cerr << " (at most " << _maxResidentLocal << " resident)";
+			cerr << endl;
+		}
+	} else {
+		// Unless the arrays come from a memory-mapped file or shared memory,
+		// put all of them in one contiguous arena
+		if(!this->_useMm && !this->useShmem_ && _nlocalGFMs > 0) {
+			size_t arenaSz = _localGFMToc.back().arenaOff + _localGFMToc.back().arenaSz;
+			try {
+				_localArena = new char[arenaSz];
+			} catch(bad_alloc& e) {
+				cerr << "Out of memory allocating the local indexes for the HISAT2 index." << endl
+				<< "Please try again on a computer with more memory." << endl;
+				throw 1;
+			}
+		}
+	
+		EList<LocalGFM<local_index_t, index_t>*> localGFMs;
+		localGFMs.resizeExact(_nlocalGFMs);
+		localGFMs.fill(NULL);
+	
+		size_t nthreads = 1;
+		if(!this->useShmem_ && _in5Str.length() > 0) {
+			nthreads = min<size_t>(max<int>(this->_nthreads, 1), _nlocalGFMs);
+			nthreads = max<size_t>(nthreads, 1);
+		}
+		if(this->_verbose || startVerbose) {
+			cerr << "  Loading " << _nlocalGFMs << " local indexes using " << nthreads << " thread(s): ";
+			logTime(cerr);
+		}
+		EList<LocalLoadParam> loadParams;
+		loadParams.resizeExact(nthreads);
+		for(size_t t = 0; t < nthreads; t++) {
+			LocalLoadParam& p = loadParams[t];
+			p = _localLoadParam;
+			p.localGFMs = &localGFMs;
+			p.begin = (size_t)((uint64_t)_nlocalGFMs * t / nthreads);
+			p.end = (size_t)((uint64_t)_nlocalGFMs * (t + 1) / nthreads);
+			if(t > 0) {
+				// Each thread reads its range through its own streams
+				if((p.in5 = fopen(_in5Str.c_str(), "rb")) == NULL) {
+					cerr << "Could not open index file " << _in5Str.c_str() << endl;
+					throw 1;
+				}
+				if(loadSASamp && (p.in6 = fopen(_in6Str.c_str(), "rb")) == NULL) {
+					cerr << "Could not open index file " << _in6Str.c_str() << endl;
+					throw 1;
+				}
+			}
+		}
+		if(nthreads == 1) {
+			loadLocalGFMs(loadParams[0]);
+		} else {
+			AutoArray<tthread::thread*> threads(nthreads - 1);
+			for(size_t t = 1; t < nthreads; t++) {
+				threads[t - 1] = new tthread::thread(local_load_worker, (void*)&loadParams[t]);
+			}
+			local_load_worker((void*)&loadParams[0]);
+			for(size_t t = 1; t < nthreads; t++) {
+				threads[t - 1]->join();
+				delete threads[t - 1];
+				fclose(loadParams[t].in5);
+				if(loadParams[t].in6 != NULL) fclose(loadParams[t].in6);
+			}
+			for(size_t t = 0; t < nthreads; t++) {
+				if(loadParams[t].failed) {
+					cerr << "Error: failed to load local indexes " << loadParams[t].begin
+					     << "-" << loadParams[t].end << " from " << _in5Str.c_str() << endl;
+					for(size_t i = 0; i < localGFMs.size(); i++) {
+						delete localGFMs[i];
+					}
+					throw 1;
+				}
+			}
+		}
+	
+		for(size_t i = 0; i < _nlocalGFMs; i++) {
+			LocalGFM<local_index_t, index_t> *localGFM = localGFMs[i];
+			assert(localGFM != NULL);
+			index_t tidx = localGFM->_tidx;
+			if(tidx >= _localGFMs.size()) {
+				assert_eq(tidx, _localGFMs.size());
+				_localGFMs.expand();
+			}
+			assert_eq(tidx + 1, _localGFMs.size());
+			_localGFMs.back().push_back(localGFM);
+		}
+	}
 		
 #ifdef BOWTIE_MM
     fseek(_in5, 0, SEEK_SET);
@@ -2650,4 +2954,216 @@ void HGFM<index_t, local_index_t>::readIntoMemory(
 #endif
 }
 
+/**
+ * Walk the headers of the local indexes in the .5 file, starting
+ * 'bytesRead' bytes in, and record where each one (and its SA sample
+ * in the .6 file) starts and how many bytes of arena it needs.  Leaves
+ * _in5 positioned at the end of the local indexes.
+ */
+template <typename index_t, typename local_index_t>
+void HGFM<index_t, local_index_t>::buildLocalGFMToc(
+                                                    size_t bytesRead,
+                                                    bool switchEndian,
+                                                    int needEntireRev,
+                                                    int32_t lineRate,
+                                                    int32_t offRate,
+                                                    int32_t ftabChars,
+                                                    bool loadSASamp,
+                                                    bool loadFtab,
+                                                    bool loadRstarts)
+{
+	_localGFMToc.resizeExact(_nlocalGFMs);
+	size_t off5 = bytesRead, off6 = 4, arenaOff = 0;
+	const size_t isz = sizeof(local_index_t);
+	for(size_t i = 0; i < _nlocalGFMs; i++) {
+		LocalGFMTocEntry& e = _localGFMToc[i];
+		e.off5 = off5;
+		e.off6 = off6;
+		e.arenaOff = arenaOff;
+		e.arenaSz = 0;
+		e.tidx = readIndex<index_t>(_in5, switchEndian);
+		readIndex<index_t>(_in5, switchEndian); // localOffset
+		readIndex<index_t>(_in5, switchEndian); // joinedOffset
+		local_index_t len      = readIndex<local_index_t>(_in5, switchEndian);
+		local_index_t gbwtLen  = readIndex<local_index_t>(_in5, switchEndian);
+		local_index_t numNodes = readIndex<local_index_t>(_in5, switchEndian);
+		local_index_t eftabLen = readIndex<local_index_t>(_in5, switchEndian);
+		off5 += 3 * sizeof(index_t) + 4 * isz;
+		if(len > 0) {
+			GFMParams<local_index_t> gh;
+			gh.init(len, gbwtLen, numNodes, lineRate, offRate, ftabChars, eftabLen, needEntireRev);
+			local_index_t nPat = readIndex<local_index_t>(_in5, switchEndian);
+			fseek(_in5, nPat * isz, SEEK_CUR);
+			local_index_t nFrag = readIndex<local_index_t>(_in5, switchEndian);
+			fseek(_in5, nFrag * isz * 3 + gh._gbwtTotLen, SEEK_CUR);
+			local_index_t num_zOffs = readIndex<local_index_t>(_in5, switchEndian);
+			size_t tail = (num_zOffs + 5 + gh._ftabLen + gh._eftabLen) * isz;
+			fseek(_in5, tail, SEEK_CUR);
+			off5 += (1 + nPat + 1 + nFrag * 3 + 1) * isz + gh._gbwtTotLen + tail;
+			off6 += gh._offsLen * isz;
+			size_t words = nPat + 5;
+			if(loadRstarts) words += nFrag * 3;
+			if(loadFtab) words += gh._ftabLen + gh._eftabLen;
+			if(loadSASamp) words += gh._offsLen;
+			e.arenaSz = words * isz + gh._gbwtTotLen + 7 * LOCAL_ARENA_ALIGN;
+		}
+		e.sz5 = off5 - e.off5;
+		e.sz6 = off6 - e.off6;
+		if(ferror(_in5) || feof(_in5)) {
+			cerr << "Error reading the header of local index " << i << " from " << _in5Str.c_str() << endl;
+			throw 1;
+		}
+		arenaOff += e.arenaSz;
+	}
+}
+
+/**
+ * Load local indexes [p.begin, p.end) into (*p.localGFMs) through the
+ * streams in 'p'.
+ */
+template <typename index_t, typename local_index_t>
+void HGFM<index_t, local_index_t>::loadLocalGFMs(LocalLoadParam& p)
+{
+	if(p.begin >= p.end) return;
+	const LocalGFMTocEntry& first = _localGFMToc[p.begin];
+	fseek(p.in5, first.off5, SEEK_SET);
+	if(p.in6 != NULL) fseek(p.in6, first.off6, SEEK_SET);
+	size_t bytesRead = first.off5, bytesRead2 = first.off6;
+	for(size_t i = p.begin; i < p.end; i++) {
+		(*p.localGFMs)[i] = newLocalGFM(p, i, bytesRead, bytesRead2);
+	}
+}
+
+/**
+ * Construct local index i, whose header is next in p.in5 and whose SA
+ * sample is next in p.in6.
+ */
+template <typename index_t, typename local_index_t>
+LocalGFM<local_index_t, index_t>* HGFM<index_t, local_index_t>::newLocalGFM(
+                                                                            const LocalLoadParam& p,
+                                                                            size_t i,
+                                                                            size_t& bytesRead,
+                                                                            size_t& bytesRead2) const
+{
+	index_t tidx = 0, localOffset = 0, joinedOffset = 0;
+	string base = "";
+	char *arena = (_localArena == NULL ? NULL : _localArena + _localGFMToc[i].arenaOff);
+	return new LocalGFM<local_index_t, index_t>(base,
+	                                            NULL,
+	                                            p.in5,
+	                                            p.in6,
+	                                            mmFile5_,
+	                                            mmFile6_,
+	                                            tidx,
+	                                            localOffset,
+	                                            joinedOffset,
+	                                            p.switchEndian,
+	                                            bytesRead,
+	                                            bytesRead2,
+	                                            p.needEntireRev,
+	                                            this->fw_,
+	                                            -1, // overrideOffRate
+	                                            -1, // offRatePlus
+	                                            (uint32_t)p.lineRate,
+	                                            (uint32_t)p.offRate,
+	                                            (uint32_t)p.ftabChars,
+	                                            this->_useMm || _lazyLocal,
+	                                            this->useShmem_,
+	                                            p.mmSweep,
+	                                            p.loadNames,
+	                                            p.loadSASamp,
+	                                            p.loadFtab,
+	                                            p.loadRstarts,
+	                                            false,  // _verbose
+	                                            false,
+	                                            this->_passMemExc,
+	                                            this->_sanity,
+	                                            false,  // use haplotypes?
+	                                            arena);
+}
+
+/**
+ * Return local index 'offsetidx' of reference 'tidx', loading it if
+ * this is its first use.  A loaded slot is read without locking; only
+ * a thread that finds it empty takes _localMutex, checks again and
+ * loads it.
+ *
+ * With --local-lru, also mark it as used.  A hit on a resident local
+ * index does that without a lock.  One that isn't resident (never used
+ * or paged out) is counted in under _localMutex, and if that makes more
+ * than _maxResidentLocal local indexes resident, a clock sweep pages out
+ * one that hasn't been used since the hand last passed it: its pages in
+ * the memory-mapped index files are released and faulted back in if it
+ * is used again, so pointers handed out earlier stay valid.
+ */
+template <typename index_t, typename local_index_t>
+const LocalGFM<local_index_t, index_t>* HGFM<index_t, local_index_t>::touchLocalGFM(
+                                                                                   index_t tidx,
+                                                                                   index_t offsetidx) const
+{
+	assert(_lazyLocal);
+	assert_lt(tidx, _localGFMs.size());
+	assert_lt(offsetidx, _localGFMs[tidx].size());
+	const LocalGFMSlot<LocalGFM<local_index_t, index_t> >& slot = _localGFMs[tidx][offsetidx];
+	LocalGFM<local_index_t, index_t>* localGFM = slot.load();
+	if(localGFM == NULL) {
+		ThreadSafe ts(&_localMutex);
+		localGFM = slot.load();
+		if(localGFM == NULL) {
+			assert_lt(tidx, _localFirst.size());
+			size_t i = _localFirst[tidx] + offsetidx;
+			assert_lt(i, _localGFMToc.size());
+			const LocalGFMTocEntry& e = _localGFMToc[i];
+			fseek(_localLoadParam.in5, e.off5, SEEK_SET);
+			if(_localLoadParam.in6 != NULL) fseek(_localLoadParam.in6, e.off6, SEEK_SET);
+			size_t bytesRead = e.off5, bytesRead2 = e.off6;
+			localGFM = newLocalGFM(_localLoadParam, i, bytesRead, bytesRead2);
+			slot.store(localGFM);
+		}
+	}
+	if(_maxResidentLocal == 0) return localGFM;
+	
+	size_t i = _localFirst[tidx] + offsetidx;
+	const LocalGFMUse& use = _localUse[i];
+	uint8_t state = use.load();
+	if(state == LocalGFMUse::USED) return localGFM;
+	if(state == LocalGFMUse::RESIDENT && use.change(LocalGFMUse::RESIDENT, LocalGFMUse::USED)) return localGFM;
+	
+	// Only threads holding the lock make a local index resident or page
+	// one out, so another thread may only have marked it used meanwhile
+	ThreadSafe ts(&_localMutex);
+	if(use.load() != LocalGFMUse::NOT_RESIDENT) {
+		use.change(LocalGFMUse::RESIDENT, LocalGFMUse::USED);
+		return localGFM;
+	}
+	use.store(LocalGFMUse::USED);
+	_nResidentLocal++;
+	
+	// Page out local indexes not used since the hand last passed them
+	while(_nResidentLocal > _maxResidentLocal) {
+		size_t j = _localClockHand;
+		_localClockHand = (j + 1 < _localUse.size() ? j + 1 : 0);
+		if(j == i) continue;
+		const LocalGFMUse& u = _localUse[j];
+		if(u.change(LocalGFMUse::USED, LocalGFMUse::RESIDENT)) continue;
+		if(!u.change(LocalGFMUse::RESIDENT, LocalGFMUse::NOT_RESIDENT)) continue;
+		_nResidentLocal--;
+#ifdef BOWTIE_MM
+		const LocalGFMTocEntry& e = _localGFMToc[j];
+		const size_t pageSz = (size_t)sysconf(_SC_PAGESIZE);
+		char *files[] = { mmFile5_, mmFile6_ };
+		size_t offs[] = { e.off5, e.off6 };
+		size_t szs[] = { e.sz5, e.sz6 };
+		for(int f = 0; f < 2; f++) {
+			if(files[f] == NULL) continue;
+			// Only release pages that lie entirely within this local index
+			size_t beg = (offs[f] + pageSz - 1) / pageSz * pageSz;
+			size_t end = (offs[f] + szs[f]) / pageSz * pageSz;
+			if(beg < end) madvise(files[f] + beg, end - beg, MADV_DONTNEED);
+		}
+#endif
+	}
+	return localGFM;
+}
+
 #endif /*HGFM_H_*/
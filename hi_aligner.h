@@ -43,6 +43,7 @@
 #include "group_walk.h"
 #include "tp.h"
 #include "gp.h"
+#include "aligner_metrics.h"
 
 // Allow longer introns for long anchored reads involving canonical splice sites
 inline uint32_t MaxIntronLen(uint32_t anchor, uint32_t minAnchorLen) {
@@ -496,6 +497,54 @@ struct GenomeHit {
         return *this;
     }
     
+    /**
+     * Move otherHit into a new hit, taking its edit and haplotype lists.
+     */
+    GenomeHit(GenomeHit&& otherHit) :
+    _edits(NULL),
+    _ht_list(NULL),
+    _hitcount(1),
+    _edits_node(NULL),
+    _ht_list_node(NULL),
+    _sharedVars(NULL)
+    {
+        *this = std::move(otherHit);
+    }
+    
+    /**
+     * Move otherHit into this hit by swapping edit and haplotype lists with
+     * it rather than copying them; otherHit keeps this hit's lists for
+     * reuse.  Hits whose lists come from different SharedTempVars are
+     * copied instead.
+     */
+    GenomeHit<index_t>& operator=(GenomeHit<index_t>&& otherHit) {
+        if(this == &otherHit) return *this;
+        if(otherHit._edits_node == NULL ||
+           otherHit._ht_list_node == NULL ||
+           (_sharedVars != NULL && _sharedVars != otherHit._sharedVars)) {
+            return *this = (const GenomeHit<index_t>&)otherHit;
+        }
+        _fw = otherHit._fw;
+        _rdoff = otherHit._rdoff;
+        _len = otherHit._len;
+        _trim5 = otherHit._trim5;
+        _trim3 = otherHit._trim3;
+        _tidx = otherHit._tidx;
+        _toff = otherHit._toff;
+        _joinedOff = otherHit._joinedOff;
+        _repeat = otherHit._repeat;
+        _score = otherHit._score;
+        _localscore = otherHit._localscore;
+        _splicescore = otherHit._splicescore;
+        _hitcount = 1;
+        std::swap(_edits, otherHit._edits);
+        std::swap(_edits_node, otherHit._edits_node);
+        std::swap(_ht_list, otherHit._ht_list);
+        std::swap(_ht_list_node, otherHit._ht_list_node);
+        _sharedVars = otherHit._sharedVars;
+        return *this;
+    }
+    
     ~GenomeHit() {
         if(_edits_node != NULL) {
             assert(_edits != NULL);
@@ -3890,13 +3939,43 @@ int64_t GenomeHit<index_t>::calculateScore(
     return score;
 }
 
+/**
+ * Stages of aligning a read (or pair) for which HIMetrics keeps latency
+ * histograms.  Stages nest: e.g. HI_STAGE_COORDS is also counted in the
+ * HI_STAGE_ALIGN or HI_STAGE_REPEAT call it happens in.
+ */
+enum {
+    HI_STAGE_BWT = 0,     // nextBWT: partial search using the global index
+    HI_STAGE_COORDS,      // getGenomeCoords: resolving BW ranges to genome offsets
+    HI_STAGE_ALIGN,       // align: extending partial alignments
+    HI_STAGE_PAIR,        // pairReads
+    HI_STAGE_MATE,        // alignMate: anchored search for an unaligned mate
+    HI_STAGE_REPEAT,      // alignment against the repeat index
+    HI_STAGE_REPORT,      // building SAM records for the read
+    HI_STAGE_OUTPUT,      // handing records to the (possibly contended) output queue
+    HI_STAGE_READ,        // whole read or pair, from parsing to output
+    HI_NUM_STAGES
+};
+
+static const char * const hi_stage_names[HI_NUM_STAGES] = {
+    "bwt",
+    "genome_coords",
+    "align",
+    "pair",
+    "align_mate",
+    "repeat",
+    "report",
+    "output",
+    "read"
+};
+
 /**
  * Encapsulates counters that measure how much work has been done by
  * hierarchical indexing
  */
 struct HIMetrics {
     
-	HIMetrics() : mutex_m() {
+	HIMetrics() : timeStages(false), mutex_m() {
 	    reset();
 	}
     
@@ -3908,6 +3987,11 @@ struct HIMetrics {
         localsearchrecur = 0;
         globalgenomecoords = 0;
         localgenomecoords = 0;
+        if(timeStages) {
+            for(size_t i = 0; i < HI_NUM_STAGES; i++) {
+                stages[i].reset();
+            }
+        }
 	}
 	
 	void init(
@@ -3942,6 +4026,19 @@ struct HIMetrics {
         localsearchrecur += r.localsearchrecur;
         globalgenomecoords += r.globalgenomecoords;
         localgenomecoords += r.localgenomecoords;
+        if(r.timeStages) {
+            for(size_t i = 0; i < HI_NUM_STAGES; i++) {
+                stages[i].merge(r.stages[i]);
+            }
+        }
+    }
+    
+    /**
+     * Record that the given stage took the given number of nanoseconds.
+     */
+    void recordStage(int stage, uint64_t ns) {
+        assert_lt(stage, HI_NUM_STAGES);
+        stages[stage].record(ns);
     }
 	   
     uint64_t localatts;      // # attempts of local search
@@ -3951,10 +4048,37 @@ struct HIMetrics {
     uint64_t localsearchrecur;
     uint64_t globalgenomecoords;
     uint64_t localgenomecoords;
+    
+    bool             timeStages; // collect per-stage latency histograms?
+    LatencyHistogram stages[HI_NUM_STAGES];
 	
 	MUTEX_T mutex_m;
 };
 
+/**
+ * Adds the time between construction and destruction to the given stage's
+ * histogram, if the HIMetrics object is collecting stage timings.
+ */
+class HIStageTimer {
+public:
+    HIStageTimer(HIMetrics& him, int stage, bool active = true) :
+    him_(him.timeStages && active ? &him : NULL),
+    stage_(stage),
+    start_(him_ != NULL ? nanoTime() : 0)
+    { }
+    
+    ~HIStageTimer() {
+        if(him_ != NULL) {
+            him_->recordStage(stage_, nanoTime() - start_);
+        }
+    }
+    
+private:
+    HIMetrics* him_;
+    int        stage_;
+    uint64_t   start_;
+};
+
 /**
  * With a hierarchical indexing, SplicedAligner provides several alignment strategies
  * , which enable effective alignment of RNA-seq reads
@@ -3974,6 +4098,8 @@ public:
     _anchorStop(anchorStop),
     _gwstate(GW_CAT),
     _gwstate_local(GW_CAT),
+    bwops_(0),
+    bwops_beg_(0),
     _thread_rids_mindist(threads_rids_mindist)
     {
         index_t genomeLen = gfm.gh().len();
@@ -3985,9 +4111,15 @@ public:
         _minK_local = 8;
     }
     
-    HI_Aligner() {
+    HI_Aligner() : bwops_(0), bwops_beg_(0) {
     }
     
+    /**
+     * Set how many reads after the read that found it a splice site
+     * becomes usable; see the constructor's threads_rids_mindist.
+     */
+    void threadRidsMindist(uint64_t mindist) { _thread_rids_mindist = mindist; }
+    
     /**
      */
     void initRead(Read *rd, bool nofw, bool norc, TAlScore minsc, TAlScore maxpen, bool rightendonly = false) {
@@ -4011,6 +4143,7 @@ public:
         _genomeHits.clear();
         _genomeHits_rep[0].clear();
         _hits_searched[0].clear();
+        _swaRdi = (index_t)INDEX_MAX;
         assert(!_paired);
     }
     
@@ -4036,6 +4169,7 @@ public:
         _genomeHits_rep[0].clear();
         _genomeHits_rep[1].clear();
         _concordantIdxInspected.first = _concordantIdxInspected.second = 0;
+        _swaRdi = (index_t)INDEX_MAX;
         assert(_paired);
         assert(!_rightendonly);
     }
@@ -4067,6 +4201,7 @@ public:
            AlnSinkWrap<index_t>&      sink)
     {
         const ReportingParams& rp = sink.reportingParams();
+        bwops_beg_ = bwops_;
         
         index_t rdi;
         bool fw;
@@ -4077,7 +4212,10 @@ public:
         while(nextBWT(sc, pepol, tpol, gpol, gfm, altdb, ref, rdi, fw, wlm, prm, him, rnd, sink)) {
             // given the partial alignment, try to extend it to full alignments
             index_t fwi = (fw == true ? 0 : 1);
-            found[rdi][fwi] = align(sc, pepol, tpol, gpol, gfm, altdb, repeatdb, ref, swa, ssdb, rdi, fw, wlm, prm, swm, him, rnd, sink);
+            {
+                HIStageTimer stageTimer(him, HI_STAGE_ALIGN);
+                found[rdi][fwi] = align(sc, pepol, tpol, gpol, gfm, altdb, repeatdb, ref, swa, ssdb, rdi, fw, wlm, prm, swm, him, rnd, sink);
+            }
             if(!found[0][0] && !found[0][1] && !found[1][0] && !found[1][1]) {
                 break;
             }
@@ -4088,11 +4226,14 @@ public:
                 pairReads(sc, pepol, tpol, gpol, gfm, altdb, repeatdb, ref, wlm, prm, him, rnd, sink);
                 // if(sink.bestPair() >= _minsc[0] + _minsc[1]) break;
             }
+            
+            // out of budget; report what has been found so far
+            if(overBudget(prm)) break;
         }
         
         // if no concordant pair is found, try to use alignment of one-end
         // as an anchor to align the other-end
-        if(this->_paired) {
+        if(this->_paired && !overBudget(prm)) {
             if(sink.numPair() == 0 &&
                (sink.bestUnp1() >= _minsc[0] || sink.bestUnp2() >= _minsc[1])) {
                 bool mate_found = false;
@@ -4102,6 +4243,7 @@ public:
                 index_t rs_size[2] = {(index_t)rs[0]->size(), (index_t)rs[1]->size()};
                 for(index_t i = 0; i < 2; i++) {
                     for(index_t j = 0; j < rs_size[i]; j++) {
+                        if(overBudget(prm)) break;
                         const AlnRes& res = (*rs[i])[j];
                         bool fw = (res.orient() == 1);
                         mate_found |= alignMate(
@@ -4149,12 +4291,13 @@ public:
         
         
         // Determine whether reads map to repetitive sequences
+        HIStageTimer repeatTimer(him, HI_STAGE_REPEAT, rgfm != NULL);
         bool repeat[2][2] = {{false, false}, {false, false}};
         bool perform_repeat_alignment = false;
         
         index_t indexIdx[2] = {0, 0};
 #if 1
-        if(rgfm != NULL && !((RFM<index_t>*)rgfm)->empty()) {
+        if(rgfm != NULL && !((RFM<index_t>*)rgfm)->empty() && !overBudget(prm)) {
             // use repeat index to decide whether a read or a pair is from repetitive sequences
             indexIdx[0] = ((RFM<index_t>*)rgfm)->getLocalRFM_idx((*_rds)[0].length());
             if(_paired) {
@@ -4478,13 +4621,18 @@ public:
                                                       _snpIDs2,
                                                       raltdb,
                                                       positions,
-                                                      rp.khits * 10);
+                                                      rp.repeatCompact ? 1 : rp.khits * 10);
                             if(positions.size() <= 0) continue;
                             
                             _repeatConcordant.expand();
                             _repeatConcordant.back().first = _genomeHits_rep[0][i]._joinedOff;
                             _repeatConcordant.back().second = _genomeHits_rep[1][j]._joinedOff;
                             
+                            // The pair is reported against the repeat sequences
+                            // below, leaving its genomic copies to be looked up
+                            // in the repeat table
+                            if(rp.repeatCompact) continue;
+                            
                             for(size_t p = 0; p < positions.size(); p++) {
                                 if(sink.bestPair() >= estScore && sink.numBestPair().first > rp.khits)
                                     break;
@@ -4576,12 +4724,20 @@ public:
                 if(_paired) {
                     index_t numBestPair = sink.numBestPair().first;
                     align2repeat = (numBestPair == 0 || numBestPair > rp.khits);
+                    // However few copies a pair in common repeats has, report
+                    // it against the repeat sequences; those alignments
+                    // outrank the equally good genomic copies
+                    if(rp.repeatCompact && !_repeatConcordant.empty()) align2repeat = true;
                 } else {
                     const EList<AlnRes> *rs = NULL;
                     if(rdi == 0) sink.getUnp1(rs);
                     else         sink.getUnp2(rs);
                     assert(rs != NULL);
-                    align2repeat = (rs->size() == 0 || sink.numBestUnp(rdi).first > rp.khits);
+                    // With --repeat-compact, a read whose best genomic
+                    // alignment is not unique is reported against the
+                    // repeat sequences however few copies it has
+                    index_t numBestUnp = sink.numBestUnp(rdi).first;
+                    align2repeat = (rs->size() == 0 || numBestUnp > (rp.repeatCompact ? 1 : rp.khits));
                 }
                 
                 if(align2repeat) {
@@ -4611,7 +4767,7 @@ public:
                     }
                     
                     if(_paired && rdi == 1) {
-                        if(sink.numBestUnp(rdi).first > rp.khits) {
+                        if(rp.repeatCompact || sink.numBestUnp(rdi).first > rp.khits) {
                             pairReads(
                                       sc,
                                       pepol,
@@ -4633,6 +4789,7 @@ public:
             } // for(size_t rdi = 0
         } // repeat
         
+        prm.nSdFmops += bwops_ - bwops_beg_;
         return EXTEND_POLICY_FULFILLED;
     }
     
@@ -4657,6 +4814,7 @@ public:
                  RandomSource&              rnd,
                  AlnSinkWrap<index_t>&      sink)
     {
+        HIStageTimer stageTimer(him, HI_STAGE_BWT);
         const ReportingParams& rp = sink.reportingParams();
         
         // Pick up a candidate from a read or its reverse complement
@@ -4861,6 +5019,14 @@ public:
                                index_t                          dep = 0)
     { return numeric_limits<int64_t>::min(); }
     
+    /**
+     * Return true iff the current read has used up its work budget
+     * (FM Index ops, extension attempts, or wall-clock time).
+     */
+    bool overBudget(PerReadMetrics& prm) {
+        return prm.overBudget(bwops_ - bwops_beg_);
+    }
+    
     /**
      * Choose a candidate for alignment from a read or its reverse complement
      * (also from a mate or its reverse complement for pair)
@@ -5410,12 +5576,16 @@ protected:
     EList<index_t>                 _snpIDs;
     EList<index_t>                 _snpIDs2;
     EList<bool>                    _genomeHits_done;
+    index_t                        _swaRdi; // mate SwAligner was last given with initRead, or INDEX_MAX
     ELList<Coord>                  _coords;
     EList<pair<RepeatCoord<index_t>, RepeatCoord<index_t> > >     _positions;
     ELList<SpliceSite>             _spliceSites;
     
     pair<index_t, index_t>         _concordantIdxInspected;
     EList<pair<index_t, index_t> > _repeatConcordant;
+    ConcordantSweep                _pairSweep;    // unique mate-2 alignments by position
+    EList<size_t>                  _pairRepeat2;  // repeat mate-2 alignments
+    EList<size_t>                  _pairCands;    // mate-2 candidates for one mate-1 alignment
     
     size_t _minK; // log4 of the size of a genome
     size_t _minK_local; // log4 of the size of a local index (8)
@@ -5425,6 +5595,7 @@ protected:
     uint64_t max_localindexatts;
     
 	uint64_t bwops_;                    // Burrows-Wheeler operations
+	uint64_t bwops_beg_;                // bwops_ when the current read started
 	uint64_t bwedits_;                  // Burrows-Wheeler edits
     
     //
@@ -5598,6 +5769,7 @@ bool HI_Aligner<index_t, local_index_t>::alignMate(
                                                    index_t                          tidx,
                                                    index_t                          toff)
 {
+    HIStageTimer stageTimer(him, HI_STAGE_MATE);
     const ReportingParams& rp = sink.reportingParams();
     
     assert_lt(rdi, 2);
@@ -5792,6 +5964,7 @@ bool HI_Aligner<index_t, local_index_t>::getGenomeCoords(
                                                          bool                       rejectStraddle,
                                                          bool&                      straddled)
 {
+    HIStageTimer stageTimer(him, HI_STAGE_COORDS);
     straddled = false;
     assert_gt(bot, top);
     assert_leq(node_bot - node_top, bot - top);
@@ -5960,6 +6133,7 @@ bool HI_Aligner<index_t, local_index_t>::pairReads(
                                                    RandomSource&              rnd,
                                                    AlnSinkWrap<index_t>&      sink)
 {
+    HIStageTimer stageTimer(him, HI_STAGE_PAIR);
     const ReportingParams& rp = sink.reportingParams();
     assert(_paired);
     const EList<AlnRes> *rs1 = NULL, *rs2 = NULL;
@@ -5968,8 +6142,56 @@ bool HI_Aligner<index_t, local_index_t>::pairReads(
     index_t start_i = _concordantIdxInspected.first, start_j = _concordantIdxInspected.second;
     _concordantIdxInspected.first = rs1->size();
     _concordantIdxInspected.second = rs2->size();
+    // Rather than trying every mate-2 alignment against every mate-1
+    // alignment, sort the unique mate-2 alignments by position and only try
+    // the ones within intron (or, for DNA, fragment) range.  Repeat
+    // alignments still pair with all repeat alignments of the other mate.
+    _pairSweep.reset();
+    _pairRepeat2.clear();
+    for(index_t j = 0; j < rs2->size(); j++) {
+        const AlnRes& r2 = (*rs2)[j];
+        if(r2.repeat()) {
+            _pairRepeat2.push_back(j);
+        } else {
+            const Coord& left2 = r2.refcoord();
+            _pairSweep.add(j, left2.ref(), left2.orient(), left2.off(), r2.refcoord_right().off());
+        }
+    }
+    _pairSweep.sort();
+    // Unspliced mates must also be within the maximum fragment length of each
+    // other, which peClassifyPair may expand to fit the longer mate
+    int64_t maxfrag = -1;
+    if(tpol.no_spliced_alignment()) {
+        int64_t maxext = _pairSweep.maxSpan();
+        for(index_t i = 0; i < rs1->size(); i++) {
+            maxext = max<int64_t>(maxext, (int64_t)(*rs1)[i].refExtent());
+        }
+        maxfrag = max<int64_t>((int64_t)pepol.maxFragLen(), maxext);
+    }
     for(index_t i = 0; i < rs1->size(); i++) {
-        for(index_t j = (i >= start_i ? 0 : start_j); j < rs2->size(); j++) {
+        const AlnRes& ri = (*rs1)[i];
+        size_t minj = (i >= start_i ? 0 : start_j);
+        if(ri.repeat()) {
+            _pairCands.clear();
+            for(size_t c = 0; c < _pairRepeat2.size(); c++) {
+                if(_pairRepeat2[c] >= minj) _pairCands.push_back(_pairRepeat2[c]);
+            }
+        } else {
+            const Coord& left = ri.refcoord();
+            _pairSweep.candidates(
+                                  left.ref(),
+                                  left.orient(),
+                                  left.off(),
+                                  ri.refcoord_right().off(),
+                                  gMate1fw,
+                                  gMate2fw,
+                                  (int)tpol.maxIntronLen(),
+                                  maxfrag,
+                                  minj,
+                                  _pairCands);
+        }
+        for(size_t c = 0; c < _pairCands.size(); c++) {
+            index_t j = (index_t)_pairCands[c];
             if(sink.state().doneConcordant()) {
                 return true;
             }
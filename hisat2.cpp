@@ -79,6 +79,13 @@ static int metricsIval;   // interval between alignment metrics messages (0 = no
 static string metricsFile;// output file to put alignment metrics in
 static bool metricsStderr;// output file to put alignment metrics in
 static bool metricsPerRead; // report a metrics tuple for every read
+static string metricsJsonFile; // output file to put per-stage latency histograms in (JSON lines)
+static string slowReadFile; // output file to capture slow reads in
+static uint64_t slowReadUsecs; // capture reads taking at least this many microseconds
+static uint64_t slowReadFmops; // capture reads taking at least this many FM-index operations (0 = off)
+static uint64_t readBudgetFmops; // stop searching a read after this many FM-index operations (0 = off)
+static uint64_t readBudgetExts; // stop searching a read after this many extension attempts (0 = off)
+static uint64_t readBudgetUsecs; // stop searching a read after this many microseconds (0 = off)
 static bool allHits;      // for multihits, report just one
 static bool showVersion;  // just print version and quit?
 static int ipause;        // pause before maching?
@@ -100,6 +107,9 @@ static bool fileParallel; // separate threads read separate input files in paral
 static bool useShmem;     // use shared memory to hold the index
 static bool useMm;        // use memory-mapped files to hold the index
 static bool mmSweep;      // sweep through memory-mapped files immediately after mapping
+static bool lazyLocal;    // load local indexes on first use
+static bool mmapReads;    // memory-map uncompressed read files
+static size_t localLRU;   // max # local indexes kept resident with --lazy-local (0 = no limit)
 int gMinInsert;           // minimum insert size
 int gMaxInsert;           // maximum insert size
 bool gMate1fw;            // -1 mate aligns in fw orientation on fw strand
@@ -114,6 +124,8 @@ bool gReportMixed;        // find and report unpaired alignments for paired read
 static uint32_t cacheLimit;      // ranges w/ size > limit will be cached
 static uint32_t cacheSize;       // # words per range cache
 static uint32_t skipReads;       // # reads/read pairs to skip
+static int shardIdx;             // read only the shardIdx'th byte range of each input
+static int nshards;              // # byte ranges inputs are split into
 bool gNofw; // don't align fw orientation of read
 bool gNorc; // don't align rc orientation of read
 static uint32_t fastaContLen;
@@ -255,6 +267,10 @@ static size_t maxIntronLen;
 static string knownSpliceSiteInfile;  //
 static string novelSpliceSiteInfile;  //
 static string novelSpliceSiteOutfile; //
+static string novelSpliceSiteSnapshot; // binary version of novelSpliceSiteOutfile
+static bool twoPass;          // collect novel splice sites in a first pass over the reads
+static uint32_t twoPassReads; // # reads/pairs the first pass aligns (0 = all)
+static uint64_t tempSpliceSiteWin; // fixed thread_rids_mindist (0 = adapt)
 static bool secondary;
 static bool no_spliced_alignment;
 static int rna_strandness; //
@@ -296,6 +312,8 @@ static bool sensitive;      // --sensitive
 static bool very_sensitive; // --very-sensitive
 
 static bool repeat;
+static bool repeatCompact;      // report repeat-repeat pairs once, against the repeat sequences
+static string repeatTableFile;  // write genomic copies of every repeat to this file
 static bool use_repeat_index;
 static EList<size_t> readLens;
 
@@ -320,6 +338,13 @@ static void resetOptions() {
 	metricsFile             = ""; // output file to put alignment metrics in
 	metricsStderr           = false; // print metrics to stderr (in addition to --metrics-file if it's specified
 	metricsPerRead          = false; // report a metrics tuple for every read?
+	metricsJsonFile         = ""; // output file to put per-stage latency histograms in
+	slowReadFile            = ""; // output file to capture slow reads in
+	slowReadUsecs           = 100000; // capture reads taking at least 0.1 seconds
+	slowReadFmops           = 0; // no FM-index operation threshold
+	readBudgetFmops         = 0; // no per-read FM-index operation budget
+	readBudgetExts          = 0; // no per-read extension attempt budget
+	readBudgetUsecs         = 0; // no per-read time budget
 	allHits					= false; // for multihits, report just one
 	showVersion				= false; // just print version and quit?
 	ipause					= 0; // pause before maching?
@@ -341,6 +366,8 @@ static void resetOptions() {
 	useShmem				= false; // use shared memory to hold the index
 	useMm					= false; // use memory-mapped files to hold the index
 	mmSweep					= false; // sweep through memory-mapped files immediately after mapping
+	lazyLocal				= false; // load all local indexes up front
+	localLRU				= 0;     // no limit on resident local indexes
 	gMinInsert				= 0;     // minimum insert size
 	gMaxInsert				= 1000;   // maximum insert size
 	gMate1fw				= true;  // -1 mate aligns in fw orientation on fw strand
@@ -356,6 +383,9 @@ static void resetOptions() {
 	cacheLimit				= 5;     // ranges w/ size > limit will be cached
 	cacheSize				= 0;     // # words per range cache
 	skipReads				= 0;     // # reads/read pairs to skip
+	shardIdx				= 0;     // read the whole input
+	nshards					= 1;     // # byte ranges inputs are split into
+	mmapReads				= false; // read files through fread()
 	gNofw					= false; // don't align fw orientation of read
 	gNorc					= false; // don't align rc orientation of read
 	fastaContLen			= 0;
@@ -500,6 +530,10 @@ static void resetOptions() {
     knownSpliceSiteInfile = "";
     novelSpliceSiteInfile = "";
     novelSpliceSiteOutfile = "";
+    novelSpliceSiteSnapshot = "";
+    twoPass = false;
+    twoPassReads = 0;
+    tempSpliceSiteWin = 0;
     secondary = false;       // allow secondary alignments
     no_spliced_alignment = false;
     rna_strandness = RNA_STRANDNESS_UNKNOWN;
@@ -532,6 +566,8 @@ static void resetOptions() {
     very_sensitive = false;
     
     repeat = false; // true iff alignments to repeat sequences are directly reported.
+    repeatCompact = false;
+    repeatTableFile = "";
     use_repeat_index = true;
     readLens.clear();
 }
@@ -557,6 +593,15 @@ static struct option long_options[] = {
 	{(char*)"met",          required_argument, 0,            ARG_METRIC_IVAL},
 	{(char*)"met-file",     required_argument, 0,            ARG_METRIC_FILE},
 	{(char*)"met-stderr",   no_argument,       0,            ARG_METRIC_STDERR},
+	{(char*)"met-json",     required_argument, 0,            ARG_METRIC_JSON},
+	{(char*)"slow-read-file",  required_argument, 0,         ARG_SLOW_READ_FILE},
+	{(char*)"slow-read-usec",  required_argument, 0,         ARG_SLOW_READ_USEC},
+	{(char*)"slow-read-fmops", required_argument, 0,         ARG_SLOW_READ_FMOPS},
+	{(char*)"read-budget-fmops", required_argument, 0,       ARG_READ_BUDGET_FMOPS},
+	{(char*)"read-budget-exts",  required_argument, 0,       ARG_READ_BUDGET_EXTS},
+	{(char*)"read-budget-usec",  required_argument, 0,       ARG_READ_BUDGET_USEC},
+	{(char*)"lazy-local",   no_argument,       0,            ARG_LAZY_LOCAL},
+	{(char*)"local-lru",    required_argument, 0,            ARG_LOCAL_LRU},
 	{(char*)"time",         no_argument,       0,            't'},
 	{(char*)"trim3",        required_argument, 0,            '3'},
 	{(char*)"trim5",        required_argument, 0,            '5'},
@@ -733,6 +778,10 @@ static struct option long_options[] = {
     {(char*)"known-splicesite-infile",       required_argument, 0,        ARG_KNOWN_SPLICESITE_INFILE},
     {(char*)"novel-splicesite-infile",       required_argument, 0,        ARG_NOVEL_SPLICESITE_INFILE},
     {(char*)"novel-splicesite-outfile",      required_argument, 0,        ARG_NOVEL_SPLICESITE_OUTFILE},
+    {(char*)"novel-splicesite-snapshot",     required_argument, 0,        ARG_NOVEL_SPLICESITE_SNAPSHOT},
+    {(char*)"two-pass",         no_argument,       0,        ARG_TWO_PASS},
+    {(char*)"two-pass-reads",   required_argument, 0,        ARG_TWO_PASS_READS},
+    {(char*)"temp-splicesite-window", required_argument, 0,  ARG_TEMP_SPLICESITE_WINDOW},
     {(char*)"secondary",        no_argument,       0,        ARG_SECONDARY},
     {(char*)"no-spliced-alignment",   no_argument, 0,        ARG_NO_SPLICED_ALIGNMENT},
     {(char*)"rna-strandness",   required_argument, 0,        ARG_RNA_STRANDNESS},
@@ -758,6 +807,10 @@ static struct option long_options[] = {
     {(char*)"enable-dp",       no_argument,        0,        ARG_DP},
     {(char*)"bowtie2-dp",      required_argument,  0,        ARG_DP},
     {(char*)"repeat",          no_argument,        0,        ARG_REPEAT},
+    {(char*)"repeat-compact",  no_argument,        0,        ARG_REPEAT_COMPACT},
+    {(char*)"repeat-table",    required_argument,  0,        ARG_REPEAT_TABLE},
+    {(char*)"shard",           required_argument,  0,        ARG_SHARD},
+    {(char*)"mm-reads",        no_argument,        0,        ARG_MM_READS},
     {(char*)"no-repeat-index", no_argument,        0,        ARG_NO_REPEAT_INDEX},
     {(char*)"read-lengths",    required_argument,  0,        ARG_READ_LENGTHS},
 	{(char*)0, 0, 0, 0} // terminator
@@ -848,6 +901,8 @@ static void printUsage(ostream& out) {
 	    << "  -c                 <m1>, <m2>, <r> are sequences themselves, not files" << endl
 	    << "  -s/--skip <int>    skip the first <int> reads/pairs in the input (none)" << endl
 	    << "  -u/--upto <int>    stop after first <int> reads/pairs (no limit)" << endl
+	    << "  --shard <i>/<N>    read only the <i>th (0-based) of <N> equal byte ranges of each FASTQ" << endl
+	    << "                     file; needs uncompressed, seekable files" << endl
 	    << "  -5/--trim5 <int>   trim <int> bases from 5'/left end of reads (0)" << endl
 	    << "  -3/--trim3 <int>   trim <int> bases from 3'/right end of reads (0)" << endl
 	    << "  --phred33          qualities are Phred+33 (default)" << endl
@@ -891,8 +946,15 @@ static void printUsage(ostream& out) {
         << "  --max-intronlen <int>              maximum intron length (500000)" << endl
         << "  --known-splicesite-infile <path>   provide a list of known splice sites" << endl
         << "  --novel-splicesite-outfile <path>  report a list of splice sites" << endl
+        << "  --novel-splicesite-snapshot <path> report the same list as a binary file that" << endl
+        << "                                     either infile option loads without parsing" << endl
         << "  --novel-splicesite-infile <path>   provide a list of novel splice sites" << endl
         << "  --no-temp-splicesite               disable the use of splice sites found" << endl
+        << "  --temp-splicesite-window <int>     with -p, wait for reads this far back to share" << endl
+        << "                                     their splice sites (adapts from 1000*threads)" << endl
+        << "  --two-pass                         find novel splice sites in a first pass, then" << endl
+        << "                                     align all reads against them" << endl
+        << "  --two-pass-reads <int>             reads/pairs the first pass looks at (all)" << endl
         << "  --no-spliced-alignment             disable spliced alignment" << endl
         << "  --rna-strandness <string>          specify strand-specific information (unstranded)" << endl
         << "  --tmo                              reports only those alignments within known transcriptome" << endl
@@ -935,6 +997,10 @@ static void printUsage(ostream& out) {
         << "  -a/--all           HISAT2 reports all alignments it can find. Using the option is equivalent to using both --max-seeds " << endl
         << "                     and -k with the maximum value that a 64-bit signed integer can represent (9,223,372,036,854,775,807)." << endl 
         << "  --repeat           report alignments to repeat sequences directly" << endl
+        << "  --repeat-compact   like --repeat, but pairs whose mates both lie in repeats are reported once" << endl
+        << "                     against the repeat sequences instead of at each genomic copy" << endl
+        << "  --repeat-table <path> write the genomic copies of every repeat to <path>, for expanding" << endl
+        << "                     alignments to repeat sequences" << endl
 		<< endl
 	    //<< " Effort:" << endl
 	    //<< "  -D <int>           give up extending after <int> failed extends in a row (15)" << endl
@@ -966,7 +1032,11 @@ static void printUsage(ostream& out) {
 	//  << "  --refidx              refer to ref. seqs by 0-based index rather than name" << endl
 		<< "  --met-file <path>     send metrics to file at <path> (off)" << endl
 		<< "  --met-stderr          send metrics to stderr (off)" << endl
+		<< "  --met-json <path>     send per-stage latency histograms as JSON lines to <path> (off)" << endl
 		<< "  --met <int>           report internal counters & metrics every <int> secs (1)" << endl
+		<< "  --slow-read-file <path> write reads that were slow to align to <path> (off)" << endl
+		<< "  --slow-read-usec <int>  capture reads taking >= <int> microseconds (100000)" << endl
+		<< "  --slow-read-fmops <int> also capture reads taking >= <int> FM-index ops (0 = off)" << endl
 	// Following is supported in the wrapper instead
 	//  << "  --no-unal             suppress SAM records for unaligned reads" << endl
 	    << "  --no-head             suppress header lines, i.e. lines starting with @" << endl
@@ -980,8 +1050,14 @@ static void printUsage(ostream& out) {
 	    << "  -o/--offrate <int> override offrate of index; must be >= index's offrate" << endl
 	    << "  -p/--threads <int> number of alignment threads to launch (1)" << endl
 	    << "  --reorder          force SAM output order to match order of input reads" << endl
+	    << "  --read-budget-fmops <int> stop searching a read after <int> FM index ops (0 = off)" << endl
+	    << "  --read-budget-exts <int>  stop searching a read after <int> extension attempts (0 = off)" << endl
+	    << "  --read-budget-usec <int>  stop searching a read after <int> microseconds (0 = off)" << endl
 #ifdef BOWTIE_MM
 	    << "  --mm               use memory-mapped I/O for index; many 'hisat2's can share" << endl
+	    << "  --lazy-local       load local indexes on first use from memory-mapped files" << endl
+	    << "  --local-lru <int>  with --lazy-local and --mm, keep at most <int> local indexes resident (0 = no limit)" << endl
+	    << "  --mm-reads         use memory-mapped I/O for uncompressed read files" << endl
 #endif
 #ifdef BOWTIE_SHARED_MEM
 		//<< "  --shmem            use shared mem for index; many 'hisat2's can share" << endl
@@ -1178,6 +1254,27 @@ static void parseOption(int next_option, const char *arg) {
 #endif
 		}
 		case ARG_MMSWEEP: mmSweep = true; break;
+		case ARG_LAZY_LOCAL: {
+#ifdef BOWTIE_MM
+			lazyLocal = true;
+			break;
+#else
+			cerr << "--lazy-local requires memory-mapped I/O, which is disabled because hisat2" << endl
+				 << "was not compiled with BOWTIE_MM defined." << endl;
+			throw 1;
+#endif
+		}
+		case ARG_MM_READS: {
+#ifdef BOWTIE_MM
+			mmapReads = true;
+			break;
+#else
+			cerr << "--mm-reads requires memory-mapped I/O, which is disabled because hisat2" << endl
+				 << "was not compiled with BOWTIE_MM defined." << endl;
+			throw 1;
+#endif
+		}
+		case ARG_LOCAL_LRU: localLRU = (size_t)parseInt(0, "--local-lru arg must be at least 0", arg); break;
 		case ARG_HADOOPOUT: hadoopOut = true; break;
 		case ARG_SOLEXA_QUALS: solexaQuals = true; break;
 		case ARG_INTEGER_QUALS: integerQuals = true; break;
@@ -1331,6 +1428,13 @@ static void parseOption(int next_option, const char *arg) {
 		case ARG_METRIC_FILE: metricsFile = arg; break;
 		case ARG_METRIC_STDERR: metricsStderr = true; break;
 		case ARG_METRIC_PER_READ: metricsPerRead = true; break;
+		case ARG_METRIC_JSON: metricsJsonFile = arg; break;
+		case ARG_SLOW_READ_FILE: slowReadFile = arg; break;
+		case ARG_SLOW_READ_USEC: slowReadUsecs = parse<uint64_t>(arg); break;
+		case ARG_SLOW_READ_FMOPS: slowReadFmops = parse<uint64_t>(arg); break;
+		case ARG_READ_BUDGET_FMOPS: readBudgetFmops = parse<uint64_t>(arg); break;
+		case ARG_READ_BUDGET_EXTS: readBudgetExts = parse<uint64_t>(arg); break;
+		case ARG_READ_BUDGET_USEC: readBudgetUsecs = parse<uint64_t>(arg); break;
 		case ARG_NO_FW: gNofw = true; break;
 		case ARG_NO_RC: gNorc = true; break;
 		case ARG_SAM_NO_QNAME_TRUNC: samTruncQname = false; break;
@@ -1686,6 +1790,17 @@ static void parseOption(int next_option, const char *arg) {
         case ARG_KNOWN_SPLICESITE_INFILE: knownSpliceSiteInfile = arg; break;
         case ARG_NOVEL_SPLICESITE_INFILE: novelSpliceSiteInfile = arg; break;
         case ARG_NOVEL_SPLICESITE_OUTFILE: novelSpliceSiteOutfile = arg; break;
+        case ARG_NOVEL_SPLICESITE_SNAPSHOT: novelSpliceSiteSnapshot = arg; break;
+        case ARG_TWO_PASS: twoPass = true; break;
+        case ARG_TEMP_SPLICESITE_WINDOW: {
+            tempSpliceSiteWin = (uint64_t)parseInt(1, "--temp-splicesite-window arg must be at least 1", arg);
+            break;
+        }
+        case ARG_TWO_PASS_READS: {
+            twoPassReads = (uint32_t)parseInt(1, "--two-pass-reads arg must be at least 1", arg);
+            twoPass = true;
+            break;
+        }
         case ARG_SECONDARY: secondary = true; break;
         case ARG_NO_SPLICED_ALIGNMENT: no_spliced_alignment = true; break;
         case ARG_RNA_STRANDNESS: {
@@ -1771,6 +1886,30 @@ static void parseOption(int next_option, const char *arg) {
             repeat = true;
             break;
         }
+        case ARG_REPEAT_COMPACT: {
+            repeat = true;
+            repeatCompact = true;
+            break;
+        }
+        case ARG_REPEAT_TABLE: {
+            repeatTableFile = arg;
+            break;
+        }
+        case ARG_SHARD: {
+            EList<string> args;
+            tokenize(arg, "/", args);
+            if(args.size() != 2) {
+                cerr << "Error: expected 2 /-separated numbers as argument to --shard; got " << arg << endl;
+                throw 1;
+            }
+            shardIdx = parse<int>(args[0].c_str());
+            nshards = parse<int>(args[1].c_str());
+            if(nshards < 1 || shardIdx < 0 || shardIdx >= nshards) {
+                cerr << "Error: --shard " << arg << " must be <i>/<N> with 0 <= <i> < <N>" << endl;
+                throw 1;
+            }
+            break;
+        }
         case ARG_NO_REPEAT_INDEX: {
             use_repeat_index = false;
             break;
@@ -1953,12 +2092,51 @@ static void parseOptions(int argc, const char **argv) {
 			}
 		}
 	}
+	if(nshards > 1) {
+		if(format != FASTQ) {
+			cerr << "Error: --shard works only with FASTQ input (-q)" << endl;
+			throw 1;
+		}
+		const EList<string>* ins[] = { &queries, &mates1, &mates2 };
+		for(size_t i = 0; i < 3; i++) {
+			for(size_t j = 0; j < ins[i]->size(); j++) {
+				if((*ins[i])[j] == "-") {
+					cerr << "Error: --shard can't read from standard input" << endl;
+					throw 1;
+				}
+			}
+		}
+	}
+	if(twoPass) {
+		if(no_spliced_alignment) {
+			cerr << "Error: --two-pass and --no-spliced-alignment are mutually exclusive" << endl;
+			throw 1;
+		}
+		const EList<string>* ins[] = { &queries, &mates1, &mates2, &mates12 };
+		for(size_t i = 0; i < 4; i++) {
+			for(size_t j = 0; j < ins[i]->size(); j++) {
+				if((*ins[i])[j] == "-") {
+					cerr << "Error: --two-pass reads its input twice and can't read from standard input" << endl;
+					throw 1;
+				}
+			}
+		}
+	}
 	// If both -s and -u are used, we need to adjust qUpto accordingly
 	// since it uses rdid to know if we've reached the -u limit (and
 	// rdids are all shifted up by skipReads characters)
 	if(qUpto + skipReads > qUpto) {
 		qUpto += skipReads;
 	}
+	if(localLRU > 0 && (!lazyLocal || !useMm)) {
+		cerr << "Error: --local-lru requires --lazy-local and --mm; only the pages of a" << endl
+		     << "memory-mapped index can be handed back to the operating system" << endl;
+		throw 1;
+	}
+	if(useShmem && lazyLocal) {
+		if(!gQuiet) cerr << "Warning: --shmem overrides --lazy-local..." << endl;
+		lazyLocal = false;
+	}
 	if(useShmem && useMm && !gQuiet) {
 		cerr << "Warning: --shmem overrides --mm..." << endl;
 		useMm = false;
@@ -2010,6 +2188,7 @@ static BitPairReference*                 multiseed_refs;
 static BitPairReference*                 multiseed_rrefs;
 static AlnSink<index_t>*                 multiseed_msink;
 static OutFileBuf*                       multiseed_metricsOfb;
+static OutFileBuf*                       multiseed_metricsJsonOfb;
 static SpliceSiteDB*                     ssdb;
 static ALTDB<index_t>*                   altdb;
 static RepeatDB<index_t>*                repeatdb;
@@ -2017,6 +2196,146 @@ static ALTDB<index_t>*                   raltdb;
 static TranscriptomePolicy*              multiseed_tpol;
 static GraphPolicy*                      gpol;
 
+/**
+ * Chooses thread_rids_mindist when threads share the splice sites they
+ * find (see --no-temp-splicesite): a splice site found by read r is used
+ * for read q only if r + window <= q, and a thread waits before aligning
+ * q until every thread is past q - window, so that the alignments don't
+ * depend on how fast each thread runs.
+ *
+ * Reads are split into epochs of maxWin reads and each epoch gets its own
+ * window.  The first two use minWin.  After that the window halves while
+ * the reads two epochs back still found at least half as many new splice
+ * sites as the best epoch so far, and doubles once they found an eighth
+ * or less, so that fast threads stop waiting for slow ones when there is
+ * little left to share.  Those reads are all aligned by the time any
+ * thread gets to the epoch, so every run picks the same windows.
+ */
+struct TempSpliceSiteWindow {
+
+	TempSpliceSiteWindow() :
+		db(NULL), minWin(0), maxWin(0), peak(0), waits(0), waitNs(0), mutex_m()
+	{ }
+
+	/**
+	 * Set up for a search.  The window is fixed if minWin_ == maxWin_.
+	 */
+	void init(SpliceSiteDB* db_, uint64_t minWin_, uint64_t maxWin_) {
+		db = db_;
+		minWin = minWin_;
+		maxWin = max(minWin_, maxWin_);
+		wins.clear();
+		sites.clear();
+		peak = 0;
+		waits = waitNs = 0;
+		if(adaptive()) {
+			db->trackDiscovery(maxWin);
+		}
+	}
+
+	bool adaptive() const { return db != NULL && maxWin > minWin; }
+
+	/**
+	 * Return the window for read rdid and set until to the first read
+	 * after rdid's epoch.  If no thread has got to the epoch yet, wait for
+	 * the reads its window depends on and choose it.
+	 */
+	uint64_t window(uint64_t rdid, uint64_t& until) {
+		if(!adaptive()) {
+			until = std::numeric_limits<uint64_t>::max();
+			return minWin;
+		}
+		uint64_t epoch = rdid / maxWin;
+		until = (epoch + 1) * maxWin;
+		{
+			ThreadSafe ts(&mutex_m);
+			if(epoch < wins.size()) return wins[epoch];
+		}
+		if(epoch >= 2) {
+			waitFor((epoch - 1) * maxWin - 1);
+		}
+		ThreadSafe ts(&mutex_m);
+		while(wins.size() <= epoch) {
+			uint64_t win = minWin;
+			if(wins.size() >= 2) {
+				uint64_t n = db->numDiscovered(wins.size() - 2);
+				if(n > peak) peak = n;
+				win = wins.back();
+				if(n > 0 && n * 2 >= peak) {
+					win = max(win / 2, minWin);
+				} else if(n * 8 <= peak) {
+					win = min(win * 2, maxWin);
+				}
+				sites.push_back(n);
+			}
+			wins.push_back(win);
+		}
+		return wins[epoch];
+	}
+
+	/**
+	 * Wait until every thread's current read is past rdid.
+	 */
+	void waitFor(uint64_t rdid) {
+		if(minThreadRid() >= rdid) return;
+		uint64_t start = nanoTime();
+		while(minThreadRid() < rdid) {
+#if defined(_TTHREAD_WIN32_)
+			Sleep(0);
+#elif defined(_TTHREAD_POSIX_)
+			sched_yield();
+#endif
+		}
+		uint64_t ns = nanoTime() - start;
+		ThreadSafe ts(&mutex_m);
+		waits++;
+		waitNs += ns;
+	}
+
+	static uint64_t minThreadRid() {
+		uint64_t min_rdid = thread_rids[0];
+		for(size_t i = 1; i < thread_rids.size(); i++) {
+			if(thread_rids[i] < min_rdid) {
+				min_rdid = thread_rids[i];
+			}
+		}
+		return min_rdid;
+	}
+
+	/**
+	 * Append the windows chosen so far and the time threads spent waiting
+	 * to a JSON object.
+	 */
+	void reportJson(ostream& js) {
+		ThreadSafe ts(&mutex_m);
+		uint64_t minRid = 0, maxRid = 0;
+		for(size_t i = 0; i < thread_rids.size(); i++) {
+			if(i == 0 || thread_rids[i] < minRid) minRid = thread_rids[i];
+			if(i == 0 || thread_rids[i] > maxRid) maxRid = thread_rids[i];
+		}
+		js << "\"window\":" << (wins.empty() ? minWin : wins.back())
+		   << ",\"min_window\":" << minWin
+		   << ",\"max_window\":" << maxWin
+		   << ",\"epochs\":" << wins.size()
+		   << ",\"new_sites\":" << (sites.empty() ? 0 : sites.back())
+		   << ",\"thread_lag\":" << (maxRid - minRid)
+		   << ",\"waits\":" << waits
+		   << ",\"wait_ns\":" << waitNs;
+	}
+
+	SpliceSiteDB*   db;
+	uint64_t        minWin;
+	uint64_t        maxWin; // also the # reads per epoch
+	EList<uint64_t> wins;   // window chosen for each epoch so far
+	EList<uint64_t> sites;  // new splice sites the decisions were based on
+	uint64_t        peak;   // most new splice sites found in an epoch
+	uint64_t        waits;  // # times a thread had to wait
+	uint64_t        waitNs; // nanoseconds threads spent waiting
+	MUTEX_T         mutex_m;
+};
+
+static TempSpliceSiteWindow tempSpliceSiteWindow;
+
 /**
  * Metrics for measuring the work done by the outer read alignment
  * loop.
@@ -2336,6 +2655,9 @@ struct PerfMetrics {
                 /* 135 */ "GlobalGenomeCoords"  "\t"
                 /* 136 */ "LocalGenomeCoords"   "\t"
             
+                /* 137 */ "SpliceSiteWindow"    "\t"
+                /* 138 */ "SpliceSiteWaitUsecs" "\t"
+            
             
 				"\n";
 			
@@ -2930,13 +3252,73 @@ struct PerfMetrics {
 		if(o != NULL) { o->writeChars(buf); o->write('\t'); }
         // 136
         itoa10<size_t>(him.localgenomecoords, buf);
-        if(metricsStderr) stderrSs << buf;
-		if(o != NULL) { o->writeChars(buf); }
+        if(metricsStderr) stderrSs << buf << '\t';
+		if(o != NULL) { o->writeChars(buf); o->write('\t'); }
+        {
+            ThreadSafe ts(&tempSpliceSiteWindow.mutex_m);
+            // 137
+            const EList<uint64_t>& wins = tempSpliceSiteWindow.wins;
+            itoa10<uint64_t>(wins.empty() ? tempSpliceSiteWindow.minWin : wins.back(), buf);
+            if(metricsStderr) stderrSs << buf << '\t';
+            if(o != NULL) { o->writeChars(buf); o->write('\t'); }
+            // 138
+            itoa10<uint64_t>(tempSpliceSiteWindow.waitNs / 1000, buf);
+            if(metricsStderr) stderrSs << buf;
+            if(o != NULL) { o->writeChars(buf); }
+        }
 
 		if(o != NULL) { o->write('\n'); }
 		if(metricsStderr) cerr << stderrSs.str().c_str() << endl;
 		if(!total) mergeIncrementals();
 	}
+
+	/**
+	 * Write one JSON object (on a single line) summarizing the per-stage
+	 * latency histograms and hierarchical-index counters accumulated so far.
+	 * Histograms are cumulative over the whole job; 'final' is set for the
+	 * record written once all reads are aligned.
+	 */
+	void reportJson(
+		OutFileBuf* o,   // file to send output to
+		bool final,      // true -> this is the last record of the job
+		bool sync)       // synchronize output
+	{
+		if(o == NULL) return;
+		ThreadSafe ts(&mutex_m, sync);
+		ostringstream js;
+		js << "{\"time\":" << time(0)
+		   << ",\"final\":" << (final ? "true" : "false")
+		   << ",\"reads\":" << (olm.reads + olmu.reads)
+		   << ",\"bases\":" << (olm.bases + olmu.bases)
+		   << ",\"stages\":{";
+		for(size_t i = 0; i < HI_NUM_STAGES; i++) {
+			const LatencyHistogram& h = him.stages[i];
+			if(i > 0) js << ',';
+			js << '"' << hi_stage_names[i] << "\":{"
+			   << "\"count\":"     << h.count
+			   << ",\"total_ns\":" << h.sum
+			   << ",\"mean_ns\":"  << (uint64_t)(h.mean() + 0.5)
+			   << ",\"p50_ns\":"   << h.quantile(0.5)
+			   << ",\"p90_ns\":"   << h.quantile(0.9)
+			   << ",\"p99_ns\":"   << h.quantile(0.99)
+			   << ",\"p999_ns\":"  << h.quantile(0.999)
+			   << ",\"max_ns\":"   << h.max
+			   << '}';
+		}
+		js << "},\"counters\":{"
+		   << "\"local_search\":"          << him.localatts
+		   << ",\"anchor_search\":"        << him.anchoratts
+		   << ",\"local_index_search\":"   << him.localindexatts
+		   << ",\"local_ext_search\":"     << him.localextatts
+		   << ",\"local_search_recur\":"   << him.localsearchrecur
+		   << ",\"global_genome_coords\":" << him.globalgenomecoords
+		   << ",\"local_genome_coords\":"  << him.localgenomecoords
+		   << "},\"splice_site_window\":{";
+		tempSpliceSiteWindow.reportJson(js);
+		js << "}}\n";
+		o->writeString(js.str());
+		o->flush();
+	}
 	
 	void mergeIncrementals() {
 		olm.merge(olmu, false);
@@ -3007,6 +3389,110 @@ struct PerfMetrics {
 
 static PerfMetrics metrics;
 
+/**
+ * Captures reads whose alignment took longer than --slow-read-usec
+ * microseconds or more than --slow-read-fmops FM-index operations.  Each
+ * captured read is written as one tab-separated line holding its name,
+ * the work counters accumulated while aligning it, and its sequence and
+ * qualities, so that pathological inputs can be collected into a
+ * regression corpus.
+ */
+struct SlowReadLog {
+
+	SlowReadLog() : o(NULL), usecs(0), fmops(0), mutex_m() { }
+
+	/**
+	 * Set the file to send captured reads to and write the header line.
+	 */
+	void init(OutFileBuf* o_, uint64_t usecs_, uint64_t fmops_) {
+		o = o_;
+		usecs = usecs_;
+		fmops = fmops_;
+		if(o == NULL) return;
+		o->writeString(string("#name\telapsed_us\tfmops"
+		               "\tlocalatts\tanchoratts\tlocalindexatts\tlocalextatts"
+		               "\tlocalsearchrecur\tglobalgenomecoords\tlocalgenomecoords"
+		               "\texdps\tmatedps\texugs\tmateugs"
+		               "\tseq1\tqual1\tseq2\tqual2\n"));
+		o->flush();
+	}
+
+	/**
+	 * Return true iff a read that took the given time and FM-index
+	 * operations should be captured.
+	 */
+	bool slow(uint64_t elapsedUs, uint64_t nfmops) const {
+		if(o == NULL) return false;
+		return elapsedUs >= usecs || (fmops > 0 && nfmops >= fmops);
+	}
+
+	/**
+	 * Write one captured read.  hiBeg holds the HIMetrics counters as
+	 * they were before the read was aligned; him holds them after.
+	 */
+	void write(
+		const Read& rd1,
+		const Read* rd2,
+		uint64_t elapsedUs,
+		const PerReadMetrics& prm,
+		const HIMetrics& hiBeg,
+		const HIMetrics& him,
+		bool sync)
+	{
+		BTString buf;
+		char ibuf[32];
+		buf.append(rd1.name.toZBuf());
+		const uint64_t cnts[] = {
+			elapsedUs,
+			prm.nSdFmops,
+			him.localatts          - hiBeg.localatts,
+			him.anchoratts         - hiBeg.anchoratts,
+			him.localindexatts     - hiBeg.localindexatts,
+			him.localextatts       - hiBeg.localextatts,
+			him.localsearchrecur   - hiBeg.localsearchrecur,
+			him.globalgenomecoords - hiBeg.globalgenomecoords,
+			him.localgenomecoords  - hiBeg.localgenomecoords,
+			prm.nExDps,
+			prm.nMateDps,
+			prm.nExUgs,
+			prm.nMateUgs
+		};
+		for(size_t i = 0; i < sizeof(cnts) / sizeof(cnts[0]); i++) {
+			buf.append('\t');
+			itoa10<uint64_t>(cnts[i], ibuf);
+			buf.append(ibuf);
+		}
+		appendRead(rd1, buf);
+		if(rd2 != NULL) {
+			appendRead(*rd2, buf);
+		} else {
+			buf.append("\t*\t*");
+		}
+		buf.append('\n');
+		ThreadSafe ts(&mutex_m, sync);
+		o->writeString(buf);
+		o->flush();
+	}
+
+	OutFileBuf* o;     // file to send captured reads to; NULL -> off
+	uint64_t    usecs; // capture reads taking at least this many microseconds
+	uint64_t    fmops; // capture reads taking at least this many FM ops; 0 -> off
+	MUTEX_T     mutex_m;
+
+protected:
+
+	static void appendRead(const Read& rd, BTString& buf) {
+		buf.append('\t');
+		for(size_t i = 0; i < rd.patFw.length(); i++) {
+			buf.append("ACGTN"[(int)rd.patFw[i]]);
+		}
+		buf.append('\t');
+		buf.append(rd.qual.toZBuf());
+	}
+};
+
+static SlowReadLog slowReads;
+
 // Cyclic rotations
 #define ROTL(n, x) (((x) << (n)) | ((x) >> (32-n)))
 #define ROTR(n, x) (((x) >> (n)) | ((x) << (32-n)))
@@ -3157,6 +3643,7 @@ static void multiseedSearchWorker_hisat2(void *vp) {
     const BitPairReference*          rref     = multiseed_rrefs;
 	AlnSink<index_t>&                msink    = *multiseed_msink;
 	OutFileBuf*                      metricsOfb = multiseed_metricsOfb;
+	OutFileBuf*                      metricsJsonOfb = multiseed_metricsJsonOfb;
     
 	// Sinks: these are so that we can print tables encoding counts for
 	// events of interest on a per-read, per-seed, per-join, or per-SW
@@ -3183,7 +3670,8 @@ static void multiseedSearchWorker_hisat2(void *vp) {
                        localAlign,
                        bowtie2_dp,
                        sensitive | very_sensitive,
-                       repeat);
+                       repeat,
+                       repeatCompact);
     
 	// Instantiate a mapping quality calculator
 	auto_ptr<Mapq> bmapq(new_mapq(mapqv, scoreMin, sc));
@@ -3218,6 +3706,9 @@ static void multiseedSearchWorker_hisat2(void *vp) {
 	uint64_t nbtfiltsc = 0; // TODO: find a new home for these
 	uint64_t nbtfiltdo = 0; // TODO: find a new home for these
     HIMetrics him;
+    him.timeStages = (metricsJsonOfb != NULL);
+    msinkwrap.timeOutput(him.timeStages);
+    HIMetrics himBeg; // counters as of the start of the current read
     
 	ASSERT_ONLY(BTDnaString tmp);
     
@@ -3248,6 +3739,9 @@ static void multiseedSearchWorker_hisat2(void *vp) {
 	BTString nametmp;
 	
 	PerReadMetrics prm;
+	prm.maxFmops = readBudgetFmops;
+	prm.maxExtAtts = readBudgetExts;
+	prm.maxUsecs = readBudgetUsecs;
     
 	// Used by thread with threadid == 1 to measure time elapsed
 	time_t iTime = time(0);
@@ -3270,6 +3764,10 @@ static void multiseedSearchWorker_hisat2(void *vp) {
 	rndArb.init((uint32_t)time(0));
 	int mergei = 0;
 	int mergeival = 16;
+	// Window for splice sites found by other threads' reads, and the
+	// first read it no longer applies to
+	uint64_t mindist = thread_rids_mindist;
+	uint64_t mindistUntil = 0;
 	while(true) {
 		bool success = false, done = false, paired = false;
 		ps->nextReadPair(success, done, paired, outType != OUTPUT_SAM);
@@ -3284,23 +3782,13 @@ static void multiseedSearchWorker_hisat2(void *vp) {
             assert_leq(tid, thread_rids.size());
             assert(thread_rids[tid - 1] == 0 || rdid > thread_rids[tid - 1]);
             thread_rids[tid - 1] = (rdid > 0 ? rdid - 1 : 0);
-            while(true) {
-                uint64_t min_rdid = thread_rids[0];
-                {
-                    for(size_t i = 1; i < thread_rids.size(); i++) {
-                        if(thread_rids[i] < min_rdid) {
-                            min_rdid = thread_rids[i];
-                        }
-                    }
-                }
-                
-                if(min_rdid + thread_rids_mindist < rdid) {
-#if defined(_TTHREAD_WIN32_)
-                    Sleep(0);
-#elif defined(_TTHREAD_POSIX_)
-                    sched_yield();
-#endif
-                } else break;
+            if(rdid >= mindistUntil) {
+                mindist = tempSpliceSiteWindow.window(rdid, mindistUntil);
+                msinkwrap.threadRidsMindist(mindist);
+                splicedAligner.threadRidsMindist(mindist);
+            }
+            if(rdid > mindist) {
+                tempSpliceSiteWindow.waitFor(rdid - mindist);
             }
         }
         
@@ -3320,7 +3808,7 @@ static void multiseedSearchWorker_hisat2(void *vp) {
 			// Check if there is metrics reporting for us to do.
 			//
 			if(metricsIval > 0 &&
-			   (metricsOfb != NULL || metricsStderr) &&
+			   (metricsOfb != NULL || metricsStderr || metricsJsonOfb != NULL) &&
 			   !metricsPerRead &&
 			   ++mergei == mergeival)
 			{
@@ -3329,17 +3817,35 @@ static void multiseedSearchWorker_hisat2(void *vp) {
 				MERGE_METRICS(metrics, nthreads > 1);
 				mergei = 0;
 				// Check if a progress message should be printed
-				if(tid == 0) {
+				if(tid == 1) {
 					// Only thread 1 prints progress messages
 					time_t curTime = time(0);
 					if(curTime - iTime >= metricsIval) {
-						metrics.reportInterval(metricsOfb, metricsStderr, false, true, NULL);
+						if(metricsOfb != NULL || metricsStderr) {
+							metrics.reportInterval(metricsOfb, metricsStderr, false, true, NULL);
+						}
+						metrics.reportJson(metricsJsonOfb, false, true);
 						iTime = curTime;
 					}
 				}
 			}
+			const bool logSlow = (slowReads.o != NULL);
+			uint64_t readStart = (him.timeStages || logSlow) ? nanoTime() : 0;
+			if(logSlow) {
+				himBeg.init(
+					him.localatts,
+					him.anchoratts,
+					him.localindexatts,
+					him.localextatts,
+					him.localsearchrecur,
+					him.globalgenomecoords,
+					him.localgenomecoords);
+			}
 			prm.reset(); // per-read metrics
 			prm.doFmString = false;
+			if(prm.maxUsecs > 0) {
+				prm.begNs = (readStart > 0 ? readStart : nanoTime());
+			}
 			if(sam_print_xt) {
 				gettimeofday(&prm.tv_beg, &prm.tz_beg);
 			}
@@ -3604,6 +4110,7 @@ static void multiseedSearchWorker_hisat2(void *vp) {
                 }
                 
 				// Commit and report paired-end/unpaired alignments
+				uint64_t reportStart = him.timeStages ? nanoTime() : 0;
 				msinkwrap.finishRead(
                                      NULL,
                                      NULL,
@@ -3625,8 +4132,29 @@ static void multiseedSearchWorker_hisat2(void *vp) {
                                      !seedSumm,            // suppress seed summaries?
                                      seedSumm,             // suppress alignments?
                                      templateLenAdjustment);
+				if(him.timeStages) {
+					uint64_t outputNs = msinkwrap.outputNs();
+					him.recordStage(HI_STAGE_REPORT, nanoTime() - reportStart - outputNs);
+					him.recordStage(HI_STAGE_OUTPUT, outputNs);
+				}
 				assert(!retry || msinkwrap.empty());
 			} // while(retry)
+			if(him.timeStages || logSlow) {
+				uint64_t readNs = nanoTime() - readStart;
+				if(him.timeStages) {
+					him.recordStage(HI_STAGE_READ, readNs);
+				}
+				if(slowReads.slow(readNs / 1000, prm.nSdFmops)) {
+					slowReads.write(
+						ps->bufa(),
+						paired ? &ps->bufb() : NULL,
+						readNs / 1000,
+						prm,
+						himBeg,
+						him,
+						nthreads > 1);
+				}
+			}
 		} // if(rdid >= skipReads && rdid < qUpto)
 		else if(rdid >= qUpto) {
 			break;
@@ -3661,7 +4189,8 @@ static void multiseedSearch(
                             RFM<index_t>* rgfm,           // index of repeat sequences
                             BitPairReference* refs,       // base reference
                             BitPairReference* rrefs,      // repeat reference
-                            OutFileBuf *metricsOfb)
+                            OutFileBuf *metricsOfb,
+                            OutFileBuf *metricsJsonOfb)
 {
     multiseed_patsrc       = &patsrc;
 	multiseed_msink        = &msink;
@@ -3671,6 +4200,7 @@ static void multiseedSearch(
     multiseed_tpol         = &tpol;
     gpol                   = &gp;
 	multiseed_metricsOfb   = metricsOfb;
+	multiseed_metricsJsonOfb = metricsJsonOfb;
 	multiseed_refs         = refs;
     multiseed_rrefs        = rrefs;
 	AutoArray<tthread::thread*> threads(nthreads);
@@ -3681,7 +4211,14 @@ static void multiseedSearch(
         
         thread_rids.resize(nthreads);
         thread_rids.fill(0);
-        thread_rids_mindist = (nthreads == 1 || !useTempSpliceSite ? 0 : 1000 * nthreads);        
+        thread_rids_mindist = 0;
+        if(nthreads > 1 && useTempSpliceSite) {
+            thread_rids_mindist = (tempSpliceSiteWin > 0 ? tempSpliceSiteWin : 1000 * nthreads);
+        }
+        tempSpliceSiteWindow.init(
+                                  ssdb,
+                                  thread_rids_mindist,
+                                  tempSpliceSiteWin > 0 ? thread_rids_mindist : 16 * thread_rids_mindist);
 		for(int i = 0; i < nthreads; i++) {
 			// Thread IDs start at 1
 			tids[i] = i+1;
@@ -3695,6 +4232,52 @@ static void multiseedSearch(
 	if(!metricsPerRead && (metricsOfb != NULL || metricsStderr)) {
 		metrics.reportInterval(metricsOfb, metricsStderr, true, false, NULL);
 	}
+	metrics.reportJson(metricsJsonOfb, true, false);
+}
+
+/**
+ * Create the splice site database the aligners consult: splice sites
+ * from the index's ALTs, then the known splice sites, then those in
+ * sites (a snapshot built in this process), if any, then the novel ones
+ * given on the command line.
+ */
+static SpliceSiteDB* newSpliceSiteDB(
+                                     const BitPairReference& refs,
+                                     const EList<string>& refnames,
+                                     HGFM<index_t>& gfm,
+                                     bool write,
+                                     bool read,
+                                     const EList<char>* sites = NULL)
+{
+    SpliceSiteDB* db = new SpliceSiteDB(
+                                        refs,
+                                        refnames,
+                                        nthreads > 1, // thread-safe
+                                        write, // write?
+                                        read);  // read?
+    db->read(gfm, altdb->alts());
+    if(knownSpliceSiteInfile != "" &&
+       !db->readSnapshot(knownSpliceSiteInfile, true)) {
+        ifstream ssdb_file(knownSpliceSiteInfile.c_str(), ios::in);
+        if(ssdb_file.is_open()) {
+            db->read(ssdb_file,
+                     true); // known splice sites
+            ssdb_file.close();
+        }
+    }
+    if(sites != NULL) {
+        db->loadSnapshot(*sites, false);
+    }
+    if(novelSpliceSiteInfile != "" &&
+       !db->readSnapshot(novelSpliceSiteInfile, false)) {
+        ifstream ssdb_file(novelSpliceSiteInfile.c_str(), ios::in);
+        if(ssdb_file.is_open()) {
+            db->read(ssdb_file,
+                     false); // novel splice sites
+            ssdb_file.close();
+        }
+    }
+    return db;
 }
 
 static string argstr;
@@ -3736,7 +4319,10 @@ static void driver(
 		fuzzy,         // true -> try to parse fuzzy fastq
 		fastaContLen,  // length of sampled reads for FastaContinuous...
 		fastaContFreq, // frequency of sampled reads for FastaContinuous...
-		skipReads      // skip the first 'skip' patterns
+		skipReads,     // skip the first 'skip' patterns
+		shardIdx,      // read only this byte range of each input...
+		nshards,       // ...out of this many
+		mmapReads      // memory-map uncompressed read files
 	);
 	if(gVerbose || startVerbose) {
 		cerr << "Creating PatternSource: "; logTime(cerr, true);
@@ -3755,6 +4341,25 @@ static void driver(
 		pp,          // read read-in parameters
         nthreads,
 		gVerbose || startVerbose); // be talkative
+	// With --two-pass the reads are aligned twice; the first pass gets a
+	// pattern source of its own
+	PairedPatternSource *patsrc1 = NULL;
+	if(twoPass) {
+		patsrc1 = PairedPatternSource::setupPatternSources(
+			queries,
+			mates1,
+			mates2,
+			mates12,
+#ifdef USE_SRA
+			sra_accs,
+#endif
+			qualities,
+			qualities1,
+			qualities2,
+			pp,
+			nthreads,
+			gVerbose || startVerbose);
+	}
 	// Open hit output file
 	if(gVerbose || startVerbose) {
 		cerr << "Opening hit output file: "; logTime(cerr, true);
@@ -3819,6 +4424,8 @@ static void driver(
         // Load the other half of the index into memory
         assert(!gfm.isInMemory());
         Timer _t(cerr, "Time loading forward index: ", timing);
+        gfm.setNThreads(nthreads); // local indexes are loaded in parallel
+        gfm.setLazyLocal(lazyLocal, localLRU);
         gfm.loadIntoMemory(
                            -1, // not the reverse index
                            true,         // load SA samp? (yes, need forward index's SA samp)
@@ -3972,6 +4579,20 @@ static void driver(
             }
         }
 
+        if(!repeatTableFile.empty()) {
+            if(rep_index_exists && use_repeat_index) {
+                ofstream repeatTable(repeatTableFile.c_str(), ios::out);
+                if(!repeatTable.is_open()) {
+                    cerr << "Error: could not open " << repeatTableFile << " for writing" << endl;
+                    throw 1;
+                }
+                repeatdb->writeTable(repeatTable, repnames, refnames);
+            } else {
+                cerr << "Warning: --repeat-table was specified but no repeat index is in use; not writing "
+                     << repeatTableFile << endl;
+            }
+        }
+
         EList<size_t> empty_replens;
         EList<string> empty_repnames;
 		SamConfig<index_t> samc(
@@ -4086,30 +4707,71 @@ static void driver(
                          enable_codis);
         
         init_junction_prob();
-        bool write = novelSpliceSiteOutfile != "" || useTempSpliceSite;
-        bool read = knownSpliceSiteInfile != "" || novelSpliceSiteInfile != "" || useTempSpliceSite || altdb->hasSpliceSites();
-        ssdb = new SpliceSiteDB(
-                                *(refs.get()),
-                                refnames,
-                                nthreads > 1, // thread-safe
-                                write, // write?
-                                read);  // read?
-        ssdb->read(gfm, altdb->alts());
-        if(knownSpliceSiteInfile != "") {
-            ifstream ssdb_file(knownSpliceSiteInfile.c_str(), ios::in);
-            if(ssdb_file.is_open()) {
-                ssdb->read(ssdb_file,
-                           true); // known splice sites
-                ssdb_file.close();
+        // Database the output sink adds splice sites to; the same as the
+        // one the aligners read from unless --two-pass is used
+        SpliceSiteDB* ssdbOut = NULL;
+        if(twoPass) {
+            // First pass: align the first --two-pass-reads reads (or all of
+            // them) as usual, but only to collect the splice sites they
+            // support.  Its alignments are thrown away.
+            EList<char> sites;
+            {
+                Timer _t(cerr, "Time collecting splice sites (first pass): ", timing);
+                ssdb = newSpliceSiteDB(*(refs.get()), refnames, gfm,
+                                       true,  // write?
+                                       true); // read?
+                OutFileBuf fout1("/dev/null");
+                OutputQueue oq1(
+                                fout1,
+                                reorder && nthreads > 1,
+                                nthreads,
+                                nthreads > 1,
+                                skipReads);
+                AlnSinkSam<index_t> msink1(
+                                           oq1,
+                                           samc,
+                                           refnames,
+                                           repnames,
+                                           true, // quiet
+                                           altdb,
+                                           ssdb);
+                uint32_t qUptoAll = qUpto;
+                if(twoPassReads > 0 && qUpto > skipReads && twoPassReads < qUpto - skipReads) {
+                    qUpto = skipReads + twoPassReads;
+                }
+                bool metricsStderrAll = metricsStderr;
+                metricsStderr = false;
+                multiseedSearch(sc, tpol, gpol, *patsrc1, msink1, gfm, rgfm, refs.get(), rrefs, NULL, NULL);
+                oq1.flush(true);
+                qUpto = qUptoAll;
+                metricsStderr = metricsStderrAll;
+                metrics.reset();
+                ssdb->snapshot(sites);
+                delete ssdb;
+                ssdb = NULL;
+                delete patsrc1;
+                patsrc1 = NULL;
             }
-        }
-        if(novelSpliceSiteInfile != "") {
-            ifstream ssdb_file(novelSpliceSiteInfile.c_str(), ios::in);
-            if(ssdb_file.is_open()) {
-                ssdb->read(ssdb_file,
-                           false); // novel splice sites
-                ssdb_file.close();
+            // Second pass: the aligners only read the splice sites, so no
+            // locking and no waiting for other threads to catch up on the
+            // sites found so far.  Sites are still counted for
+            // --novel-splicesite-outfile/-snapshot, in a separate database.
+            useTempSpliceSite = false;
+            ssdb = newSpliceSiteDB(*(refs.get()), refnames, gfm,
+                                   false, // write?
+                                   true,  // read?
+                                   &sites);
+            if(novelSpliceSiteOutfile != "" || novelSpliceSiteSnapshot != "") {
+                ssdbOut = newSpliceSiteDB(*(refs.get()), refnames, gfm,
+                                          true,  // write?
+                                          false, // read?
+                                          &sites);
             }
+        } else {
+            bool write = novelSpliceSiteOutfile != "" || novelSpliceSiteSnapshot != "" || useTempSpliceSite;
+            bool read = knownSpliceSiteInfile != "" || novelSpliceSiteInfile != "" || useTempSpliceSite || altdb->hasSpliceSites();
+            ssdb = newSpliceSiteDB(*(refs.get()), refnames, gfm, write, read);
+            ssdbOut = ssdb;
         }
 		switch(outType) {
 			case OUTPUT_SAM: {
@@ -4120,7 +4782,7 @@ static void driver(
                                                  repnames,     // repeat names
                                                  gQuiet,       // don't print alignment summary at end
                                                  altdb,
-                                                 ssdb);
+                                                 ssdbOut);
 				if(!samNoHead) {
 					bool printHd = true, printSq = true;
 					BTString buf;
@@ -4141,6 +4803,15 @@ static void driver(
 		if(!metricsFile.empty() && metricsIval > 0) {
 			metricsOfb = new OutFileBuf(metricsFile);
 		}
+		OutFileBuf *metricsJsonOfb = NULL;
+		if(!metricsJsonFile.empty()) {
+			metricsJsonOfb = new OutFileBuf(metricsJsonFile);
+		}
+		OutFileBuf *slowReadOfb = NULL;
+		if(!slowReadFile.empty()) {
+			slowReadOfb = new OutFileBuf(slowReadFile);
+		}
+		slowReads.init(slowReadOfb, slowReadUsecs, slowReadFmops);
 		// Do the search for all input reads
 		assert(patsrc != NULL);
 		assert(mssink != NULL);
@@ -4154,7 +4825,8 @@ static void driver(
                         rgfm,
                         refs.get(),
                         rrefs,
-                        metricsOfb);
+                        metricsOfb,
+                        metricsJsonOfb);
 		// Evict any loaded indexes from memory
 		if(gfm.isInMemory()) {
 			gfm.evictFromMemory();
@@ -4183,14 +4855,17 @@ static void driver(
                 }
             }
 		}
-        if(ssdb != NULL) {
+        if(ssdbOut != NULL) {
             if(novelSpliceSiteOutfile != "") {
                 ofstream ssdb_file(novelSpliceSiteOutfile.c_str(), ios::out);
                 if(ssdb_file.is_open()) {
-                    ssdb->print(ssdb_file);
+                    ssdbOut->print(ssdb_file);
                     ssdb_file.close();
                 }
             }
+            if(novelSpliceSiteSnapshot != "") {
+                ssdbOut->writeSnapshot(novelSpliceSiteSnapshot);
+            }
         }
 		oq.flush(true);
 		assert_eq(oq.numStarted(), oq.numFinished());
@@ -4200,8 +4875,12 @@ static void driver(
         delete altdb;
         delete repeatdb;
         delete raltdb;
+        if(ssdbOut != ssdb) delete ssdbOut;
         delete ssdb;
 		delete metricsOfb;
+		delete metricsJsonOfb;
+		slowReads.init(NULL, 0, 0);
+		delete slowReadOfb;
         delete rgfm;
         delete rrefs;
 		if(fout != NULL) {
@@ -513,7 +513,7 @@ static void driver(
 		if(!reverse && (writeRef || justRef)) {
 			filesWritten.push_back(outfile + ".3." + gfm_ext);
 			filesWritten.push_back(outfile + ".4." + gfm_ext);
-            sztot = BitPairReference::szsFromFasta(is, outfile, bigEndian, refparams, szs, sanityCheck);
+            sztot = BitPairReference::szsFromFasta(is, outfile, bigEndian, refparams, szs, sanityCheck, NULL, nthreads);
 		} else {
             assert(false);
 			sztot = BitPairReference::szsFromFasta(is, string(), bigEndian, refparams, szs, sanityCheck);
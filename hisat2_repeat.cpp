@@ -755,7 +755,8 @@ static void driver(
                                               szs,
                                               ref_names,
                                               forward_only,
-                                              outfile);
+                                              outfile,
+                                              nthreads);
             cerr << "RepeatBuilder: " << outfile << " " << rp.min_repeat_len << "-" << rp.max_repeat_len << endl;
 
             {
@@ -0,0 +1,332 @@
+// The class computes the log likelihood of every allele pair given the
+// compatibility of each alignment with each allele.
+
+#ifndef _LSONG_LIKELIHOOD_HEADER
+#define _LSONG_LIKELIHOOD_HEADER
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+#include <vector>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "defs.h"
+
+// Counts over a range of alignments for one allele pair (j, k).  With vj, vk
+// the compatibility of an alignment with j and k, and mx, mn their max and
+// min, the alignment contributes 100 * mx - 2 * [ mx - mn == 2 && mx != 0 ]
+// hundredths to the log likelihood, and assigns itself to j with weight
+// 1, 0.99, 0.5, 0.01 or 0 according to gt, sgt, eq and slt.
+struct _pairStats
+{
+	int64_t sumMax ;
+	int64_t gt, eq ; // vj > vk, vj == vk
+	int64_t sgt, slt ; // vj == vk + 2 or vk == vj + 2, and the larger is not 0
+
+	int64_t LogLikelihood100() const
+	{
+		return 100 * sumMax - 2 * ( sgt + slt ) ;
+	}
+
+	// Weight (in hundredths) of the alignments assigned to j.
+	int64_t WeightJ100() const
+	{
+		return 100 * gt + 50 * eq - sgt + slt ;
+	}
+} ;
+
+class AllelePairLikelihood
+{
+private:
+	int numOfAllele ;
+	int binSize ;
+	int numOfAlignments ;
+
+	std::vector<int> rows ; // compatibility, one row of numOfAllele per alignment, while streaming
+	std::vector<int> compatibility ; // compatibility, one row of stride per allele
+	size_t stride ;
+	std::vector<int64_t> binStart ; // bin of each alignment's start
+	std::vector<int> runs ; // first alignment of each run of alignments in the same bin, then numOfAlignments
+
+	const int *alleleLength ;
+	double *logLikelihood ;
+
+	// Work distribution
+	pthread_mutex_t lock ;
+	std::vector<struct _pair> tiles ;
+	size_t nextTile ;
+
+	static const int tileSize = 16 ;
+	static const int flushInterval = 1 << 16 ;
+
+	void Stats( const int *vj, const int *vk, int from, int to, struct _pairStats &s ) const
+	{
+		memset( &s, 0, sizeof( s ) ) ;
+		int i = from ;
+#ifdef __SSE2__
+		const __m128i zero = _mm_setzero_si128() ;
+		const __m128i two = _mm_set1_epi32( 2 ) ;
+		while ( i + 4 <= to )
+		{
+			// Accumulate in 32-bit lanes for at most flushInterval vectors
+			int end = to - ( to - i ) % 4 ;
+			if ( end - i > 4 * flushInterval )
+				end = i + 4 * flushInterval ;
+			__m128i sumMax = zero, gt = zero, eq = zero, sgt = zero, slt = zero ;
+			for ( ; i < end ; i += 4 )
+			{
+				__m128i a = _mm_loadu_si128( (const __m128i *)( vj + i ) ) ;
+				__m128i b = _mm_loadu_si128( (const __m128i *)( vk + i ) ) ;
+				__m128i mgt = _mm_cmpgt_epi32( a, b ) ;
+				__m128i mlt = _mm_cmpgt_epi32( b, a ) ;
+				__m128i meq = _mm_cmpeq_epi32( a, b ) ;
+				__m128i mx = _mm_or_si128( _mm_and_si128( mgt, a ), _mm_andnot_si128( mgt, b ) ) ;
+				__m128i mn = _mm_or_si128( _mm_and_si128( mgt, b ), _mm_andnot_si128( mgt, a ) ) ;
+				__m128i spec = _mm_andnot_si128( _mm_cmpeq_epi32( mx, zero ),
+					_mm_cmpeq_epi32( _mm_sub_epi32( mx, mn ), two ) ) ;
+				sumMax = _mm_add_epi32( sumMax, mx ) ;
+				// Masks are -1, so subtracting them counts
+				gt = _mm_sub_epi32( gt, mgt ) ;
+				eq = _mm_sub_epi32( eq, meq ) ;
+				sgt = _mm_sub_epi32( sgt, _mm_and_si128( spec, mgt ) ) ;
+				slt = _mm_sub_epi32( slt, _mm_and_si128( spec, mlt ) ) ;
+			}
+			int lanes[5][4] ;
+			_mm_storeu_si128( (__m128i *)lanes[0], sumMax ) ;
+			_mm_storeu_si128( (__m128i *)lanes[1], gt ) ;
+			_mm_storeu_si128( (__m128i *)lanes[2], eq ) ;
+			_mm_storeu_si128( (__m128i *)lanes[3], sgt ) ;
+			_mm_storeu_si128( (__m128i *)lanes[4], slt ) ;
+			for ( int l = 0 ; l < 4 ; ++l )
+			{
+				s.sumMax += lanes[0][l] ;
+				s.gt += lanes[1][l] ;
+				s.eq += lanes[2][l] ;
+				s.sgt += lanes[3][l] ;
+				s.slt += lanes[4][l] ;
+			}
+		}
+#endif
+		for ( ; i < to ; ++i )
+		{
+			int a = vj[i], b = vk[i] ;
+			int mx = a > b ? a : b ;
+			int mn = a > b ? b : a ;
+			bool spec = ( mx - mn == 2 && mx != 0 ) ;
+			s.sumMax += mx ;
+			if ( a > b )
+			{
+				++s.gt ;
+				if ( spec )
+					++s.sgt ;
+			}
+			else if ( a == b )
+				++s.eq ;
+			else if ( spec )
+				++s.slt ;
+		}
+	}
+
+	// The log likelihood of allele pair (j, k).  The result is the same as
+	// summing, over the alignments in order, the read weighted between the two
+	// alleles, plus the allele length terms, minus 4 for every bin whose
+	// reads assigned to either allele exceed the expected count by 4 standard
+	// deviations.
+	double PairLikelihood( int j, int k ) const
+	{
+		const int *vj = &compatibility[0] + j * stride ;
+		const int *vk = &compatibility[0] + k * stride ;
+		double averageRead = ( (double)numOfAlignments ) / (double)( alleleLength[j] + alleleLength[k] ) * binSize ;
+		double threshold = averageRead + 4 * sqrt( averageRead ) ;
+		double binAdjust = 0 ;
+		struct _pairStats s ;
+		int numOfRuns = (int)runs.size() - 1 ;
+
+		Stats( vj, vk, 0, numOfAlignments, s ) ;
+		int64_t l100 = s.LogLikelihood100() ;
+		if ( numOfRuns >= 2 )
+		{
+			// The bin counts used to carry over from one allele pair to the
+			// next in the order (0,0), (0,1), ..., (0,n-1), (1,1), ...: the last
+			// bin of the previous pair was only checked when this pair started,
+			// or added to this pair's first bin if that is the same bin.
+			bool hasCarry = ( j != 0 || k != 0 ) ;
+			bool sameEnds = ( binStart[0] == binStart[ numOfAlignments - 1 ] ) ;
+			int lastFrom = runs[ numOfRuns - 1 ] ;
+			int lastCount = numOfAlignments - lastFrom ;
+			int64_t carryJ = 0, carryK = 0 ;
+			// A bin can't assign either allele more reads than it holds, so
+			// only bins bigger than the threshold need their weights summed.
+			if ( hasCarry && lastCount + ( sameEnds ? runs[1] : 0 ) > threshold )
+			{
+				int pj = j, pk = k - 1 ;
+				if ( pk < pj )
+				{
+					pj = j - 1 ;
+					pk = numOfAllele - 1 ;
+				}
+				Stats( &compatibility[0] + pj * stride, &compatibility[0] + pk * stride, lastFrom, numOfAlignments, s ) ;
+				carryJ = s.WeightJ100() ;
+				carryK = 100 * (int64_t)lastCount - carryJ ;
+				if ( !sameEnds &&
+					( carryJ / 100.0 > threshold || carryK / 100.0 > threshold ) )
+					binAdjust -= 4 ;
+			}
+
+			// The last bin is left for the next pair
+			for ( int r = 0 ; r < numOfRuns - 1 ; ++r )
+			{
+				int count = runs[r + 1] - runs[r] ;
+				bool carried = ( r == 0 && hasCarry && sameEnds ) ;
+				if ( count + ( carried ? lastCount : 0 ) <= threshold )
+					continue ;
+				Stats( vj, vk, runs[r], runs[r + 1], s ) ;
+				int64_t assignJ = s.WeightJ100() ;
+				int64_t assignK = 100 * (int64_t)count - assignJ ;
+				if ( carried )
+				{
+					assignJ += carryJ ;
+					assignK += carryK ;
+				}
+				if ( assignJ / 100.0 > threshold || assignK / 100.0 > threshold )
+					binAdjust -= 4 ;
+			}
+		}
+
+		double ret = l100 / 100.0 ;
+		ret += ( -log( (double)alleleLength[j] ) / log(10.0 ) -
+				log( (double)alleleLength[k] ) / log(10.0) ) ;
+		ret += binAdjust ;
+		return ret ;
+	}
+
+	// Index of pair (j, k), k >= j, in the order (0,0), (0,1), ..., (1,1), ...
+	size_t PairIndex( int j, int k ) const
+	{
+		return (size_t)j * numOfAllele - (size_t)j * ( j - 1 ) / 2 + ( k - j ) ;
+	}
+
+	void Worker()
+	{
+		while ( 1 )
+		{
+			pthread_mutex_lock( &lock ) ;
+			size_t t = nextTile++ ;
+			pthread_mutex_unlock( &lock ) ;
+			if ( t >= tiles.size() )
+				break ;
+
+			int tj = tiles[t].a, tk = tiles[t].b ;
+			int ej = tj + tileSize < numOfAllele ? tj + tileSize : numOfAllele ;
+			int ek = tk + tileSize < numOfAllele ? tk + tileSize : numOfAllele ;
+			for ( int j = tj ; j < ej ; ++j )
+				for ( int k = ( tk > j ? tk : j ) ; k < ek ; ++k )
+					logLikelihood[ PairIndex( j, k ) ] = PairLikelihood( j, k ) ;
+		}
+	}
+
+	static void *WorkerThread( void *arg )
+	{
+		( (AllelePairLikelihood *)arg )->Worker() ;
+		return NULL ;
+	}
+
+	// Move the streamed rows into one contiguous row per allele.
+	void Transpose()
+	{
+		stride = ( numOfAlignments + 3 ) & ~3 ;
+		compatibility.assign( (size_t)numOfAllele * stride + 4, 0 ) ;
+		const int block = 64 ;
+		for ( int ib = 0 ; ib < numOfAlignments ; ib += block )
+		{
+			int ie = ib + block < numOfAlignments ? ib + block : numOfAlignments ;
+			for ( int j = 0 ; j < numOfAllele ; ++j )
+			{
+				int *dst = &compatibility[0] + j * stride ;
+				for ( int i = ib ; i < ie ; ++i )
+					dst[i] = rows[ (size_t)i * numOfAllele + j ] ;
+			}
+		}
+		std::vector<int>().swap( rows ) ;
+	}
+
+public:
+	AllelePairLikelihood( int n, int bs )
+	{
+		numOfAllele = n ;
+		binSize = bs ;
+		numOfAlignments = 0 ;
+		stride = 0 ;
+		pthread_mutex_init( &lock, NULL ) ;
+	}
+
+	~AllelePairLikelihood()
+	{
+		pthread_mutex_destroy( &lock ) ;
+	}
+
+	int GetAlignmentCount()
+	{
+		return numOfAlignments ;
+	}
+
+	// Add an alignment starting at coordinate start; returns its row of
+	// compatibility values, zeroed, for the caller to fill in.  Alignments
+	// need only be seen once, in the order the likelihood visits them.
+	int *AddAlignment( int64_t start )
+	{
+		int64_t bin = start / binSize ;
+		if ( numOfAlignments == 0 || bin != binStart.back() )
+			runs.push_back( numOfAlignments ) ;
+		binStart.push_back( bin ) ;
+		rows.resize( rows.size() + numOfAllele, 0 ) ;
+		++numOfAlignments ;
+		return &rows[0] + rows.size() - numOfAllele ;
+	}
+
+	// Compute the log likelihood of every allele pair (j, k), k >= j, into
+	// result, in the order (0,0), (0,1), ..., (0,n-1), (1,1), ...  Tiles of
+	// allele pairs are shared among numOfThreads threads.
+	void Compute( const int *length, int numOfThreads, std::vector<double> &result )
+	{
+		int i ;
+		alleleLength = length ;
+		runs.push_back( numOfAlignments ) ;
+		Transpose() ;
+		result.resize( (size_t)numOfAllele * ( numOfAllele + 1 ) / 2 ) ;
+		logLikelihood = result.size() > 0 ? &result[0] : NULL ;
+
+		tiles.clear() ;
+		for ( int tj = 0 ; tj < numOfAllele ; tj += tileSize )
+			for ( int tk = tj ; tk < numOfAllele ; tk += tileSize )
+			{
+				struct _pair p ;
+				p.a = tj ;
+				p.b = tk ;
+				tiles.push_back( p ) ;
+			}
+		nextTile = 0 ;
+
+		if ( numOfThreads <= 1 )
+		{
+			Worker() ;
+		}
+		else
+		{
+			pthread_t *threads = new pthread_t[ numOfThreads ] ;
+			for ( i = 0 ; i < numOfThreads ; ++i )
+				pthread_create( &threads[i], NULL, WorkerThread, this ) ;
+			for ( i = 0 ; i < numOfThreads ; ++i )
+				pthread_join( threads[i], NULL ) ;
+			delete[] threads ;
+		}
+		runs.pop_back() ;
+	}
+} ;
+
+#endif
@@ -1,4 +1,4 @@
-//usage: a.out prefix_of_allele_information alignment.bam [-b backbone_id]
+//usage: a.out prefix_of_allele_information alignment.bam [-b backbone_id] [-p num_threads]
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
@@ -7,14 +7,9 @@
 #include <algorithm>
 
 #include "alignments.hpp"
+#include "likelihood.hpp"
 
 
-struct _compatible
-{
-	int weight ;
-	double value ;
-} ;
-
 struct _snpInfo
 {
 	char type ; // d, s, i
@@ -47,7 +42,6 @@ std::vector< std::vector<int> > snpLink ; // What are the allele ids associate w
 std::map<int, std::vector<int> > positionToSnp ; // map of the genomic coordinate to the snp id
 std::vector< std::vector<int> > alleleSnpList ; // the list of snp ids associate with this allele
 std::vector<int> alleleLength ; 
-std::vector< struct _pair > alignmentCoords ;
 
 bool CompResult( struct _result a, struct _result b )
 {
@@ -84,10 +78,8 @@ int main( int argc, char *argv[] )
 	std::vector<std::string> fields ;
 	int binSize = 50 ;
 	const char *backboneName = NULL ;
+	int numOfThreads = 1 ;
 
-	// the compatilibity between the alignment and allele
-	// The likelihood of this read from this allele
-	struct _compatible **compatibility ; 
 	int **snpAllele ; // whether a snp showed up in the allele.
 
 	Alignments alignments ;
@@ -101,6 +93,11 @@ int main( int argc, char *argv[] )
 			alignments.OnlyChrom( backboneName ) ;
 			++i ;
 		}
+		else if ( !strcmp( argv[i], "-p" ) )
+		{
+			numOfThreads = atoi( argv[i + 1] ) ;
+			++i ;
+		}
 		else
 		{
 			fprintf( stderr, "Unknown argument %s.\n", argv[i] ) ;
@@ -263,30 +260,15 @@ int main( int argc, char *argv[] )
 		}
 	}
 
-	// Compute the compatbility score for each alignment and the allele
- 	// Get the number of alignment
-	int numOfAlignments = 0 ;
-	while ( alignments.Next() )
-		++numOfAlignments ;
-		
-	alignments.Rewind() ;
-
-	compatibility = new struct _compatible*[numOfAlignments] ;	
-	for ( i = 0 ; i < numOfAlignments ; ++i )
-	{
-		compatibility[i] = new struct _compatible[ numOfAllele ] ;
-		for ( j = 0 ; j < numOfAllele ; ++j )
-		{
-			compatibility[i][j].value = 0 ;//-log( (double)alleleLength[j] ) / log( 10.0 );
-		}
-	}
+	// Compute the compatbility score for each alignment and the allele.
+	// The alignments are streamed: each one only adds its row of scores.
+	AllelePairLikelihood likelihood( numOfAllele, binSize ) ;
 
-	i = 0 ; 
 	bool *snpHit = new bool[ numOfSnps ] ;
 	while ( alignments.Next() )
 	{
 		struct _pair coord = alignments.segments[0] ;
-		alignmentCoords.push_back( coord ) ;
+		int *compatibility = likelihood.AddAlignment( coord.a ) ;
 		memset( snpHit, 0, sizeof( bool ) * numOfSnps ) ;
 		Split( alignments.GetFieldZ( "Zs" ), ',', fields ) ;
 		int size = fields.size() ;
@@ -332,131 +314,30 @@ int main( int argc, char *argv[] )
 							// The penality has already been subtracted.
 							v = 0 ;
 						}
-						compatibility[i][j].value += v ;
-						/*if ( i == 8 && j == 78 )
-						{
-							printf( "Bad snp %d: %d %d\n", tag, k, positionToSnp[k][l] ) ;
-						}*/
+						compatibility[j] += v ;
 					}
 				}
 			}
 		}
-		++i ;
 	}
-	//printf( "%d %d\n", numOfAlignments, numOfAllele ) ;
+	delete[] snpHit ;
 	// Now, let's consider every pair of alleles, and compute its log likelihood 
-	double **logLikelihood ;
-	logLikelihood = new double *[ numOfAllele] ;
-	for ( j = 0 ; j < numOfAllele ; ++j )
-	{
-		logLikelihood[j] = new double[ numOfAllele ] ;
-		//memset( logLikelihood[j], 0, sizeof( double ) * numOfAllele ) ;
-		for ( k = 0 ; k < numOfAllele ; ++k )
-			logLikelihood[j][k] = 0 ;
-	}
-
-	int prevBin = -1 ;
-	double assignJBin = 0 ;
-	double assignKBin = 0 ;
-	for ( j = 0 ; j < numOfAllele ; ++j )
-	{
-		for ( k = j ; k < numOfAllele ; ++k )
-		{
-			double binAdjust = 0 ;
-			double averageRead = ( (double)numOfAlignments ) / (double)( alleleLength[j] + alleleLength[k] ) * binSize ;
-			for ( i = 0 ; i < numOfAlignments ; ++i )
-			{
-				double vj = compatibility[i][j].value ;
-				double vk = compatibility[i][k].value ;
-				double weightJ = 0, weightK = 0 ;
-				if ( vj == vk )
-				{
-					weightJ = weightK = 0.5 ;
-				}
-				else if ( vj == vk + 2 )
-				{
-					if ( vj == 0 )
-					{
-						weightJ = 1 ;
-					}
-					else
-					{
-						weightJ = 0.99 ;
-						weightK = 0.01 ;
-					}
-				}
-				else if ( vk == vj + 2 )
-				{
-					if ( vk == 0 )
-					{
-						weightK = 1 ;
-					}
-					else
-					{
-						weightJ = 0.01 ;
-						weightK = 0.99 ;
-					}
-				}
-				else
-				{
-					if ( vk > vj )
-						weightK = 1 ;
-					else
-						weightJ = 1 ;
-				}
-				
-				double l = weightJ * compatibility[i][j].value + weightK * compatibility[i][k].value ;
-				if ( alignmentCoords[i].a / binSize != prevBin )
-				{
-					if ( prevBin != -1 && 
-						( assignJBin > averageRead + 4 * sqrt( averageRead ) 
-							|| assignKBin > averageRead + 4 * sqrt( averageRead ) ) )
-					{
-						//if ( j == 8 && k == 78 )
-						//	printf( "%lf: %lf %lf %d %d\n", averageRead, assignJBin, assignKBin, alleleLength[j], alleleLength[k] ) ;
-						binAdjust -= 4 ;
-					}
-					prevBin = alignmentCoords[i].a / binSize ;
-					assignJBin = 0 ;
-					assignKBin = 0 ;
-				}
-				assignJBin += weightJ ;
-				assignKBin += weightK ;
-				
-				/*if ( j == 8 && k == 78 && l < 0 )
-				{
-					printf( "Bad alignment %d (%s %s). %lf %lf: %lf\n", i,
-						alleleIdToName[j].c_str(), alleleIdToName[k].c_str(),
-						 compatibility[i][j].value, compatibility[i][k].value, l ) ;
-				}*/
-				logLikelihood[j][k] += l ;
-			}
-			logLikelihood[j][k] += ( -log( (double)alleleLength[j] ) / log(10.0 ) -
-							log( (double)alleleLength[k] ) / log(10.0) ) ;
-			logLikelihood[j][k] += binAdjust ;
-		}
-	}
+	std::vector<double> logLikelihood ;
+	likelihood.Compute( numOfAllele > 0 ? &alleleLength[0] : NULL, numOfThreads, logLikelihood ) ;
 	
 	// Find the result
-	double max ;
-	int maxj = -1 ;
-	int maxk = -1 ;
 	std::vector< struct _result > results ;
+	i = 0 ;
 	for ( j = 0 ; j < numOfAllele ; ++j )
 	{
 		for ( k = j ; k < numOfAllele ; ++k )
 		{
-			if ( maxj == -1 || logLikelihood[j][k] > max )
-			{
-				maxj = j ;
-				maxk = k ;
-				max = logLikelihood[j][k] ;
-			}
 			struct _result r ;
 			r.a = j ;
 			r.b = k ;
-			r.logLikelihood = logLikelihood[j][k] ;
+			r.logLikelihood = logLikelihood[i] ;
 			results.push_back( r ) ;
+			++i ;
 		}
 	}
 
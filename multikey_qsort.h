@@ -27,6 +27,9 @@
 #include "diff_sample.h"
 #include "sstring.h"
 #include "btypes.h"
+#include "ds.h"
+#include "mem_ids.h"
+#include "threading.h"
 
 using namespace std;
 
@@ -1022,10 +1025,12 @@ static void bucketSortSufDcU8(
                               size_t _depth,
                               bool sanityCheck = false)
 {
-    // 5 64-element buckets for bucket-sorting A, C, G, T, $
+    // 5 64-element buckets for bucket-sorting A, C, G, T, $; none can
+    // hold more than the whole range.  Sized to the range rather than to
+    // BUCKET_SORT_CUTOFF since several sorts may run at once.
     TIndexOffU* bkts[4];
     for(size_t i = 0; i < 4; i++) {
-        bkts[i] = new TIndexOffU[4 * 1024 * 1024];
+        bkts[i] = new TIndexOffU[_end - _begin];
     }
     ELList<size_t, 5, 1024> block_list;
     bool first = true;
@@ -1234,4 +1239,235 @@ void mkeyQSortSufDcU8(
 }
 
 
+#define PAR_SORT_CUTOFF (1024 * 1024)
+
+/**
+ * Return true iff suffix s1 < suffix s2, comparing characters up to the
+ * difference-cover period and breaking the tie with the difference cover
+ * after that.  Unlike sufDcLtU8, the suffixes needn't share a prefix.
+ */
+template<typename T1, typename T2> inline
+bool sufDcLtAnyU8(
+	const T1& host1,
+	const T2& host,
+	size_t hlen,
+	size_t s1,
+	size_t s2,
+	const DifferenceCoverSample<T1>& dc,
+	int hi)
+{
+	if(s1 == s2) return false;
+	size_t v = dc.v();
+	for(size_t d = 0; d < v; d++) {
+		int c1 = (s1 + d < hlen) ? get_uint8(host, s1 + d) : hi;
+		int c2 = (s2 + d < hlen) ? get_uint8(host, s2 + d) : hi;
+		if(c1 != c2) return c1 < c2;
+	}
+	return sufDcLtU8(host1, host, hlen, s1, s2, dc);
+}
+
+/**
+ * State shared by the threads of mkeyQSortSufDcU8Par.
+ */
+template<typename T1, typename T2>
+struct SufSortParShared {
+	const T1*                          host1;
+	const T2*                          host;
+	size_t                             hlen;
+	TIndexOffU*                        s;
+	size_t                             slen;
+	TIndexOffU*                        tmp;      // scatter target
+	uint16_t*                          part;     // partition of each suffix
+	const DifferenceCoverSample<T1>*   dc;
+	int                                hi;
+	const TIndexOffU*                  splitters;
+	size_t                             nsplit;
+	EList<pair<size_t, size_t> >       parts;    // [begin, end), largest first
+	size_t                             nextPart; // next of parts to sort
+	MUTEX_T                            mutex;
+	bool                               sanityCheck;
+};
+
+/**
+ * One thread's slice of the suffixes, with its count of suffixes in each
+ * partition (later turned into write offsets).
+ */
+template<typename T1, typename T2>
+struct SufSortParParams {
+	SufSortParShared<T1, T2>* sh;
+	size_t                    begin;
+	size_t                    end;
+	EList<size_t>             counts;
+};
+
+/**
+ * Find the partition of each suffix in the slice by binary search over the
+ * splitters and count partition sizes.
+ */
+template<typename T1, typename T2>
+static void sufSortParClassify(void *vp) {
+	SufSortParParams<T1, T2>& p = *(SufSortParParams<T1, T2>*)vp;
+	SufSortParShared<T1, T2>& sh = *p.sh;
+	p.counts.fill(0);
+	for(size_t i = p.begin; i < p.end; i++) {
+		size_t lo = 0, hi = sh.nsplit;
+		while(lo < hi) {
+			size_t mid = (lo + hi) >> 1;
+			if(sufDcLtAnyU8(*sh.host1, *sh.host, sh.hlen, sh.s[i], sh.splitters[mid], *sh.dc, sh.hi)) {
+				hi = mid;
+			} else {
+				lo = mid + 1;
+			}
+		}
+		sh.part[i] = (uint16_t)lo;
+		p.counts[lo]++;
+	}
+}
+
+/**
+ * Copy the suffixes in the slice to their partitions.
+ */
+template<typename T1, typename T2>
+static void sufSortParScatter(void *vp) {
+	SufSortParParams<T1, T2>& p = *(SufSortParParams<T1, T2>*)vp;
+	SufSortParShared<T1, T2>& sh = *p.sh;
+	for(size_t i = p.begin; i < p.end; i++) {
+		sh.tmp[p.counts[sh.part[i]]++] = sh.s[i];
+	}
+}
+
+/**
+ * Sort partitions with the sequential multikey quicksort until none are
+ * left.
+ */
+template<typename T1, typename T2>
+static void sufSortParSort(void *vp) {
+	SufSortParParams<T1, T2>& p = *(SufSortParParams<T1, T2>*)vp;
+	SufSortParShared<T1, T2>& sh = *p.sh;
+	while(true) {
+		size_t begin, end;
+		{
+			ThreadSafe ts(&sh.mutex);
+			if(sh.nextPart == sh.parts.size()) break;
+			begin = sh.parts[sh.nextPart].first;
+			end = sh.parts[sh.nextPart].second;
+			sh.nextPart++;
+		}
+		mkeyQSortSufDcU8(*sh.host1, *sh.host, sh.hlen, sh.s, sh.slen,
+		                 *sh.dc, sh.hi, begin, end, 0, sh.sanityCheck);
+	}
+}
+
+/**
+ * Run worker over every element of params, one thread each.
+ */
+template<typename P>
+static void sufSortParRun(void (*worker)(void*), EList<P>& params) {
+	AutoArray<tthread::thread*> threads(params.size());
+	for(size_t i = 0; i < params.size(); i++) {
+		threads[i] = new tthread::thread(worker, (void*)&params[i]);
+	}
+	for(size_t i = 0; i < params.size(); i++) {
+		threads[i]->join();
+		delete threads[i];
+	}
+}
+
+/**
+ * Multikey quicksort over suffixes using nthreads threads: a sample sort
+ * that picks splitters from a sorted sample of the suffixes, moves every
+ * suffix into its partition between two splitters, and then sorts the
+ * partitions independently with the sequential mkeyQSortSufDcU8, largest
+ * first.  Comparisons against splitters use the difference cover the same
+ * way the sequential sort does, so the result is the same.  Small inputs
+ * and nthreads <= 1 go straight to the sequential sort.
+ */
+template<typename T1, typename T2>
+void mkeyQSortSufDcU8Par(
+	const T1& host1,
+	const T2& host,
+	size_t hlen,
+	TIndexOffU* s,
+	size_t slen,
+	const DifferenceCoverSample<T1>& dc,
+	int hi,
+	int nthreads,
+	bool verbose = false,
+	bool sanityCheck = false)
+{
+	if(nthreads <= 1 || slen < PAR_SORT_CUTOFF) {
+		mkeyQSortSufDcU8(host1, host, hlen, s, slen, dc, hi, verbose, sanityCheck);
+		return;
+	}
+	if(sanityCheck) sanityCheckInputSufs(s, slen);
+	// Choose nparts-1 splitters from an evenly spaced, sorted sample
+	const size_t over = 32;
+	size_t nparts = min<size_t>((size_t)nthreads * 8, 4096);
+	EList<TIndexOffU> sample(MISC_CAT);
+	sample.resizeExact(nparts * over);
+	for(size_t i = 0; i < sample.size(); i++) {
+		sample[i] = s[(size_t)((double)i * slen / sample.size())];
+	}
+	mkeyQSortSufDcU8(host1, host, hlen, sample.ptr(), sample.size(), dc, hi, false, sanityCheck);
+	EList<TIndexOffU> splitters(MISC_CAT);
+	splitters.resizeExact(nparts - 1);
+	for(size_t i = 0; i < splitters.size(); i++) {
+		splitters[i] = sample[(i + 1) * over - 1];
+	}
+	sample.clear();
+
+	SufSortParShared<T1, T2> sh;
+	AutoArray<TIndexOffU> tmp(slen, MISC_CAT);
+	AutoArray<uint16_t> part(slen, MISC_CAT);
+	sh.host1 = &host1;
+	sh.host = &host;
+	sh.hlen = hlen;
+	sh.s = s;
+	sh.slen = slen;
+	sh.tmp = &tmp[0];
+	sh.part = &part[0];
+	sh.dc = &dc;
+	sh.hi = hi;
+	sh.splitters = splitters.ptr();
+	sh.nsplit = splitters.size();
+	sh.nextPart = 0;
+	sh.sanityCheck = sanityCheck;
+	EList<SufSortParParams<T1, T2> > params(MISC_CAT);
+	params.resize(nthreads);
+	for(int t = 0; t < nthreads; t++) {
+		params[t].sh = &sh;
+		params[t].begin = slen / nthreads * t;
+		params[t].end = (t + 1 == nthreads) ? slen : slen / nthreads * (t + 1);
+		params[t].counts.resizeExact(nparts);
+	}
+	sufSortParRun(sufSortParClassify<T1, T2>, params);
+
+	// Turn counts into write offsets, partition-major; note partitions
+	// that need sorting, keyed so that the largest sort first
+	EList<pair<size_t, size_t> > bysz(MISC_CAT);
+	size_t off = 0;
+	for(size_t b = 0; b < nparts; b++) {
+		size_t pbegin = off;
+		for(int t = 0; t < nthreads; t++) {
+			size_t c = params[t].counts[b];
+			params[t].counts[b] = off;
+			off += c;
+		}
+		if(off - pbegin > 1) {
+			bysz.push_back(make_pair(std::numeric_limits<size_t>::max() - (off - pbegin), pbegin));
+		}
+	}
+	assert_eq(slen, off);
+	sufSortParRun(sufSortParScatter<T1, T2>, params);
+	memcpy(s, &tmp[0], slen * sizeof(TIndexOffU));
+
+	bysz.sort();
+	for(size_t i = 0; i < bysz.size(); i++) {
+		size_t len = std::numeric_limits<size_t>::max() - bysz[i].first;
+		sh.parts.push_back(make_pair(bysz[i].second, bysz[i].second + len));
+	}
+	sufSortParRun(sufSortParSort<T1, T2>, params);
+	if(sanityCheck) sanityCheckOrderedSufs(host1, hlen, s, slen, OFF_MASK);
+}
+
 #endif /*MULTIKEY_QSORT_H_*/
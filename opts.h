@@ -187,7 +187,24 @@ enum {
     ARG_DP,
     ARG_REPEAT,
     ARG_NO_REPEAT_INDEX,
-    ARG_READ_LENGTHS
+    ARG_READ_LENGTHS,
+    ARG_METRIC_JSON,            // --met-json
+    ARG_SLOW_READ_FILE,         // --slow-read-file
+    ARG_SLOW_READ_USEC,         // --slow-read-usec
+    ARG_SLOW_READ_FMOPS,        // --slow-read-fmops
+    ARG_READ_BUDGET_FMOPS,      // --read-budget-fmops
+    ARG_READ_BUDGET_EXTS,       // --read-budget-exts
+    ARG_READ_BUDGET_USEC,       // --read-budget-usec
+    ARG_LAZY_LOCAL,             // --lazy-local
+    ARG_LOCAL_LRU,              // --local-lru
+    ARG_REPEAT_COMPACT,         // --repeat-compact
+    ARG_REPEAT_TABLE,           // --repeat-table
+    ARG_SHARD,                  // --shard
+    ARG_MM_READS,               // --mm-reads
+    ARG_NOVEL_SPLICESITE_SNAPSHOT, // --novel-splicesite-snapshot
+    ARG_TWO_PASS,               // --two-pass
+    ARG_TWO_PASS_READS,         // --two-pass-reads
+    ARG_TEMP_SPLICESITE_WINDOW  // --temp-splicesite-window
 };
 
 #endif
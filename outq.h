@@ -26,6 +26,7 @@
 #include "read.h"
 #include "threading.h"
 #include "mem_ids.h"
+#include "timer.h"
 
 /**
  * Encapsulates a list of lines of output.  If the earliest as-yet-unreported
@@ -120,23 +121,36 @@ protected:
 	MUTEX_T         mutex_m;
 };
 
+/**
+ * Brackets the writing of a read's output records.  If finishNs is non-NULL,
+ * the time spent handing the records to the queue (including waiting for its
+ * lock) is stored there.
+ */
 class OutputQueueMark {
 public:
 	OutputQueueMark(
 		OutputQueue& q,
 		const BTString& rec,
 		TReadId rdid,
-		size_t threadId) :
+		size_t threadId,
+		uint64_t* finishNs = NULL) :
 		q_(q),
 		rec_(rec),
 		rdid_(rdid),
-		threadId_(threadId)
+		threadId_(threadId),
+		finishNs_(finishNs)
 	{
 		q_.beginRead(rdid, threadId);
 	}
 	
 	~OutputQueueMark() {
-		q_.finishRead(rec_, rdid_, threadId_);
+		if(finishNs_ != NULL) {
+			uint64_t start = nanoTime();
+			q_.finishRead(rec_, rdid_, threadId_);
+			*finishNs_ = nanoTime() - start;
+		} else {
+			q_.finishRead(rec_, rdid_, threadId_);
+		}
 	}
 	
 protected:
@@ -144,6 +158,7 @@ protected:
 	const BTString& rec_;
 	TReadId rdid_;
 	size_t threadId_;
+	uint64_t* finishNs_;
 };
 
 #endif
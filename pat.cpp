@@ -26,6 +26,7 @@
 #include "pat.h"
 #include "filebuf.h"
 #include "formats.h"
+#include "read_sse.h"
 
 #ifdef USE_SRA
 
@@ -413,6 +414,13 @@ PairedPatternSource* PairedPatternSource::setupPatternSources(
 	}
 	// All mates/mate files must be paired
 	assert_eq(a->size(), b->size());
+	if(p.nshards > 1) {
+		// Mate 2 can't pick its own byte range; it follows mate 1
+		assert_eq(FASTQ, p.format);
+		for(size_t i = 0; i < a->size(); i++) {
+			((FastqPatternSource*)(*b)[i])->shardFollow((FastqPatternSource*)(*a)[i]);
+		}
+	}
 
 	// Create list of pattern sources for the unpaired reads
 	for(size_t i = 0; i < si.size(); i++) {
@@ -671,11 +679,12 @@ int parseQuals(
 					assert_eq(num, 0);
 				} else {
 					if(!isdigit(c)) {
-						char buf[2048];
+						char buf[FileBuf::LASTN_BUF_SZ + 1];
 						cerr << "Warning: could not parse quality line:" << endl;
 						fb.getPastNewline();
-						cerr << fb.copyLastN(buf);
-						buf[2047] = '\0';
+						size_t len = fb.copyLastN(buf);
+						cerr << len;
+						buf[len] = '\0';
 						cerr << buf;
 						throw 1;
 					}
@@ -849,6 +858,90 @@ bool FastaPatternSource::read(
 }
 
 /// Read another pattern from a FASTQ input file
+bool FastqPatternSource::scanToRecord(
+	uint64_t lo,
+	uint64_t hi,
+	const string* key,
+	uint64_t& off)
+{
+	// Move to the start of the first line at or after lo
+	if(!fb_.seek(lo == 0 ? 0 : lo - 1)) {
+		cerr << "Error: could not seek in reads file \"" << infiles_[filecur_-1] << "\"" << endl;
+		throw 1;
+	}
+	if(lo > 0) {
+		int c;
+		while((c = fb_.get()) >= 0 && c != '\n');
+		if(c < 0) return false;
+	}
+	// Offset, first character and (for '@' lines) name of the last
+	// three lines seen
+	uint64_t loff[3] = {0, 0, 0};
+	int lfirst[3] = {-1, -1, -1};
+	string lname[3];
+	for(size_t line = 0; ; line++) {
+		size_t cur = line % 3;
+		loff[cur] = fb_.tell();
+		int c = fb_.get();
+		if(c < 0) return false;
+		lfirst[cur] = c;
+		lname[cur].clear();
+		while(c >= 0 && c != '\n') {
+			c = fb_.get();
+			if(lfirst[cur] == '@' && c >= 0 && c != '\n') lname[cur].push_back((char)c);
+		}
+		size_t rec = (line + 1) % 3; // the line two lines back
+		if(line >= 2 && lfirst[cur] == '+' && lfirst[rec] == '@') {
+			if(loff[rec] > hi) return false;
+			if(key == NULL || shardKey(lname[rec], lname[rec].length()) == *key) {
+				off = loff[rec];
+				return true;
+			}
+		}
+		if(c < 0) return false;
+	}
+}
+
+void FastqPatternSource::shardSeek() {
+	int64_t sz = fb_.size();
+	if(sz < 0) {
+		cerr << "Error: --shard requires seekable, uncompressed FASTQ files; \""
+		     << infiles_[filecur_-1] << "\" is not one" << endl;
+		throw 1;
+	}
+	uint64_t off = (uint64_t)sz;
+	shardFirst_ = true;
+	if(leader_ == NULL) {
+		uint64_t begin = (uint64_t)sz * shard_ / nshards_;
+		shardEnd_ = (uint64_t)sz * (shard_ + 1) / nshards_;
+		if(begin == 0) {
+			off = 0;
+		} else if(!scanToRecord(begin, shardEnd_, NULL, off)) {
+			off = (uint64_t)sz; // no record starts in our range
+		}
+	} else if(leader_->shardOff_ == 0) {
+		off = 0;
+	} else {
+		// Guess where the mate of the leader's first record is by
+		// scaling its offset, then widen the window until it's found
+		int64_t sza = leader_->fb_.size();
+		uint64_t est = (uint64_t)((double)leader_->shardOff_ * sz / max<int64_t>(sza, 1));
+		for(uint64_t w = 64 * 1024; ; w *= 4) {
+			uint64_t lo = est > w ? est - w : 0;
+			if(scanToRecord(lo, est + w, &leader_->shardName_, off)) {
+				break;
+			}
+			if(lo == 0 && est + w >= (uint64_t)sz) {
+				cerr << "Error: could not find mate of read \"" << leader_->shardName_
+				     << "\" in \"" << infiles_[filecur_-1] << "\"; are the -1 and -2 files"
+				     << " in the same order?" << endl;
+				throw 1;
+			}
+		}
+	}
+	fb_.seek(off);
+}
+
 bool FastqPatternSource::read(
 	Read& r,
 	TReadId& rdid,
@@ -863,8 +956,15 @@ bool FastqPatternSource::read(
 	r.reset();
 	r.color = gColor;
 	r.fuzzy = fuzzy_;
+	if(leader_ != NULL && (leader_->shardDone_ || leader_->filecur_ != filecur_)) {
+		// The mate-1 source has moved past its range in this file
+		bail(r); success = false; done = true; return success;
+	}
 	// Pick off the first at
 	if(first_) {
+		if(nshards_ > 1) {
+			shardSeek();
+		}
 		c = fb_.get();
 		if(c != '@') {
 			c = getOverNewline(fb_);
@@ -879,10 +979,28 @@ bool FastqPatternSource::read(
 		assert_eq('@', c);
 		first_ = false;
 	}
+	if(nshards_ > 1 && leader_ == NULL) {
+		uint64_t recOff = fb_.tell() - 1; // '@' already consumed
+		if(recOff >= shardEnd_) {
+			bail(r); success = false; done = true; return success;
+		}
+		if(shardFirst_) {
+			shardOff_ = recOff;
+		}
+	}
 
 	// Read to the end of the id line, sticking everything after the '@'
 	// into *name
 	while(true) {
+		// Take as much of the name as is in memory in one go
+		const char *buf;
+		size_t avail = fb_.inBuf(buf);
+		const char *eol = (const char*)memchr(buf, '\n', avail);
+		size_t n = (eol == NULL) ? avail : (size_t)(eol - buf);
+		const char *cr = (const char*)memchr(buf, '\r', n);
+		if(cr != NULL) n = (size_t)(cr - buf);
+		r.name.append(buf, n);
+		fb_.advance(n);
 		c = fb_.get();
 		if(c < 0) {
 			bail(r); success = false; done = true; return success;
@@ -899,6 +1017,10 @@ bool FastqPatternSource::read(
 		}
 		r.name.append(c);
 	}
+	if(shardFirst_) {
+		shardName_ = shardKey(r.name, r.name.length());
+		shardFirst_ = false;
+	}
 	// fb_ now points just past the first character of a
 	// sequence line, and c holds the first character
 	int charsRead = 0;
@@ -943,6 +1065,41 @@ bool FastqPatternSource::read(
 					(*dstLenCur)++;
 				}
 				charsRead++;
+				if(!gColor && !fuzzy_) {
+					// Convert the rest of the line that's in memory
+					// in place, treating each character as above
+					const char *buf;
+					size_t avail = fb_.inBuf(buf);
+					const char *eol = (const char*)memchr(buf, '\n', avail);
+					size_t n = (eol == NULL) ? avail : (size_t)(eol - buf);
+					size_t len = sbuf->length(), i = 0;
+					sbuf->resize(len + n);
+					char *dst = sbuf->wbuf();
+					for(; i < n; i++) {
+						if(charsRead >= trim5) {
+							// Vectorized run of letters up to the next
+							// '.', '+' or other non-letter
+							size_t k = readSseAsciiToDna(dst + len, buf + i, n - i);
+							len += k;
+							(*dstLenCur) += (int)k;
+							charsRead += (int)k;
+							i += k;
+							if(i == n) break;
+						}
+						int ch = buf[i];
+						if(ch == '+') break;
+						if(ch == '.') ch = 'N';
+						if(isalpha(ch)) {
+							if(charsRead >= trim5) {
+								dst[len++] = asc2dna[ch];
+								(*dstLenCur)++;
+							}
+							charsRead++;
+						}
+					}
+					sbuf->resize(len);
+					fb_.advance(i);
+				}
 			} else if(fuzzy_ && c == ' ') {
 				trim5 = 0; // disable 5' trimming for now
 				if(charsRead == 0) {
@@ -1040,6 +1197,37 @@ bool FastqPatternSource::read(
 			trim5--;
 		}
 		while(true) {
+			if(!fuzzy_) {
+				// Convert as much of the line as is in memory in one
+				// go, leaving spaces and newlines to the code below
+				const char *buf;
+				size_t avail = fb_.inBuf(buf);
+				const char *eol = (const char*)memchr(buf, '\n', avail);
+				size_t n = (eol == NULL) ? avail : (size_t)(eol - buf);
+				size_t len = qbuf->length(), i = 0;
+				qbuf->resize(len + n);
+				char *dst = qbuf->wbuf();
+				for(; i < n; i++) {
+					if(!solQuals_ && *qualsReadCur >= trim5) {
+						// Vectorized run of in-range qualities
+						size_t k = readSseQualToPhred33(dst + len, buf + i, n - i, phred64Quals_);
+						len += k;
+						(*qualsReadCur) += (int)k;
+						i += k;
+						if(i == n) break;
+					}
+					char ch = buf[i];
+					if(ch == ' ' || ch == '\r') break;
+					if(*qualsReadCur >= trim5) {
+						ch = charToPhred33(ch, solQuals_, phred64Quals_);
+						assert_geq(ch, 33);
+						dst[len++] = ch;
+					}
+					(*qualsReadCur)++;
+				}
+				qbuf->resize(len);
+				fb_.advance(i);
+			}
 			c = fb_.get();
 			if (!fuzzy_ && c == ' ') {
 				wrongQualityFormat(r.name);
@@ -105,7 +105,10 @@ struct PatternParams {
 		bool fuzzy_,
 		int sampleLen_,
 		int sampleFreq_,
-		uint32_t skip_) :
+		uint32_t skip_,
+		int shard_ = 0,
+		int nshards_ = 1,
+		bool mmapReads_ = false) :
 		format(format_),
 		fileParallel(fileParallel_),
 		seed(seed_),
@@ -116,7 +119,10 @@ struct PatternParams {
 		fuzzy(fuzzy_),
 		sampleLen(sampleLen_),
 		sampleFreq(sampleFreq_),
-		skip(skip_) { }
+		skip(skip_),
+		shard(shard_),
+		nshards(nshards_),
+		mmapReads(mmapReads_) { }
 
 	int format;           // file format
 	bool fileParallel;    // true -> wrap files with separate PairedPatternSources
@@ -129,6 +135,9 @@ struct PatternParams {
 	int sampleLen;        // length of sampled reads for FastaContinuous...
 	int sampleFreq;       // frequency of sampled reads for FastaContinuous...
 	uint32_t skip;        // skip the first 'skip' patterns
+	int shard;            // read only the shard'th of nshards byte ranges
+	int nshards;          // number of byte ranges each input is split into
+	bool mmapReads;       // true -> memory-map uncompressed read files
 };
 
 /**
@@ -764,7 +773,8 @@ public:
 		filecur_(0),
 		fb_(),
 		skip_(p.skip),
-		first_(true)
+		first_(true),
+		mmap_(p.mmapReads)
 	{
 		assert_gt(infiles.size(), 0);
 		errs_.resize(infiles_.size());
@@ -896,6 +906,9 @@ protected:
 				continue;
 			}
 			fb_.newFile(in);
+			if(mmap_ && in != stdin) {
+				fb_.map(); // falls back to buffered reads if it can't
+			}
 			return;
 		}
 		cerr << "Error: No input read files were valid" << endl;
@@ -909,6 +922,7 @@ protected:
 	FileBuf fb_;             // read file currently being read from
 	TReadId skip_;           // number of reads to skip
 	bool first_;
+	bool mmap_;              // memory-map read files where possible
 };
 
 /**
@@ -1367,14 +1381,47 @@ public:
 		solQuals_(p.solexa64),
 		phred64Quals_(p.phred64),
 		intQuals_(p.intQuals),
-		fuzzy_(p.fuzzy)
+		fuzzy_(p.fuzzy),
+		shard_(p.shard),
+		nshards_(p.nshards),
+		shardEnd_(0),
+		shardFirst_(false),
+		shardOff_(0),
+		shardDone_(false),
+		leader_(NULL)
 	{ }
 	
 	virtual void reset() {
 		first_ = true;
+		shardDone_ = false;
 		fb_.resetLastN();
 		BufferedFilePatternSource::reset();
 	}
+
+	/**
+	 * Make this the mate-2 source for leader when sharding.  Rather
+	 * than taking its own byte range, this source starts each file at
+	 * the record whose name matches the first record of the leader's
+	 * range, and ends wherever the leader's range ends.
+	 */
+	void shardFollow(FastqPatternSource *leader) {
+		assert_gt(nshards_, 1);
+		leader_ = leader;
+	}
+
+	virtual bool nextReadImpl(
+		Read& r,
+		TReadId& rdid,
+		TReadId& endid,
+		bool& success,
+		bool& done)
+	{
+		bool ret = BufferedFilePatternSource::nextReadImpl(r, rdid, endid, success, done);
+		if(!success && done) {
+			shardDone_ = true; // every file exhausted
+		}
+		return ret;
+	}
 	
 protected:
 
@@ -1449,6 +1496,44 @@ protected:
 	virtual void resetForNextFile() {
 		first_ = true;
 	}
+
+	/**
+	 * Scan forward from the first line starting at or after offset lo
+	 * for a FASTQ record starting at or before offset hi.  A record
+	 * starts at a line beginning with '@' where the line two lines
+	 * later begins with '+'; quality lines may begin with either, but
+	 * never two lines before a '+' line.  If key is non-NULL, only a
+	 * record whose name has that key qualifies.  Return true and set
+	 * off to the record's offset if one was found.
+	 */
+	bool scanToRecord(
+		uint64_t lo,
+		uint64_t hi,
+		const string* key,
+		uint64_t& off);
+
+	/**
+	 * Position fb_ at the first record of this source's byte range of
+	 * the current file, or at the end of the file if the range holds
+	 * no record.
+	 */
+	void shardSeek();
+
+	/**
+	 * Return the part of a read name mates have in common: everything
+	 * up to the first whitespace, minus any trailing /1 or /2.
+	 */
+	template<typename T>
+	static string shardKey(const T& name, size_t len) {
+		size_t i = 0;
+		while(i < len && !isspace(name[i])) i++;
+		if(i >= 2 && name[i-2] == '/' && (name[i-1] == '1' || name[i-1] == '2')) {
+			i -= 2;
+		}
+		string key;
+		for(size_t j = 0; j < i; j++) key.push_back(name[j]);
+		return key;
+	}
 	
 private:
 
@@ -1468,6 +1553,14 @@ private:
 	bool intQuals_;
 	bool fuzzy_;
 	EList<string> qualToks_;
+	int shard_;           // which byte range of each file to read
+	int nshards_;         // number of byte ranges per file
+	uint64_t shardEnd_;   // records starting here or later are not ours
+	bool shardFirst_;     // next record is the first of the range
+	uint64_t shardOff_;   // offset of the first record of the range
+	string shardName_;    // key of the first record of the range
+	bool shardDone_;      // true -> all files have been read
+	FastqPatternSource *leader_; // mate-1 source we follow, if any
 };
 
 /**
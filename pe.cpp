@@ -354,6 +354,60 @@ bool PairedEndPolicy::otherMate(
 	return true;
 }
 
+/**
+ * Set idxs to the indexes of the mate-2 alignments that could pair with the
+ * given mate-1 alignment.  See pe.h.
+ */
+void ConcordantSweep::candidates(
+	int64_t ref,
+	bool fw,
+	int64_t left,
+	int64_t right,
+	bool mate1fw,
+	bool mate2fw,
+	int64_t maxgap,
+	int64_t maxfrag,
+	size_t minidx,
+	EList<size_t>& idxs) const
+{
+	idxs.clear();
+	bool fw2;
+	int64_t lo, hi;
+	if(fw == mate1fw) {
+		fw2 = mate2fw;
+		lo = left;
+		hi = right + maxgap;
+		if(maxfrag >= 0) hi = min<int64_t>(hi, left + maxfrag);
+	} else {
+		// Mate 2 ends no more than maxgap before mate 1 starts, so it can't
+		// start more than its own span before that
+		fw2 = !mate2fw;
+		lo = left - maxgap - maxspan_;
+		if(maxfrag >= 0) lo = max<int64_t>(lo, left - maxfrag);
+		hi = left;
+	}
+	if(lo > hi) return;
+	// Binary search for the first alignment at or after lo
+	size_t b = 0, e = mates_.size();
+	while(b < e) {
+		size_t mid = b + (e - b) / 2;
+		const Mate& m = mates_[mid];
+		bool before;
+		if(m.ref != ref)  before = m.ref < ref;
+		else if(m.fw != fw2) before = !m.fw;
+		else before = m.off < lo;
+		if(before) b = mid + 1;
+		else e = mid;
+	}
+	for(; b < mates_.size(); b++) {
+		const Mate& m = mates_[b];
+		if(m.ref != ref || m.fw != fw2 || m.off > hi) break;
+		if(m.idx >= minidx) idxs.push_back(m.idx);
+	}
+	// Callers report pairs in the order of the mate-2 alignments
+	idxs.sort();
+}
+
 #ifdef MAIN_PE
 
 #include <string>
@@ -939,3 +993,174 @@ int main(int argc, char **argv) {
 }
 
 #endif /*def MAIN_PE*/
+
+#ifdef CONCORDANT_SWEEP_MAIN
+
+/*
+ * Benchmark ConcordantSweep against trying every pair of alignments, the way
+ * HI_Aligner::pairReads used to, on read pairs with many alignments per mate:
+ * each mate aligns to every copy of a repeat family scattered over a few
+ * chromosomes, so every mate-1 alignment has a concordant partner and most
+ * mate-2 alignments are far away.  The pairing test below mirrors the one in
+ * pairReads, and both ways must find the same pairs in the same order.
+ *
+ * Build with something like:
+ *
+ *   g++ -O3 -DNDEBUG -DCONCORDANT_SWEEP_MAIN -o pe_sweep_bench \
+ *       pe.cpp ds.cpp -lpthread
+ *
+ * and run as "pe_sweep_bench [pairs per case]".
+ */
+
+#include <stdio.h>
+#include "random_source.h"
+#include "timer.h"
+
+MemoryTally gMemTally;
+
+struct SweepAln {
+	int64_t ref;
+	bool    fw;
+	int64_t left;
+	int64_t right;
+};
+
+/**
+ * The unique-alignment pairing test of HI_Aligner::pairReads for FR pairs.
+ */
+static bool sweepPairOk(
+	const PairedEndPolicy& pepol,
+	const SweepAln& a1,
+	const SweepAln& a2,
+	int64_t maxIntron,
+	bool spliced)
+{
+	if(a1.ref != a2.ref) return false;
+	const SweepAln *l = &a1, *r = &a2;
+	if(a1.fw) {
+		if(a2.fw) return false;
+	} else {
+		if(!a2.fw) return false;
+		swap(l, r);
+	}
+	if(l->left > r->left) return false;
+	if(l->right > r->right) return false;
+	if(l->right + maxIntron < r->left) return false;
+	if(spliced) return true;
+	const SweepAln *o1 = a1.left < a2.left ? &a1 : &a2;
+	const SweepAln *o2 = a1.left < a2.left ? &a2 : &a1;
+	return pepol.peClassifyPair(
+		o1->left, o1->right - o1->left + 1, o1->fw,
+		o2->left, o2->right - o2->left + 1, o2->fw) != PE_ALS_DISCORD;
+}
+
+struct SweepCase {
+	const char *name;
+	size_t      nals;      // alignments per mate
+	size_t      nchr;      // chromosomes the family is spread over
+	bool        spliced;   // intron-bounded rather than fragment-bounded
+};
+
+int main(int argc, char **argv) {
+	const SweepCase cases[] = {
+		{ "dna-100",     100,  5, false },
+		{ "dna-1000",   1000, 20, false },
+		{ "dna-5000",   5000, 20, false },
+		{ "rna-100",     100,  5, true  },
+		{ "rna-1000",   1000, 20, true  },
+		{ "rna-5000",   5000, 20, true  },
+	};
+	size_t npair = argc > 1 ? (size_t)atoi(argv[1]) : 20;
+	const int64_t chrlen = 200000000, rdlen = 100, maxIntron = 500000;
+	PairedEndPolicy pepol;
+	// --fr: gMate1fw is true and gMate2fw false
+	pepol.init(PE_POLICY_FR, 500, 0, false, false, true, true, true, true);
+	RandomSource rnd(35);
+	int nbad = 0;
+	for(size_t ci = 0; ci < sizeof(cases) / sizeof(cases[0]); ci++) {
+		const SweepCase& c = cases[ci];
+		EList<SweepAln> als1, als2;
+		EList<size_t> naive, swept, cands;
+		ConcordantSweep sweep;
+		double secs[2] = { 0.0, 0.0 };
+		size_t npaired = 0, nsame = 0;
+		for(size_t p = 0; p < npair; p++) {
+			als1.clear(); als2.clear();
+			for(size_t i = 0; i < c.nals; i++) {
+				SweepAln a;
+				a.ref = rnd.nextU32() % c.nchr;
+				a.fw = (rnd.nextU32() & 1) == 0;
+				a.left = rnd.nextU32() % (uint32_t)(chrlen - 2 * maxIntron);
+				a.right = a.left + rdlen - 1;
+				if(c.spliced && (rnd.nextU32() & 3) == 0) {
+					a.right += 100 + rnd.nextU32() % 20000;
+				}
+				SweepAln b = a;
+				b.fw = !a.fw;
+				int64_t frag = 200 + rnd.nextU32() % 200;
+				if(a.fw) {
+					b.left = a.left + frag - rdlen;
+				} else {
+					b.left = a.left - frag + rdlen;
+				}
+				b.right = b.left + rdlen - 1;
+				als1.push_back(a);
+				als2.push_back(b);
+			}
+			// The aligner finds the alignments of each mate in no particular
+			// positional order
+			als2.shufflePortion(0, als2.size(), rnd);
+			for(size_t k = 0; k < 2; k++) {
+				size_t m = (p + k) & 1;
+				EList<size_t>& out = m == 0 ? naive : swept;
+				out.clear();
+				uint64_t t0 = nanoTime();
+				if(m == 0) {
+					for(size_t i = 0; i < als1.size(); i++) {
+						for(size_t j = 0; j < als2.size(); j++) {
+							if(sweepPairOk(pepol, als1[i], als2[j], maxIntron, c.spliced)) {
+								out.push_back(i * als2.size() + j);
+							}
+						}
+					}
+				} else {
+					sweep.reset();
+					for(size_t j = 0; j < als2.size(); j++) {
+						sweep.add(j, als2[j].ref, als2[j].fw, als2[j].left, als2[j].right);
+					}
+					sweep.sort();
+					int64_t maxfrag = -1;
+					if(!c.spliced) {
+						maxfrag = max<int64_t>((int64_t)pepol.maxFragLen(), max<int64_t>(rdlen, sweep.maxSpan()));
+					}
+					for(size_t i = 0; i < als1.size(); i++) {
+						const SweepAln& a = als1[i];
+						sweep.candidates(a.ref, a.fw, a.left, a.right, true, false,
+						                 maxIntron, maxfrag, 0, cands);
+						for(size_t j = 0; j < cands.size(); j++) {
+							if(sweepPairOk(pepol, a, als2[cands[j]], maxIntron, c.spliced)) {
+								out.push_back(i * als2.size() + cands[j]);
+							}
+						}
+					}
+				}
+				secs[m] += (nanoTime() - t0) / 1e9;
+			}
+			npaired += naive.size();
+			if(naive == swept) {
+				nsame++;
+			}
+		}
+		if(nsame != npair) {
+			nbad++;
+		}
+		fprintf(stderr, "%-10s alns/mate=%5u  naive %10.1f us  sweep %8.1f us  speedup %7.1fx  pairs/read %6.1f  same %u/%u\n",
+		        c.name, (unsigned)c.nals,
+		        secs[0] * 1e6 / npair, secs[1] * 1e6 / npair,
+		        secs[1] > 0 ? secs[0] / secs[1] : 0.0,
+		        (double)npaired / npair, (unsigned)nsame, (unsigned)npair);
+	}
+	return nbad == 0 ? 0 : 1;
+}
+
+#endif /*def CONCORDANT_SWEEP_MAIN*/
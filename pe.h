@@ -32,6 +32,8 @@
 
 #include <iostream>
 #include <stdint.h>
+#include "ds.h"
+#include "mem_ids.h"
 
 // In description below "To the left" = "Upstream of w/r/t the Watson strand"
 
@@ -318,4 +320,94 @@ protected:
 	size_t minfrag_;
 };
 
+/**
+ * Alignments of mate 2 indexed by reference, strand and leftmost offset, so
+ * that finding the ones that could pair concordantly with an alignment of
+ * mate 1 costs a binary search plus a pass over the alignments in range,
+ * rather than a pass over all of them.  Call add() for each alignment, then
+ * sort(), then any number of candidates().
+ */
+class ConcordantSweep {
+
+public:
+
+	ConcordantSweep() : mates_(MISC_CAT), maxspan_(0) { }
+
+	/**
+	 * Forget all alignments.
+	 */
+	void reset() {
+		mates_.clear();
+		maxspan_ = 0;
+	}
+
+	/**
+	 * Add alignment number idx, spanning reference offsets [left, right]
+	 * (introns included) on strand fw of reference ref.
+	 */
+	void add(size_t idx, int64_t ref, bool fw, int64_t left, int64_t right) {
+		mates_.expand();
+		mates_.back().init(idx, ref, fw, left);
+		if(right - left + 1 > maxspan_) maxspan_ = right - left + 1;
+	}
+
+	/**
+	 * Sort the alignments added so far; must precede candidates().
+	 */
+	void sort() { mates_.sort(); }
+
+	size_t size() const { return mates_.size(); }
+
+	/**
+	 * Longest reference span of any alignment added.
+	 */
+	int64_t maxSpan() const { return maxspan_; }
+
+	/**
+	 * Set idxs to the indexes, in ascending order and no less than minidx,
+	 * of the alignments that could pair with a mate-1 alignment spanning
+	 * [left, right] on strand fw of reference ref.  Mate 1 is upstream when
+	 * fw == mate1fw, in which case mate 2 must be on strand mate2fw and start
+	 * no earlier than mate 1 and at most maxgap past its end; otherwise mate
+	 * 2 is upstream, on the other strand, and must start no later than mate
+	 * 1 and end at most maxgap before it.  If maxfrag >= 0 the two must also
+	 * start less than maxfrag apart.  This is a superset of the concordant
+	 * partners; callers still check each one.
+	 */
+	void candidates(
+		int64_t ref,
+		bool fw,
+		int64_t left,
+		int64_t right,
+		bool mate1fw,
+		bool mate2fw,
+		int64_t maxgap,
+		int64_t maxfrag,
+		size_t minidx,
+		EList<size_t>& idxs) const;
+
+protected:
+
+	struct Mate {
+		void init(size_t idx_, int64_t ref_, bool fw_, int64_t off_) {
+			idx = idx_; ref = ref_; fw = fw_; off = off_;
+		}
+
+		bool operator<(const Mate& o) const {
+			if(ref != o.ref) return ref < o.ref;
+			if(fw != o.fw) return !fw;
+			if(off != o.off) return off < o.off;
+			return idx < o.idx;
+		}
+
+		size_t  idx;
+		int64_t ref;
+		bool    fw;
+		int64_t off;
+	};
+
+	EList<Mate> mates_;   // sorted by ref, strand, offset
+	int64_t     maxspan_; // longest reference span
+};
+
 #endif /*ndef PE_H_*/
@@ -64,6 +64,34 @@ public:
     }
 
 #endif // POPCNT_CAPABILITY
+
+#if defined(USING_GCC_COMPILER) && (defined(__x86_64__) || defined(__i386__))
+
+public:
+    // AVX2 needs CPUID.07H:EBX.AVX2[bit 5] and the OS saving the YMM state
+    // (XCR0 bits 1 and 2), which is only queryable once CPUID.01H:ECX
+    // reports OSXSAVE[bit 27].
+    bool AVX2enabled()
+    {
+        regs_t regs;
+        if(!OSsavesState(0x6)) return false;
+        if(__get_cpuid_max(0, 0) < 7) return false;
+        __cpuid_count(7, 0, regs.EAX, regs.EBX, regs.ECX, regs.EDX);
+        return (regs.EBX & BIT(5)) != 0;
+    }
+
+private:
+    bool OSsavesState(unsigned int mask)
+    {
+        regs_t regs;
+        if(!__get_cpuid(0x1, &regs.EAX, &regs.EBX, &regs.ECX, &regs.EDX)) return false;
+        if(!(regs.ECX & BIT(27))) return false;
+        unsigned int xcr0, xcr0hi;
+        __asm__ __volatile__("xgetbv" : "=a"(xcr0), "=d"(xcr0hi) : "c"(0));
+        return (xcr0 & mask) == mask;
+    }
+
+#endif // USING_GCC_COMPILER && x86
 };
 
 #endif /*PROCESSOR_SUPPORT_H_*/
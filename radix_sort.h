@@ -3,6 +3,9 @@
 
 #include <time.h>
 
+// Inputs smaller than this are sorted by a single thread
+static const size_t RADIX_SORT_MIN_PARALLEL = (size_t)1 << 16;
+
 // in place radix sort using a single thread, should not be called directly
 // used for leaves of both in and out of place radix sorts
 template <typename T, typename CMP, typename index_t>
@@ -145,153 +148,169 @@ void radix_sort_in_place(T* begin, T* end, index_t (*hash)(T&), index_t maxv, in
 }
 
 template <typename T, typename index_t>
-struct CountParams {
-    T* begin;
-    T* end;
-    T* o;
-    index_t* count;
-    index_t (*hash)(T&);
-    int occupied;
-    int right_shift;
+struct LSDParams {
+    T*          begin;  // this thread's slice of the pass input
+    T*          end;
+    T*          o;      // pass output
+    size_t*     count;  // per digit: count, then where the slice's next one goes
+    index_t     (*hash)(T&);
+    int         shift;
+    index_t     mask;
 };
 
 template <typename T, typename index_t>
-static void _count_worker(void* vp) {
-    CountParams<T, index_t>* params = (CountParams<T, index_t>*)vp;
-    T* begin            = params->begin;
+static void _lsd_count_worker(void* vp) {
+    LSDParams<T, index_t>* params = (LSDParams<T, index_t>*)vp;
     T* end              = params->end;
+    size_t* count       = params->count;
     index_t (*hash)(T&) = params->hash;
-    int occupied        = params->occupied;
-    int right_shift     = params->right_shift;
+    int shift           = params->shift;
+    index_t mask        = params->mask;
 
-    params->count = new index_t[occupied + 1]();
-    for(T* curr = begin; curr != end; curr++) {
-        params->count[hash(*curr) >> right_shift]++;
+    for(T* curr = params->begin; curr != end; curr++) {
+        count[(hash(*curr) >> shift) & mask]++;
     }
 }
+
 template <typename T, typename index_t>
-static void _write_worker(void* vp) {
-    CountParams<T, index_t>* params = (CountParams<T, index_t>*)vp;
-    T* begin            = params->begin;
+static void _lsd_write_worker(void* vp) {
+    LSDParams<T, index_t>* params = (LSDParams<T, index_t>*)vp;
     T* end              = params->end;
     T* o                = params->o;
-    index_t* count      = params->count;
+    size_t* count       = params->count;
     index_t (*hash)(T&) = params->hash;
-    int right_shift     = params->right_shift;
+    int shift           = params->shift;
+    index_t mask        = params->mask;
 
-    for(T* curr = begin; curr != end; curr++) {
-        o[count[hash(*curr) >> right_shift]++] = *curr;
+    for(T* curr = params->begin; curr != end; curr++) {
+        o[count[(hash(*curr) >> shift) & mask]++] = *curr;
     }
 }
 
-template <typename T, typename CMP, typename index_t>
-void radix_sort_copy(T* begin, T* end, T* o, index_t (*hash)(T&), index_t maxv, int nthreads = 1) {
-    //set parameters
-    const int SHIFT = 8;
-    const int BLOCKS = (1 << (SHIFT + 1));
-    int log_size = sizeof(maxv) * 8;
-    while(!((1 << log_size) & maxv)) log_size--;
-    int right_shift = log_size - SHIFT;
-    int occupied = (maxv >> right_shift) + 1;
-    //count nodes
-    time_t start = time(0);
-    EList<CountParams<T, index_t> > cparams; cparams.resizeExact(nthreads);
-    AutoArray<tthread::thread*> threads1(nthreads);
-    T* st = begin;
-    T* en = st + (end - begin) / nthreads;
-    for(int i = 0; i < nthreads; i++) {
-        cparams[i].begin = st;
-        cparams[i].end = en;
-        cparams[i].hash = hash;
-        cparams[i].o = o;
-        cparams[i].occupied = occupied;
-        cparams[i].right_shift= right_shift;
-        if(nthreads == 1) {
-            _count_worker<T, index_t>((void*)&cparams[i]);
-        } else {
-            threads1[i] = new tthread::thread(&_count_worker<T, index_t>, (void*)&cparams[i]);
-        }
-        st = en;
-        if(i + 2 == nthreads) {
-            en = end;
-        } else {
-            en = st + (end - begin) / nthreads;
-        }
-    }
-    if(nthreads > 1) {
-        for(int i = 0; i < nthreads; i++) {
-            threads1[i]->join();
-            delete threads1[i];
-        }
-    }
-    if(nthreads != 1) cerr << "COUNT NUMBER IN EACH BIN: " << time(0) - start << endl;
-    start = time(0);
-    //transform counts into index
-    index_t tot = cparams[0].count[0];
-    cparams[0].count[0] = 0;
-    for(int i = 1; i < nthreads; i++) {
-        tot += cparams[i].count[0];
-        cparams[i].count[0] = tot - cparams[i].count[0];
-    }
-    for(int j = 1; j < occupied + 1; j++) {
-        for(int i = 0; i < nthreads; i++) {
-            tot += cparams[i].count[j];
-            cparams[i].count[j] = tot - cparams[i].count[j];
-        }
-    }
-    T* index[BLOCKS + 1];
-    for(int i = 0; i < occupied + 1; i++) {
-        index[i] = o + cparams[0].count[i];
-    }
-    //write T's to correct bin
+// run worker on each element of params, in a thread of its own if there
+// is more than one
+template <typename P>
+static void _radix_run_workers(void (*worker)(void*), EList<P>& params) {
+    int nthreads = (int)params.size();
     if(nthreads == 1) {
-        _write_worker<T, index_t>((void*)&cparams[0]);
-    } else {
-        for(int i = 0; i < nthreads; i++)
-            threads1[i] = new tthread::thread(&_write_worker<T, index_t>, (void*)&cparams[i]);
-        for(int i = 0; i < nthreads; i++) {
-            threads1[i]->join();
-        }
+        worker((void*)&params[0]);
+        return;
     }
+    AutoArray<tthread::thread*> threads(nthreads);
     for(int i = 0; i < nthreads; i++) {
-        delete[] cparams[i].count;
-        delete threads1[i];
+        threads[i] = new tthread::thread(worker, (void*)&params[i]);
     }
-    if(nthreads != 1) cerr << "FINISHED FIRST ROUND: " << time(0) - start << endl;
-    start = time(0);
-    //sort partitions
-    if(nthreads == 1) {
-        for(int bin = 0; bin < occupied; bin++)
-            if(index[bin + 1] - index[bin] > 1)
-                _radix_sort<T, CMP, index_t>(index[bin], index[bin + 1], hash, right_shift);
-    } else {
-        AutoArray<tthread::thread*> threads(nthreads);
-        EList<RecurseParams<T, index_t> > params; params.resizeExact(nthreads);
-        int st = 0;
+    for(int i = 0; i < nthreads; i++) {
+        threads[i]->join();
+        delete threads[i];
+    }
+}
+
+// Stable LSD radix sort of the n elements at in by hash, which must not exceed
+// maxv.  Every pass is parallel: each thread counts the digits in its slice,
+// then, after a prefix sum over (digit, thread), writes its slice out in order.
+// The result ends up in o.  scratch must hold n elements and be distinct from
+// o; in may be either o or scratch, and is overwritten if so.
+template <typename T, typename index_t>
+void radix_sort_stable(T* in, size_t n, T* o, T* scratch, index_t (*hash)(T&), index_t maxv, int nthreads = 1) {
+    const int MAX_BITS = 11;
+    assert(o != scratch);
+    if(n == 0) return;
+    // Small inputs aren't worth the threads
+    if(n < RADIX_SORT_MIN_PARALLEL) nthreads = 1;
+    int bits = 1;
+    while(bits < (int)sizeof(index_t) * 8 && (maxv >> bits) != 0) bits++;
+    int passes = (bits + MAX_BITS - 1) / MAX_BITS;
+    // The last pass writes to o, and the first can't write over its input
+    if(((passes % 2 == 1) ? o : scratch) == in) passes++;
+    int width = (bits + passes - 1) / passes;
+    size_t buckets = (size_t)1 << width;
+
+    EList<LSDParams<T, index_t> > params; params.resizeExact(nthreads);
+    EList<size_t> counts; counts.resizeExact(buckets * nthreads);
+    T* src = in;
+    for(int pass = 0; pass < passes; pass++) {
+        T* dst = ((passes - pass) % 2 == 1) ? o : scratch;
+        counts.fillZero();
+        T* st = src;
         for(int i = 0; i < nthreads; i++) {
+            params[i].begin = st;
+            params[i].end = (i + 1 == nthreads) ? src + n : st + n / nthreads;
+            params[i].o = dst;
+            params[i].count = counts.ptr() + buckets * i;
             params[i].hash = hash;
-            params[i].begin = index + st;
-            params[i].log_size = right_shift;
-            params[i].num = 0;
-            index_t remaining_elements = (index_t)(index[occupied] - index[st]);
-            while(params[i].num + st < occupied
-                        && (index_t)(index[params[i].num + st] - index[st]) < remaining_elements / (nthreads - i))
-                params[i].num++;
-            cerr << params[i].num << " " << (index_t)(index[params[i].num + st] - index[st]) << endl;
-            threads[i] = new tthread::thread(&_radix_sort_worker<T, CMP, index_t>, (void*)&params[i]);
-            st += params[i].num;
+            params[i].shift = pass * width;
+            params[i].mask = (index_t)(buckets - 1);
+            st = params[i].end;
         }
-        //do any remaining bins using main thread
-        for(int bin = st; bin < occupied; bin++) {
-            if(index[bin + 1] - index[bin] > 1)
-                _radix_sort<T, CMP, index_t>(index[bin], index[bin + 1], hash, right_shift);
+        _radix_run_workers<LSDParams<T, index_t> >(&_lsd_count_worker<T, index_t>, params);
+        // turn counts into where each thread writes the first of each digit
+        size_t tot = 0;
+        for(size_t d = 0; d < buckets; d++) {
+            for(int i = 0; i < nthreads; i++) {
+                size_t c = counts[buckets * i + d];
+                counts[buckets * i + d] = tot;
+                tot += c;
+            }
         }
-        for(int i = 0; i < nthreads; i++) {
-            threads[i]->join();
-            delete threads[i];
+        assert_eq(tot, n);
+        _radix_run_workers<LSDParams<T, index_t> >(&_lsd_write_worker<T, index_t>, params);
+        src = dst;
+    }
+    assert(src == o);
+}
+
+template <typename T, typename index_t>
+struct RunParams {
+    T*          begin;
+    T*          end;
+    index_t     (*hash)(T&);
+};
+
+// sort each run of elements with the same hash by CMP
+template <typename T, typename CMP, typename index_t>
+static void _sort_runs_worker(void* vp) {
+    RunParams<T, index_t>* params = (RunParams<T, index_t>*)vp;
+    T* end              = params->end;
+    index_t (*hash)(T&) = params->hash;
+    CMP cmp;
+
+    T* run = params->begin;
+    while(run != end) {
+        index_t h = hash(*run);
+        T* run_end = run + 1;
+        bool sorted = true;
+        while(run_end != end && hash(*run_end) == h) {
+            if(cmp(*run_end, *(run_end - 1))) sorted = false;
+            run_end++;
         }
+        if(!sorted) sort(run, run_end, cmp);
+        run = run_end;
     }
-    if(nthreads != 1) cerr << "FINISHED RECURSIVE SORTS: " << time(0) - start << endl;
+}
+
+// Sort [begin, end) by CMP into o, where hash gives the primary key of CMP and
+// never exceeds maxv.  Elements are radix sorted by hash (see
+// radix_sort_stable), then runs sharing a hash are sorted by CMP.  scratch
+// must hold end - begin elements; it may be begin, which is then overwritten.
+template <typename T, typename CMP, typename index_t>
+void radix_sort_copy(T* begin, T* end, T* o, T* scratch, index_t (*hash)(T&), index_t maxv, int nthreads = 1) {
+    size_t n = end - begin;
+    radix_sort_stable<T, index_t>(begin, n, o, scratch, hash, maxv, nthreads);
+    if(n < RADIX_SORT_MIN_PARALLEL) nthreads = 1;
+    // split into slices that don't cut a run
+    EList<RunParams<T, index_t> > params; params.resizeExact(nthreads);
+    T* st = o;
+    for(int i = 0; i < nthreads; i++) {
+        T* en = (i + 1 == nthreads) ? o + n : o + n / nthreads * (i + 1);
+        if(en < st) en = st;
+        while(en != o + n && en != o && hash(*en) == hash(*(en - 1))) en++;
+        params[i].begin = st;
+        params[i].end = en;
+        params[i].hash = hash;
+        st = en;
+    }
+    _radix_run_workers<RunParams<T, index_t> >(&_sort_runs_worker<T, CMP, index_t>, params);
 }
 
 #endif //RADIX_SORT_H_
@@ -26,6 +26,8 @@
 #include "sstring.h"
 #include "filebuf.h"
 #include "util.h"
+#include "timer.h"
+#include "read_sse.h"
 
 enum rna_strandness_format {
     RNA_STRANDNESS_UNKNOWN = 0,
@@ -83,11 +85,7 @@ struct Read {
 	 * Finish initializing a new read.
 	 */
 	void finalize() {
-		for(size_t i = 0; i < patFw.length(); i++) {
-			if((int)patFw[i] > 3) {
-				ns_++;
-			}
-		}
+		ns_ += readSseCountNs(patFw.buf(), patFw.length());
 		constructRevComps();
 		constructReverses();
 	}
@@ -103,11 +101,7 @@ struct Read {
 		reset();
 		patFw.installChars(seq);
 		qual.install(ql);
-		for(size_t i = 0; i < patFw.length(); i++) {
-			if((int)patFw[i] > 3) {
-				ns_++;
-			}
-		}
+		ns_ += readSseCountNs(patFw.buf(), patFw.length());
 		constructRevComps();
 		constructReverses();
 		if(nm != NULL) name.install(nm);
@@ -142,7 +136,8 @@ struct Read {
 				altPatRc[j].installReverse(altPatFw[j]);
 			}
 		} else {
-			patRc.installReverseComp(patFw);
+			patRc.resize(patFw.length());
+			readSseRevComp(patRc.wbuf(), patFw.buf(), patFw.length());
 			for(int j = 0; j < alts; j++) {
 				altPatRc[j].installReverseComp(altPatFw[j]);
 			}
@@ -154,9 +149,12 @@ struct Read {
 	 * place.  Assumes constructRevComps() was called previously.
 	 */
 	void constructReverses() {
-		patFwRev.installReverse(patFw);
-		patRcRev.installReverse(patRc);
-		qualRev.installReverse(qual);
+		patFwRev.resize(patFw.length());
+		readSseReverse(patFwRev.wbuf(), patFw.buf(), patFw.length());
+		patRcRev.resize(patRc.length());
+		readSseReverse(patRcRev.wbuf(), patRc.buf(), patRc.length());
+		qualRev.resize(qual.length());
+		readSseReverse(qualRev.wbuf(), qual.buf(), qual.length());
 		for(int j = 0; j < alts; j++) {
 			altPatFwRev[j].installReverse(altPatFw[j]);
 			altPatRcRev[j].installReverse(altPatRc[j]);
@@ -431,7 +429,7 @@ struct FmString {
  */
 struct PerReadMetrics {
 
-	PerReadMetrics() { reset(); }
+	PerReadMetrics() : maxFmops(0), maxExtAtts(0), maxUsecs(0) { reset(); }
 
 	void reset() {
 		nExIters =
@@ -446,6 +444,9 @@ struct PerReadMetrics {
 		nUgFail = nUgFailStreak = nUgLastSucc =
 		nEeFail = nEeFailStreak = nEeLastSucc =
 		nFilt = 0;
+		nExtAtts = 0;
+		begNs = 0;
+		budgetExceeded = false;
 		nFtabs = 0;
 		nRedSkip = 0;
 		nRedFail = 0;
@@ -522,6 +523,33 @@ struct PerReadMetrics {
 	
 	uint64_t nFilt;         // # mates filtered
 	
+	/**
+	 * Return true iff the work done on this read so far, given that
+	 * fmops FM Index ops have been spent on it, exceeds one of the
+	 * per-read budgets.  Once exceeded, the budget stays exceeded until
+	 * the next reset(), so callers can stop searching and report the
+	 * alignments found so far.
+	 */
+	bool overBudget(uint64_t fmops) {
+		if(budgetExceeded) return true;
+		if((maxFmops > 0 && fmops >= maxFmops) ||
+		   (maxExtAtts > 0 && nExtAtts >= maxExtAtts) ||
+		   (maxUsecs > 0 && nanoTime() - begNs >= maxUsecs * 1000))
+		{
+			budgetExceeded = true;
+		}
+		return budgetExceeded;
+	}
+
+	uint64_t nExtAtts;      // # hybrid search extension attempts
+	
+	// Per-read work budgets; 0 means no limit.  Not cleared by reset().
+	uint64_t maxFmops;      // max FM Index ops
+	uint64_t maxExtAtts;    // max hybrid search extension attempts
+	uint64_t maxUsecs;      // max wall-clock microseconds, counted from begNs
+	uint64_t begNs;         // time alignment of this read started
+	bool     budgetExceeded; // search was cut short by a budget
+	
 	TAlScore bestLtMinscMate1; // best invalid score observed for mate 1
 	TAlScore bestLtMinscMate2; // best invalid score observed for mate 2
 	
@@ -0,0 +1,479 @@
+/*
+ * Copyright 2015, Daehwan Kim <infphilo@gmail.com>
+ *
+ * This file is part of HISAT 2.
+ *
+ * HISAT 2 is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * HISAT 2 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with HISAT 2.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include "alphabet.h"
+#include "read_sse.h"
+#include "processor_support.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && !defined(NO_SSE)
+#define READ_SSE_CAPABILITY
+#include <immintrin.h>
+#endif
+
+/**
+ * Scalar versions; these are what the parser and Read did one character
+ * at a time before, and what the vector versions finish the tails with.
+ */
+namespace read_sse_scalar {
+
+static inline bool isAsciiAlpha(char c) {
+	return (unsigned char)((c | 0x20) - 'a') <= 'z' - 'a';
+}
+
+static size_t asciiToDna(char *dst, const char *src, size_t n) {
+	size_t i = 0;
+	for(; i < n && isAsciiAlpha(src[i]); i++) {
+		dst[i] = asc2dna[(int)src[i]];
+	}
+	return i;
+}
+
+static size_t qualToPhred33(char *dst, const char *src, size_t n, bool phred64) {
+	const signed char lo = phred64 ? 64 : 33;
+	const char off = phred64 ? 64 - 33 : 0;
+	size_t i = 0;
+	for(; i < n && (signed char)src[i] >= lo; i++) {
+		dst[i] = src[i] - off;
+	}
+	return i;
+}
+
+static void revComp(char *dst, const char *src, size_t n) {
+	for(size_t i = 0; i < n; i++) {
+		char c = src[n-i-1];
+		dst[i] = (c == 4 ? 4 : c ^ 3);
+	}
+}
+
+static void reverse(char *dst, const char *src, size_t n) {
+	for(size_t i = 0; i < n; i++) {
+		dst[i] = src[n-i-1];
+	}
+}
+
+static size_t countNs(const char *src, size_t n) {
+	size_t ns = 0;
+	for(size_t i = 0; i < n; i++) {
+		if((int)src[i] > 3) ns++;
+	}
+	return ns;
+}
+
+}
+
+#ifdef READ_SSE_CAPABILITY
+
+/**
+ * SSE2: 16 characters at a time.  Every x86-64 processor has it.
+ */
+namespace read_sse_sse2 {
+
+/**
+ * Reverse the 16 bytes of v: reverse the dwords, swap the words within
+ * each dword, then swap the bytes within each word.
+ */
+static inline __m128i rev(__m128i v) {
+	v = _mm_shuffle_epi32(v, _MM_SHUFFLE(0, 1, 2, 3));
+	v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+	v = _mm_shufflehi_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+	return _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+}
+
+static size_t asciiToDna(char *dst, const char *src, size_t n) {
+	const __m128i vcase = _mm_set1_epi8(0x20);
+	const __m128i va = _mm_set1_epi8('a');
+	const __m128i vz = _mm_set1_epi8('z' - 'a');
+	const __m128i vc = _mm_set1_epi8('c'), vg = _mm_set1_epi8('g');
+	const __m128i vt = _mm_set1_epi8('t'), vn = _mm_set1_epi8('n');
+	const __m128i v1 = _mm_set1_epi8(1), v2 = _mm_set1_epi8(2);
+	const __m128i v3 = _mm_set1_epi8(3), v4 = _mm_set1_epi8(4);
+	size_t i = 0;
+	for(; i + 16 <= n; i += 16) {
+		__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+		__m128i l = _mm_or_si128(v, vcase); // lower case
+		__m128i d = _mm_sub_epi8(l, va);
+		__m128i alpha = _mm_cmpeq_epi8(_mm_min_epu8(d, vz), d);
+		// Letters other than c, g, t and n map to 0, as in asc2dna
+		__m128i code = _mm_or_si128(
+			_mm_or_si128(_mm_and_si128(_mm_cmpeq_epi8(l, vc), v1),
+			             _mm_and_si128(_mm_cmpeq_epi8(l, vg), v2)),
+			_mm_or_si128(_mm_and_si128(_mm_cmpeq_epi8(l, vt), v3),
+			             _mm_and_si128(_mm_cmpeq_epi8(l, vn), v4)));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), code);
+		int m = _mm_movemask_epi8(alpha);
+		if(m != 0xffff) {
+			return i + __builtin_ctz(~m);
+		}
+	}
+	return i + read_sse_scalar::asciiToDna(dst + i, src + i, n - i);
+}
+
+static size_t qualToPhred33(char *dst, const char *src, size_t n, bool phred64) {
+	const __m128i vmin = _mm_set1_epi8(phred64 ? 63 : 32);
+	const __m128i voff = _mm_set1_epi8(phred64 ? 64 - 33 : 0);
+	size_t i = 0;
+	for(; i + 16 <= n; i += 16) {
+		__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_sub_epi8(v, voff));
+		int m = _mm_movemask_epi8(_mm_cmpgt_epi8(v, vmin));
+		if(m != 0xffff) {
+			return i + __builtin_ctz(~m);
+		}
+	}
+	return i + read_sse_scalar::qualToPhred33(dst + i, src + i, n - i, phred64);
+}
+
+static void revComp(char *dst, const char *src, size_t n) {
+	const __m128i v3 = _mm_set1_epi8(3), v4 = _mm_set1_epi8(4);
+	size_t i = 0;
+	for(; i + 16 <= n; i += 16) {
+		__m128i v = rev(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + n - i - 16)));
+		v = _mm_xor_si128(v, _mm_andnot_si128(_mm_cmpeq_epi8(v, v4), v3));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), v);
+	}
+	read_sse_scalar::revComp(dst + i, src, n - i);
+}
+
+static void reverse(char *dst, const char *src, size_t n) {
+	size_t i = 0;
+	for(; i + 16 <= n; i += 16) {
+		__m128i v = rev(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + n - i - 16)));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), v);
+	}
+	read_sse_scalar::reverse(dst + i, src, n - i);
+}
+
+static size_t countNs(const char *src, size_t n) {
+	const __m128i v3 = _mm_set1_epi8(3);
+	size_t ns = 0, i = 0;
+	for(; i + 16 <= n; i += 16) {
+		__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+		ns += __builtin_popcount(_mm_movemask_epi8(_mm_cmpgt_epi8(v, v3)));
+	}
+	return ns + read_sse_scalar::countNs(src + i, n - i);
+}
+
+}
+
+/**
+ * AVX2: 32 characters at a time, finishing with the SSE2 versions.  Those
+ * are not VEX-encoded, so clear the upper halves before calling them or
+ * the tail pays an AVX-SSE transition penalty.
+ */
+namespace read_sse_avx2 {
+
+#define READ_SSE_TARGET __attribute__((target("avx2")))
+
+/**
+ * Reverse the 32 bytes of v: reverse each 128-bit half, then swap them.
+ */
+READ_SSE_TARGET static inline __m256i rev(__m256i v) {
+	const __m256i vrev = _mm256_setr_epi8(
+		15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0,
+		15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0);
+	v = _mm256_shuffle_epi8(v, vrev);
+	return _mm256_permute2x128_si256(v, v, 0x01);
+}
+
+READ_SSE_TARGET static size_t asciiToDna(char *dst, const char *src, size_t n) {
+	const __m256i vcase = _mm256_set1_epi8(0x20);
+	const __m256i va = _mm256_set1_epi8('a');
+	const __m256i vz = _mm256_set1_epi8('z' - 'a');
+	const __m256i vc = _mm256_set1_epi8('c'), vg = _mm256_set1_epi8('g');
+	const __m256i vt = _mm256_set1_epi8('t'), vn = _mm256_set1_epi8('n');
+	const __m256i v1 = _mm256_set1_epi8(1), v2 = _mm256_set1_epi8(2);
+	const __m256i v3 = _mm256_set1_epi8(3), v4 = _mm256_set1_epi8(4);
+	size_t i = 0;
+	for(; i + 32 <= n; i += 32) {
+		__m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+		__m256i l = _mm256_or_si256(v, vcase);
+		__m256i d = _mm256_sub_epi8(l, va);
+		__m256i alpha = _mm256_cmpeq_epi8(_mm256_min_epu8(d, vz), d);
+		__m256i code = _mm256_or_si256(
+			_mm256_or_si256(_mm256_and_si256(_mm256_cmpeq_epi8(l, vc), v1),
+			                _mm256_and_si256(_mm256_cmpeq_epi8(l, vg), v2)),
+			_mm256_or_si256(_mm256_and_si256(_mm256_cmpeq_epi8(l, vt), v3),
+			                _mm256_and_si256(_mm256_cmpeq_epi8(l, vn), v4)));
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), code);
+		uint32_t m = (uint32_t)_mm256_movemask_epi8(alpha);
+		if(m != 0xffffffffu) {
+			return i + __builtin_ctz(~m);
+		}
+	}
+	_mm256_zeroupper();
+	return i + read_sse_sse2::asciiToDna(dst + i, src + i, n - i);
+}
+
+READ_SSE_TARGET static size_t qualToPhred33(char *dst, const char *src, size_t n, bool phred64) {
+	const __m256i vmin = _mm256_set1_epi8(phred64 ? 63 : 32);
+	const __m256i voff = _mm256_set1_epi8(phred64 ? 64 - 33 : 0);
+	size_t i = 0;
+	for(; i + 32 <= n; i += 32) {
+		__m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), _mm256_sub_epi8(v, voff));
+		uint32_t m = (uint32_t)_mm256_movemask_epi8(_mm256_cmpgt_epi8(v, vmin));
+		if(m != 0xffffffffu) {
+			return i + __builtin_ctz(~m);
+		}
+	}
+	_mm256_zeroupper();
+	return i + read_sse_sse2::qualToPhred33(dst + i, src + i, n - i, phred64);
+}
+
+READ_SSE_TARGET static void revComp(char *dst, const char *src, size_t n) {
+	const __m256i v3 = _mm256_set1_epi8(3), v4 = _mm256_set1_epi8(4);
+	size_t i = 0;
+	for(; i + 32 <= n; i += 32) {
+		__m256i v = rev(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + n - i - 32)));
+		v = _mm256_xor_si256(v, _mm256_andnot_si256(_mm256_cmpeq_epi8(v, v4), v3));
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), v);
+	}
+	_mm256_zeroupper();
+	read_sse_sse2::revComp(dst + i, src, n - i);
+}
+
+READ_SSE_TARGET static void reverse(char *dst, const char *src, size_t n) {
+	size_t i = 0;
+	for(; i + 32 <= n; i += 32) {
+		__m256i v = rev(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + n - i - 32)));
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), v);
+	}
+	_mm256_zeroupper();
+	read_sse_sse2::reverse(dst + i, src, n - i);
+}
+
+READ_SSE_TARGET static size_t countNs(const char *src, size_t n) {
+	const __m256i v3 = _mm256_set1_epi8(3);
+	size_t ns = 0, i = 0;
+	for(; i + 32 <= n; i += 32) {
+		__m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+		ns += __builtin_popcount((uint32_t)_mm256_movemask_epi8(_mm256_cmpgt_epi8(v, v3)));
+	}
+	_mm256_zeroupper();
+	return ns + read_sse_sse2::countNs(src + i, n - i);
+}
+
+#undef READ_SSE_TARGET
+}
+
+#endif /*def READ_SSE_CAPABILITY*/
+
+/**
+ * One set of helpers per instruction set.
+ */
+struct ReadSseFuncs {
+	size_t (*asciiToDna)(char*, const char*, size_t);
+	size_t (*qualToPhred33)(char*, const char*, size_t, bool);
+	void   (*revComp)(char*, const char*, size_t);
+	void   (*reverse)(char*, const char*, size_t);
+	size_t (*countNs)(const char*, size_t);
+};
+
+enum {
+	READ_SSE_SCALAR = 0,
+	READ_SSE_SSE2,
+	READ_SSE_AVX2
+};
+
+static ReadSseFuncs readSseFuncs(int level) {
+	ReadSseFuncs f = {
+		read_sse_scalar::asciiToDna,
+		read_sse_scalar::qualToPhred33,
+		read_sse_scalar::revComp,
+		read_sse_scalar::reverse,
+		read_sse_scalar::countNs
+	};
+#ifdef READ_SSE_CAPABILITY
+	if(level >= READ_SSE_AVX2) {
+		f.asciiToDna    = read_sse_avx2::asciiToDna;
+		f.qualToPhred33 = read_sse_avx2::qualToPhred33;
+		f.revComp       = read_sse_avx2::revComp;
+		f.reverse       = read_sse_avx2::reverse;
+		f.countNs       = read_sse_avx2::countNs;
+	} else if(level >= READ_SSE_SSE2) {
+		f.asciiToDna    = read_sse_sse2::asciiToDna;
+		f.qualToPhred33 = read_sse_sse2::qualToPhred33;
+		f.revComp       = read_sse_sse2::revComp;
+		f.reverse       = read_sse_sse2::reverse;
+		f.countNs       = read_sse_sse2::countNs;
+	}
+#endif
+	return f;
+}
+
+/**
+ * Return the widest level this processor and OS support.
+ */
+static int readSseDetect() {
+#ifdef READ_SSE_CAPABILITY
+	ProcessorSupport ps;
+	if(ps.AVX2enabled()) {
+		return READ_SSE_AVX2;
+	}
+	return READ_SSE_SSE2;
+#else
+	return READ_SSE_SCALAR;
+#endif
+}
+
+static const ReadSseFuncs gReadSse = readSseFuncs(readSseDetect());
+
+size_t readSseAsciiToDna(char *dst, const char *src, size_t n) {
+	return gReadSse.asciiToDna(dst, src, n);
+}
+
+size_t readSseQualToPhred33(char *dst, const char *src, size_t n, bool phred64) {
+	return gReadSse.qualToPhred33(dst, src, n, phred64);
+}
+
+void readSseRevComp(char *dst, const char *src, size_t n) {
+	gReadSse.revComp(dst, src, n);
+}
+
+void readSseReverse(char *dst, const char *src, size_t n) {
+	gReadSse.reverse(dst, src, n);
+}
+
+size_t readSseCountNs(const char *src, size_t n) {
+	return gReadSse.countNs(src, n);
+}
+
+#ifdef READ_SSE_MAIN
+
+/*
+ * Benchmark the helpers on reads of 100-300 bp: encode the bases and
+ * qualities as FastqPatternSource does, then count Ns and build the
+ * reverse complement and the three reversed strings as Read::finalize
+ * does.  Every level must produce the same bytes as the scalar one.
+ *
+ * Build with something like:
+ *
+ *   g++ -O3 -msse2 -DNDEBUG -DREAD_SSE_MAIN -o read_sse_bench \
+ *       read_sse.cpp alphabet.cpp
+ *
+ * and run as "read_sse_bench [reads] [passes]".
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include "timer.h"
+
+/**
+ * Everything finalize() and the parser produce for one read.
+ */
+struct BenchOut {
+	std::string fw, rc, fwRev, rcRev, qual, qualRev;
+	size_t ns;
+};
+
+static void benchOne(
+	const ReadSseFuncs& f,
+	const std::string& seq,
+	const std::string& qual,
+	BenchOut& o)
+{
+	size_t n = seq.length();
+	o.fw.resize(n); o.rc.resize(n); o.fwRev.resize(n); o.rcRev.resize(n);
+	o.qual.resize(n); o.qualRev.resize(n);
+	f.asciiToDna(&o.fw[0], seq.data(), n);
+	f.qualToPhred33(&o.qual[0], qual.data(), n, false);
+	o.ns = f.countNs(o.fw.data(), n);
+	f.revComp(&o.rc[0], o.fw.data(), n);
+	f.reverse(&o.fwRev[0], o.fw.data(), n);
+	f.reverse(&o.rcRev[0], o.rc.data(), n);
+	f.reverse(&o.qualRev[0], o.qual.data(), n);
+}
+
+int main(int argc, char **argv) {
+	size_t nread = argc > 1 ? (size_t)atoi(argv[1]) : 100000;
+	int npass = argc > 2 ? atoi(argv[2]) : 5;
+	srand(77);
+	std::vector<std::string> seqs(nread), quals(nread);
+	size_t totlen = 0;
+	for(size_t i = 0; i < nread; i++) {
+		size_t len = 100 + rand() % 201;
+		for(size_t j = 0; j < len; j++) {
+			int r = rand() % 200;
+			seqs[i].push_back(r == 0 ? 'N' : (r == 1 ? 'n' : "ACGTacgt"[r & 7]));
+			quals[i].push_back((char)(33 + rand() % 42));
+		}
+		totlen += len;
+	}
+	// Runs of valid characters must stop at the first invalid one
+	const char *runs[] = { "ACGT+ACGT", "acgtnACGTNRYacgtnACGTNRYacgtnACGTNRY.ACGT", "ACGTACGTACGTACGTACGTACGTACGTACG\r" };
+	int nbad = 0;
+	const char *names[] = { "scalar", "sse2", "avx2" };
+	int maxLevel = readSseDetect();
+	std::vector<BenchOut> ref(nread);
+	for(int level = READ_SSE_SCALAR; level <= maxLevel; level++) {
+		ReadSseFuncs f = readSseFuncs(level);
+		std::vector<BenchOut> out(nread);
+		for(size_t r = 0; r < sizeof(runs) / sizeof(runs[0]); r++) {
+			char buf[64], rbuf[64];
+			size_t n = strlen(runs[r]);
+			size_t k = f.asciiToDna(buf, runs[r], n);
+			size_t rk = read_sse_scalar::asciiToDna(rbuf, runs[r], n);
+			if(k != rk || memcmp(buf, rbuf, k) != 0) {
+				fprintf(stderr, "%s: asciiToDna run mismatch on \"%s\"\n", names[level], runs[r]);
+				nbad++;
+			}
+			k = f.qualToPhred33(buf, runs[r], n, true);
+			rk = read_sse_scalar::qualToPhred33(rbuf, runs[r], n, true);
+			if(k != rk || memcmp(buf, rbuf, k) != 0) {
+				fprintf(stderr, "%s: qualToPhred33 run mismatch on \"%s\"\n", names[level], runs[r]);
+				nbad++;
+			}
+		}
+		double best = 1e30;
+		for(int p = 0; p < npass; p++) {
+			uint64_t t0 = nanoTime();
+			for(size_t i = 0; i < nread; i++) {
+				benchOne(f, seqs[i], quals[i], out[i]);
+			}
+			double t = (nanoTime() - t0) / 1e9;
+			if(t < best) best = t;
+		}
+		for(size_t i = 0; i < nread; i++) {
+			const BenchOut& a = out[i];
+			if(level == READ_SSE_SCALAR) {
+				ref[i] = a;
+				continue;
+			}
+			const BenchOut& b = ref[i];
+			if(a.fw != b.fw || a.rc != b.rc || a.fwRev != b.fwRev || a.rcRev != b.rcRev ||
+			   a.qual != b.qual || a.qualRev != b.qualRev || a.ns != b.ns)
+			{
+				nbad++;
+			}
+		}
+		printf("%-7s %8.1f ns/read %7.2f GB/s\n", names[level],
+		       best * 1e9 / nread, totlen / best / 1e9);
+	}
+	if(nbad > 0) {
+		fprintf(stderr, "%d mismatches against the scalar helpers\n", nbad);
+		return 1;
+	}
+	return 0;
+}
+
+#endif /*def READ_SSE_MAIN*/
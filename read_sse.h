@@ -0,0 +1,66 @@
+/*
+ * Copyright 2015, Daehwan Kim <infphilo@gmail.com>
+ *
+ * This file is part of HISAT 2.
+ *
+ * HISAT 2 is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * HISAT 2 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with HISAT 2.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * read_sse.h
+ *
+ * Vectorized helpers for turning parsed reads into the strings Read keeps:
+ * ASCII bases to 0-4 codes, ASCII qualities to Phred+33, and the reversed
+ * and reverse-complemented copies Read::finalize builds.  Each helper has a
+ * scalar, an SSE2 and an AVX2 version; the AVX2 one is picked once at
+ * runtime with ProcessorSupport.
+ */
+
+#ifndef READ_SSE_H_
+#define READ_SSE_H_
+
+#include <stddef.h>
+
+/**
+ * Encode the longest prefix of src[0..n) made of letters, as asc2dna
+ * does, into dst and return its length.  dst must have room for n
+ * characters; characters past the returned length may be overwritten.
+ */
+extern size_t readSseAsciiToDna(char *dst, const char *src, size_t n);
+
+/**
+ * Convert the longest prefix of src[0..n) made of valid Phred+33 (or,
+ * if phred64, Phred+64) quality characters to Phred+33 into dst and
+ * return its length.  Stops at spaces, newlines and out-of-range
+ * characters so the caller can deal with them.  dst must have room for
+ * n characters.
+ */
+extern size_t readSseQualToPhred33(char *dst, const char *src, size_t n, bool phred64);
+
+/**
+ * Set dst[0..n) to the reverse complement of the 0-4 codes in src.
+ */
+extern void readSseRevComp(char *dst, const char *src, size_t n);
+
+/**
+ * Set dst[0..n) to src[0..n) reversed.
+ */
+extern void readSseReverse(char *dst, const char *src, size_t n);
+
+/**
+ * Return how many of the 0-4 codes in src[0..n) are Ns.
+ */
+extern size_t readSseCountNs(const char *src, size_t n);
+
+#endif /*READ_SSE_H_*/
@@ -18,23 +18,26 @@
  */
 
 #include "ref_read.h"
+#include "mem_ids.h"
+#include "threading.h"
 
 /**
  * Reads past the next ambiguous or unambiguous stretch of sequence
  * from the given FASTA file and returns its length.  Does not do
  * anything with the sequence characters themselves; this is purely for
- * measuring lengths.
+ * measuring lengths.  'lastc' holds the last character seen by the
+ * previous call on the same input.
  */
-RefRecord fastaRefReadSize(
-	FileBuf& in,
+template<typename TIn, typename TOut>
+static RefRecord fastaRefReadSize(
+	TIn& in,
 	const RefReadInParams& rparms,
 	bool first,
-	BitpairOutFileBuf* bpout,
-	string* name // put parsed FASTA name here
-	)
+	TOut* bpout,
+	string* name, // put parsed FASTA name here
+	int& lastc)
 {
 	int c;
-	static int lastc = '>'; // last character seen
 
 	// RefRecord params
 	TIndexOffU len = 0; // 'len' counts toward total length
@@ -231,6 +234,376 @@ RefRecord fastaRefReadSize(
 	return RefRecord((TIndexOffU)off, (TIndexOffU)len, first);
 }
 
+RefRecord fastaRefReadSize(
+	FileBuf& in,
+	const RefReadInParams& rparms,
+	bool first,
+	BitpairOutFileBuf* bpout,
+	string* name // put parsed FASTA name here
+	)
+{
+	static int lastc = '>'; // last character seen
+	return fastaRefReadSize(in, rparms, first, bpout, name, lastc);
+}
+
+/**
+ * In-memory stand-in for FileBuf with just what fastaRefReadSize()
+ * needs.
+ */
+class RefMemBuf {
+public:
+	RefMemBuf(const char *buf, size_t len) : buf_(buf), len_(len), cur_(0) { }
+
+	int get() {
+		return cur_ < len_ ? (int)(uint8_t)buf_[cur_++] : -1;
+	}
+
+	bool eof() const { return cur_ == len_; }
+
+	int getPastWhitespace() {
+		int c;
+		while(isspace(c = get()) && c != -1);
+		return c;
+	}
+
+private:
+	const char *buf_;
+	size_t      len_;
+	size_t      cur_;
+};
+
+/**
+ * Input for fastaRefReadSize() that reads what's left of a batch buffer
+ * and then carries on reading the file.
+ */
+class RefChainBuf {
+public:
+	RefChainBuf(const char *buf, size_t len, FileBuf& in) : mem_(buf, len), in_(in) { }
+
+	int get() {
+		int c = mem_.get();
+		return c != -1 ? c : in_.get();
+	}
+
+	bool eof() { return mem_.eof() && in_.eof(); }
+
+	int getPastWhitespace() {
+		int c;
+		while(isspace(c = get()) && c != -1);
+		return c;
+	}
+
+private:
+	RefMemBuf mem_;
+	FileBuf&  in_;
+};
+
+/**
+ * Collects bitpairs packed four to a byte in the same layout as
+ * BitpairOutFileBuf, to be appended to one later.
+ */
+struct RefPackBuf {
+	RefPackBuf() : len(0) { }
+
+	void write(int bp) {
+		if((len & 3) == 0) packed.push_back(0);
+		packed.back() |= (uint8_t)(bp << ((len & 3) << 1));
+		len++;
+	}
+
+	EList<uint8_t> packed;
+	size_t         len;     // number of bitpairs
+};
+
+/**
+ * Piece of a FASTA file that starts at a new sequence and runs up to and
+ * including the '>' of the next one, along with what fastaRefReadSize()
+ * parsed out of it.  Parsing a piece on its own gives the same records as
+ * parsing it as part of the whole file.
+ */
+struct RefSegment {
+	void reset(size_t b, size_t e) {
+		beg = b;
+		end = e;
+		recs.clear();
+		bps.packed.clear();
+		bps.len = 0;
+		tooLong = false;
+	}
+
+	size_t           beg;     // offsets into the batch buffer
+	size_t           end;
+	EList<RefRecord> recs;
+	RefPackBuf       bps;
+	bool             tooLong; // RefTooLongException was thrown
+};
+
+/**
+ * Finds where a FASTA file can be cut into RefSegments: at each '>' that
+ * ends a sequence, i.e. one that isn't inside a name line and doesn't
+ * immediately follow one (fastaRefReadSize() just reads another name
+ * there).  State is kept across calls so the file can be scanned in
+ * pieces.
+ */
+class RefSplitter {
+public:
+	RefSplitter() : state_(SKIP_WS) { }
+
+	/**
+	 * Scan buf[beg, end) and append the offsets of split points to
+	 * 'splits'.
+	 */
+	void scan(const char *buf, size_t beg, size_t end, EList<size_t>& splits) {
+		for(size_t i = beg; i < end; i++) {
+			int c = (uint8_t)buf[i];
+			switch(state_) {
+				case SKIP_WS:
+					// FileBuf::getPastWhitespace() then consumes the '>'
+					if(!isspace(c)) state_ = NAME;
+					break;
+				case NAME:
+					if(c == '\n' || c == '\r') state_ = AFTER_NAME;
+					break;
+				case AFTER_NAME:
+					if(c == '>') state_ = NAME;
+					else if(c != '\n' && c != '\r') state_ = SEQ;
+					break;
+				default:
+					assert_eq(SEQ, state_);
+					if(c == '>') {
+						splits.push_back(i);
+						state_ = NAME;
+					}
+					break;
+			}
+		}
+	}
+
+private:
+	enum { SKIP_WS = 0, NAME, AFTER_NAME, SEQ };
+	int state_;
+};
+
+struct RefSegmentParams {
+	const char*            buf;
+	EList<RefSegment>*     segs;
+	const RefReadInParams* rparms;
+	bool                   pack;
+	size_t*                next;  // next segment to parse
+	MUTEX_T*               mutex;
+};
+
+static void fastaRefReadSegment_worker(void *vp)
+{
+	RefSegmentParams& p = *(RefSegmentParams*)vp;
+	while(true) {
+		size_t i = 0;
+		{
+			ThreadSafe ts(p.mutex);
+			i = (*p.next)++;
+		}
+		if(i >= p.segs->size()) break;
+		RefSegment& seg = (*p.segs)[i];
+		RefMemBuf in(p.buf + seg.beg, seg.end - seg.beg);
+		if(p.pack) seg.bps.packed.reserveExact((seg.end - seg.beg + 3) >> 2);
+		int lastc = '>';
+		bool first = true;
+		try {
+			while(!in.eof()) {
+				seg.recs.push_back(fastaRefReadSize(in,
+				                                    *p.rparms,
+				                                    first,
+				                                    p.pack ? &seg.bps : (RefPackBuf*)NULL,
+				                                    (string*)NULL,
+				                                    lastc));
+				first = false;
+			}
+		} catch(RefTooLongException& e) {
+			seg.tooLong = true;
+		}
+	}
+}
+
+/**
+ * Count record 'rec' from fastaRefReadSize() in the totals and keep it
+ * unless it's an empty continuation of a sequence.
+ */
+static void addRefRecord(
+	const RefRecord& rec,
+	EList<RefRecord>& recs,
+	TIndexOff& numSeqs,
+	TIndexOffU& unambigTot,
+	size_t& bothTot)
+{
+	if((unambigTot + rec.len) < unambigTot) {
+		cerr << RefTooLongException().what() << endl;
+		throw 1;
+	}
+	// Add the length of this record.
+	if(rec.first) numSeqs++;
+	unambigTot += rec.len;
+	bothTot += rec.len;
+	bothTot += rec.off;
+	if(rec.len == 0 && rec.off == 0 && !rec.first) return;
+	recs.push_back(rec);
+}
+
+/**
+ * The per-file loop of fastaRefReadSizes() when there's one thread.
+ */
+static void fastaRefReadSizesST(
+	FileBuf& in,
+	EList<RefRecord>& recs,
+	const RefReadInParams& rparms,
+	BitpairOutFileBuf* bpout,
+	TIndexOff& numSeqs,
+	TIndexOffU& unambigTot,
+	size_t& bothTot)
+{
+	bool first = true;
+	// For each pattern in this istream
+	while(!in.eof()) {
+		RefRecord rec;
+		try {
+			rec = fastaRefReadSize(in, rparms, first, bpout);
+		}
+		catch(RefTooLongException& e) {
+			cerr << e.what() << endl;
+			throw 1;
+		}
+		addRefRecord(rec, recs, numSeqs, unambigTot, bothTot);
+		first = false;
+	}
+}
+
+/**
+ * Multithreaded version of fastaRefReadSizesST().  Reads the file in
+ * batches of 'batch' characters, cuts each batch into RefSegments,
+ * parses and packs the segments in parallel and then appends their
+ * records and bitpairs in file order.  A single sequence is never split,
+ * so this helps only for references with many sequences (or with long
+ * runs of Ns splitting them).  A sequence that doesn't end within a
+ * batch of its start is parsed serially straight from the file instead,
+ * so at most two batches are held in memory.
+ */
+static void fastaRefReadSizesMT(
+	FileBuf& in,
+	EList<RefRecord>& recs,
+	const RefReadInParams& rparms,
+	BitpairOutFileBuf* bpout,
+	TIndexOff& numSeqs,
+	TIndexOffU& unambigTot,
+	size_t& bothTot,
+	int nthreads,
+	size_t batch)
+{
+	assert_gt(nthreads, 1);
+	assert_gt(batch, 0);
+	EList<char> buf(MISC_CAT);
+	EList<size_t> splits(MISC_CAT);
+	EList<RefSegment> segs(MISC_CAT);
+	RefSplitter splitter;
+	size_t scanned = 0;
+	bool done = false;
+	MUTEX_T mutex;
+	AutoArray<tthread::thread*> threads(nthreads);
+	EList<RefSegmentParams> params(MISC_CAT);
+	params.resizeExact(nthreads);
+	splits.push_back(0);
+	while(!done) {
+		size_t old = buf.size();
+		buf.resize(old + batch);
+		size_t got = in.read(buf.ptr() + old, batch);
+		buf.resize(old + got);
+		done = (got < batch);
+		if(buf.empty()) {
+			// Empty file; fastaRefReadSize() would warn and count one
+			// empty sequence
+			assert(done);
+			cerr << "Warning: Empty input file" << endl;
+			addRefRecord(RefRecord(0, 0, true), recs, numSeqs, unambigTot, bothTot);
+			break;
+		}
+		// Hold back the last character until we know whether it's the
+		// very last one of the file; a '>' there doesn't start a new sequence
+		size_t upto = (done || buf.empty()) ? buf.size() : buf.size() - 1;
+		splitter.scan(buf.ptr(), scanned, upto, splits);
+		scanned = upto;
+		if(done && splits.size() > 1 && splits.back() + 1 == buf.size()) {
+			splits.pop_back();
+		}
+		size_t nsegs = splits.size() - 1;
+		if(done) nsegs++;
+		if(nsegs == 0) continue;
+		segs.resize(nsegs);
+		for(size_t i = 0; i < nsegs; i++) {
+			segs[i].reset(splits[i], i + 1 < splits.size() ? splits[i+1] + 1 : buf.size());
+		}
+		size_t next = 0;
+		const int nt = (int)min<size_t>(nthreads, nsegs);
+		for(int i = 0; i < nt; i++) {
+			params[i].buf = buf.ptr();
+			params[i].segs = &segs;
+			params[i].rparms = &rparms;
+			params[i].pack = (bpout != NULL);
+			params[i].next = &next;
+			params[i].mutex = &mutex;
+			threads[i] = new tthread::thread(fastaRefReadSegment_worker, (void*)&params[i]);
+		}
+		for(int i = 0; i < nt; i++) {
+			threads[i]->join();
+			delete threads[i];
+		}
+		// Append in file order, as fastaRefReadSizes() would
+		for(size_t s = 0; s < nsegs; s++) {
+			const RefSegment& seg = segs[s];
+			if(seg.tooLong) {
+				cerr << RefTooLongException().what() << endl;
+				throw 1;
+			}
+			for(size_t r = 0; r < seg.recs.size(); r++) {
+				addRefRecord(seg.recs[r], recs, numSeqs, unambigTot, bothTot);
+			}
+			if(bpout != NULL) {
+				bpout->write(seg.bps.packed.ptr(), seg.bps.len);
+			}
+		}
+		if(!done) {
+			// Keep the unfinished segment for the next batch
+			size_t keep = splits.back();
+			memmove(buf.ptr(), buf.ptr() + keep, buf.size() - keep);
+			buf.resize(buf.size() - keep);
+			scanned -= keep;
+			splits.clear();
+			splits.push_back(0);
+			if(buf.size() >= batch) {
+				// Rather than hold all of a long sequence, parse the rest
+				// of it serially and start batching again at the next one
+				RefChainBuf chain(buf.ptr(), buf.size(), in);
+				int lastc = '>';
+				bool first = true;
+				do {
+					RefRecord rec;
+					try {
+						rec = fastaRefReadSize(chain, rparms, first, bpout, (string*)NULL, lastc);
+					} catch(RefTooLongException& e) {
+						cerr << e.what() << endl;
+						throw 1;
+					}
+					addRefRecord(rec, recs, numSeqs, unambigTot, bothTot);
+					first = false;
+				} while(lastc != '>' && !chain.eof());
+				buf.clear();
+				scanned = 0;
+				splitter = RefSplitter();
+				if(chain.eof()) break;
+				// The next sequence's '>' has already been read
+				buf.push_back('>');
+			}
+		}
+	}
+}
+
 #if 0
 static void
 printRecords(ostream& os, const EList<RefRecord>& l) {
@@ -317,36 +690,20 @@ fastaRefReadSizes(
 	EList<RefRecord>& recs,
 	const RefReadInParams& rparms,
 	BitpairOutFileBuf* bpout,
-	TIndexOff& numSeqs)
+	TIndexOff& numSeqs,
+	int nthreads)
 {
 	TIndexOffU unambigTot = 0;
 	size_t bothTot = 0;
 	assert_gt(in.size(), 0);
 	// For each input istream
 	for(size_t i = 0; i < in.size(); i++) {
-		bool first = true;
 		assert(!in[i]->eof());
-		// For each pattern in this istream
-		while(!in[i]->eof()) {
-			RefRecord rec;
-			try {
-				rec = fastaRefReadSize(*in[i], rparms, first, bpout);
-				if((unambigTot + rec.len) < unambigTot) {
-					throw RefTooLongException();
-				}
-			}
-			catch(RefTooLongException& e) {
-				cerr << e.what() << endl;
-				throw 1;
-			}
-			// Add the length of this record.
-			if(rec.first) numSeqs++;
-			unambigTot += rec.len;
-			bothTot += rec.len;
-			bothTot += rec.off;
-			first = false;
-			if(rec.len == 0 && rec.off == 0 && !rec.first) continue;
-			recs.push_back(rec);
+		if(nthreads > 1) {
+			const size_t batch = (size_t)nthreads << 26; // 64MB per thread
+			fastaRefReadSizesMT(*in[i], recs, rparms, bpout, numSeqs, unambigTot, bothTot, nthreads, batch);
+		} else {
+			fastaRefReadSizesST(*in[i], recs, rparms, bpout, numSeqs, unambigTot, bothTot);
 		}
 		// Reset the input stream
 		in[i]->reset();
@@ -452,3 +809,139 @@ fastaRefReadFragsNames(
 		unambigTot, // total number of unambiguous DNA characters read
 		bothTot); // total number of DNA characters read, incl. ambiguous ones
 }
+
+#ifdef REF_READ_MAIN
+
+/*
+ * Check that fastaRefReadSizesMT() gives the same records, totals and
+ * packed bitpairs as fastaRefReadSizesST() on random and edge-case FASTA
+ * inputs, with batches small enough that sequences straddle them and
+ * fall back to the serial parser.  The warnings for empty sequences and
+ * files are printed once by each.
+ *
+ * Build with something like:
+ *
+ *   g++ -O2 -DREF_READ_MAIN -DPOPCNT_CAPABILITY -o ref_read_test \
+ *       ref_read.cpp ds.cpp alphabet.cpp ccnt_lut.cpp tinythread.cpp -lpthread
+ *
+ * and run as "ref_read_test [random inputs]".
+ */
+
+#include <sstream>
+#include <unistd.h>
+
+MemoryTally gMemTally;
+
+struct RefReadResult {
+	EList<RefRecord> recs;
+	TIndexOff        numSeqs;
+	TIndexOffU       unambigTot;
+	size_t           bothTot;
+	string           packed;
+};
+
+/**
+ * Parse 'fasta' with 'nthreads' threads and batches of 'batch' characters
+ * (serially if nthreads is 1) and put what was parsed in 'res'.
+ */
+static void refReadSizes(const string& fasta, int nthreads, size_t batch, RefReadResult& res) {
+	RefReadInParams rparms(false, REF_READ_FORWARD, false, false);
+	std::istringstream ins(fasta);
+	FileBuf in(&ins);
+	ostringstream fname;
+	fname << "ref_read_test." << getpid() << ".4";
+	res.recs.clear();
+	res.numSeqs = 0;
+	res.unambigTot = 0;
+	res.bothTot = 0;
+	{
+		BitpairOutFileBuf bpout(fname.str().c_str());
+		if(nthreads > 1) {
+			fastaRefReadSizesMT(in, res.recs, rparms, &bpout, res.numSeqs, res.unambigTot, res.bothTot, nthreads, batch);
+		} else {
+			fastaRefReadSizesST(in, res.recs, rparms, &bpout, res.numSeqs, res.unambigTot, res.bothTot);
+		}
+		bpout.close();
+	}
+	std::ifstream packed(fname.str().c_str(), ios::binary);
+	res.packed.assign(std::istreambuf_iterator<char>(packed), std::istreambuf_iterator<char>());
+	unlink(fname.str().c_str());
+}
+
+/**
+ * Return a random FASTA file of 'nseqs' sequences mixing everything
+ * fastaRefReadSize() treats specially: runs of Ns and gaps, empty
+ * sequences, blank lines, CRLF line ends and characters it ignores.
+ */
+static string randomFasta(int nseqs) {
+	static const char *chars = "ACGTacgtNNn-";
+	string fasta;
+	for(int s = 0; s < nseqs; s++) {
+		if(rand() % 4 == 0) fasta += " \n";
+		fasta += ">seq";
+		fasta += (char)('0' + s % 10);
+		fasta += (rand() % 5 == 0 ? "\r\n" : "\n");
+		int len = (rand() % 6 == 0) ? 0 : rand() % 300;
+		for(int i = 0; i < len; i++) {
+			fasta += (i % 60 == 59 ? '\n' : chars[rand() % (rand() % 3 == 0 ? 12 : 4)]);
+			if(rand() % 200 == 0) fasta += '*';
+		}
+		if(rand() % 3 != 0) fasta += "\n";
+	}
+	return fasta;
+}
+
+int main(int argc, char **argv) {
+	int nrandom = argc > 1 ? atoi(argv[1]) : 200;
+	EList<string> fastas;
+	fastas.push_back("");                              // empty file
+	fastas.push_back(" \n\n");                         // only whitespace
+	fastas.push_back(">");                             // only a '>'
+	fastas.push_back(">a\nACGT\n>");                   // trailing bare '>'
+	fastas.push_back(">a\nACGT\n>\n");                 // trailing empty name line
+	fastas.push_back(">a\nACGT");                      // no final newline
+	fastas.push_back(">a\n>b\nACGT\n>c\n");            // empty sequences
+	fastas.push_back(">a\nNNNN\n>b\nNNACNNGT\n");      // sequences of and with Ns
+	fastas.push_back(">a\nACGTN");                     // ends in an N
+	srand(0);
+	for(int i = 0; i < nrandom; i++) {
+		string fasta = randomFasta(1 + rand() % 20);
+		if(i % 4 == 0) fasta += ">";
+		fastas.push_back(fasta);
+	}
+	static const size_t batches[] = { 1, 2, 3, 7, 16, 61, 256, 4096 };
+	int nbad = 0, ncases = 0;
+	for(size_t f = 0; f < fastas.size(); f++) {
+		RefReadResult st;
+		refReadSizes(fastas[f], 1, 0, st);
+		for(int nthreads = 2; nthreads <= 3; nthreads++) {
+			for(size_t b = 0; b < sizeof(batches) / sizeof(batches[0]); b++) {
+				RefReadResult mt;
+				refReadSizes(fastas[f], nthreads, batches[b], mt);
+				ncases++;
+				bool same = st.recs.size() == mt.recs.size() &&
+				            st.numSeqs == mt.numSeqs &&
+				            st.unambigTot == mt.unambigTot &&
+				            st.bothTot == mt.bothTot &&
+				            st.packed == mt.packed;
+				for(size_t r = 0; same && r < st.recs.size(); r++) {
+					same = st.recs[r].off == mt.recs[r].off &&
+					       st.recs[r].len == mt.recs[r].len &&
+					       st.recs[r].first == mt.recs[r].first;
+				}
+				if(!same) {
+					cerr << "Input " << f << " with " << nthreads << " threads and batches of "
+					     << batches[b] << ": " << mt.recs.size() << " records, " << mt.numSeqs
+					     << " sequences, totals " << mt.unambigTot << "/" << mt.bothTot
+					     << "; serial: " << st.recs.size() << " records, " << st.numSeqs
+					     << " sequences, totals " << st.unambigTot << "/" << st.bothTot << endl;
+					nbad++;
+				}
+			}
+		}
+	}
+	cout << ncases << " cases, " << nbad << " differ" << endl;
+	return nbad == 0 ? 0 : 1;
+}
+
+#endif /*def REF_READ_MAIN*/
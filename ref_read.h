@@ -138,7 +138,8 @@ fastaRefReadSizes(
 	EList<RefRecord>& recs,
 	const RefReadInParams& rparms,
 	BitpairOutFileBuf* bpout,
-	TIndexOff& numSeqs);
+	TIndexOff& numSeqs,
+	int nthreads = 1);
 
 extern std::pair<size_t, size_t>
 fastaRefReadFragsNames(
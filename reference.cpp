@@ -657,7 +657,8 @@ BitPairReference::szsFromFasta(
 	const RefReadInParams& refparams,
 	EList<RefRecord>& szs,
 	bool sanity,
-	EList<string> *names)
+	EList<string> *names,
+	int nthreads)
 {
 	RefReadInParams parms = refparams;
 	std::pair<size_t, size_t> sztot;
@@ -679,7 +680,7 @@ BitPairReference::szsFromFasta(
 		// it's done.
 		writeIndex<int32_t>(fout3, 1, bigEndian); // endianness sentinel
         TIndexOff numSeqs = 0;
-        sztot = fastaRefReadSizes(is, szs, parms, &bpout, numSeqs);
+        sztot = fastaRefReadSizes(is, szs, parms, &bpout, numSeqs, nthreads);
         writeIndex<TIndexOffU>(fout3, (TIndexOffU)szs.size(), bigEndian); // write # records
         for(size_t i = 0; i < szs.size(); i++) szs[i].write(fout3, bigEndian);
 		if(sztot.first == 0) {
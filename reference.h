@@ -162,7 +162,8 @@ public:
 		const RefReadInParams& refparams,
 		EList<RefRecord>& szs,
 		bool sanity,
-		EList<string> *names = NULL);
+		EList<string> *names = NULL,
+		int nthreads = 1);
 	
 protected:
 
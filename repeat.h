@@ -356,6 +356,60 @@ public:
         }
     }
     
+    /**
+     * Write one tab-separated line per genomic copy of every repeat:
+     *
+     *   name  start  length  copy_start  copy_length  chromosome  position  strand
+     *
+     * name is the repeat sequence named in SAM records and start the offset
+     * of the repeat within it; copy_start and copy_length give the part of
+     * the repeat (relative to start) that this copy holds, and position
+     * where that part begins on the chromosome.  An alignment at offset off
+     * of length len in the repeat sequence, with o = off - start, lies in
+     * every copy holding [o, o + len), at position + (o - copy_start) if
+     * strand is '+' or position + (copy_start + copy_length - o - len) if
+     * it is '-'.  All offsets are 0-based.  Must be called after construct().
+     */
+    void writeTable(ostream& out,
+                    const EList<string>& repnames,
+                    const EList<string>& refnames) const {
+        out << "#name\tstart\tlength\tcopy_start\tcopy_length\tchromosome\tposition\tstrand" << endl;
+        for(index_t repID = 0; repID < _repeatMap.size(); repID++) {
+            const EList<pair<index_t, index_t> >& repeatMap = _repeatMap[repID];
+            for(index_t k = 0; k < repeatMap.size(); k++) {
+                index_t start = (k == 0 ? 0 : repeatMap[k-1].first);
+                const Repeat<index_t>& repeat = _repeats[repeatMap[k].second];
+                for(index_t p = 0; p < repeat.positions.size(); p++) {
+                    const RepeatCoord<index_t>& position = repeat.positions[p];
+                    assert_lt(position.alleleID, repeat.alleles.size());
+                    const RepeatAllele<index_t>& allele = repeat.alleles[position.alleleID];
+                    // Undo the shift construct() applies to line copies up
+                    // with the start of the repeat
+                    index_t toff = position.toff;
+                    if(position.fw) {
+                        toff += allele.allelePos;
+                    } else {
+                        toff += repeat.repLen - allele.allelePos - allele.alleleLen;
+                    }
+                    if(repID < repnames.size()) writeName(out, repnames[repID]);
+                    else                        out << repID;
+                    out << '\t' << start << '\t' << repeat.repLen
+                        << '\t' << allele.allelePos << '\t' << allele.alleleLen << '\t';
+                    if(position.tid < refnames.size()) writeName(out, refnames[position.tid]);
+                    else                               out << position.tid;
+                    out << '\t' << toff << '\t' << (position.fw ? '+' : '-') << '\n';
+                }
+            }
+        }
+    }
+    
+    // Reference names as SAM prints them: up to the first whitespace
+    static void writeName(ostream& out, const string& name) {
+        for(size_t i = 0; i < name.length() && !isspace(name[i]); i++) {
+            out << name[i];
+        }
+    }
+    
     bool repeatExist(index_t repID, index_t left, index_t right) const {
         if(repID >= _repeatMap.size())
             return false;
@@ -3168,14 +3168,22 @@ RepeatBuilder<TStr>::RepeatBuilder(TStr& s,
                                    const EList<RefRecord>& szs,
                                    const EList<string>& ref_names,
                                    bool forward_only,
-                                   const string& filename) :
+                                   const string& filename,
+                                   int nthreads) :
 s_(s),
 coordHelper_(s.length(), forward_only ? s.length() : s.length() / 2, szs, ref_names),
 forward_only_(forward_only),
 filename_(filename),
-forward_length_(forward_only ? s.length() : s.length() / 2)
+forward_length_(forward_only ? s.length() : s.length() / 2),
+nthreads_(max(nthreads, 1)),
+task_bases_(NULL)
 {
 	cerr << "RepeatBuilder: " << filename_ << endl;
+    if(nthreads_ > 1) {
+        for(int i = 0; i < nthreads_; i++) {
+            coordHelpers_.push_back(new CoordHelper(coordHelper_));
+        }
+    }
 }
 
 template<typename TStr>
@@ -3185,6 +3193,10 @@ RepeatBuilder<TStr>::~RepeatBuilder()
         delete it->second;
     }
     repeat_map_.clear();
+    for(size_t i = 0; i < coordHelpers_.size(); i++) {
+        delete coordHelpers_[i];
+    }
+    coordHelpers_.clear();
 }
 
 template<typename TStr>
@@ -3229,20 +3241,26 @@ void RepeatBuilder<TStr>::readSA(const RepeatParameter &rp,
 
     subSA_.init(s_.length() + 1, rp.min_repeat_len, rp.repeat_count);
 
-    for(size_t i = 0; i < sa.size(); i++) {
-        TIndexOffU saElt = sa[i];
-        count++;
+    if(nthreads_ > 1 && rp.repeat_count > 1 && sa.size() == s_.length() + 1) {
+        // the suffix starting at s_.length() sorts last
+        assert_eq(sa[s_.length()], s_.length());
+        subSA_.build(s_, coordHelper_, sa, s_.length(), nthreads_);
+    } else {
+        for(size_t i = 0; i < sa.size(); i++) {
+            TIndexOffU saElt = sa[i];
+            count++;
 
-        if(count && (count % 10000000 == 0)) {
-            cerr << "RB count " << count << endl;
-        }
+            if(count && (count % 10000000 == 0)) {
+                cerr << "RB count " << count << endl;
+            }
 
-        if(saElt == s_.length()) {
-            assert_eq(count, s_.length() + 1);
-            break;
-        }
+            if(saElt == s_.length()) {
+                assert_eq(count, s_.length() + 1);
+                break;
+            }
 
-        subSA_.push_back(s_, coordHelper_, saElt, count == s_.length());
+            subSA_.push_back(s_, coordHelper_, saElt, count == s_.length());
+        }
     }
 
     cerr << "subSA size: " << endl;
@@ -3275,14 +3293,22 @@ void RepeatBuilder<TStr>::build(const RepeatParameter& rp)
                            rp.max_repeat_len,
                            repeatBases);
     
-    size_t repeat_id = 0;
+    // Repeats are independent of each other; initialize them in parallel
+    //  and add them to repeat_map_ in the same order as before
+    task_repeats_.resizeExact(repeatBases.size());
     for(size_t i = 0; i < repeatBases.size(); i++) {
-        addRepeatGroup(rp,
-                       repeat_id,
-                       *repeat_manager,
-                       repeatBases[i],
-                       fp);
+        task_repeats_[i] = new RB_Repeat;
+        task_repeats_[i]->repeat_id(i);
+    }
+    task_bases_ = &repeatBases;
+    runTask(rp, RB_TASK_INIT_REPEATS, repeatBases.size(), 16);
+    task_bases_ = NULL;
+    for(size_t i = 0; i < task_repeats_.size(); i++) {
+        RB_Repeat* repeat = task_repeats_[i];
+        assert(repeat_map_.find(repeat->repeat_id()) == repeat_map_.end());
+        repeat_map_[repeat->repeat_id()] = repeat;
     }
+    task_repeats_.clear();
     
     {
         // Build and test minimizer-based k-mer table
@@ -3508,16 +3534,132 @@ void RepeatBuilder<TStr>::build(const RepeatParameter& rp)
     
     const bool sanity_check = true;
     if(sanity_check) {
-        EList<pair<size_t, size_t> > kmer_table;
         string query;
         size_t total = 0, match = 0;
-        EList<TIndexOffU> positions;
         const EList<TIndexOffU>& test_repeat_index = subSA_.getRepeatIndex();
         size_t interval = 1;
         if(test_repeat_index.size() >= 10000) {
             interval = test_repeat_index.size() / 10000;
         }
+        task_samples_.clear();
         for(size_t i = 0; i < test_repeat_index.size(); i += interval) {
+            task_samples_.push_back(i);
+        }
+        task_repeats_.clear();
+        for(map<size_t, RB_Repeat*>::iterator it = repeat_map_.begin(); it != repeat_map_.end(); it++) {
+            task_repeats_.push_back(it->second);
+        }
+        task_counts_.resizeExact(task_samples_.size());
+        runTask(rp, RB_TASK_SANITY_CHECK, task_samples_.size(), 8);
+        task_repeats_.clear();
+        
+        for(size_t k = 0; k < task_samples_.size(); k++) {
+            size_t i = task_samples_[k];
+            TIndexOffU saElt_idx = test_repeat_index[i];
+            TIndexOffU saElt_idx_end = (i + 1 < test_repeat_index.size() ? test_repeat_index[i+1] : subSA_.size());
+            TIndexOffU saElt = subSA_[saElt_idx];
+            size_t true_count = saElt_idx_end - saElt_idx;
+            getString(s_, saElt, rp.min_repeat_len, query);
+            total++;
+            
+            size_t count = task_counts_[k].first, rc_count = task_counts_[k].second;
+            string rc_query = reverse_complement(query);
+            if(count == true_count || rc_count == true_count) {
+                match++;
+            } else if(total - match <= 10) {
+                cerr << "   query: " << query << endl;
+                cerr << "rc_query: " << rc_query << endl;
+                cerr << "true count: " << true_count << endl;
+                cerr << "found count: " << count << endl;
+                cerr << "rc found count: " << rc_count << endl;
+                cerr << endl;
+            }
+        }
+        
+        cerr << "RepeatBuilder: sanity check: " << match << " passed (out of " << total << ")" << endl << endl;
+        task_samples_.clear();
+        task_counts_.clear();
+    }
+}
+
+template<typename TStr>
+struct RB_BuilderParam {
+    RepeatBuilder<TStr>*   builder;
+    const RepeatParameter* rp;
+    int                    task;
+    int                    tid;
+    RB_WorkQueue*          queue;
+};
+
+template<typename TStr>
+static void RB_Builder_worker(void* vp)
+{
+    RB_BuilderParam<TStr>& p = *(RB_BuilderParam<TStr>*)vp;
+    size_t begin = 0, end = 0;
+    while(p.queue->next(begin, end)) {
+        p.builder->doTask(*p.rp, p.task, begin, end, p.tid);
+    }
+}
+
+/**
+ * Split items [0, size) of a task into chunks of the given size and
+ * process them with up to nthreads_ threads.
+ */
+template<typename TStr>
+void RepeatBuilder<TStr>::runTask(const RepeatParameter& rp,
+                                  int task,
+                                  size_t size,
+                                  size_t chunk)
+{
+    RB_WorkQueue queue(size, chunk);
+    int nthreads = (int)min<size_t>(nthreads_, (size + chunk - 1) / chunk);
+    nthreads = max(nthreads, 1);
+    AutoArray<tthread::thread*> threads(nthreads);
+    EList<RB_BuilderParam<TStr> > params;
+    params.resizeExact(nthreads);
+    for(int i = 0; i < nthreads; i++) {
+        params[i].builder = this;
+        params[i].rp = &rp;
+        params[i].task = task;
+        params[i].tid = i;
+        params[i].queue = &queue;
+        if(nthreads == 1) {
+            RB_Builder_worker<TStr>((void*)&params[i]);
+        } else {
+            threads[i] = new tthread::thread(RB_Builder_worker<TStr>, (void*)&params[i]);
+        }
+    }
+    if(nthreads > 1) {
+        for(int i = 0; i < nthreads; i++) {
+            threads[i]->join();
+            delete threads[i];
+        }
+    }
+}
+
+template<typename TStr>
+void RepeatBuilder<TStr>::doTask(const RepeatParameter& rp,
+                                 int task,
+                                 size_t begin,
+                                 size_t end,
+                                 int tid)
+{
+    CoordHelper& coordHelper = threadCoordHelper(tid);
+    if(task == RB_TASK_INIT_REPEATS) {
+        assert(task_bases_ != NULL);
+        for(size_t i = begin; i < end; i++) {
+            task_repeats_[i]->init(rp,
+                                   s_,
+                                   coordHelper,
+                                   subSA_,
+                                   (*task_bases_)[i]);
+        }
+    } else if(task == RB_TASK_SANITY_CHECK) {
+        string query, rc_query, seq;
+        EList<TIndexOffU> positions;
+        const EList<TIndexOffU>& test_repeat_index = subSA_.getRepeatIndex();
+        for(size_t k = begin; k < end; k++) {
+            size_t i = task_samples_[k];
             TIndexOffU saElt_idx = test_repeat_index[i];
             TIndexOffU saElt_idx_end = (i + 1 < test_repeat_index.size() ? test_repeat_index[i+1] : subSA_.size());
             positions.clear();
@@ -3526,7 +3668,7 @@ void RepeatBuilder<TStr>::build(const RepeatParameter& rp)
 #ifndef NDEBUG
                 if(j > saElt_idx) {
                     TIndexOffU lcp_len = getLCP(s_,
-                                                coordHelper_,
+                                                coordHelper,
                                                 positions[0],
                                                 positions.back(),
                                                 rp.min_repeat_len);
@@ -3534,26 +3676,23 @@ void RepeatBuilder<TStr>::build(const RepeatParameter& rp)
                 }
                 
                 TIndexOffU saElt = subSA_[j];
-                TIndexOffU start = coordHelper_.getStart(saElt);
-                TIndexOffU start2 = coordHelper_.getStart(saElt + rp.min_repeat_len - 1);
+                TIndexOffU start = coordHelper.getStart(saElt);
+                TIndexOffU start2 = coordHelper.getStart(saElt + rp.min_repeat_len - 1);
                 assert_eq(start, start2);
 #endif
             }
             
             TIndexOffU saElt = subSA_[saElt_idx];
-            size_t true_count = saElt_idx_end - saElt_idx;
             getString(s_, saElt, rp.min_repeat_len, query);
-            total++;
             
             size_t count = 0, rc_count = 0;
-            string rc_query = reverse_complement(query);
-            for(map<size_t, RB_Repeat*>::iterator it = repeat_map_.begin(); it != repeat_map_.end(); it++) {
-                RB_Repeat& repeat = *(it->second);
+            rc_query = reverse_complement(query);
+            for(size_t r = 0; r < task_repeats_.size(); r++) {
+                RB_Repeat& repeat = *task_repeats_[r];
                 int pos = repeat.consensus().find(query);
                 if(pos != string::npos) {
                     for(size_t s = 0; s < repeat.seeds().size(); s++) {
                         SeedExt& seed = repeat.seeds()[s];
-                        string seq;
                         seed.getExtendedSeedSequence(s_, seq);
                         if(seq.find(query) != string::npos)
                             count++;
@@ -3563,27 +3702,24 @@ void RepeatBuilder<TStr>::build(const RepeatParameter& rp)
                 if(pos != string::npos) {
                     for(size_t s = 0; s < repeat.seeds().size(); s++) {
                         SeedExt& seed = repeat.seeds()[s];
-                        string seq;
                         seed.getExtendedSeedSequence(s_, seq);
                         if(seq.find(rc_query) != string::npos)
                             rc_count++;
                     }
                 }
             }
+            task_counts_[k] = pair<size_t, size_t>(count, rc_count);
+        }
+    } else {
+        assert_eq(task, RB_TASK_GENERATE_SNPS);
+        for(size_t i = begin; i < end; i++) {
+            RB_Repeat& repeat = *task_repeats_[i];
+            if(!repeat.satisfy(rp))
+                continue;
             
-            if(count == true_count || rc_count == true_count) {
-                match++;
-            } else if(total - match <= 10) {
-                cerr << "   query: " << query << endl;
-                cerr << "rc_query: " << rc_query << endl;
-                cerr << "true count: " << true_count << endl;
-                cerr << "found count: " << count << endl;
-                cerr << "rc found count: " << rc_count << endl;
-                cerr << endl;
-            }
+            // for each repeats
+            repeat.generateSNPs(rp, s_, i);
         }
-        
-        cerr << "RepeatBuilder: sanity check: " << match << " passed (out of " << total << ")" << endl << endl;
     }
 }
 
@@ -3936,33 +4072,6 @@ void RepeatBuilder<TStr>::reassignSeeds(const RepeatParameter& rp,
     }
 }
 
-/**
- * TODO
- * @brief 
- *
- * @param rpt_seq
- * @param rpt_range
- */
-template<typename TStr>
-void RepeatBuilder<TStr>::addRepeatGroup(const RepeatParameter& rp,
-                                         size_t& repeat_id,
-                                         RB_RepeatManager& repeat_manager,
-                                         const RB_RepeatBase& repeatBase,
-                                         ostream& fp)
-{
-    RB_Repeat* repeat = new RB_Repeat;
-    repeat->repeat_id(repeat_id);
-    repeat->init(rp,
-                 s_,
-                 coordHelper_,
-                 subSA_,
-                 repeatBase);
-    
-    assert(repeat_map_.find(repeat->repeat_id()) == repeat_map_.end());
-    repeat_map_[repeat->repeat_id()] = repeat;
-    repeat_id++;
-}
-
 template<typename TStr>
 bool RepeatBuilder<TStr>::checkSequenceMergeable(const string& ref,
                                                  const string& read,
@@ -4029,16 +4138,14 @@ void RepeatBuilder<TStr>::saveRepeats(const RepeatParameter &rp)
     } else {
         mode |= ios_base::trunc;
     }
-    // Generate SNPs
-    size_t i = 0;
-    for(map<size_t, RB_Repeat*>::iterator it = repeat_map_.begin(); it != repeat_map_.end(); it++, i++) {
-        RB_Repeat& repeat = *(it->second);
-        if(!repeat.satisfy(rp))
-            continue;
-
-        // for each repeats
-        repeat.generateSNPs(rp, s_, i);
+    // Generate SNPs, each repeat independently
+    task_repeats_.clear();
+    for(map<size_t, RB_Repeat*>::iterator it = repeat_map_.begin(); it != repeat_map_.end(); it++) {
+        task_repeats_.push_back(it->second);
     }
+    runTask(rp, RB_TASK_GENERATE_SNPS, task_repeats_.size(), 4);
+    task_repeats_.clear();
+    size_t i = 0;
 
     // save snp, consensus sequenuce, info
     string snp_fname = filename_ + ".rep.snp";
@@ -4292,13 +4399,7 @@ void RB_SubSA::push_back(const TStr& s,
             }
             
             if(!same || lastInput) {
-                if(temp_suffixes_.size() >= seed_count_) {
-                    repeat_index_.push_back(repeat_list_.size());
-                    temp_suffixes_.sort();
-                    for(size_t pi = 0; pi < temp_suffixes_.size(); pi++) {
-                        repeat_list_.push_back(temp_suffixes_[pi]);
-                    }
-                }
+                addGroup(temp_suffixes_);
                 temp_suffixes_.clear();
                 if(!lastInput) {
                     temp_suffixes_.push_back(saElt);
@@ -4310,6 +4411,32 @@ void RB_SubSA::push_back(const TStr& s,
     }
     
     if(lastInput) {
+        finish(s);
+    }
+}
+
+/**
+ * Add a group of suffixes sharing the same seed_len-long prefix if it
+ * occurs often enough.  Sorts the suffixes by text offset.
+ */
+void RB_SubSA::addGroup(EList<TIndexOffU>& suffixes)
+{
+    if(suffixes.size() < seed_count_)
+        return;
+    repeat_index_.push_back(repeat_list_.size());
+    suffixes.sort();
+    for(size_t pi = 0; pi < suffixes.size(); pi++) {
+        repeat_list_.push_back(suffixes[pi]);
+    }
+}
+
+/**
+ * Called once all the suffixes have been grouped.
+ */
+template<typename TStr>
+void RB_SubSA::finish(const TStr& s)
+{
+    {
         size_t bit = sizeof(uint32_t) * 8;
         size_t num = (repeat_list_.size() + bit - 1) / bit;
         done_.resizeExact(num);
@@ -4334,6 +4461,185 @@ void RB_SubSA::push_back(const TStr& s,
     }
 }
 
+/**
+ * Group the suffixes in sa[begin..end) the way push_back() does, except
+ * that the first and the last groups are always kept (they may continue
+ * into the neighbouring slices) and are left unsorted.
+ */
+template<typename TStr>
+void RB_SubSA::groupSlice(const TStr& s,
+                          CoordHelper& coordHelper,
+                          const BitPackedArray& sa,
+                          TIndexOffU begin,
+                          TIndexOffU end,
+                          RB_SubSAChunk& chunk) const
+{
+    assert_lt(begin, end);
+    chunk.reset();
+    EList<TIndexOffU>* group = &chunk.first;
+    EList<TIndexOffU> temp_suffixes;
+    for(TIndexOffU i = begin; i < end; i++) {
+        TIndexOffU saElt = sa[i];
+        bool valid = (saElt + seed_len_ <= coordHelper.getEnd(saElt));
+        if(i + 1 == end) {
+            chunk.last_valid = valid;
+        }
+        if(!valid)
+            continue;
+        if(group->empty() ||
+           isSameSequenceUpto(s,
+                              coordHelper,
+                              group->back(),
+                              saElt,
+                              seed_len_)) {
+            group->push_back(saElt);
+            continue;
+        }
+        
+        // the current group is closed
+        if(chunk.single) {
+            chunk.single = false;
+        } else if(temp_suffixes.size() >= seed_count_) {
+            chunk.repeat_index.push_back(chunk.repeat_list.size());
+            temp_suffixes.sort();
+            for(size_t pi = 0; pi < temp_suffixes.size(); pi++) {
+                chunk.repeat_list.push_back(temp_suffixes[pi]);
+            }
+        }
+        group = &temp_suffixes;
+        temp_suffixes.clear();
+        temp_suffixes.push_back(saElt);
+    }
+    if(!chunk.single) {
+        chunk.last = temp_suffixes;
+    }
+}
+
+template<typename TStr>
+struct RB_SubSAParam {
+    const RB_SubSA*       subSA;
+    const TStr*           s;
+    CoordHelper*          coordHelper;
+    const BitPackedArray* sa;
+    TIndexOffU            len;
+    TIndexOffU            slice_len;
+    RB_WorkQueue*         queue;
+    EList<RB_SubSAChunk>* chunks;
+};
+
+template<typename TStr>
+static void RB_SubSA_worker(void* vp)
+{
+    RB_SubSAParam<TStr>& p = *(RB_SubSAParam<TStr>*)vp;
+    size_t begin = 0, end = 0;
+    while(p.queue->next(begin, end)) {
+        for(size_t c = begin; c < end; c++) {
+            TIndexOffU sa_begin = (TIndexOffU)(c * p.slice_len);
+            TIndexOffU sa_end = min<TIndexOffU>(sa_begin + p.slice_len, p.len);
+            p.subSA->groupSlice(*p.s,
+                                *p.coordHelper,
+                                *p.sa,
+                                sa_begin,
+                                sa_end,
+                                (*p.chunks)[c]);
+        }
+    }
+}
+
+template<typename TStr>
+void RB_SubSA::build(const TStr& s,
+                     const CoordHelper& coordHelper,
+                     const BitPackedArray& sa,
+                     TIndexOffU len,
+                     int nthreads)
+{
+    assert_gt(seed_count_, 1);
+    assert_gt(nthreads, 0);
+    assert_leq(len, sa.size());
+    
+    // Use many more slices than threads so that threads hitting
+    // highly repetitive parts of the SA don't hold up the others
+    size_t num_slices = min<size_t>((size_t)nthreads * 64, len);
+    TIndexOffU slice_len = (TIndexOffU)((len + num_slices - 1) / max<size_t>(num_slices, 1));
+    num_slices = (slice_len > 0 ? (len + slice_len - 1) / slice_len : 0);
+    
+    EList<RB_SubSAChunk> chunks;
+    chunks.resizeExact(num_slices);
+    RB_WorkQueue queue(num_slices, 1);
+    
+    AutoArray<tthread::thread*> threads(nthreads);
+    EList<RB_SubSAParam<TStr> > params;
+    params.resizeExact(nthreads);
+    for(int i = 0; i < nthreads; i++) {
+        params[i].subSA = this;
+        params[i].s = &s;
+        params[i].coordHelper = new CoordHelper(coordHelper);
+        params[i].sa = &sa;
+        params[i].len = len;
+        params[i].slice_len = slice_len;
+        params[i].queue = &queue;
+        params[i].chunks = &chunks;
+        if(nthreads == 1) {
+            RB_SubSA_worker<TStr>((void*)&params[i]);
+        } else {
+            threads[i] = new tthread::thread(RB_SubSA_worker<TStr>, (void*)&params[i]);
+        }
+    }
+    if(nthreads > 1) {
+        for(int i = 0; i < nthreads; i++) {
+            threads[i]->join();
+            delete threads[i];
+        }
+    }
+    
+    // Join groups spanning slices, in SA order
+    const bool last_valid = (!chunks.empty() && chunks.back().last_valid);
+    CoordHelper& coordHelper0 = *params[0].coordHelper;
+    EList<TIndexOffU>& group = temp_suffixes_;
+    group.clear();
+    for(size_t c = 0; c < chunks.size(); c++) {
+        RB_SubSAChunk& chunk = chunks[c];
+        if(chunk.first.empty())
+            continue;
+        if(!group.empty() &&
+           isSameSequenceUpto(s,
+                              coordHelper0,
+                              group.back(),
+                              chunk.first[0],
+                              seed_len_)) {
+            for(size_t pi = 0; pi < chunk.first.size(); pi++) {
+                group.push_back(chunk.first[pi]);
+            }
+        } else {
+            addGroup(group);
+            group = chunk.first;
+        }
+        if(chunk.single)
+            continue;
+        addGroup(group);
+        const TIndexOffU base = (TIndexOffU)repeat_list_.size();
+        for(size_t pi = 0; pi < chunk.repeat_index.size(); pi++) {
+            repeat_index_.push_back(base + chunk.repeat_index[pi]);
+        }
+        for(size_t pi = 0; pi < chunk.repeat_list.size(); pi++) {
+            repeat_list_.push_back(chunk.repeat_list[pi]);
+        }
+        group = chunk.last;
+        chunk.reset();
+    }
+    // push_back() only flushes the final group when the last suffix is valid
+    if(last_valid) {
+        addGroup(group);
+    }
+    group.nullify();
+    
+    for(int i = 0; i < nthreads; i++) {
+        delete params[i].coordHelper;
+    }
+    
+    finish(s);
+}
+
 template<typename TStr>
 Range RB_SubSA::find(const TStr& s,
                      const string& seq) const
@@ -37,6 +37,7 @@
 #include "scoring.h"
 #include "aligner_sw.h"
 #include "bit_packed_array.h"
+#include "threading.h"
 
 //#define DEBUGLOG
 
@@ -762,6 +763,61 @@ private:
     RandomSource rnd_;
 };
 
+/**
+ * Hands out [begin, end) chunks of an index range to worker threads.
+ * Threads that finish early simply come back for more, so uneven
+ * chunks (e.g. repeats with very different seed counts) balance out.
+ */
+class RB_WorkQueue {
+public:
+    RB_WorkQueue(size_t size, size_t chunk) :
+    size_(size),
+    chunk_(max<size_t>(chunk, 1)),
+    next_(0)
+    {}
+
+    /**
+     * Grab the next chunk; return false when the range is exhausted.
+     */
+    bool next(size_t& begin, size_t& end)
+    {
+        ThreadSafe ts(&mutex_m);
+        if(next_ >= size_) return false;
+        begin = next_;
+        end = min(next_ + chunk_, size_);
+        next_ = end;
+        return true;
+    }
+
+private:
+    size_t  size_;
+    size_t  chunk_;
+    size_t  next_;
+    MUTEX_T mutex_m;
+};
+
+// Seed groups found by a thread in one contiguous slice of the SA.
+// The first and last groups may continue into the neighbouring slices,
+// so they are kept aside (unfiltered) and joined when slices are merged.
+struct RB_SubSAChunk {
+    void reset()
+    {
+        first.clear();
+        last.clear();
+        repeat_list.clear();
+        repeat_index.clear();
+        single = true;
+        last_valid = false;
+    }
+
+    EList<TIndexOffU> first;
+    EList<TIndexOffU> last;
+    EList<TIndexOffU> repeat_list;  // qualifying groups strictly inside
+    EList<TIndexOffU> repeat_index;
+    bool              single;       // whole slice is one (possibly empty) group
+    bool              last_valid;   // last suffix of the slice can hold a seed
+};
+
 // SA Subset
 class RB_SubSA {
 public:
@@ -781,6 +837,25 @@ public:
                    TIndexOffU saElt,
                    bool lastInput = false);
 
+    /**
+     * Same result as calling push_back() on sa[0..len), but the SA is
+     * split into slices that are grouped by nthreads threads.
+     */
+    template<typename TStr>
+    void build(const TStr& s,
+               const CoordHelper& coordHelper,
+               const BitPackedArray& sa,
+               TIndexOffU len,
+               int nthreads);
+
+    template<typename TStr>
+    void groupSlice(const TStr& s,
+                    CoordHelper& coordHelper,
+                    const BitPackedArray& sa,
+                    TIndexOffU begin,
+                    TIndexOffU end,
+                    RB_SubSAChunk& chunk) const;
+
     inline TIndexOffU seed_len() const { return seed_len_; }
     inline TIndexOffU seed_count() const { return seed_count_; }
 
@@ -827,6 +902,12 @@ public:
                          const size_t max_len,
                          EList<RB_RepeatBase>& repeatBases);
 
+private:
+    void addGroup(EList<TIndexOffU>& suffixes);
+
+    template<typename TStr>
+    void finish(const TStr& s);
+
 private:
     TIndexOffU sa_size_;
     TIndexOffU seed_len_;
@@ -849,7 +930,8 @@ public:
                   const EList<RefRecord>& szs,
                   const EList<string>& ref_names,
                   bool forward_only,
-                  const string& filename);
+                  const string& filename,
+                  int nthreads = 1);
     ~RepeatBuilder();
 
 
@@ -875,12 +957,6 @@ public:
                        const string& repName);
     void saveFile(const RepeatParameter& rp);
     
-    void addRepeatGroup(const RepeatParameter& rp,
-                        size_t& repeat_id,
-                        RB_RepeatManager& repeat_manger,
-                        const RB_RepeatBase& repeatBase,
-                        ostream& fp);
-    
     void reassignSeeds(const RepeatParameter& rp,
                        size_t repeat_bid,
                        size_t repeat_eid,
@@ -899,7 +975,35 @@ public:
     {
         swaligner_.doTest(rp, refstr, readstr);
     }
-    
+
+    // Tasks split across threads by runTask()
+    enum {
+        RB_TASK_INIT_REPEATS = 0,
+        RB_TASK_SANITY_CHECK,
+        RB_TASK_GENERATE_SNPS
+    };
+
+    /**
+     * Process items [begin, end) of the given task; called from the
+     * worker threads started by runTask().
+     */
+    void doTask(const RepeatParameter& rp,
+                int task,
+                size_t begin,
+                size_t end,
+                int tid);
+
+private:
+    void runTask(const RepeatParameter& rp,
+                 int task,
+                 size_t size,
+                 size_t chunk);
+
+    CoordHelper& threadCoordHelper(int tid)
+    {
+        return coordHelpers_.empty() ? coordHelper_ : *coordHelpers_[tid];
+    }
+
 private:
     void saveAlleles(const RepeatParameter& rp,
                      const string& repName,
@@ -953,6 +1057,14 @@ private:
     EList<string> consensus_all_;
     ELList<SeedExt> seeds_;
     map<size_t, RB_Repeat*> repeat_map_;
+
+    // Multithreading
+    int nthreads_;
+    EList<CoordHelper*> coordHelpers_;  // one per thread (fragment cache isn't shared)
+    EList<RB_Repeat*> task_repeats_;    // repeats being processed by runTask()
+    const EList<RB_RepeatBase>* task_bases_;
+    EList<size_t> task_samples_;        // sanity check: sampled seed groups
+    EList<pair<size_t, size_t> > task_counts_;  // sanity check: (count, rc_count)
 };
 
 
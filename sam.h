@@ -571,44 +571,10 @@ const
     if(print_x1_) {
         // X1:i: Number of sub-optimal best hits
     }
-    size_t num_mm = 0;
-    size_t num_go = 0;
-    size_t num_gx = 0;
-    for(size_t i = 0; i < res.ned().size(); i++) {
-        if(res.ned()[i].isMismatch()) {
-            if(res.ned()[i].snpID >= altdb->alts().size()) {
-                num_mm++;
-            }
-        } else if(res.ned()[i].isReadGap()) {
-            if(res.ned()[i].snpID >= altdb->alts().size()) {
-                num_go++;
-                num_gx++;
-            }
-            while(i < res.ned().size()-1 &&
-                  res.ned()[i+1].pos == res.ned()[i].pos &&
-                  res.ned()[i+1].isReadGap())
-            {
-                i++;
-                if(res.ned()[i].snpID >= altdb->alts().size()) {
-                    num_gx++;
-                }
-            }
-        } else if(res.ned()[i].isRefGap()) {
-            if(res.ned()[i].snpID >= altdb->alts().size()) {
-                num_go++;
-                num_gx++;
-            }
-            while(i < res.ned().size()-1 &&
-                  res.ned()[i+1].pos == res.ned()[i].pos+1 &&
-                  res.ned()[i+1].isRefGap())
-            {
-                i++;
-                if(res.ned()[i].snpID >= altdb->alts().size()) {
-                    num_gx++;
-                }
-            }
-        }
-    }
+    // Tallied by StackedAln::initFused() along with the CIGAR and MD:Z
+    size_t num_mm = staln.numMismatches();
+    size_t num_go = staln.numGapOpens();
+    size_t num_gx = staln.numGapExts();
     if(print_xm_) {
         // XM:i: Number of mismatches in the alignment
         itoa10<size_t>(num_mm, buf);
@@ -632,15 +598,7 @@ const
     }
     if(print_nm_) {
         // NM:i: Edit dist. to the ref, Ns count, clipping doesn't
-        size_t NM = 0;
-        for(size_t i = 0; i < res.ned().size(); i++) {
-            if(res.ned()[i].type != EDIT_TYPE_SPL) {
-                if(res.ned()[i].snpID >= altdb->alts().size()) {
-                    NM++;
-                }
-            }
-        }
-        itoa10<size_t>(NM, buf);
+        itoa10<size_t>(staln.editDistance(), buf);
         WRITE_SEP();
         o.append("NM:i:");
         o.append(buf);
@@ -922,6 +880,11 @@ const
         o.append("ZI:i:");
         o.append(buf);
     }
+    if(prm.budgetExceeded) {
+        // ZW:i: Search was cut short by the per-read work budget
+        WRITE_SEP();
+        o.append("ZW:i:1");
+    }
     if(print_xs_a_) {
         if(rna_strandness_ == RNA_STRANDNESS_UNKNOWN) {
             uint8_t whichsense = res.spliced_whichsense_transcript();
@@ -1244,6 +1207,11 @@ const
         o.append("ZI:i:");
         o.append(buf);
     }
+    if(prm.budgetExceeded) {
+        // ZW:i: Search was cut short by the per-read work budget
+        WRITE_SEP();
+        o.append("ZW:i:1");
+    }
     if(print_xr_) {
         // Original read string
         o.append("\n");
@@ -17,6 +17,9 @@
  * along with Bowtie 2.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
 #include "edit.h"
 #include "splice_site.h"
 #include "aligner_report.h"
@@ -120,6 +123,44 @@ ostream& operator<<(ostream& out, const SpliceSite& s)
 	return out;
 }
 
+/**
+ * Orders splice sites the way _bwIndex does: by right end, then left.
+ */
+struct SpliceSiteBwLess {
+    bool operator()(const SpliceSitePos& a, const SpliceSitePos& b) const {
+        if(a.ref() != b.ref()) return a.ref() < b.ref();
+        if(a.right() != b.right()) return a.right() < b.right();
+        if(a.left() != b.left()) return a.left() < b.left();
+        return a.splDir() < b.splDir();
+    }
+};
+
+/**
+ * Orders snapshot records the way _fwIndex orders splice sites.
+ */
+struct SpliceSiteRecLess {
+    bool operator()(const SpliceSiteRec& a, const SpliceSiteRec& b) const {
+        if(a.left != b.left) return a.left < b.left;
+        if(a.right != b.right) return a.right < b.right;
+        return a.splDir < b.splDir;
+    }
+};
+
+/**
+ * Orders indexes of snapshot records the way _bwIndex orders splice sites.
+ */
+struct SpliceSiteRecBwLess {
+    SpliceSiteRecBwLess(const SpliceSiteRec *recs) : recs_(recs) { }
+    bool operator()(uint32_t i, uint32_t j) const {
+        const SpliceSiteRec& a = recs_[i];
+        const SpliceSiteRec& b = recs_[j];
+        if(a.right != b.right) return a.right < b.right;
+        if(a.left != b.left) return a.left < b.left;
+        return a.splDir < b.splDir;
+    }
+    const SpliceSiteRec *recs_;
+};
+
 SpliceSiteDB::SpliceSiteDB(
                            const BitPairReference& refs,
                            const EList<string>& refnames,
@@ -130,7 +171,12 @@ _numRefs(refs.numRefs()),
 _write(write),
 _read(read),
 _threadSafe(threadSafe),
-_empty(true)
+_empty(true),
+_frozen(false),
+_frozenKnown(false),
+_snapMap(NULL),
+_snapLen(0),
+_epochLen(0)
 {
     for(size_t r = 0; r < refnames.size(); r++) {
         const string& refname = refnames[r];
@@ -152,6 +198,12 @@ _empty(true)
         _pool.expand();
         _spliceSites.expand();
         _mutex.push_back(MUTEX_T());
+        _frozenFw.push_back(NULL);
+        _frozenBw.push_back(NULL);
+        _frozenLen.push_back(0);
+        _frozenStats.expand();
+        _frozenOwnFw.expand();
+        _frozenOwnBw.expand();
     }
     
     donorstr.resize(donor_exonic_len + donor_intronic_len);
@@ -170,6 +222,11 @@ SpliceSiteDB::~SpliceSiteDB() {
             delete pool[j];
         }
     }
+#ifdef BOWTIE_MM
+    if(_snapMap != NULL) {
+        munmap(_snapMap, _snapLen);
+    }
+#endif
 }
 
 size_t SpliceSiteDB::size(uint64_t ref) const {
@@ -238,7 +295,10 @@ bool SpliceSiteDB::addSpliceSite(
                         if(edits[j].isGap() || edits[j].isMismatch()) mm2++;
                     }
                     uint32_t minRightAnchorLen = minAnchorLen + mm2 * 2 + (edits[eidx].splDir == SPL_UNKNOWN ? 6 : 0);
-                    if(leftAnchorLen >= minLeftAnchorLen && rightAnchorLen >= minRightAnchorLen) {
+                    if(leftAnchorLen >= minLeftAnchorLen && rightAnchorLen >= minRightAnchorLen &&
+                       frozenAdd(ssp, rd.rdid, leftAnchorLen, rightAnchorLen, editdist)) {
+                        // counted against a splice site from a snapshot
+                    } else if(leftAnchorLen >= minLeftAnchorLen && rightAnchorLen >= minRightAnchorLen) {
                         bool added = false;
                         assert_lt(ref, _mutex.size());
                         ThreadSafe t(&_mutex[ref], _threadSafe && _write);
@@ -250,6 +310,7 @@ bool SpliceSiteDB::addSpliceSite(
                             _spliceSites[ref].expand();
                             _spliceSites[ref].back().init(ssp.ref(), ssp.left(), ssp.right(), ssp.splDir());
                             _spliceSites[ref].back()._readid = rd.rdid;
+                            discovered(numeric_limits<uint64_t>::max(), rd.rdid);
                             _spliceSites[ref].back()._leftext = leftAnchorLen;
                             _spliceSites[ref].back()._rightext = rightAnchorLen;
                             _spliceSites[ref].back()._editdist = editdist;
@@ -274,6 +335,7 @@ bool SpliceSiteDB::addSpliceSite(
                             if(editdist < _spliceSites[ref][cur->payload]._editdist) _spliceSites[ref][cur->payload]._editdist = editdist;
                             _spliceSites[ref][cur->payload]._numreads += 1;
                             if(rd.rdid < _spliceSites[ref][cur->payload]._readid) {
+                                discovered(_spliceSites[ref][cur->payload]._readid, rd.rdid);
                                 _spliceSites[ref][cur->payload]._readid = rd.rdid;
                             }
                         }
@@ -300,7 +362,10 @@ bool SpliceSiteDB::addSpliceSite(
             if(edits[j].isGap() || edits[j].isMismatch()) mm2++;
         }
         uint32_t minRightAnchorLen = minAnchorLen + mm2 * 2 + (edits[last_eidx].splDir == SPL_UNKNOWN ? 6 : 0);
-        if(leftAnchorLen >= minLeftAnchorLen && rightAnchorLen >= minRightAnchorLen) {
+        if(leftAnchorLen >= minLeftAnchorLen && rightAnchorLen >= minRightAnchorLen &&
+           frozenAdd(ssp, rd.rdid, leftAnchorLen, rightAnchorLen, editdist)) {
+            // counted against a splice site from a snapshot
+        } else if(leftAnchorLen >= minLeftAnchorLen && rightAnchorLen >= minRightAnchorLen) {
             bool added = false;
             assert_lt(ref, _mutex.size());
             ThreadSafe t(&_mutex[ref], _threadSafe && _write);
@@ -312,6 +377,7 @@ bool SpliceSiteDB::addSpliceSite(
                 _spliceSites[ref].expand();
                 _spliceSites[ref].back().init(ssp.ref(), ssp.left(), ssp.right(), ssp.splDir());
                 _spliceSites[ref].back()._readid = rd.rdid;
+                discovered(numeric_limits<uint64_t>::max(), rd.rdid);
                 _spliceSites[ref].back()._leftext = leftAnchorLen;
                 _spliceSites[ref].back()._rightext = rightAnchorLen;
                 _spliceSites[ref].back()._editdist = editdist;
@@ -336,6 +402,7 @@ bool SpliceSiteDB::addSpliceSite(
                 if(editdist < _spliceSites[ref][cur->payload]._editdist) _spliceSites[ref][cur->payload]._editdist = editdist;
                 _spliceSites[ref][cur->payload]._numreads += 1;
                 if(rd.rdid < _spliceSites[ref][cur->payload]._readid) {
+                    discovered(_spliceSites[ref][cur->payload]._readid, rd.rdid);
                     _spliceSites[ref][cur->payload]._readid = rd.rdid;
                 }
             }
@@ -348,6 +415,48 @@ bool SpliceSiteDB::addSpliceSite(
     return true;
 }
 
+/**
+ * Start counting, for every block of epochLen reads, the splice sites
+ * added by addSpliceSite whose earliest read falls in it.  Once all
+ * reads up to the end of a block have been added, its count is the same
+ * however the reads were spread over threads.
+ */
+void SpliceSiteDB::trackDiscovery(uint64_t epochLen)
+{
+    ThreadSafe t(&_discoveredMutex, _threadSafe);
+    _epochLen = epochLen;
+    _discovered.clear();
+}
+
+/**
+ * Return the number of splice sites whose earliest read falls in the
+ * given block of reads; see trackDiscovery.
+ */
+uint64_t SpliceSiteDB::numDiscovered(uint64_t epoch) const
+{
+    ThreadSafe t(const_cast<MUTEX_T*>(&_discoveredMutex), _threadSafe);
+    return epoch < _discovered.size() ? _discovered[epoch] : 0;
+}
+
+/**
+ * Move a splice site's count from the block holding oldReadid (none if
+ * it's the maximum) to the one holding readid.
+ */
+void SpliceSiteDB::discovered(uint64_t oldReadid, uint64_t readid)
+{
+    if(_epochLen == 0) return;
+    uint64_t from = (oldReadid == numeric_limits<uint64_t>::max() ? oldReadid : oldReadid / _epochLen);
+    uint64_t to = readid / _epochLen;
+    if(from == to) return;
+    ThreadSafe t(&_discoveredMutex, _threadSafe);
+    while(_discovered.size() <= to) _discovered.push_back(0);
+    if(from < _discovered.size()) {
+        assert_gt(_discovered[from], 0);
+        _discovered[from]--;
+    }
+    _discovered[to]++;
+}
+
 bool SpliceSiteDB::getSpliceSite(SpliceSite& ss) const
 {
     if(!_read) return false;
@@ -357,6 +466,12 @@ bool SpliceSiteDB::getSpliceSite(SpliceSite& ss) const
     assert_lt(ref, _mutex.size());
     ThreadSafe t(const_cast<MUTEX_T*>(&_mutex[ref]), _threadSafe && _write);
     
+    size_t fi = frozenFind(ref, ss.left(), ss.right(), ss.splDir());
+    if(fi < _frozenLen[ref] && !ss.exon()) {
+        frozenSite(ref, fi, ss);
+        return true;
+    }
+    
     assert_lt(ref, _fwIndex.size());
     assert(_fwIndex[ref] != NULL);
     const Node *cur = _fwIndex[ref]->lookup(ss);
@@ -378,8 +493,21 @@ void SpliceSiteDB::getLeftSpliceSites(uint32_t ref, uint32_t left, uint32_t rang
     assert_geq(left + 1, range);
     assert_lt(ref, _bwIndex.size());
     assert(_bwIndex[ref] != NULL);
+    size_t first = spliceSites.size();
     const Node *cur = _bwIndex[ref]->root();
     if(cur != NULL) getSpliceSites_recur(cur, left + 1 - range, left, spliceSites);
+    size_t lo = 0, hi = 0;
+    frozenRange(ref, true, left + 1 - range, left, lo, hi);
+    if(lo == hi) return;
+    bool merge = spliceSites.size() > first;
+    for(size_t i = lo; i < hi; i++) {
+        spliceSites.expand();
+        frozenSite(ref, _frozenBw[ref][i], spliceSites.back());
+    }
+    if(merge) {
+        // Same order as if all had come from _bwIndex
+        sort(spliceSites.ptr() + first, spliceSites.ptr() + spliceSites.size(), SpliceSiteBwLess());
+    }
 }
 
 void SpliceSiteDB::getRightSpliceSites(uint32_t ref, uint32_t right, uint32_t range, EList<SpliceSite>& spliceSites) const
@@ -393,9 +521,21 @@ void SpliceSiteDB::getRightSpliceSites(uint32_t ref, uint32_t right, uint32_t ra
     assert_gt(right + range, range);
     assert_lt(ref, _fwIndex.size());
     assert(_fwIndex[ref] != NULL);
+    size_t first = spliceSites.size();
     const Node *cur = _fwIndex[ref]->root();
     if(cur != NULL) getSpliceSites_recur(cur, right, right + range - 1, spliceSites);
-    
+    size_t lo = 0, hi = 0;
+    frozenRange(ref, false, right, right + range - 1, lo, hi);
+    if(lo == hi) return;
+    bool merge = spliceSites.size() > first;
+    for(size_t i = lo; i < hi; i++) {
+        spliceSites.expand();
+        frozenSite(ref, i, spliceSites.back());
+    }
+    if(merge) {
+        // Same order as if all had come from _fwIndex
+        sort(spliceSites.ptr() + first, spliceSites.ptr() + spliceSites.size());
+    }
 }
 
 void SpliceSiteDB::getSpliceSites_recur(
@@ -447,6 +587,18 @@ bool SpliceSiteDB::hasSpliceSites(
     assert_lt(ref, _mutex.size());
     ThreadSafe t(const_cast<MUTEX_T*>(&_mutex[ref]), _threadSafe && _write);
     
+    if(_frozenLen[ref] > 0 && (includeNovel || _frozenKnown)) {
+        size_t lo = 0, hi = 0;
+        if(left1 < right1) {
+            frozenRange(ref, true, left1, right1, lo, hi);
+            if(lo < hi) return true;
+        }
+        if(left2 < right2) {
+            frozenRange(ref, false, left2, right2, lo, hi);
+            if(lo < hi) return true;
+        }
+    }
+    
     if(left1 < right1) {
         assert_lt(ref, _bwIndex.size());
         assert(_bwIndex[ref] != NULL);
@@ -525,30 +677,11 @@ bool SpliceSiteDB::insideExon(
     return false;
 }
 
-void calculate_splicesite_read_dist_impl(const RedBlackNode<SpliceSitePos, uint32_t> *node,
-                                         const EList<SpliceSite> &spliceSites,
-                                         EList<int64_t>& splicesite_read_dist) {
-    if(node == NULL) return;
-    calculate_splicesite_read_dist_impl(node->left, spliceSites, splicesite_read_dist);
-    assert_lt(node->payload, spliceSites.size());
-    const SpliceSite& ss = spliceSites[node->payload];
-    if(ss.numreads() < splicesite_read_dist.size())
-        splicesite_read_dist[ss.numreads()] += 1;
-    else
-        splicesite_read_dist.back() += 1;
-    calculate_splicesite_read_dist_impl(node->right, spliceSites, splicesite_read_dist);
-}
-
-uint32_t calculate_splicesite_read_dist(const EList<RedBlack<SpliceSitePos, uint32_t>* >& fwIndex,
-                                    const ELList<SpliceSite> &spliceSites,
-                                    EList<int64_t>& splicesite_read_dist) {
-    for(size_t i = 0; i < fwIndex.size(); i++) {
-        assert(fwIndex[i] != NULL);
-        const RedBlackNode<SpliceSitePos, uint32_t> *root = fwIndex[i]->root();
-        assert_lt(i, spliceSites.size());
-        if(root != NULL) calculate_splicesite_read_dist_impl(root, spliceSites[i], splicesite_read_dist);
-    }
-    
+/**
+ * Turn the cumulative counts of splice sites by number of supporting reads
+ * into the read count below which print() leaves a splice site out.
+ */
+static uint32_t calculate_splicesite_read_dist(EList<int64_t>& splicesite_read_dist) {
     for(size_t i = 1; i < splicesite_read_dist.size(); i++) {
         splicesite_read_dist[i] += splicesite_read_dist[i-1];
     }
@@ -562,50 +695,103 @@ uint32_t calculate_splicesite_read_dist(const EList<RedBlack<SpliceSitePos, uint
     return 0;
 }
 
-void SpliceSiteDB::print(ofstream& out)
+void SpliceSiteDB::sortedSites_recur(
+                                     const RedBlackNode<SpliceSitePos, uint32_t> *node,
+                                     EList<SpliceSite>& spliceSites) const
+{
+    if(node == NULL) return;
+    sortedSites_recur(node->left, spliceSites);
+    uint32_t ref = node->key.ref();
+    assert_lt(ref, _spliceSites.size());
+    assert_lt(node->payload, _spliceSites[ref].size());
+    spliceSites.push_back(_spliceSites[ref][node->payload]);
+    sortedSites_recur(node->right, spliceSites);
+}
+
+/**
+ * Set spliceSites to all the splice sites on reference ref, in the order
+ * of _fwIndex.
+ */
+void SpliceSiteDB::sortedSites(uint32_t ref, EList<SpliceSite>& spliceSites) const
+{
+    spliceSites.clear();
+    assert_lt(ref, _fwIndex.size());
+    assert(_fwIndex[ref] != NULL);
+    sortedSites_recur(_fwIndex[ref]->root(), spliceSites);
+    size_t ntree = spliceSites.size();
+    for(size_t i = 0; i < _frozenLen[ref]; i++) {
+        spliceSites.expand();
+        frozenSite(ref, i, spliceSites.back());
+    }
+    if(ntree > 0 && _frozenLen[ref] > 0) {
+        sort(spliceSites.ptr(), spliceSites.ptr() + spliceSites.size());
+    }
+}
+
+/**
+ * Set selected to the splice sites print() reports, in the order it
+ * reports them: those supported by enough reads, keeping only the best
+ * supported of any that lie within 10 bp of each other.
+ */
+void SpliceSiteDB::select(EList<SpliceSite>& selected)
 {
     EList<int64_t> splicesite_read_dist;
     for(size_t i = 0; i < 100; i++) {
         splicesite_read_dist.push_back(0);
     }
-    uint32_t numreads_cutoff = calculate_splicesite_read_dist(_fwIndex, _spliceSites, splicesite_read_dist);
+    EList<SpliceSite> sites;
     size_t numsplicesites = 0;
-    for(size_t i = 0; i < _spliceSites.size(); i++) {
-        numsplicesites += _spliceSites[i].size();
+    for(uint32_t ref = 0; ref < _numRefs; ref++) {
+        sortedSites(ref, sites);
+        numsplicesites += sites.size();
+        for(size_t i = 0; i < sites.size(); i++) {
+            const SpliceSite& ss = sites[i];
+            if(ss.numreads() < splicesite_read_dist.size())
+                splicesite_read_dist[ss.numreads()] += 1;
+            else
+                splicesite_read_dist.back() += 1;
+        }
     }
+    uint32_t numreads_cutoff = calculate_splicesite_read_dist(splicesite_read_dist);
     uint32_t numreads_cutoff2 = (uint32_t)(numsplicesites / 100000);
     
     EList<SpliceSite> ss_list;
-    for(size_t i = 0; i < _fwIndex.size(); i++) {
-        assert(_fwIndex[i] != NULL);
-        const Node *root = _fwIndex[i]->root();
-        if(root != NULL) print_recur(root, out, numreads_cutoff, numreads_cutoff2, ss_list);
+    for(uint32_t ref = 0; ref < _numRefs; ref++) {
+        sortedSites(ref, sites);
+        for(size_t i = 0; i < sites.size(); i++) {
+            const SpliceSite& ss = sites[i];
+            if(ss.numreads() >= numreads_cutoff ||
+               (ss.editdist() == 0 && ss.numreads() >= numreads_cutoff2)) select_impl(selected, ss_list, &ss);
+        }
     }
-    print_impl(out, ss_list);
+    select_impl(selected, ss_list);
 }
 
-void SpliceSiteDB::print_recur(
-                               const RedBlackNode<SpliceSitePos, uint32_t> *node,
-                               ofstream& out,
-                               const uint32_t numreads_cutoff,
-                               const uint32_t numreads_cutoff2,
-                               EList<SpliceSite>& ss_list)
+void SpliceSiteDB::print(ofstream& out)
 {
-    if(node == NULL) return;
-    print_recur(node->left, out, numreads_cutoff, numreads_cutoff2, ss_list);
-    const SpliceSitePos& ssp = node->key;
-    assert_lt(ssp.ref(), _spliceSites.size());
-    assert_lt(node->payload, _spliceSites[ssp.ref()].size());
-    const SpliceSite& ss = _spliceSites[ssp.ref()][node->payload];
-    if(ss.numreads() >= numreads_cutoff ||
-       (ss.editdist() == 0 && ss.numreads() >= numreads_cutoff2)) print_impl(out, ss_list, &ss);
-    print_recur(node->right, out, numreads_cutoff, numreads_cutoff2, ss_list);
+    EList<SpliceSite> selected;
+    select(selected);
+    for(size_t i = 0; i < selected.size(); i++) {
+        const SpliceSite& ss = selected[i];
+        assert_lt(ss.ref(), _refnames.size());
+        out << _refnames[ss.ref()] << "\t"
+        << ss.left() << "\t"
+        << ss.right() << "\t";
+        if(ss.splDir() == SPL_FW || ss.splDir() == SPL_SEMI_FW) {
+            out << "+";
+        } else if(ss.splDir() == SPL_RC || ss.splDir() == SPL_SEMI_RC) {
+            out << "-";
+        } else {
+            out << ".";
+        }
+        out << endl;
+    }
 }
 
-void SpliceSiteDB::print_impl(
-                              ofstream& out,
-                              EList<SpliceSite>& ss_list,
-                              const SpliceSite* ss)
+void SpliceSiteDB::select_impl(
+                               EList<SpliceSite>& selected,
+                               EList<SpliceSite>& ss_list,
+                               const SpliceSite* ss)
 {
     size_t i = 0;
     while(i < ss_list.size()) {
@@ -632,18 +818,7 @@ void SpliceSiteDB::print_impl(
             continue;
         }
         
-        assert_lt(tmp_ss.ref(), _refnames.size());
-        out << _refnames[tmp_ss.ref()] << "\t"
-        << tmp_ss.left() << "\t"
-        << tmp_ss.right() << "\t";
-        if(tmp_ss.splDir() == SPL_FW || tmp_ss.splDir() == SPL_SEMI_FW) {
-            out << "+";
-        } else if(tmp_ss.splDir() == SPL_RC || tmp_ss.splDir() == SPL_SEMI_RC) {
-            out << "-";
-        } else {
-            out << ".";
-        }
-        out << endl;
+        selected.push_back(tmp_ss);
         ss_list.erase(i);
     }
     
@@ -674,6 +849,7 @@ void SpliceSiteDB::read(const GFM<TIndexOffU>& gfm, const EList<ALT<TIndexOffU>
         TIndexOffU right = left + (alt.right - alt.left);
         if(alt.splicesite()) {
             left -= 1; right += 1;
+            if(!alt.exon() && frozenFind(ref, left, right, fw ? SPL_FW : SPL_RC) < _frozenLen[ref]) continue;
             _spliceSites[ref].expand();
             _spliceSites[ref].back().init(ref,
                                           left,
@@ -738,39 +914,486 @@ void SpliceSiteDB::read(ifstream& in, bool known)
             if(_refnames[ref] == refname) break;
         }
         if(ref >= _numRefs) continue;
-        assert_lt(ref, _spliceSites.size());
-        _spliceSites[ref].expand();
-        _spliceSites[ref].back().init(ref,
-                                      left,
-                                      right,
-                                      fw == '+' ? SPL_FW : SPL_RC,
-                                      false,  // exon?
-                                      true,   // from file?
-                                      known); // known splice site?
-        assert_gt(_spliceSites[ref].size(), 0);
-        
-        bool added = false;
-        assert_lt(ref, _fwIndex.size());
-        assert(_fwIndex[ref] != NULL);
-        Node *cur = _fwIndex[ref]->add(pool(ref), _spliceSites[ref].back(), &added);
-        if(!added) {
-            _spliceSites[ref].pop_back();
+        addFileSpliceSite(ref, left, right, fw == '+' ? SPL_FW : SPL_RC, known);
+    }
+}
+
+/**
+ * Add a splice site read from a file, unless it is already there.  Return
+ * true iff it was added.
+ */
+bool SpliceSiteDB::addFileSpliceSite(uint32_t ref, uint32_t left, uint32_t right, uint8_t splDir, bool known)
+{
+    if(frozenFind(ref, left, right, splDir) < _frozenLen[ref]) return false;
+    assert_lt(ref, _spliceSites.size());
+    _spliceSites[ref].expand();
+    _spliceSites[ref].back().init(ref,
+                                  left,
+                                  right,
+                                  splDir,
+                                  false,  // exon?
+                                  true,   // from file?
+                                  known); // known splice site?
+    assert_gt(_spliceSites[ref].size(), 0);
+    
+    bool added = false;
+    assert_lt(ref, _fwIndex.size());
+    assert(_fwIndex[ref] != NULL);
+    Node *cur = _fwIndex[ref]->add(pool(ref), _spliceSites[ref].back(), &added);
+    if(!added) {
+        _spliceSites[ref].pop_back();
+        return false;
+    }
+    
+    assert(cur != NULL);
+    cur->payload = (uint32_t)_spliceSites[ref].size() - 1;
+    added = false;
+    SpliceSitePos rssp(ref,
+                       right,
+                       left,
+                       splDir);
+    assert_lt(ref, _bwIndex.size());
+    assert(_bwIndex[ref] != NULL);
+    cur = _bwIndex[ref]->add(pool(ref), rssp, &added);
+    assert(added);
+    assert(cur != NULL);
+    cur->payload = (uint32_t)_spliceSites[ref].size() - 1;
+    return true;
+}
+
+/**
+ * Return the index of the given splice site among those on ref in the
+ * snapshot layer, or _frozenLen[ref] if it is not there.
+ */
+size_t SpliceSiteDB::frozenFind(uint32_t ref, uint32_t left, uint32_t right, uint8_t splDir) const
+{
+    assert_lt(ref, _frozenLen.size());
+    size_t n = _frozenLen[ref];
+    if(n == 0) return n;
+    const SpliceSiteRec *fw = _frozenFw[ref];
+    SpliceSiteRec key;
+    key.left = left; key.right = right; key.splDir = splDir;
+    const SpliceSiteRec *it = lower_bound(fw, fw + n, key, SpliceSiteRecLess());
+    if(it == fw + n || it->left != left || it->right != right || it->splDir != splDir) return n;
+    return (size_t)(it - fw);
+}
+
+/**
+ * Set [lo, hi) to the snapshot splice sites on ref whose left (or, if bw,
+ * right) end lies within [first, last].  With bw, lo and hi index
+ * _frozenBw[ref].
+ */
+void SpliceSiteDB::frozenRange(uint32_t ref, bool bw, uint32_t first, uint32_t last, size_t& lo, size_t& hi) const
+{
+    lo = hi = 0;
+    assert_lt(ref, _frozenLen.size());
+    size_t n = _frozenLen[ref];
+    if(n == 0 || first > last) return;
+    const SpliceSiteRec *fw = _frozenFw[ref];
+    const uint32_t *bwi = _frozenBw[ref];
+    size_t a = 0, b = n;
+    while(a < b) {
+        size_t m = (a + b) / 2;
+        if((bw ? fw[bwi[m]].right : fw[m].left) < first) a = m + 1;
+        else b = m;
+    }
+    lo = a;
+    b = n;
+    while(a < b) {
+        size_t m = (a + b) / 2;
+        if((bw ? fw[bwi[m]].right : fw[m].left) <= last) a = m + 1;
+        else b = m;
+    }
+    hi = a;
+}
+
+/**
+ * Set ss to the i-th snapshot splice site on ref, as read() would have
+ * made it, along with whatever addSpliceSite has counted for it.
+ */
+void SpliceSiteDB::frozenSite(uint32_t ref, size_t i, SpliceSite& ss) const
+{
+    assert_lt(i, _frozenLen[ref]);
+    const SpliceSiteRec& rec = _frozenFw[ref][i];
+    ss.init(ref,
+            rec.left,
+            rec.right,
+            rec.splDir,
+            false,         // exon?
+            true,          // from file?
+            _frozenKnown); // known splice site?
+    const SpliceSiteStats& st = _frozenStats[ref][i];
+    ss._leftext = st.leftext;
+    ss._rightext = st.rightext;
+    ss._numreads = st.numreads;
+    ss._editdist = st.editdist;
+    ss._readid = st.readid;
+}
+
+/**
+ * If the given splice site is in the snapshot layer, count one more read
+ * for it the way addSpliceSite does for one already in the trees and
+ * return true.  Otherwise return false.
+ */
+bool SpliceSiteDB::frozenAdd(
+                             const SpliceSitePos& ssp,
+                             uint64_t readid,
+                             uint32_t leftext,
+                             uint32_t rightext,
+                             uint32_t editdist)
+{
+    if(!_frozen || ssp.exon()) return false;
+    uint32_t ref = ssp.ref();
+    size_t fi = frozenFind(ref, ssp.left(), ssp.right(), ssp.splDir());
+    if(fi >= _frozenLen[ref]) return false;
+    assert_lt(ref, _mutex.size());
+    ThreadSafe t(&_mutex[ref], _threadSafe && _write);
+    SpliceSiteStats& st = _frozenStats[ref][fi];
+    if(leftext > st.leftext) st.leftext = leftext;
+    if(rightext > st.rightext) st.rightext = rightext;
+    if(editdist < st.editdist) st.editdist = editdist;
+    st.numreads += 1;
+    if(readid < st.readid) st.readid = readid;
+    return true;
+}
+
+/*
+ * Binary splice site snapshot.  All integers are in the byte order of the
+ * machine that wrote it; the endianness word lets a reader tell.
+ *
+ *   header     magic[8], uint32_t version, uint32_t endianness (1),
+ *              uint64_t number of references
+ *   directory  one SpliceSiteSnapRef per reference
+ *   names      reference names, not terminated
+ *   arrays     per reference, 8-byte aligned: num SpliceSiteRecs sorted
+ *              by (left, right, direction), then num uint32_t indexes of
+ *              those records sorted by (right, left, direction)
+ */
+static const char     snapMagic[8] = { 'H', 'T', '2', 'S', 'P', 'L', 'C', '\n' };
+static const uint32_t snapVersion = 1;
+
+struct SpliceSiteSnapHeader {
+    char      magic[8];
+    uint32_t  version;
+    uint32_t  endian;
+    uint64_t  numRefs;
+};
+
+struct SpliceSiteSnapRef {
+    uint64_t  nameOff;
+    uint64_t  nameLen;
+    uint64_t  fwOff;
+    uint64_t  bwOff;
+    uint64_t  num;
+};
+
+/**
+ * Return true iff everything past the header of the snapshot in
+ * base[0..len) can be used: the directory, every name and array lies
+ * inside it, and each reference's records are in order with indexes that
+ * put them in order again by right end.  The header itself must already
+ * have been checked.
+ */
+static bool snapshotOk(const char* base, size_t len)
+{
+    SpliceSiteSnapHeader hdr;
+    memcpy(&hdr, base, sizeof(hdr));
+    if((len - sizeof(hdr)) / sizeof(SpliceSiteSnapRef) < hdr.numRefs) return false;
+    const SpliceSiteSnapRef *dir = (const SpliceSiteSnapRef*)(base + sizeof(hdr));
+    for(uint64_t s = 0; s < hdr.numRefs; s++) {
+        const SpliceSiteSnapRef& sr = dir[s];
+        if(sr.nameOff > len || sr.nameLen > len - sr.nameOff ||
+           sr.num > numeric_limits<uint32_t>::max() ||
+           sr.fwOff % 4 != 0 || sr.fwOff > len || sr.num > (len - sr.fwOff) / sizeof(SpliceSiteRec) ||
+           sr.bwOff % 4 != 0 || sr.bwOff > len || sr.num > (len - sr.bwOff) / sizeof(uint32_t))
+        {
+            return false;
+        }
+        size_t n = (size_t)sr.num;
+        const SpliceSiteRec *fw = (const SpliceSiteRec*)(base + sr.fwOff);
+        const uint32_t *bw = (const uint32_t*)(base + sr.bwOff);
+        SpliceSiteRecLess fwLess;
+        SpliceSiteRecBwLess bwLess(fw);
+        for(size_t i = 0; i < n; i++) {
+            if(fw[i].splDir != SPL_FW && fw[i].splDir != SPL_RC) return false;
+            if(i > 0 && !fwLess(fw[i-1], fw[i])) return false;
+        }
+        for(size_t i = 0; i < n; i++) {
+            if(bw[i] >= n) return false;
+            if(i > 0 && !bwLess(bw[i-1], bw[i])) return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Lay out the splice sites print() would report as a binary snapshot in
+ * buf, so that they can be loaded back with loadSnapshot or written out.
+ */
+void SpliceSiteDB::snapshot(EList<char>& buf)
+{
+    EList<SpliceSite> selected;
+    select(selected);
+    // Directions are collapsed the way print() and read() do
+    ELList<SpliceSiteRec> fw;
+    ELList<uint32_t> bw;
+    for(uint64_t ref = 0; ref < _numRefs; ref++) {
+        fw.expand();
+        bw.expand();
+    }
+    for(size_t i = 0; i < selected.size(); i++) {
+        const SpliceSite& ss = selected[i];
+        assert_lt(ss.ref(), fw.size());
+        SpliceSiteRec rec;
+        memset(&rec, 0, sizeof(rec));
+        rec.left = ss.left();
+        rec.right = ss.right();
+        rec.splDir = (ss.splDir() == SPL_FW || ss.splDir() == SPL_SEMI_FW) ? SPL_FW : SPL_RC;
+        fw[ss.ref()].push_back(rec);
+    }
+    uint64_t off = sizeof(SpliceSiteSnapHeader) + _numRefs * sizeof(SpliceSiteSnapRef);
+    EList<SpliceSiteSnapRef> dir;
+    for(uint64_t ref = 0; ref < _numRefs; ref++) {
+        EList<SpliceSiteRec>& recs = fw[ref];
+        sort(recs.ptr(), recs.ptr() + recs.size(), SpliceSiteRecLess());
+        size_t n = 0;
+        for(size_t i = 0; i < recs.size(); i++) {
+            if(n > 0 &&
+               recs[n-1].left == recs[i].left &&
+               recs[n-1].right == recs[i].right &&
+               recs[n-1].splDir == recs[i].splDir) continue;
+            recs[n++] = recs[i];
+        }
+        recs.resize(n);
+        for(size_t i = 0; i < n; i++) {
+            bw[ref].push_back((uint32_t)i);
+        }
+        sort(bw[ref].ptr(), bw[ref].ptr() + n, SpliceSiteRecBwLess(recs.ptr()));
+        dir.expand();
+        dir.back().nameOff = off;
+        dir.back().nameLen = _refnames[ref].length();
+        dir.back().num = n;
+        off += _refnames[ref].length();
+    }
+    for(uint64_t ref = 0; ref < _numRefs; ref++) {
+        off = (off + 7) & ~(uint64_t)7;
+        dir[ref].fwOff = off;
+        off += dir[ref].num * sizeof(SpliceSiteRec);
+        off = (off + 7) & ~(uint64_t)7;
+        dir[ref].bwOff = off;
+        off += dir[ref].num * sizeof(uint32_t);
+    }
+    
+    buf.resizeExact((size_t)off);
+    buf.fillZero();
+    SpliceSiteSnapHeader hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, snapMagic, sizeof(snapMagic));
+    hdr.version = snapVersion;
+    hdr.endian = 1;
+    hdr.numRefs = _numRefs;
+    memcpy(buf.ptr(), &hdr, sizeof(hdr));
+    if(_numRefs > 0) {
+        memcpy(buf.ptr() + sizeof(hdr), dir.ptr(), _numRefs * sizeof(SpliceSiteSnapRef));
+    }
+    for(uint64_t ref = 0; ref < _numRefs; ref++) {
+        memcpy(buf.ptr() + dir[ref].nameOff, _refnames[ref].c_str(), _refnames[ref].length());
+        if(dir[ref].num == 0) continue;
+        memcpy(buf.ptr() + dir[ref].fwOff, fw[ref].ptr(), dir[ref].num * sizeof(SpliceSiteRec));
+        memcpy(buf.ptr() + dir[ref].bwOff, bw[ref].ptr(), dir[ref].num * sizeof(uint32_t));
+    }
+}
+
+/**
+ * Write the splice sites print() would report as a binary snapshot that
+ * readSnapshot can use without parsing or building trees.
+ */
+void SpliceSiteDB::writeSnapshot(const string& fname)
+{
+    EList<char> buf;
+    snapshot(buf);
+    ofstream out(fname.c_str(), ios::out | ios::binary);
+    if(!out.is_open()) {
+        cerr << "Error: could not open " << fname << " for writing" << endl;
+        throw 1;
+    }
+    out.write(buf.ptr(), buf.size());
+    if(!out.good()) {
+        cerr << "Error: could not write " << fname << endl;
+        throw 1;
+    }
+    out.close();
+}
+
+/**
+ * Load splice sites from a snapshot written by writeSnapshot, as read()
+ * would from the equivalent text file.  The per-reference arrays are used
+ * in place (memory-mapped where possible) rather than copied into the
+ * trees.  Return false, having done nothing, if fname can't be opened or
+ * doesn't start like a snapshot, so that the caller can read it as text.
+ * A file that does but can't be used (another version or byte order, or
+ * truncated or corrupt anywhere) is an error; it is checked in full
+ * before any of its splice sites are taken.
+ */
+bool SpliceSiteDB::readSnapshot(const string& fname, bool known)
+{
+    int fd = open(fname.c_str(), O_RDONLY);
+    if(fd < 0) return false;
+    struct stat st;
+    SpliceSiteSnapHeader hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    if(fstat(fd, &st) != 0 ||
+       (size_t)st.st_size < sizeof(snapMagic) ||
+       pread(fd, &hdr, sizeof(hdr), 0) < (ssize_t)sizeof(snapMagic) ||
+       memcmp(hdr.magic, snapMagic, sizeof(snapMagic)) != 0)
+    {
+        close(fd);
+        return false;
+    }
+    size_t len = (size_t)st.st_size;
+    if(len < sizeof(hdr)) {
+        close(fd);
+        cerr << "Error: splice site snapshot " << fname << " is truncated or corrupt" << endl;
+        throw 1;
+    }
+    if(hdr.endian != 1 || hdr.version != snapVersion) {
+        close(fd);
+        cerr << "Error: splice site snapshot " << fname << " was written by a different version of HISAT2 or on a machine with a different byte order" << endl;
+        throw 1;
+    }
+    EList<char> buf;
+    char *map = NULL;
+#ifdef BOWTIE_MM
+    // Only one snapshot at a time can be used in place
+    if(!_frozen) {
+        map = (char*)mmap((void *)0, len, PROT_READ, MAP_SHARED, fd, 0);
+        if(map == (char*)MAP_FAILED) map = NULL;
+    }
+#endif
+    if(map == NULL) {
+        buf.resizeExact(len);
+        size_t done = 0;
+        while(done < len) {
+            ssize_t r = pread(fd, buf.ptr() + done, len - done, done);
+            if(r <= 0) {
+                close(fd);
+                cerr << "Error: could not read splice site snapshot " << fname << endl;
+                throw 1;
+            }
+            done += (size_t)r;
+        }
+    }
+    close(fd);
+    if(!snapshotOk(map != NULL ? map : buf.ptr(), len)) {
+#ifdef BOWTIE_MM
+        if(map != NULL) munmap(map, len);
+#endif
+        cerr << "Error: splice site snapshot " << fname << " is truncated or corrupt" << endl;
+        throw 1;
+    }
+    useSnapshot(map != NULL ? map : buf.ptr(), len, map != NULL, known);
+    if(map != NULL) {
+        _snapMap = map;
+        _snapLen = len;
+    }
+    return true;
+}
+
+/**
+ * Load splice sites from a snapshot built by snapshot() in this process,
+ * as readSnapshot would from a file.  buf is copied from, not kept.
+ */
+void SpliceSiteDB::loadSnapshot(const EList<char>& buf, bool known)
+{
+    const char *base = buf.ptr();
+    SpliceSiteSnapHeader hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    if(buf.size() >= sizeof(hdr)) memcpy(&hdr, base, sizeof(hdr));
+    if(memcmp(hdr.magic, snapMagic, sizeof(snapMagic)) != 0 ||
+       hdr.endian != 1 || hdr.version != snapVersion ||
+       !snapshotOk(base, buf.size()))
+    {
+        cerr << "Error: in-memory splice site snapshot is truncated or corrupt" << endl;
+        throw 1;
+    }
+    useSnapshot(base, buf.size(), false, known);
+}
+
+/**
+ * Take the splice sites from the snapshot in base[0..len), which
+ * snapshotOk has accepted.  If inPlace, base outlives this object and its
+ * arrays are used directly where possible; otherwise they are copied.
+ * Only one snapshot at a time is kept in the read-only layer; the sites
+ * of any others go into the trees.
+ */
+void SpliceSiteDB::useSnapshot(const char* base, size_t len, bool inPlace, bool known)
+{
+    assert(snapshotOk(base, len));
+    SpliceSiteSnapHeader hdr;
+    memcpy(&hdr, base, sizeof(hdr));
+    bool frozen = !_frozen;
+    assert(frozen || !inPlace);
+    
+    _empty = false;
+    const SpliceSiteSnapRef *dir = (const SpliceSiteSnapRef*)(base + sizeof(hdr));
+    EList<uint32_t> remap;
+    for(uint64_t s = 0; s < hdr.numRefs; s++) {
+        const SpliceSiteSnapRef& sr = dir[s];
+        string refname(base + sr.nameOff, (size_t)sr.nameLen);
+        uint32_t ref = 0;
+        for(; ref < _refnames.size(); ref++) {
+            if(_refnames[ref] == refname) break;
+        }
+        if(ref >= _numRefs) continue;
+        size_t n = (size_t)sr.num;
+        const SpliceSiteRec *fw = (const SpliceSiteRec*)(base + sr.fwOff);
+        const uint32_t *bw = (const uint32_t*)(base + sr.bwOff);
+        if(!frozen || _frozenLen[ref] > 0) {
+            for(size_t i = 0; i < n; i++) {
+                addFileSpliceSite(ref, fw[i].left, fw[i].right, fw[i].splDir, known);
+            }
             continue;
         }
-        
-        assert(cur != NULL);
-        cur->payload = (uint32_t)_spliceSites[ref].size() - 1;
-        added = false;
-        SpliceSitePos rssp(ref,
-                           right,
-                           left,
-                           fw == '+' ? SPL_FW : SPL_RC);
-        assert_lt(ref, _bwIndex.size());
-        assert(_bwIndex[ref] != NULL);
-        cur = _bwIndex[ref]->add(pool(ref), rssp, &added);
-        assert(added);
-        assert(cur != NULL);
-        cur->payload = (uint32_t)_spliceSites[ref].size() - 1;
+        // Leave out sites already in the trees, as read() would
+        size_t nshadow = 0;
+        remap.resizeExact(n);
+        if(_fwIndex[ref]->size() > 0) {
+            for(size_t i = 0; i < n; i++) {
+                SpliceSitePos ssp(ref, fw[i].left, fw[i].right, fw[i].splDir);
+                if(_fwIndex[ref]->lookup(ssp) != NULL) {
+                    remap[i] = (uint32_t)n;
+                    nshadow++;
+                } else {
+                    remap[i] = (uint32_t)(i - nshadow);
+                }
+            }
+        }
+        if(nshadow > 0 || !inPlace) {
+            EList<SpliceSiteRec>& ownFw = _frozenOwnFw[ref];
+            EList<uint32_t>& ownBw = _frozenOwnBw[ref];
+            ownFw.clear();
+            ownBw.clear();
+            for(size_t i = 0; i < n; i++) {
+                if(nshadow == 0 || remap[i] < n) ownFw.push_back(fw[i]);
+            }
+            for(size_t i = 0; i < n; i++) {
+                if(nshadow == 0) ownBw.push_back(bw[i]);
+                else if(remap[bw[i]] < n) ownBw.push_back(remap[bw[i]]);
+            }
+            assert_eq(ownFw.size(), ownBw.size());
+            fw = ownFw.ptr();
+            bw = ownBw.ptr();
+            n = ownFw.size();
+        }
+        _frozenFw[ref] = fw;
+        _frozenBw[ref] = bw;
+        _frozenLen[ref] = n;
+        _frozenStats[ref].resizeExact(n);
+        _frozenStats[ref].fillZero();
+    }
+    if(frozen) {
+        _frozen = true;
+        _frozenKnown = known;
     }
 }
 
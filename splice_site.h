@@ -516,6 +516,30 @@ protected:
 
 class AlnRes;
 
+/**
+ * One splice site as stored in a binary snapshot written by
+ * SpliceSiteDB::writeSnapshot.  Plain data, so the per-reference arrays
+ * can be searched straight out of a memory-mapped file.
+ */
+struct SpliceSiteRec {
+    uint32_t  left;
+    uint32_t  right;
+    uint8_t   splDir;
+    uint8_t   pad[3];
+};
+
+/**
+ * What addSpliceSite records about a splice site that came from a
+ * snapshot; see the corresponding fields of SpliceSite.
+ */
+struct SpliceSiteStats {
+    uint32_t  leftext;
+    uint32_t  rightext;
+    uint64_t  numreads;
+    uint32_t  editdist;
+    uint64_t  readid;
+};
+
 class SpliceSiteDB {
 public:
     typedef RedBlackNode<SpliceSitePos, uint32_t> Node;
@@ -556,6 +580,14 @@ public:
     void read(const GFM<TIndexOffU>& gfm, const EList<ALT<TIndexOffU> >& alts);
     void read(ifstream& in, bool known = false);
     
+    void snapshot(EList<char>& buf);
+    void writeSnapshot(const string& fname);
+    bool readSnapshot(const string& fname, bool known = false);
+    void loadSnapshot(const EList<char>& buf, bool known = false);
+    
+    void trackDiscovery(uint64_t epochLen);
+    uint64_t numDiscovered(uint64_t epoch) const;
+    
 private:
     void getSpliceSites_recur(
                               const RedBlackNode<SpliceSitePos, uint32_t> *node,
@@ -571,19 +603,31 @@ private:
     
     const RedBlackNode<SpliceSitePos, uint32_t>* getSpliceSite_temp(const SpliceSitePos& ssp) const;
     
-    void print_recur(
-                     const RedBlackNode<SpliceSitePos, uint32_t> *node,
-                     ofstream& out,
-                     const uint32_t numreads_cutoff,
-                     const uint32_t numreads_cutoff2,
-                     EList<SpliceSite>& ss_list);
+    void sortedSites_recur(
+                           const RedBlackNode<SpliceSitePos, uint32_t> *node,
+                           EList<SpliceSite>& spliceSites) const;
+    
+    void sortedSites(uint32_t ref, EList<SpliceSite>& spliceSites) const;
+    
+    void select(EList<SpliceSite>& selected);
     
     Pool& pool(uint64_t ref);
     
-    void print_impl(
-                    ofstream& out,
-                    EList<SpliceSite>& ss_list,
-                    const SpliceSite* ss = NULL);
+    void select_impl(
+                     EList<SpliceSite>& selected,
+                     EList<SpliceSite>& ss_list,
+                     const SpliceSite* ss = NULL);
+    
+    bool addFileSpliceSite(uint32_t ref, uint32_t left, uint32_t right, uint8_t splDir, bool known);
+    
+    // Splice sites loaded from a snapshot; see readSnapshot
+    size_t frozenFind(uint32_t ref, uint32_t left, uint32_t right, uint8_t splDir) const;
+    void frozenRange(uint32_t ref, bool bw, uint32_t first, uint32_t last, size_t& lo, size_t& hi) const;
+    void frozenSite(uint32_t ref, size_t i, SpliceSite& ss) const;
+    bool frozenAdd(const SpliceSitePos& ssp, uint64_t readid, uint32_t leftext, uint32_t rightext, uint32_t editdist);
+    void useSnapshot(const char* base, size_t len, bool inPlace, bool known);
+    
+    void discovered(uint64_t oldReadid, uint64_t readid);
     
 private:
     uint64_t                            _numRefs;
@@ -610,6 +654,26 @@ private:
     bool                                _empty;
     
     EList<Exon>                         _exons;
+    
+    // Read-only layer of splice sites from a snapshot, consulted next to
+    // the red-black trees.  Per reference, _frozenFw is sorted like
+    // _fwIndex and _frozenBw holds indexes into it sorted like _bwIndex.
+    bool                                _frozen;
+    bool                                _frozenKnown;
+    EList<const SpliceSiteRec*>         _frozenFw;
+    EList<const uint32_t*>              _frozenBw;
+    EList<size_t>                       _frozenLen;
+    ELList<SpliceSiteStats>             _frozenStats;
+    ELList<SpliceSiteRec>               _frozenOwnFw;  // when not mapped
+    ELList<uint32_t>                    _frozenOwnBw;
+    char*                               _snapMap;
+    size_t                              _snapLen;
+    
+    // Number of splice sites whose earliest read falls in each block of
+    // _epochLen reads; see trackDiscovery
+    uint64_t                            _epochLen;
+    EList<uint64_t>                     _discovered;
+    MUTEX_T                             _discoveredMutex;
 };
 
 #endif /*ifndef SPLICE_SITE_H_*/
@@ -180,6 +180,9 @@ void SplicedAligner<index_t, local_index_t>::hybridSearch(
             }
         }
         
+        // stop once the read's work budget has run out
+        if(this->overBudget(prm)) break;
+        
         // given a candidate partial alignment, extend it bidirectionally
         him.anchoratts++;
         GenomeHit<index_t>& genomeHit = this->_genomeHits[hj];
@@ -208,17 +211,24 @@ void SplicedAligner<index_t, local_index_t>::hybridSearch(
         
         if(rp.bowtie2_dp == 2 || (rp.bowtie2_dp == 1 && maxsc < this->_minsc[rdi])) {
             const Read& rd = *this->_rds[rdi];
-            // Initialize the aligner with a new read
-            swa.initRead(rd.patFw,    // fw version of query
-                         rd.patRc,    // rc version of query
-                         rd.qual,     // fw version of qualities
-                         rd.qualRev,  // rc version of qualities
-                         0,           // off of first char in 'rd' to consider
-                         rd.length(), // off of last char (excl) in 'rd' to consider
-                         sc);         // scoring scheme
-            
             bool found = genomeHit.len() >= rd.length();
+            if(!found && this->_swaRdi != rdi) {
+                // Initialize the aligner with a new read; every extension of
+                // this mate, on either strand, then reuses its query profiles
+                swa.initRead(rd.patFw,    // fw version of query
+                             rd.patRc,    // rc version of query
+                             rd.qual,     // fw version of qualities
+                             rd.qualRev,  // rc version of qualities
+                             0,           // off of first char in 'rd' to consider
+                             rd.length(), // off of last char (excl) in 'rd' to consider
+                             sc);         // scoring scheme
+                this->_swaRdi = rdi;
+            }
             if(!found) {
+                // Each extension is filled on its own rather than batched with
+                // other reads' or other hits' problems: the result feeds
+                // hybridSearch_recur right away, and most calls have only one
+                // hit needing DP
                 DynProgFramer dpframe(false);  // trimToRef
                 size_t tlen = ref.approxLen(genomeHit.ref());
                 size_t readGaps = 10, refGaps = 10, nceil = 0, maxhalf = 10;
@@ -355,6 +365,8 @@ int64_t SplicedAligner<index_t, local_index_t>::hybridSearch_recur(
     const ReportingParams& rp = sink.reportingParams();
     int64_t maxsc = numeric_limits<int64_t>::min();
     him.localsearchrecur++;
+    prm.nExtAtts++;
+    if(this->overBudget(prm)) return maxsc;
     assert_lt(rdi, 2);
     assert(this->_rds[rdi] != NULL);
     const Read& rd = *(this->_rds[rdi]);
@@ -529,6 +529,19 @@ public:
 		*this = o;
 	}
 
+	/**
+	 * Take over the buffers of another SString, leaving it empty.
+	 */
+	SString(SString<T>&& o) :
+		cs_(o.cs_),
+		printcs_(o.printcs_),
+		len_(o.len_)
+	{
+		o.cs_ = NULL;
+		o.printcs_ = NULL;
+		o.len_ = 0;
+	}
+
 	/**
 	 * Create an SStringExpandable from a std::basic_string of the
 	 * appropriate type.
@@ -586,6 +599,16 @@ public:
 		return *this;
 	}
 
+	/**
+	 * Swap buffers with other SString.
+	 */
+	SString<T>& operator=(SString<T>&& o) {
+		std::swap(cs_, o.cs_);
+		std::swap(printcs_, o.printcs_);
+		std::swap(len_, o.len_);
+		return *this;
+	}
+
 	/**
 	 * Assignment to other SString.
 	 */
@@ -1667,6 +1690,21 @@ public:
 		*this = o;
 	}
 
+	/**
+	 * Take over the buffers of another SStringExpandable, leaving it
+	 * empty.
+	 */
+	SStringExpandable(SStringExpandable<T, S>&& o) :
+		cs_(o.cs_),
+		printcs_(o.printcs_),
+		len_(o.len_),
+		sz_(o.sz_)
+	{
+		o.cs_ = NULL;
+		o.printcs_ = NULL;
+		o.len_ = o.sz_ = 0;
+	}
+
 	/**
 	 * Create an SStringExpandable from a std::basic_string of the
 	 * appropriate type.
@@ -1760,6 +1798,18 @@ public:
 		return *this;
 	}
 
+	/**
+	 * Swap buffers with other SStringExpandable, which keeps this one's
+	 * buffers for reuse.
+	 */
+	SStringExpandable<T,S>& operator=(SStringExpandable<T,S>&& o) {
+		std::swap(cs_, o.cs_);
+		std::swap(printcs_, o.printcs_);
+		std::swap(len_, o.len_);
+		std::swap(sz_, o.sz_);
+		return *this;
+	}
+
 	/**
 	 * Assignment from a std::basic_string
 	 */
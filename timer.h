@@ -21,6 +21,8 @@
 #define TIMER_H_
 
 #include <ctime>
+#include <chrono>
+#include <stdint.h>
 #include <iostream>
 #include <sstream>
 #include <iomanip>
@@ -68,6 +70,15 @@ private:
 	bool        _verbose;
 };
 
+/**
+ * Return a monotonic timestamp in nanoseconds.  Only differences between two
+ * timestamps are meaningful; used for fine-grained latency measurements.
+ */
+static inline uint64_t nanoTime() {
+	return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
 static inline void logTime(std::ostream& os, bool nl = true) {
 	struct tm *current;
 	time_t now;
@@ -22,30 +22,65 @@
 
 #include <stdlib.h>
 #include <limits>
+#include <string.h>
+
+/**
+ * Two-character decimal representations of 0-99, used to emit integers two
+ * digits per division.
+ */
+static const char itoa10_pairs[] =
+	"00010203040506070809"
+	"10111213141516171819"
+	"20212223242526272829"
+	"30313233343536373839"
+	"40414243444546474849"
+	"50515253545556575859"
+	"60616263646566676869"
+	"70717273747576777879"
+	"80818283848586878889"
+	"90919293949596979899";
+
+/**
+ * Write the decimal representation of an unsigned value to 'result'
+ * without a terminator and return a pointer just past the last digit.
+ */
+template<typename T>
+inline char* utoa10(T value, char* result) {
+	char tmp[24];
+	char* p = tmp + sizeof(tmp);
+	while(value >= 100) {
+		size_t r = (size_t)(value % 100) * 2;
+		value /= 100;
+		*--p = itoa10_pairs[r + 1];
+		*--p = itoa10_pairs[r];
+	}
+	if(value >= 10) {
+		size_t r = (size_t)value * 2;
+		*--p = itoa10_pairs[r + 1];
+		*--p = itoa10_pairs[r];
+	} else {
+		*--p = (char)('0' + value);
+	}
+	size_t n = tmp + sizeof(tmp) - p;
+	memcpy(result, p, n);
+	return result + n;
+}
 
 /**
  * C++ version char* style "itoa":
  */
 template<typename T>
 char* itoa10(const T& value, char* result) {
-	// Check that base is valid
 	char* out = result;
 	T quotient = value;
 	if(std::numeric_limits<T>::is_signed) {
-		if(quotient <= 0) quotient = 0-quotient;
-	}
-	// Now write each digit from most to least significant
-	do {
-		*out = "0123456789"[quotient % 10];
-		++out;
-		quotient /= 10;
-	} while (quotient > 0);
-	// Only apply negative sign for base 10
-	if(std::numeric_limits<T>::is_signed) {
-		// Avoid compiler warning in cases where T is unsigned
-		if (value <= 0 && value != 0) *out++ = '-';
+		if(quotient <= 0) {
+			quotient = 0-quotient;
+			// Avoid compiler warning in cases where T is unsigned
+			if(value != 0) *out++ = '-';
+		}
 	}
-	reverse( result, out );
+	out = utoa10(quotient, out);
 	*out = 0; // terminator
 	return out;
 }